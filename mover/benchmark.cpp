@@ -0,0 +1,376 @@
+// Copyright (C) 2019 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+/* Benchmark for the block processing of Mover.  It processes a stream of
+   synthetic blocks the same way the game daemon does (parsing the
+   notification, ProcessForward, storage and commit, rendering the state
+   as JSON) and reports the time and (if compiled in with
+   --enable-alloc-stats) the heap allocations spent in each phase, in total
+   and per block.  Optionally, all blocks are then detached again with
+   ProcessBackwards and measured in the same way.
+
+   The game state can be pre-populated with many players, which shows how
+   processing scales with the size of the state.  Since Mover parses its
+   state into protobuf messages for each block, this is the reference for
+   how allocations in protobuf-based games behave (Mover allocates those
+   messages on a reused arena).  */
+
+#include "logic.hpp"
+
+#include "xayagame/allocstats.hpp"
+#include "xayagame/storage.hpp"
+#include "xayagame/uint256.hpp"
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include <google/protobuf/stubs/common.h>
+
+#include <json/json.h>
+
+#include <array>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+DEFINE_int32 (blocks, 1000, "number of blocks to process");
+DEFINE_int32 (players, 1000, "number of distinct names sending moves");
+DEFINE_int32 (initial_players, 0,
+              "number of players in the game state before the first block");
+DEFINE_int32 (moves_per_block, 100, "number of moves in each block");
+DEFINE_int32 (render_interval, 10,
+              "render the game state as JSON every this many blocks"
+              " (zero to disable)");
+DEFINE_int32 (seed, 42, "seed for the random generation of moves");
+DEFINE_bool (backwards, false,
+             "process all blocks backwards again after the forward run");
+
+namespace
+{
+
+using Clock = std::chrono::steady_clock;
+
+/**
+ * Time spent in each allocation phase.
+ */
+std::array<Clock::duration, xaya::NUM_ALLOC_PHASES> phaseTimes;
+
+/**
+ * RAII helper that sets the allocation phase and accounts the time
+ * spent until it is destructed.
+ */
+class Phase
+{
+
+private:
+
+  xaya::AllocPhaseScope scope;
+  const xaya::AllocPhase phase;
+  const Clock::time_point start;
+
+public:
+
+  explicit Phase (const xaya::AllocPhase p)
+    : scope(p), phase(p), start(Clock::now ())
+  {}
+
+  ~Phase ()
+  {
+    phaseTimes[static_cast<size_t> (phase)] += Clock::now () - start;
+  }
+
+};
+
+/**
+ * Returns a fake block hash for the given height.
+ */
+xaya::uint256
+BlockHash (const unsigned height)
+{
+  std::ostringstream hex;
+  hex << std::hex << std::setw (64) << std::setfill ('0') << height;
+
+  xaya::uint256 res;
+  CHECK (res.FromHex (hex.str ()));
+  return res;
+}
+
+/**
+ * Generates the initial game state with FLAGS_initial_players players
+ * at random positions.  They have the same names as the players sending
+ * moves, so that both sets overlap.
+ */
+xaya::GameStateData
+GenerateInitialState (std::mt19937& rnd)
+{
+  std::uniform_int_distribution<int> coordDist(-1000, 1000);
+
+  mover::proto::GameState state;
+  for (int i = 0; i < FLAGS_initial_players; ++i)
+    {
+      auto& p = (*state.mutable_players ())["player " + std::to_string (i)];
+      p.set_x (coordDist (rnd));
+      p.set_y (coordDist (rnd));
+    }
+
+  xaya::GameStateData res;
+  CHECK (state.SerializeToString (&res));
+  return res;
+}
+
+/**
+ * Generates the JSON text of a block notification with random moves.
+ * Each name moves at most once per block, as is the case on the real
+ * blockchain (and assumed by the undo logic of Mover).
+ */
+std::string
+GenerateBlock (std::mt19937& rnd, const unsigned height,
+               const xaya::uint256& parent, const xaya::uint256& hash)
+{
+  static const char* const DIRECTIONS[] = {"l", "h", "k", "j",
+                                           "u", "n", "y", "b"};
+
+  std::uniform_int_distribution<int> dirDist(0, 7);
+  std::uniform_int_distribution<int> stepsDist(1, 100);
+
+  Json::Value block(Json::objectValue);
+  block["height"] = height;
+  block["hash"] = hash.ToHex ();
+  block["parent"] = parent.ToHex ();
+
+  /* Choose the moving players by a partial Fisher-Yates shuffle.  */
+  std::vector<int> players(FLAGS_players);
+  for (int i = 0; i < FLAGS_players; ++i)
+    players[i] = i;
+  for (int i = 0; i < FLAGS_moves_per_block; ++i)
+    {
+      std::uniform_int_distribution<int> dist(i, FLAGS_players - 1);
+      std::swap (players[i], players[dist (rnd)]);
+    }
+
+  Json::Value moves(Json::arrayValue);
+  for (int i = 0; i < FLAGS_moves_per_block; ++i)
+    {
+      Json::Value mv(Json::objectValue);
+      mv["d"] = DIRECTIONS[dirDist (rnd)];
+      mv["n"] = stepsDist (rnd);
+
+      Json::Value entry(Json::objectValue);
+      entry["txid"] = std::to_string (height) + "-" + std::to_string (i);
+      entry["name"] = "player " + std::to_string (players[i]);
+      entry["move"] = mv;
+      moves.append (entry);
+    }
+
+  Json::Value data(Json::objectValue);
+  data["block"] = block;
+  data["moves"] = moves;
+
+  Json::StreamWriterBuilder wbuilder;
+  wbuilder["indentation"] = "";
+  return Json::writeString (wbuilder, data);
+}
+
+/**
+ * Parses the JSON text of a block notification.
+ */
+Json::Value
+ParseBlock (const std::string& text)
+{
+  Json::CharReaderBuilder rbuilder;
+  Json::Value res;
+  std::string errs;
+  std::istringstream in(text);
+  CHECK (Json::parseFromStream (rbuilder, in, &res, &errs)) << errs;
+  return res;
+}
+
+/**
+ * Resets the measured times and allocation counts.
+ */
+void
+ResetResults ()
+{
+  phaseTimes.fill (Clock::duration::zero ());
+  xaya::ResetAllocStats ();
+}
+
+/**
+ * Prints the results for all phases, in total and per block (for the given
+ * number of processed blocks).
+ */
+void
+PrintResults (const unsigned numBlocks)
+{
+  const bool allocs = xaya::AllocStatsEnabled ();
+
+  std::cout << std::left << std::setw (10) << "phase"
+            << std::right << std::setw (12) << "time [ms]"
+            << std::setw (14) << "us / block";
+  if (allocs)
+    std::cout << std::setw (14) << "allocs"
+              << std::setw (14) << "allocs / blk"
+              << std::setw (16) << "bytes"
+              << std::setw (16) << "peak live";
+  std::cout << std::endl;
+
+  for (size_t i = 0; i < xaya::NUM_ALLOC_PHASES; ++i)
+    {
+      const auto p = static_cast<xaya::AllocPhase> (i);
+      const auto ms = std::chrono::duration_cast<std::chrono::milliseconds> (
+          phaseTimes[i]);
+
+      const auto us = std::chrono::duration_cast<std::chrono::microseconds> (
+          phaseTimes[i]);
+
+      std::cout << std::left << std::setw (10) << xaya::AllocPhaseToString (p)
+                << std::right << std::setw (12) << ms.count ()
+                << std::setw (14) << us.count () / numBlocks;
+      if (allocs)
+        {
+          const xaya::AllocCounts c = xaya::GetAllocCounts (p);
+          std::cout << std::setw (14) << c.allocs
+                    << std::setw (14) << c.allocs / numBlocks
+                    << std::setw (16) << c.bytes
+                    << std::setw (16) << c.peakLive;
+        }
+      std::cout << std::endl;
+    }
+
+  if (!allocs)
+    std::cout << "\nAllocation counting is not enabled, reconfigure with"
+                 " --enable-alloc-stats to see it." << std::endl;
+}
+
+} // anonymous namespace
+
+int
+main (int argc, char** argv)
+{
+  google::InitGoogleLogging (argv[0]);
+  GOOGLE_PROTOBUF_VERIFY_VERSION;
+
+  gflags::SetUsageMessage ("Benchmark block processing of Mover");
+  gflags::ParseCommandLineFlags (&argc, &argv, true);
+
+  if (FLAGS_blocks <= 0 || FLAGS_players <= 0 || FLAGS_moves_per_block < 0
+        || FLAGS_moves_per_block > FLAGS_players || FLAGS_initial_players < 0)
+    {
+      std::cerr << "Invalid benchmark parameters" << std::endl;
+      return EXIT_FAILURE;
+    }
+
+  mover::MoverLogic rules;
+  rules.SetChain (xaya::Chain::REGTEST);
+
+  xaya::MemoryStorage storage;
+  storage.Initialise ();
+
+  unsigned height;
+  std::string hashHex;
+  rules.GetInitialState (height, hashHex);
+
+  std::mt19937 rnd(FLAGS_seed);
+  xaya::GameStateData state = GenerateInitialState (rnd);
+
+  /* Generate the blocks up front, so that this is not included in the
+     measured allocations.  */
+  std::vector<std::string> blocks;
+  for (int i = 1; i <= FLAGS_blocks; ++i)
+    {
+      const unsigned h = height + i;
+      blocks.push_back (GenerateBlock (rnd, h, BlockHash (h - 1),
+                                       BlockHash (h)));
+    }
+
+  std::vector<xaya::UndoData> undos;
+  undos.reserve (FLAGS_blocks);
+
+  ResetResults ();
+  Clock::time_point start = Clock::now ();
+
+  for (int i = 1; i <= FLAGS_blocks; ++i)
+    {
+      const unsigned h = height + i;
+      const xaya::uint256 hash = BlockHash (h);
+
+      Json::Value blockData;
+      {
+        Phase phase(xaya::AllocPhase::PARSE);
+        blockData = ParseBlock (blocks[i - 1]);
+      }
+
+      storage.BeginTransaction ();
+
+      xaya::UndoData undo;
+      {
+        Phase phase(xaya::AllocPhase::PROCESS);
+        state = rules.ProcessForward (state, blockData, undo);
+      }
+
+      {
+        Phase phase(xaya::AllocPhase::STORAGE);
+        storage.AddUndoData (hash, h, undo);
+        storage.SetCurrentGameState (hash, state);
+      }
+
+      {
+        Phase phase(xaya::AllocPhase::COMMIT);
+        storage.CommitTransaction ();
+      }
+
+      if (FLAGS_backwards)
+        undos.push_back (std::move (undo));
+
+      if (FLAGS_render_interval > 0 && i % FLAGS_render_interval == 0)
+        {
+          Phase phase(xaya::AllocPhase::RENDER);
+          const Json::Value json = rules.GameStateToJson (state);
+          Json::StreamWriterBuilder wbuilder;
+          wbuilder["indentation"] = "";
+          CHECK (!Json::writeString (wbuilder, json).empty ());
+        }
+    }
+
+  auto total = std::chrono::duration_cast<std::chrono::milliseconds> (
+      Clock::now () - start);
+  std::cout << "Processed " << FLAGS_blocks << " blocks with "
+            << FLAGS_moves_per_block << " moves each in " << total.count ()
+            << " ms, final state has " << state.size () << " bytes\n"
+            << std::endl;
+  PrintResults (FLAGS_blocks);
+
+  if (FLAGS_backwards)
+    {
+      ResetResults ();
+      start = Clock::now ();
+
+      for (int i = FLAGS_blocks; i >= 1; --i)
+        {
+          Json::Value blockData;
+          {
+            Phase phase(xaya::AllocPhase::PARSE);
+            blockData = ParseBlock (blocks[i - 1]);
+          }
+
+          Phase phase(xaya::AllocPhase::PROCESS);
+          state = rules.ProcessBackwards (state, blockData, undos[i - 1]);
+        }
+
+      total = std::chrono::duration_cast<std::chrono::milliseconds> (
+          Clock::now () - start);
+      std::cout << "\nProcessed " << FLAGS_blocks << " blocks backwards in "
+                << total.count () << " ms\n" << std::endl;
+      PrintResults (FLAGS_blocks);
+    }
+
+  google::protobuf::ShutdownProtobufLibrary ();
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,56 @@
+#!/usr/bin/env python
+# Copyright (C) 2019 The Xaya developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+from mover import MoverTest
+
+"""
+Tests the getcurrentcompressedstate RPC method.
+"""
+
+import base64
+import json
+import zlib
+
+
+class CompressedStateTest (MoverTest):
+
+  def run (self):
+    self.generate (101)
+    for i in range (20):
+      self.move ("player%d" % i, "k", 5)
+    self.generate (1)
+    expected = self.getGameState ()
+
+    self.mainLogger.info ("Small threshold and gzip...")
+    self.stopGameDaemon ()
+    self.startGameDaemon (extraArgs=["--game_rpc_compression_threshold=100"])
+    state = self.rpc.game.getcurrentcompressedstate ("gzip, deflate")
+    assert state["encoding"] == "gzip"
+    assert "gamestate" not in state
+    data = zlib.decompress (base64.b64decode (state["compressedgamestate"]),
+                            16 + zlib.MAX_WBITS)
+    assert json.loads (data.decode ("utf-8")) == expected
+
+    self.mainLogger.info ("Deflate...")
+    state = self.rpc.game.getcurrentcompressedstate ("deflate")
+    assert state["encoding"] == "deflate"
+    data = zlib.decompress (base64.b64decode (state["compressedgamestate"]))
+    assert json.loads (data.decode ("utf-8")) == expected
+
+    self.mainLogger.info ("No acceptable encoding...")
+    state = self.rpc.game.getcurrentcompressedstate ("")
+    assert state["encoding"] == "identity"
+    assert state["gamestate"] == expected
+
+    self.mainLogger.info ("Compression disabled...")
+    self.stopGameDaemon ()
+    self.startGameDaemon (extraArgs=["--game_rpc_compression_threshold=-1"])
+    state = self.rpc.game.getcurrentcompressedstate ("gzip")
+    assert state["encoding"] == "identity"
+    assert state["gamestate"] == expected
+
+
+if __name__ == "__main__":
+  CompressedStateTest ().main ()
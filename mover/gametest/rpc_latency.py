@@ -0,0 +1,71 @@
+#!/usr/bin/env python
+# Copyright (C) 2019 The Xaya developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+from mover import MoverTest
+
+"""
+Compares the latency of the game daemon's JSON-RPC interface over HTTP
+with that over a Unix domain socket, and checks that the socket is created
+with the requested permissions.
+"""
+
+import os
+import os.path
+import stat
+import time
+
+
+# Number of RPC calls made for each measurement.
+CALLS = 1000
+
+
+class RpcLatencyTest (MoverTest):
+
+  def run (self):
+    self.generate (101)
+    for i in range (20):
+      self.move ("player%d" % i, "k", 5)
+    self.generate (1)
+    expected = self.getGameState ()
+
+    httpStats = self.measure ("HTTP")
+
+    socketPath = os.path.join (self.basedir, "moverd.sock")
+    self.log.info ("Restarting with Unix domain socket at %s..." % socketPath)
+    self.stopGameDaemon ()
+    self.gamenode.rpcSocket = socketPath
+    self.startGameDaemon (extraArgs=["--game_rpc_socket_mode=0600"])
+
+    mode = stat.S_IMODE (os.stat (socketPath).st_mode)
+    assert mode == 0o600, "unexpected socket mode %o" % mode
+    assert self.getGameState () == expected
+
+    unixStats = self.measure ("Unix socket")
+
+    self.mainLogger.info ("Average latency: HTTP %.3f ms, Unix socket %.3f ms"
+        % (httpStats, unixStats))
+
+    self.stopGameDaemon ()
+    self.gamenode.rpcSocket = None
+    self.startGameDaemon ()
+
+  def measure (self, name):
+    """
+    Measures the average latency (in ms) of getcurrentstate calls through
+    the currently active RPC connection.
+    """
+
+    self.log.info ("Measuring %d calls through %s..." % (CALLS, name))
+
+    start = time.time ()
+    for _ in range (CALLS):
+      self.rpc.game.getcurrentstate ()
+    end = time.time ()
+
+    return 1000.0 * (end - start) / CALLS
+
+
+if __name__ == "__main__":
+  RpcLatencyTest ().main ()
@@ -4,8 +4,22 @@
 
 #include "logic.hpp"
 
+#include <google/protobuf/arena.h>
+#include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/wire_format_lite.h>
+
 #include <glog/logging.h>
 
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <functional>
+#include <iterator>
+#include <limits>
+#include <map>
+#include <utility>
+#include <vector>
+
 using xaya::Chain;
 using xaya::GameStateData;
 using xaya::UndoData;
@@ -13,6 +27,8 @@ using xaya::UndoData;
 namespace mover
 {
 
+constexpr unsigned MoverLogic::LEADERBOARD_SIZE;
+
 GameStateData
 MoverLogic::GetInitialState (unsigned& height, std::string& hashHex)
 {
@@ -163,6 +179,99 @@ DirectionToString (const proto::Direction dir)
   LOG (FATAL) << "Unexpected direction: " << dir;
 }
 
+/**
+ * Maximum size of the buffer kept for protobuf arenas.  States that need more
+ * than that still use arenas, but the memory beyond this size is allocated
+ * and freed again for each block.
+ */
+constexpr size_t MAX_ARENA_BUFFER = 64 << 20;
+
+/**
+ * Arena for the protobuf messages used while processing a block.  The arena's
+ * initial block is a buffer that grows to the space used by earlier arenas.
+ * In the steady state, parsing and updating the game state and undo data thus
+ * do not allocate on the heap for each map entry and string, but just reuse
+ * that buffer.
+ *
+ * There is only a single buffer for the whole process, so that threads other
+ * than the one processing blocks (which may occasionally process a block
+ * as well) do not each keep a buffer of their own.  Arenas created while
+ * the buffer is in use by another arena (on any thread) just use the heap.
+ */
+class BlockArena
+{
+
+private:
+
+  /** The shared buffer.  Only accessed by the arena that owns it.  */
+  static std::vector<char> buffer;
+
+  /** Whether the shared buffer is currently used by some arena.  */
+  static std::atomic<bool> bufferInUse;
+
+  /** Whether this instance uses the shared buffer.  */
+  bool ownsBuffer;
+
+  /** The arena itself.  */
+  std::unique_ptr<google::protobuf::Arena> arena;
+
+public:
+
+  BlockArena ()
+  {
+    bool expected = false;
+    ownsBuffer = bufferInUse.compare_exchange_strong (
+        expected, true, std::memory_order_acquire);
+
+    google::protobuf::ArenaOptions options;
+    if (ownsBuffer && !buffer.empty ())
+      {
+        options.initial_block = buffer.data ();
+        options.initial_block_size = buffer.size ();
+      }
+
+    arena = std::make_unique<google::protobuf::Arena> (options);
+  }
+
+  ~BlockArena ()
+  {
+    if (!ownsBuffer)
+      return;
+
+    /* The buffer must only be resized after the arena is destructed, since
+       the arena's own data structures live in its initial block.  */
+    const size_t used = arena->SpaceAllocated ();
+    arena.reset ();
+
+    const size_t wanted = std::min (used, MAX_ARENA_BUFFER);
+    if (wanted > buffer.size ())
+      {
+        buffer.clear ();
+        buffer.shrink_to_fit ();
+        buffer.resize (wanted);
+      }
+
+    bufferInUse.store (false, std::memory_order_release);
+  }
+
+  BlockArena (const BlockArena&) = delete;
+  void operator= (const BlockArena&) = delete;
+
+  /**
+   * Constructs a new message of the given type on the arena.
+   */
+  template <typename T>
+    T&
+    Create ()
+  {
+    return *google::protobuf::Arena::CreateMessage<T> (arena.get ());
+  }
+
+};
+
+std::vector<char> BlockArena::buffer;
+std::atomic<bool> BlockArena::bufferInUse(false);
+
 } // anonymous namespace
 
 /**
@@ -200,13 +309,16 @@ GameStateData
 MoverLogic::ProcessForward (const GameStateData& oldState,
                             const Json::Value& blockData, UndoData& undoData)
 {
-  proto::GameState state;
+  BlockArena arena;
+  auto& state = arena.Create<proto::GameState> ();
   CHECK (state.ParseFromString (oldState));
-  proto::UndoData undo;
+  auto& undo = arena.Create<proto::UndoData> ();
 
   /* Go over all moves, adding/updating players in the state.  */
   for (const auto& m : blockData["moves"])
     {
+      xaya::MoveCostScope cost(GetCostAccounting (), m);
+
       const std::string& name = m["name"].asString ();
       const Json::Value& obj = m["move"];
 
@@ -282,9 +394,10 @@ MoverLogic::ProcessBackwards (const GameStateData& newState,
                               const Json::Value& blockData,
                               const UndoData& undoData)
 {
-  proto::GameState state;
+  BlockArena arena;
+  auto& state = arena.Create<proto::GameState> ();
   CHECK (state.ParseFromString (newState));
-  proto::UndoData undo;
+  auto& undo = arena.Create<proto::UndoData> ();
   CHECK (undo.ParseFromString (undoData));
 
   std::set<std::string> playersToRemove;
@@ -348,6 +461,118 @@ MoverLogic::ProcessBackwards (const GameStateData& newState,
   return oldState;
 }
 
+namespace
+{
+
+/**
+ * Converts the state of a single player to JSON.
+ */
+Json::Value
+PlayerStateToJson (const proto::PlayerState& p)
+{
+  Json::Value res(Json::objectValue);
+  res["x"] = p.x ();
+  res["y"] = p.y ();
+  if (p.dir () != proto::NONE)
+    {
+      res["dir"] = DirectionToString (p.dir ());
+      res["steps"] = static_cast<int> (p.steps_left ());
+    }
+
+  return res;
+}
+
+/** Number of shards into which the players are split for rendering.  */
+constexpr unsigned NUM_PLAYER_SHARDS = 16;
+
+/**
+ * Mover game state partitioned for parallel rendering.  The players are
+ * split into a fixed number of shards based on a hash of their name.
+ */
+class PartitionedMoverState : public xaya::PartitionedState
+{
+
+private:
+
+  /** Entry of a shard (name and state of a player).  */
+  using ShardEntry = std::pair<const std::string*, const proto::PlayerState*>;
+
+  /** The parsed game state.  */
+  proto::GameState state;
+
+  /** The players in each shard.  */
+  std::vector<std::vector<ShardEntry>> shards;
+
+  /**
+   * Returns the shard for a given partition.
+   */
+  const std::vector<ShardEntry>&
+  GetShard (const Partition& p) const
+  {
+    const unsigned ind = std::stoul (p.id);
+    CHECK_LT (ind, shards.size ());
+    return shards[ind];
+  }
+
+public:
+
+  explicit PartitionedMoverState (const GameStateData& encodedState)
+    : shards(NUM_PLAYER_SHARDS)
+  {
+    CHECK (state.ParseFromString (encodedState));
+
+    const std::hash<std::string> hasher;
+    for (const auto& entry : state.players ())
+      shards[hasher (entry.first) % NUM_PLAYER_SHARDS].emplace_back (
+          &entry.first, &entry.second);
+  }
+
+  std::vector<Partition>
+  GetPartitions () const override
+  {
+    std::vector<Partition> res;
+    for (unsigned i = 0; i < NUM_PLAYER_SHARDS; ++i)
+      res.push_back ({"players", std::to_string (i)});
+    return res;
+  }
+
+  std::string
+  GetFingerprint (const Partition& p) const override
+  {
+    /* The fingerprint is the binary data of all players in the shard, in
+       a canonical order.  This is exact and much cheaper to produce and
+       compare than the JSON conversion itself.  */
+    auto entries = GetShard (p);
+    std::sort (entries.begin (), entries.end (),
+               [] (const ShardEntry& a, const ShardEntry& b)
+                 {
+                   return *a.first < *b.first;
+                 });
+
+    std::string res;
+    for (const auto& entry : entries)
+      {
+        const std::string data = entry.second->SerializeAsString ();
+        res += std::to_string (entry.first->size ()) + ":" + *entry.first;
+        res += std::to_string (data.size ()) + ":" + data;
+      }
+
+    return res;
+  }
+
+  Json::Value
+  PartitionToJson (const Partition& p) const override
+  {
+    Json::Value res(Json::objectValue);
+    for (const auto& entry : GetShard (p))
+      res[*entry.first] = PlayerStateToJson (*entry.second);
+    return res;
+  }
+
+};
+
+} // anonymous namespace
+
 Json::Value
 MoverLogic::GameStateToJson (const GameStateData& encodedState)
 {
@@ -356,25 +581,160 @@ MoverLogic::GameStateToJson (const GameStateData& encodedState)
 
   Json::Value players(Json::objectValue);
   for (const auto& playerEntry : state.players ())
+    players[playerEntry.first] = PlayerStateToJson (playerEntry.second);
+
+  Json::Value res(Json::objectValue);
+  res["players"] = players;
+
+  return res;
+}
+
+bool
+MoverLogic::GameStateToJsonPage (const GameStateData& encodedState,
+                                 const std::string* startAfter,
+                                 const unsigned limit,
+                                 Json::Value& entries, bool& more)
+{
+  using google::protobuf::internal::WireFormatLite;
+  using google::protobuf::io::CodedInputStream;
+
+  /* The protobuf map has no defined order, so we have to scan all the
+     players; this is linear in the size of the state.  To at least keep
+     memory and conversion work bounded by the page size, only the names
+     are read while scanning the encoded map entries, and we keep just
+     the (up to) limit + 1 smallest names after startAfter together with
+     the range of their encoded entry.  Only those entries are then
+     parsed and converted.  */
+  std::map<std::string, std::pair<int, int>> selected;
+
+  CodedInputStream in(
+      reinterpret_cast<const uint8_t*> (encodedState.data ()),
+      encodedState.size ());
+  in.SetTotalBytesLimit (std::numeric_limits<int>::max ());
+  while (true)
     {
-      const proto::PlayerState& p = playerEntry.second;
+      const int start = in.CurrentPosition ();
+      const uint32_t tag = in.ReadTag ();
+      if (tag == 0)
+        break;
+
+      if (WireFormatLite::GetTagFieldNumber (tag)
+            != proto::GameState::kPlayersFieldNumber
+          || WireFormatLite::GetTagWireType (tag)
+                != WireFormatLite::WIRETYPE_LENGTH_DELIMITED)
+        {
+          CHECK (WireFormatLite::SkipField (&in, tag));
+          continue;
+        }
 
-      Json::Value playerJson(Json::objectValue);
-      playerJson["x"] = p.x ();
-      playerJson["y"] = p.y ();
-      if (p.dir () != proto::NONE)
+      uint32_t length;
+      CHECK (in.ReadVarint32 (&length));
+      const auto oldLimit = in.PushLimit (length);
+
+      /* Map entries have the key as field 1.  It may be missing, which
+         means the empty string.  */
+      std::string name;
+      while (true)
         {
-          playerJson["dir"] = DirectionToString (p.dir ());
-          playerJson["steps"] = static_cast<int> (p.steps_left ());
+          const uint32_t entryTag = in.ReadTag ();
+          if (entryTag == 0)
+            break;
+          if (entryTag == WireFormatLite::MakeTag (
+                              1, WireFormatLite::WIRETYPE_LENGTH_DELIMITED))
+            CHECK (WireFormatLite::ReadString (&in, &name));
+          else
+            CHECK (WireFormatLite::SkipField (&in, entryTag));
         }
+      CHECK (in.ConsumedEntireMessage ());
+      in.PopLimit (oldLimit);
 
-      players[playerEntry.first] = playerJson;
+      if (startAfter != nullptr && name <= *startAfter)
+        continue;
+      if (selected.size () > limit && name >= selected.rbegin ()->first)
+        continue;
+
+      /* A later entry for the same key takes precedence when parsing, so
+         just overwrite the range in that case.  */
+      selected[name] = std::make_pair (start, in.CurrentPosition () - start);
+      if (selected.size () > limit + 1)
+        selected.erase (std::prev (selected.end ()));
     }
+  CHECK_EQ (static_cast<size_t> (in.CurrentPosition ()),
+            encodedState.size ());
 
-  Json::Value res(Json::objectValue);
-  res["players"] = players;
+  more = (selected.size () > limit);
+  if (more)
+    selected.erase (std::prev (selected.end ()));
 
-  return res;
+  /* The selected entries form a valid encoded state on their own.  */
+  std::string pageData;
+  for (const auto& entry : selected)
+    pageData.append (encodedState, entry.second.first, entry.second.second);
+  proto::GameState page;
+  CHECK (page.ParseFromString (pageData));
+
+  entries = Json::Value (Json::objectValue);
+  for (const auto& entry : selected)
+    entries[entry.first]
+        = PlayerStateToJson (page.players ().at (entry.first));
+
+  return true;
+}
+
+std::unique_ptr<xaya::PartitionedState>
+MoverLogic::PartitionState (const GameStateData& encodedState)
+{
+  return std::make_unique<PartitionedMoverState> (encodedState);
+}
+
+bool
+MoverLogic::ComputeDerivedData (const GameStateData& encodedState,
+                                const std::function<bool ()>& cancelled,
+                                Json::Value& result)
+{
+  proto::GameState state;
+  CHECK (state.ParseFromString (encodedState));
+
+  /* Rank the players by their distance from the origin.  Since players can
+     move diagonally, this is the maximum of the coordinates' absolute
+     values.  Ties are broken by name.  */
+  using Entry = std::pair<int, const std::string*>;
+  std::vector<Entry> ranking;
+  ranking.reserve (state.players_size ());
+  for (const auto& playerEntry : state.players ())
+    {
+      const auto& p = playerEntry.second;
+      const int dist = std::max (std::abs (p.x ()), std::abs (p.y ()));
+      ranking.emplace_back (-dist, &playerEntry.first);
+    }
+
+  if (cancelled ())
+    return false;
+
+  const auto cmp = [] (const Entry& a, const Entry& b)
+    {
+      if (a.first != b.first)
+        return a.first < b.first;
+      return *a.second < *b.second;
+    };
+  const size_t n = std::min<size_t> (ranking.size (), LEADERBOARD_SIZE);
+  std::partial_sort (ranking.begin (), ranking.begin () + n, ranking.end (),
+                     cmp);
+
+  Json::Value leaderboard(Json::arrayValue);
+  for (size_t i = 0; i < n; ++i)
+    {
+      Json::Value entry(Json::objectValue);
+      entry["name"] = *ranking[i].second;
+      entry["distance"] = -ranking[i].first;
+      leaderboard.append (entry);
+    }
+
+  result = Json::Value (Json::objectValue);
+  result["players"] = static_cast<Json::Int> (ranking.size ());
+  result["leaderboard"] = leaderboard;
+
+  return true;
 }
 
 } // namespace mover
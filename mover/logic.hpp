@@ -12,6 +12,8 @@
 
 #include <json/json.h>
 
+#include <functional>
+#include <memory>
 #include <string>
 
 namespace mover
@@ -36,6 +38,9 @@ private:
 
 public:
 
+  /** Number of players in the leaderboard computed as derived data.  */
+  static constexpr unsigned LEADERBOARD_SIZE = 10;
+
   xaya::GameStateData GetInitialState (unsigned& height,
                                        std::string& hashHex) override;
 
@@ -49,6 +54,21 @@ public:
 
   Json::Value GameStateToJson (const xaya::GameStateData& state) override;
 
+  bool GameStateToJsonPage (const xaya::GameStateData& state,
+                            const std::string* startAfter, unsigned limit,
+                            Json::Value& entries, bool& more) override;
+
+  std::unique_ptr<xaya::PartitionedState> PartitionState (
+      const xaya::GameStateData& state) override;
+
+  /**
+   * Computes a leaderboard of the players furthest away from the origin
+   * as derived data.
+   */
+  bool ComputeDerivedData (const xaya::GameStateData& state,
+                           const std::function<bool ()>& cancelled,
+                           Json::Value& result) override;
+
 };
 
 } // namespace mover
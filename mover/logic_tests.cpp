@@ -9,8 +9,14 @@
 
 #include <gtest/gtest.h>
 
+#include <glog/logging.h>
+
+#include <set>
 #include <sstream>
 #include <stack>
+#include <string>
+#include <thread>
+#include <vector>
 
 using google::protobuf::TextFormat;
 using google::protobuf::util::MessageDifferencer;
@@ -360,6 +366,67 @@ TEST_F (StateProcessingTests, MovingAround)
 
 /* ************************************************************************** */
 
+/**
+ * Processes blocks forward and backwards repeatedly on multiple threads.
+ * The messages for each block are allocated on arenas, of which only one
+ * at a time reuses the shared buffer.  That should not affect the results.
+ */
+TEST (ArenaTests, RepeatedProcessingOnThreads)
+{
+  MoverLogic rules;
+
+  Json::Value moves(Json::arrayValue);
+  for (int i = 0; i < 200; ++i)
+    {
+      Json::Value mv(Json::objectValue);
+      mv["d"] = (i % 2 == 0 ? "k" : "n");
+      mv["n"] = 1 + i % 3;
+
+      Json::Value entry(Json::objectValue);
+      entry["name"] = "player " + std::to_string (i);
+      entry["move"] = mv;
+      moves.append (entry);
+    }
+  Json::Value blockData(Json::objectValue);
+  blockData["moves"] = moves;
+
+  proto::GameState emptyPb;
+  GameStateData empty;
+  ASSERT_TRUE (emptyPb.SerializeToString (&empty));
+
+  UndoData expectedUndo;
+  const GameStateData expected
+      = rules.ProcessForward (empty, blockData, expectedUndo);
+  proto::GameState expectedPb;
+  ASSERT_TRUE (expectedPb.ParseFromString (expected));
+  ASSERT_EQ (expectedPb.players_size (), 200);
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; ++t)
+    threads.emplace_back ([&] ()
+      {
+        for (int i = 0; i < 20; ++i)
+          {
+            UndoData undo;
+            const GameStateData state
+                = rules.ProcessForward (empty, blockData, undo);
+            proto::GameState pb;
+            ASSERT_TRUE (pb.ParseFromString (state));
+            EXPECT_TRUE (MessageDifferencer::Equals (pb, expectedPb));
+
+            const GameStateData back
+                = rules.ProcessBackwards (state, blockData, undo);
+            ASSERT_TRUE (pb.ParseFromString (back));
+            EXPECT_EQ (pb.players_size (), 0);
+          }
+      });
+
+  for (auto& t : threads)
+    t.join ();
+}
+
+/* ************************************************************************** */
+
 TEST (GameStateToJsonTests, Works)
 {
   MoverLogic rules;
@@ -390,5 +457,303 @@ TEST (GameStateToJsonTests, Works)
       << "Actual:\n" << json << "\nExpected:\n" << expectedJson;
 }
 
+/* ************************************************************************** */
+
+class GameStateToJsonPageTests : public testing::Test
+{
+
+protected:
+
+  MoverLogic rules;
+
+  /** Encoded game state with a couple of players.  */
+  GameStateData state;
+
+  GameStateToJsonPageTests ()
+  {
+    proto::GameState statePb;
+    CHECK (TextFormat::ParseFromString (R"(
+      players: {key: "e", value: {x: 5, y: 5, dir: NONE}}
+      players: {key: "b", value: {x: 2, y: 2, dir: NONE}}
+      players: {key: "d", value: {x: 4, y: 4, dir: UP, steps_left: 1}}
+      players: {key: "a", value: {x: 1, y: 1, dir: NONE}}
+      players: {key: "c", value: {x: 3, y: 3, dir: NONE}}
+    )", &statePb));
+    CHECK (statePb.SerializeToString (&state));
+  }
+
+  /**
+   * Requests a page and returns the names of the players in it.
+   */
+  std::vector<std::string>
+  GetPage (const std::string* startAfter, const unsigned limit, bool& more)
+  {
+    Json::Value entries;
+    EXPECT_TRUE (rules.GameStateToJsonPage (state, startAfter, limit,
+                                            entries, more));
+    return entries.getMemberNames ();
+  }
+
+  /**
+   * Requests a page after the given key.
+   */
+  std::vector<std::string>
+  GetPage (const std::string& startAfter, const unsigned limit, bool& more)
+  {
+    return GetPage (&startAfter, limit, more);
+  }
+
+};
+
+TEST_F (GameStateToJsonPageTests, PagesThrough)
+{
+  bool more;
+  EXPECT_EQ (GetPage (nullptr, 2, more),
+             std::vector<std::string> ({"a", "b"}));
+  EXPECT_TRUE (more);
+  EXPECT_EQ (GetPage ("b", 2, more), std::vector<std::string> ({"c", "d"}));
+  EXPECT_TRUE (more);
+  EXPECT_EQ (GetPage ("d", 2, more), std::vector<std::string> ({"e"}));
+  EXPECT_FALSE (more);
+}
+
+TEST_F (GameStateToJsonPageTests, ExactLimit)
+{
+  bool more;
+  EXPECT_EQ (GetPage (nullptr, 5, more),
+             std::vector<std::string> ({"a", "b", "c", "d", "e"}));
+  EXPECT_FALSE (more);
+  EXPECT_EQ (GetPage ("c", 2, more), std::vector<std::string> ({"d", "e"}));
+  EXPECT_FALSE (more);
+  EXPECT_EQ (GetPage ("e", 2, more), std::vector<std::string> ());
+  EXPECT_FALSE (more);
+}
+
+TEST_F (GameStateToJsonPageTests, EntriesMatchFullState)
+{
+  const Json::Value full = rules.GameStateToJson (state);
+
+  Json::Value entries;
+  bool more;
+  const std::string startAfter = "a";
+  ASSERT_TRUE (rules.GameStateToJsonPage (state, &startAfter, 3,
+                                          entries, more));
+  EXPECT_TRUE (more);
+  for (const auto& nm : {"b", "c", "d"})
+    EXPECT_TRUE (entries[nm] == full["players"][nm]) << nm;
+}
+
+TEST_F (GameStateToJsonPageTests, ManyPlayers)
+{
+  proto::GameState statePb;
+  std::set<std::string> names;
+  for (unsigned i = 0; i < 100; ++i)
+    {
+      /* Insert in a scrambled order, so that the encoded map entries are
+         not sorted by name.  */
+      const std::string nm = "p" + std::to_string ((i * 37) % 100);
+      auto& p = (*statePb.mutable_players ())[nm];
+      p.set_x (i);
+      names.insert (nm);
+    }
+  CHECK (statePb.SerializeToString (&state));
+
+  std::vector<std::string> all;
+  bool more;
+  auto page = GetPage (nullptr, 7, more);
+  while (true)
+    {
+      ASSERT_FALSE (page.empty ());
+      EXPECT_LE (page.size (), 7);
+      all.insert (all.end (), page.begin (), page.end ());
+      if (!more)
+        break;
+      page = GetPage (page.back (), 7, more);
+    }
+
+  EXPECT_EQ (all, std::vector<std::string> (names.begin (), names.end ()));
+}
+
+TEST_F (GameStateToJsonPageTests, EmptyName)
+{
+  proto::GameState statePb;
+  CHECK (TextFormat::ParseFromString (R"(
+    players: {key: "b", value: {x: 2, y: 2, dir: NONE}}
+    players: {key: "", value: {x: 0, y: 0, dir: NONE}}
+    players: {key: "a", value: {x: 1, y: 1, dir: NONE}}
+  )", &statePb));
+  CHECK (statePb.SerializeToString (&state));
+
+  bool more;
+  EXPECT_EQ (GetPage (nullptr, 1, more), std::vector<std::string> ({""}));
+  EXPECT_TRUE (more);
+  EXPECT_EQ (GetPage ("", 1, more), std::vector<std::string> ({"a"}));
+  EXPECT_TRUE (more);
+  EXPECT_EQ (GetPage ("a", 2, more), std::vector<std::string> ({"b"}));
+  EXPECT_FALSE (more);
+}
+
+TEST_F (GameStateToJsonPageTests, DuplicateEntries)
+{
+  /* If a key appears twice in the encoded map, the later entry is the one
+     that takes effect when parsing.  */
+  proto::GameState other;
+  CHECK (TextFormat::ParseFromString (R"(
+    players: {key: "b", value: {x: 42, y: 0, dir: NONE}}
+  )", &other));
+  std::string data;
+  CHECK (other.SerializeToString (&data));
+  state += data;
+
+  const Json::Value full = rules.GameStateToJson (state);
+  EXPECT_EQ (full["players"]["b"]["x"].asInt (), 42);
+
+  Json::Value entries;
+  bool more;
+  const std::string startAfter = "a";
+  ASSERT_TRUE (rules.GameStateToJsonPage (state, &startAfter, 1,
+                                          entries, more));
+  EXPECT_TRUE (more);
+  EXPECT_TRUE (entries["b"] == full["players"]["b"]);
+}
+
+/* ************************************************************************** */
+
+using PartitionStateTests = GameStateToJsonPageTests;
+
+TEST_F (PartitionStateTests, MatchesFullState)
+{
+  const auto partitioned = rules.PartitionState (state);
+  ASSERT_NE (partitioned, nullptr);
+
+  Json::Value players(Json::objectValue);
+  for (const auto& p : partitioned->GetPartitions ())
+    {
+      EXPECT_EQ (p.field, "players");
+      const Json::Value part = partitioned->PartitionToJson (p);
+      for (const auto& nm : part.getMemberNames ())
+        {
+          EXPECT_FALSE (players.isMember (nm)) << nm;
+          players[nm] = part[nm];
+        }
+    }
+
+  EXPECT_TRUE (players == rules.GameStateToJson (state)["players"]);
+}
+
+TEST_F (PartitionStateTests, FingerprintsTrackChanges)
+{
+  proto::GameState statePb;
+  ASSERT_TRUE (statePb.ParseFromString (state));
+  (*statePb.mutable_players ())["c"].set_x (42);
+  GameStateData modified;
+  ASSERT_TRUE (statePb.SerializeToString (&modified));
+
+  const auto before = rules.PartitionState (state);
+  const auto after = rules.PartitionState (modified);
+  const auto parts = before->GetPartitions ();
+
+  unsigned changed = 0;
+  for (const auto& p : parts)
+    {
+      EXPECT_EQ (before->GetFingerprint (p),
+                 rules.PartitionState (state)->GetFingerprint (p));
+      if (before->GetFingerprint (p) != after->GetFingerprint (p))
+        {
+          ++changed;
+          EXPECT_TRUE (after->PartitionToJson (p).isMember ("c"));
+        }
+    }
+  EXPECT_EQ (changed, 1);
+}
+
+/* ************************************************************************** */
+
+class DerivedDataTests : public testing::Test
+{
+
+protected:
+
+  MoverLogic rules;
+
+  /**
+   * Computes the derived data for a state given in text format.
+   */
+  Json::Value
+  Compute (const std::string& text)
+  {
+    proto::GameState statePb;
+    CHECK (TextFormat::ParseFromString (text, &statePb));
+    GameStateData state;
+    CHECK (statePb.SerializeToString (&state));
+
+    Json::Value res;
+    EXPECT_TRUE (rules.ComputeDerivedData (state, [] ()
+      {
+        return false;
+      }, res));
+
+    return res;
+  }
+
+  /**
+   * Returns the names in a computed leaderboard.
+   */
+  static std::vector<std::string>
+  LeaderboardNames (const Json::Value& data)
+  {
+    std::vector<std::string> res;
+    for (const auto& entry : data["leaderboard"])
+      res.push_back (entry["name"].asString ());
+    return res;
+  }
+
+};
+
+TEST_F (DerivedDataTests, Empty)
+{
+  const Json::Value data = Compute ("");
+  EXPECT_EQ (data["players"].asInt (), 0);
+  EXPECT_EQ (data["leaderboard"].size (), 0);
+}
+
+TEST_F (DerivedDataTests, Ranking)
+{
+  const Json::Value data = Compute (R"(
+    players: {key: "a", value: {x: 1, y: -1, dir: NONE}}
+    players: {key: "b", value: {x: -5, y: 2, dir: NONE}}
+    players: {key: "c", value: {x: 0, y: 3, dir: UP, steps_left: 1}}
+    players: {key: "d", value: {x: 3, y: 0, dir: NONE}}
+  )");
+
+  EXPECT_EQ (data["players"].asInt (), 4);
+  EXPECT_EQ (LeaderboardNames (data),
+             std::vector<std::string> ({"b", "c", "d", "a"}));
+  EXPECT_EQ (data["leaderboard"][0]["distance"].asInt (), 5);
+  EXPECT_EQ (data["leaderboard"][3]["distance"].asInt (), 1);
+}
+
+TEST_F (DerivedDataTests, LeaderboardSize)
+{
+  std::ostringstream text;
+  for (int i = 0; i < 20; ++i)
+    text << "players: {key: \"p" << (100 + i) << "\", value: {x: " << i
+         << ", y: 0, dir: NONE}}\n";
+
+  const Json::Value data = Compute (text.str ());
+  EXPECT_EQ (data["players"].asInt (), 20);
+  ASSERT_EQ (data["leaderboard"].size (), MoverLogic::LEADERBOARD_SIZE);
+  EXPECT_EQ (data["leaderboard"][0]["name"].asString (), "p119");
+}
+
+TEST_F (DerivedDataTests, Cancelled)
+{
+  Json::Value res;
+  EXPECT_FALSE (rules.ComputeDerivedData ("", [] ()
+    {
+      return true;
+    }, res));
+}
+
 } // anonymous namespace
 } // namespace mover
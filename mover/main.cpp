@@ -13,20 +13,130 @@
 
 #include <google/protobuf/stubs/common.h>
 
+#include <exception>
 #include <iostream>
+#include <sstream>
+#include <string>
 
 DEFINE_string (xaya_rpc_url, "",
                "URL at which Xaya Core's JSON-RPC interface is available");
+DEFINE_string (additional_zmq_endpoints, "",
+               "comma-separated list of ZMQ endpoints of other Xaya daemons"
+               " to receive block notifications from as well");
+
 DEFINE_int32 (game_rpc_port, 0,
               "the port at which the game daemon's JSON-RPC server will be"
               " start (if non-zero)");
 
+DEFINE_string (game_rpc_socket, "",
+               "if set, start the game daemon's JSON-RPC server on this"
+               " Unix domain socket (instead of the HTTP port)");
+DEFINE_string (game_rpc_socket_mode, "",
+               "permissions (octal, e.g. 0660) for the --game_rpc_socket");
+
+DEFINE_int32 (game_rpc_compression_threshold, 1024,
+              "minimum size in bytes of the game state's JSON for which"
+              " getcurrentcompressedstate compresses it (negative to"
+              " disable)");
+
+DEFINE_string (game_state_zmq, "",
+               "if set, publish game state changes through ZMQ at this"
+               " endpoint");
+DEFINE_string (game_state_zmq_mode, "notification",
+               "what to include in published state changes (notification,"
+               " full or diff)");
+
 DEFINE_int32 (enable_pruning, -1,
               "if non-negative (including zero), enable pruning of old undo"
               " data and keep as many blocks as specified by the value");
 
+DEFINE_int32 (transaction_batch_size, 1000,
+              "number of blocks to batch into one storage transaction"
+              " while catching up");
+DEFINE_int32 (uptodate_batch_size, 1,
+              "number of blocks to batch into one storage transaction"
+              " while up-to-date");
+DEFINE_int32 (batch_flush_ms, 0,
+              "if positive, commit batches of blocks after this many"
+              " milliseconds even if they are not full");
+DEFINE_int32 (catching_up_notify_ms, 1000,
+              "while catching up, wake up waitforchange clients at most"
+              " once per this many milliseconds (zero for no time limit)");
+DEFINE_int32 (catching_up_notify_blocks, 0,
+              "while catching up, also wake up waitforchange clients after"
+              " this many blocks (zero for no block limit)");
+
+DEFINE_int32 (state_history_blocks, 0,
+              "if positive, keep an in-memory history of this many blocks"
+              " so that past game states can be queried");
+
+DEFINE_int32 (move_archive_blocks, 0,
+              "if positive, keep the moves of this many blocks in memory"
+              " so that they can be queried by name");
+
+DEFINE_int32 (detached_block_cache, 0,
+              "if positive, keep the results of this many detached blocks"
+              " for reuse when they are attached again");
+
+DEFINE_int32 (checkpoint_interval, 0,
+              "if positive, write a local checkpoint of the game state"
+              " every this many blocks (requires --datadir)");
+DEFINE_int32 (checkpoints_to_keep, 3,
+              "number of local checkpoints to keep");
+
+DEFINE_int32 (render_threads, 0,
+              "if positive, convert the game state to JSON in parallel"
+              " on this many extra threads");
+
+DEFINE_bool (derived_data, false,
+             "if true, compute a leaderboard of players on a background"
+             " thread for the getderiveddata RPC method");
+
+DEFINE_int32 (cost_accounting_entries, 0,
+              "if positive, track this many of the most expensive moves"
+              " and names for the getmetrics RPC method");
+
+DEFINE_int32 (memory_budget_mb, 0,
+              "if positive, limit the memory used by in-memory caches"
+              " to this many MiB in total");
+
+DEFINE_string (shared_state_name, "",
+               "if set, export the current game state into the POSIX"
+               " shared-memory segment with this name (e.g. /mv-state)");
+
+DEFINE_string (state_files_dir, "",
+               "if set, write the game state for each block as JSON file"
+               " into this directory for static serving");
+DEFINE_int32 (state_files_keep, 10,
+              "number of blocks for which state files are kept");
+DEFINE_bool (state_files_gzip, false,
+             "if true, write gzip-compressed state files as well");
+DEFINE_int32 (state_files_catching_up_ms, 10000,
+              "minimum time between state files written while catching up"
+              " (0 to only write them when up-to-date)");
+
+DEFINE_bool (enable_profiling, false,
+             "if true, allow CPU profiles to be taken with the profile RPC"
+             " method (requires --datadir)");
+DEFINE_bool (lock_profiling, false,
+             "if true, record contention of the game lock for the"
+             " getmetrics RPC method");
+
+DEFINE_string (block_processing_cpus, "",
+               "if set, pin the block-processing thread to these CPUs"
+               " (e.g. 0-3,6)");
+DEFINE_int32 (block_processing_nice, 0,
+              "if non-zero, nice value for the block-processing thread");
+DEFINE_string (game_rpc_cpus, "",
+               "if set, pin the RPC server threads to these CPUs (e.g. 0-3,6)");
+DEFINE_int32 (game_rpc_nice, 0,
+              "if non-zero, nice value for the RPC server threads");
+
 DEFINE_string (storage_type, "memory",
                "the type of storage to use for game data (memory or sqlite)");
+DEFINE_bool (sqlite_snapshots, false,
+             "enable snapshots for SQLite storage (puts the database into"
+             " WAL mode)");
 DEFINE_string (datadir, "",
                "base data directory for game data (will be extended by the"
                " game ID and chain); must be set if --storage_type is not"
@@ -55,15 +165,112 @@ main (int argc, char** argv)
       return EXIT_FAILURE;
     }
 
+  if (FLAGS_checkpoint_interval > 0
+        && (FLAGS_datadir.empty () || FLAGS_checkpoints_to_keep <= 0))
+    {
+      std::cerr << "Error: checkpoints require --datadir and a positive"
+                   " --checkpoints_to_keep" << std::endl;
+      return EXIT_FAILURE;
+    }
+
+  if (FLAGS_enable_profiling && FLAGS_datadir.empty ())
+    {
+      std::cerr << "Error: profiling requires --datadir" << std::endl;
+      return EXIT_FAILURE;
+    }
+
+  if (FLAGS_transaction_batch_size <= 0 || FLAGS_uptodate_batch_size <= 0
+        || FLAGS_batch_flush_ms < 0)
+    {
+      std::cerr << "Error: invalid transaction batching parameters"
+                << std::endl;
+      return EXIT_FAILURE;
+    }
+
+  if (FLAGS_catching_up_notify_ms < 0 || FLAGS_catching_up_notify_blocks < 0)
+    {
+      std::cerr << "Error: invalid catching-up notification limits"
+                << std::endl;
+      return EXIT_FAILURE;
+    }
+
+  if (FLAGS_state_files_keep <= 0 || FLAGS_state_files_catching_up_ms < 0)
+    {
+      std::cerr << "Error: invalid state-file parameters" << std::endl;
+      return EXIT_FAILURE;
+    }
+
   xaya::GameDaemonConfiguration config;
   config.XayaRpcUrl = FLAGS_xaya_rpc_url;
-  if (FLAGS_game_rpc_port != 0)
+  {
+    std::istringstream in(FLAGS_additional_zmq_endpoints);
+    std::string endpoint;
+    while (std::getline (in, endpoint, ','))
+      if (!endpoint.empty ())
+        config.AdditionalZmqEndpoints.push_back (endpoint);
+  }
+  if (!FLAGS_game_rpc_socket.empty ())
+    {
+      config.GameRpcServer = xaya::RpcServerType::UNIX;
+      config.GameRpcSocket = FLAGS_game_rpc_socket;
+      if (!FLAGS_game_rpc_socket_mode.empty ())
+        {
+          size_t pos;
+          try
+            {
+              config.GameRpcSocketMode
+                  = std::stoi (FLAGS_game_rpc_socket_mode, &pos, 8);
+            }
+          catch (const std::exception& exc)
+            {
+              pos = 0;
+            }
+          if (pos != FLAGS_game_rpc_socket_mode.size ())
+            {
+              std::cerr << "Error: invalid --game_rpc_socket_mode"
+                        << std::endl;
+              return EXIT_FAILURE;
+            }
+        }
+    }
+  else if (FLAGS_game_rpc_port != 0)
     {
       config.GameRpcServer = xaya::RpcServerType::HTTP;
       config.GameRpcPort = FLAGS_game_rpc_port;
     }
+  config.GameRpcCompressionThreshold = FLAGS_game_rpc_compression_threshold;
   config.EnablePruning = FLAGS_enable_pruning;
+  config.TransactionBatchSize = FLAGS_transaction_batch_size;
+  config.UpToDateBatchSize = FLAGS_uptodate_batch_size;
+  config.BatchFlushMillis = FLAGS_batch_flush_ms;
+  config.CatchingUpNotifyMillis = FLAGS_catching_up_notify_ms;
+  config.CatchingUpNotifyBlocks = FLAGS_catching_up_notify_blocks;
+  config.GameStatePublisher = FLAGS_game_state_zmq;
+  config.GameStatePublishMode = FLAGS_game_state_zmq_mode;
+  config.StateHistoryBlocks = FLAGS_state_history_blocks;
+  config.MoveArchiveBlocks = FLAGS_move_archive_blocks;
+  config.DetachedBlockCacheSize = FLAGS_detached_block_cache;
+  config.CheckpointInterval = FLAGS_checkpoint_interval;
+  config.CheckpointsToKeep = FLAGS_checkpoints_to_keep;
+  config.RenderThreads = FLAGS_render_threads;
+  config.DerivedData = FLAGS_derived_data;
+  config.CostAccountingEntries = FLAGS_cost_accounting_entries;
+  if (FLAGS_memory_budget_mb > 0)
+    config.MemoryBudgetBytes
+        = static_cast<uint64_t> (FLAGS_memory_budget_mb) << 20;
+  config.SharedStateName = FLAGS_shared_state_name;
+  config.StateFilesDirectory = FLAGS_state_files_dir;
+  config.StateFilesToKeep = FLAGS_state_files_keep;
+  config.StateFilesCompressed = FLAGS_state_files_gzip;
+  config.StateFilesCatchingUpMillis = FLAGS_state_files_catching_up_ms;
+  config.EnableProfiling = FLAGS_enable_profiling;
+  config.LockProfiling = FLAGS_lock_profiling;
+  config.BlockProcessingCpus = FLAGS_block_processing_cpus;
+  config.BlockProcessingNice = FLAGS_block_processing_nice;
+  config.GameRpcCpus = FLAGS_game_rpc_cpus;
+  config.GameRpcNice = FLAGS_game_rpc_nice;
   config.StorageType = FLAGS_storage_type;
+  config.SQLiteSnapshots = FLAGS_sqlite_snapshots;
   config.DataDirectory = FLAGS_datadir;
 
   mover::MoverLogic rules;
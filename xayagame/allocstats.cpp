@@ -0,0 +1,338 @@
+// Copyright (C) 2019 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "allocstats.hpp"
+
+#include <glog/logging.h>
+
+#include <atomic>
+#include <cerrno>
+
+#ifdef XAYAGAME_ALLOC_STATS
+# ifndef __GLIBC__
+#   error "Allocation counting is only supported with glibc"
+# endif // !__GLIBC__
+# include <malloc.h>
+# include <new>
+#endif // XAYAGAME_ALLOC_STATS
+
+namespace xaya
+{
+
+namespace
+{
+
+/**
+ * Counters for a single phase.  These are plain globals that are
+ * zero-initialised statically, so that they can be used by allocations
+ * that happen before or during static initialisation.
+ */
+struct PhaseCounters
+{
+  std::atomic<uint64_t> allocs;
+  std::atomic<uint64_t> frees;
+  std::atomic<uint64_t> bytes;
+  std::atomic<uint64_t> peakLive;
+};
+
+PhaseCounters counters[NUM_ALLOC_PHASES];
+
+/** The currently live heap bytes (since the last reset).  */
+std::atomic<int64_t> liveBytes;
+
+/**
+ * The phase allocations of the current thread are attributed to.  When
+ * counting is enabled, this is accessed from within malloc, and thus uses
+ * the initial-exec TLS model (which never allocates on access).
+ */
+#ifdef XAYAGAME_ALLOC_STATS
+thread_local AllocPhase currentPhase
+    __attribute__ ((tls_model ("initial-exec"))) = AllocPhase::OTHER;
+#else // XAYAGAME_ALLOC_STATS
+thread_local AllocPhase currentPhase = AllocPhase::OTHER;
+#endif // XAYAGAME_ALLOC_STATS
+
+#ifdef XAYAGAME_ALLOC_STATS
+
+/**
+ * Records a new allocation of the given block (if it is not null).
+ */
+void
+RecordAlloc (void* ptr)
+{
+  if (ptr == nullptr)
+    return;
+
+  const size_t size = malloc_usable_size (ptr);
+  auto& c = counters[static_cast<size_t> (currentPhase)];
+  c.allocs.fetch_add (1, std::memory_order_relaxed);
+  c.bytes.fetch_add (size, std::memory_order_relaxed);
+
+  const int64_t live
+      = liveBytes.fetch_add (size, std::memory_order_relaxed) + size;
+  if (live <= 0)
+    return;
+
+  uint64_t peak = c.peakLive.load (std::memory_order_relaxed);
+  while (static_cast<uint64_t> (live) > peak
+          && !c.peakLive.compare_exchange_weak (peak, live,
+                                                std::memory_order_relaxed))
+    ;
+}
+
+/**
+ * Records that the given block (if not null) is about to be freed.
+ */
+void
+RecordFree (void* ptr)
+{
+  if (ptr == nullptr)
+    return;
+
+  const size_t size = malloc_usable_size (ptr);
+  auto& c = counters[static_cast<size_t> (currentPhase)];
+  c.frees.fetch_add (1, std::memory_order_relaxed);
+  liveBytes.fetch_sub (size, std::memory_order_relaxed);
+}
+
+#endif // XAYAGAME_ALLOC_STATS
+
+} // anonymous namespace
+
+std::string
+AllocPhaseToString (const AllocPhase p)
+{
+  switch (p)
+    {
+    case AllocPhase::OTHER:
+      return "other";
+    case AllocPhase::PARSE:
+      return "parse";
+    case AllocPhase::PROCESS:
+      return "process";
+    case AllocPhase::STORAGE:
+      return "storage";
+    case AllocPhase::COMMIT:
+      return "commit";
+    case AllocPhase::RENDER:
+      return "render";
+    }
+
+  LOG (FATAL) << "Invalid allocation phase: " << static_cast<int> (p);
+}
+
+bool
+AllocStatsEnabled ()
+{
+#ifdef XAYAGAME_ALLOC_STATS
+  return true;
+#else // XAYAGAME_ALLOC_STATS
+  return false;
+#endif // XAYAGAME_ALLOC_STATS
+}
+
+AllocCounts
+GetAllocCounts (const AllocPhase p)
+{
+  const auto& c = counters[static_cast<size_t> (p)];
+
+  AllocCounts res;
+  res.allocs = c.allocs.load ();
+  res.frees = c.frees.load ();
+  res.bytes = c.bytes.load ();
+  res.peakLive = c.peakLive.load ();
+
+  return res;
+}
+
+int64_t
+GetLiveHeapBytes ()
+{
+  return liveBytes.load ();
+}
+
+void
+ResetAllocStats ()
+{
+  for (auto& c : counters)
+    {
+      c.allocs = 0;
+      c.frees = 0;
+      c.bytes = 0;
+      c.peakLive = 0;
+    }
+  liveBytes = 0;
+}
+
+Json::Value
+AllocStatsToJson ()
+{
+  Json::Value res(Json::objectValue);
+  res["enabled"] = AllocStatsEnabled ();
+  res["live"] = static_cast<Json::Int64> (GetLiveHeapBytes ());
+
+  Json::Value phases(Json::objectValue);
+  for (size_t i = 0; i < NUM_ALLOC_PHASES; ++i)
+    {
+      const auto p = static_cast<AllocPhase> (i);
+      const AllocCounts c = GetAllocCounts (p);
+
+      Json::Value cur(Json::objectValue);
+      cur["allocs"] = static_cast<Json::UInt64> (c.allocs);
+      cur["frees"] = static_cast<Json::UInt64> (c.frees);
+      cur["bytes"] = static_cast<Json::UInt64> (c.bytes);
+      cur["peaklive"] = static_cast<Json::UInt64> (c.peakLive);
+      phases[AllocPhaseToString (p)] = cur;
+    }
+  res["phases"] = phases;
+
+  return res;
+}
+
+AllocPhase
+GetCurrentAllocPhase ()
+{
+  return currentPhase;
+}
+
+AllocPhaseScope::AllocPhaseScope (const AllocPhase p)
+  : previous(currentPhase)
+{
+  currentPhase = p;
+}
+
+AllocPhaseScope::~AllocPhaseScope ()
+{
+  currentPhase = previous;
+}
+
+} // namespace xaya
+
+#ifdef XAYAGAME_ALLOC_STATS
+
+/* Replacements of the global allocation functions.  They forward to glibc's
+   internal implementation, so that calls from operator new do not end up
+   in the replaced malloc and are not counted twice.  */
+
+extern "C"
+{
+
+void* __libc_malloc (size_t);
+void* __libc_calloc (size_t, size_t);
+void* __libc_realloc (void*, size_t);
+void* __libc_memalign (size_t, size_t);
+void __libc_free (void*);
+
+void*
+malloc (const size_t size)
+{
+  void* res = __libc_malloc (size);
+  xaya::RecordAlloc (res);
+  return res;
+}
+
+void*
+calloc (const size_t num, const size_t size)
+{
+  void* res = __libc_calloc (num, size);
+  xaya::RecordAlloc (res);
+  return res;
+}
+
+void*
+realloc (void* ptr, const size_t size)
+{
+  xaya::RecordFree (ptr);
+  void* res = __libc_realloc (ptr, size);
+
+  /* If the reallocation failed, the old block is still alive.  */
+  if (res == nullptr && size > 0)
+    xaya::RecordAlloc (ptr);
+  else
+    xaya::RecordAlloc (res);
+
+  return res;
+}
+
+void*
+memalign (const size_t alignment, const size_t size)
+{
+  void* res = __libc_memalign (alignment, size);
+  xaya::RecordAlloc (res);
+  return res;
+}
+
+void*
+aligned_alloc (const size_t alignment, const size_t size)
+{
+  return memalign (alignment, size);
+}
+
+int
+posix_memalign (void** ptr, const size_t alignment, const size_t size)
+{
+  if (alignment % sizeof (void*) != 0
+        || (alignment & (alignment - 1)) != 0)
+    return EINVAL;
+
+  void* res = memalign (alignment, size);
+  if (res == nullptr)
+    return ENOMEM;
+
+  *ptr = res;
+  return 0;
+}
+
+void
+free (void* ptr)
+{
+  xaya::RecordFree (ptr);
+  __libc_free (ptr);
+}
+
+} // extern "C"
+
+void*
+operator new (const size_t size)
+{
+  void* res = __libc_malloc (size == 0 ? 1 : size);
+  if (res == nullptr)
+    throw std::bad_alloc ();
+
+  xaya::RecordAlloc (res);
+  return res;
+}
+
+void*
+operator new[] (const size_t size)
+{
+  return operator new (size);
+}
+
+void
+operator delete (void* ptr) noexcept
+{
+  xaya::RecordFree (ptr);
+  __libc_free (ptr);
+}
+
+void
+operator delete[] (void* ptr) noexcept
+{
+  operator delete (ptr);
+}
+
+void
+operator delete (void* ptr, size_t) noexcept
+{
+  operator delete (ptr);
+}
+
+void
+operator delete[] (void* ptr, size_t) noexcept
+{
+  operator delete (ptr);
+}
+
+#endif // XAYAGAME_ALLOC_STATS
@@ -0,0 +1,136 @@
+// Copyright (C) 2019 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef XAYAGAME_ALLOCSTATS_HPP
+#define XAYAGAME_ALLOCSTATS_HPP
+
+#include <json/json.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace xaya
+{
+
+/**
+ * Phases of block processing, to which heap allocations are attributed
+ * when allocation counting is enabled.
+ */
+enum class AllocPhase
+{
+  /** Anything that is not in one of the other phases.  */
+  OTHER = 0,
+  /** Parsing of block notifications.  */
+  PARSE = 1,
+  /** The game logic's ProcessForward / ProcessBackwards.  */
+  PROCESS = 2,
+  /** Writing the new state and undo data to the storage.  */
+  STORAGE = 3,
+  /** Committing the storage transaction.  */
+  COMMIT = 4,
+  /** Converting the game state to JSON (and text) for clients.  */
+  RENDER = 5,
+};
+
+/** Number of distinct AllocPhase values.  */
+constexpr size_t NUM_ALLOC_PHASES = 6;
+
+/**
+ * Converts an allocation phase to a string for reporting.
+ */
+std::string AllocPhaseToString (AllocPhase p);
+
+/**
+ * Counters of heap activity within one phase.  Byte counts are based on the
+ * usable size of the allocated blocks, which may be slightly larger than
+ * what has been requested.
+ */
+struct AllocCounts
+{
+
+  /** Number of allocations (malloc, operator new and friends).  */
+  uint64_t allocs = 0;
+
+  /** Number of deallocations.  */
+  uint64_t frees = 0;
+
+  /** Total number of bytes allocated.  */
+  uint64_t bytes = 0;
+
+  /**
+   * Peak of the process-wide live heap (as counted since the last reset)
+   * that was seen while in this phase.
+   */
+  uint64_t peakLive = 0;
+
+};
+
+/**
+ * Returns true if allocation counting has been compiled in (configure
+ * option --enable-alloc-stats).  If not, all counters stay at zero and
+ * the other functions here are cheap no-ops.
+ *
+ * When enabled, libxayagame replaces the global malloc family of functions
+ * (via glibc's internal __libc_* entry points) as well as the global
+ * operator new and delete for the entire process.  This is meant for
+ * benchmarking and should not be used in production builds.
+ */
+bool AllocStatsEnabled ();
+
+/**
+ * Returns the counters for the given phase.
+ */
+AllocCounts GetAllocCounts (AllocPhase p);
+
+/**
+ * Returns the number of heap bytes allocated and not yet freed since the
+ * last reset.  This may be negative if memory allocated before the reset
+ * has been freed in the mean time.
+ */
+int64_t GetLiveHeapBytes ();
+
+/**
+ * Resets all counters to zero.
+ */
+void ResetAllocStats ();
+
+/**
+ * Returns the counters of all phases as JSON object.
+ */
+Json::Value AllocStatsToJson ();
+
+/**
+ * Returns the phase that allocations on the calling thread are currently
+ * attributed to.
+ */
+AllocPhase GetCurrentAllocPhase ();
+
+/**
+ * RAII helper that attributes allocations on the current thread to the
+ * given phase while it is alive.  Scopes can be nested, in which case the
+ * innermost one wins.
+ */
+class AllocPhaseScope
+{
+
+private:
+
+  /** The phase that was active before and is restored when done.  */
+  const AllocPhase previous;
+
+public:
+
+  explicit AllocPhaseScope (AllocPhase p);
+  ~AllocPhaseScope ();
+
+  AllocPhaseScope () = delete;
+  AllocPhaseScope (const AllocPhaseScope&) = delete;
+  void operator= (const AllocPhaseScope&) = delete;
+
+};
+
+} // namespace xaya
+
+#endif // XAYAGAME_ALLOCSTATS_HPP
@@ -0,0 +1,87 @@
+// Copyright (C) 2019 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "allocstats.hpp"
+
+#include <gtest/gtest.h>
+
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace xaya
+{
+namespace
+{
+
+TEST (AllocStatsTests, PhaseToString)
+{
+  EXPECT_EQ (AllocPhaseToString (AllocPhase::OTHER), "other");
+  EXPECT_EQ (AllocPhaseToString (AllocPhase::PARSE), "parse");
+  EXPECT_EQ (AllocPhaseToString (AllocPhase::PROCESS), "process");
+  EXPECT_EQ (AllocPhaseToString (AllocPhase::STORAGE), "storage");
+  EXPECT_EQ (AllocPhaseToString (AllocPhase::COMMIT), "commit");
+  EXPECT_EQ (AllocPhaseToString (AllocPhase::RENDER), "render");
+}
+
+TEST (AllocStatsTests, Scopes)
+{
+  EXPECT_EQ (GetCurrentAllocPhase (), AllocPhase::OTHER);
+  {
+    AllocPhaseScope outer(AllocPhase::PROCESS);
+    EXPECT_EQ (GetCurrentAllocPhase (), AllocPhase::PROCESS);
+    {
+      AllocPhaseScope inner(AllocPhase::STORAGE);
+      EXPECT_EQ (GetCurrentAllocPhase (), AllocPhase::STORAGE);
+    }
+    EXPECT_EQ (GetCurrentAllocPhase (), AllocPhase::PROCESS);
+  }
+  EXPECT_EQ (GetCurrentAllocPhase (), AllocPhase::OTHER);
+}
+
+TEST (AllocStatsTests, Counting)
+{
+  ResetAllocStats ();
+
+  {
+    AllocPhaseScope scope(AllocPhase::RENDER);
+
+    auto ptr = std::make_unique<std::vector<char>> (1000);
+    void* raw = std::malloc (500);
+    std::free (raw);
+    ptr.reset ();
+  }
+
+  const AllocCounts c = GetAllocCounts (AllocPhase::RENDER);
+  const AllocCounts other = GetAllocCounts (AllocPhase::COMMIT);
+  EXPECT_EQ (other.allocs, 0);
+
+  if (!AllocStatsEnabled ())
+    {
+      EXPECT_EQ (c.allocs, 0);
+      EXPECT_EQ (c.bytes, 0);
+      return;
+    }
+
+  /* The vector object, its data and the malloc'ed block.  */
+  EXPECT_EQ (c.allocs, 3);
+  EXPECT_EQ (c.frees, 3);
+  EXPECT_GE (c.bytes, 1500);
+  EXPECT_GE (c.peakLive, 1000);
+}
+
+TEST (AllocStatsTests, Json)
+{
+  ResetAllocStats ();
+
+  const Json::Value val = AllocStatsToJson ();
+  EXPECT_EQ (val["enabled"].asBool (), AllocStatsEnabled ());
+  ASSERT_EQ (val["phases"].size (), NUM_ALLOC_PHASES);
+  EXPECT_TRUE (val["phases"]["process"].isMember ("allocs"));
+  EXPECT_TRUE (val["phases"]["render"].isMember ("peaklive"));
+}
+
+} // anonymous namespace
+} // namespace xaya
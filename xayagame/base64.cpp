@@ -0,0 +1,129 @@
+// Copyright (C) 2019 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "base64.hpp"
+
+namespace xaya
+{
+
+namespace
+{
+
+const char ALPHABET[]
+    = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+constexpr char PADDING = '=';
+
+/**
+ * Returns the 6-bit value of a base64 character, or -1 if it is not
+ * a valid character of the alphabet.
+ */
+int
+DecodeCharacter (const char c)
+{
+  if (c >= 'A' && c <= 'Z')
+    return c - 'A';
+  if (c >= 'a' && c <= 'z')
+    return c - 'a' + 26;
+  if (c >= '0' && c <= '9')
+    return c - '0' + 52;
+  if (c == '+')
+    return 62;
+  if (c == '/')
+    return 63;
+  return -1;
+}
+
+} // anonymous namespace
+
+std::string
+EncodeBase64 (const std::string& data)
+{
+  std::string res;
+  res.reserve (4 * ((data.size () + 2) / 3));
+
+  size_t pos = 0;
+  for (; pos + 3 <= data.size (); pos += 3)
+    {
+      const unsigned n = (static_cast<unsigned char> (data[pos]) << 16)
+                          | (static_cast<unsigned char> (data[pos + 1]) << 8)
+                          | static_cast<unsigned char> (data[pos + 2]);
+      res.push_back (ALPHABET[(n >> 18) & 0x3F]);
+      res.push_back (ALPHABET[(n >> 12) & 0x3F]);
+      res.push_back (ALPHABET[(n >> 6) & 0x3F]);
+      res.push_back (ALPHABET[n & 0x3F]);
+    }
+
+  const size_t remaining = data.size () - pos;
+  if (remaining == 1)
+    {
+      const unsigned n = static_cast<unsigned char> (data[pos]) << 16;
+      res.push_back (ALPHABET[(n >> 18) & 0x3F]);
+      res.push_back (ALPHABET[(n >> 12) & 0x3F]);
+      res.push_back (PADDING);
+      res.push_back (PADDING);
+    }
+  else if (remaining == 2)
+    {
+      const unsigned n = (static_cast<unsigned char> (data[pos]) << 16)
+                          | (static_cast<unsigned char> (data[pos + 1]) << 8);
+      res.push_back (ALPHABET[(n >> 18) & 0x3F]);
+      res.push_back (ALPHABET[(n >> 12) & 0x3F]);
+      res.push_back (ALPHABET[(n >> 6) & 0x3F]);
+      res.push_back (PADDING);
+    }
+
+  return res;
+}
+
+bool
+DecodeBase64 (const std::string& encoded, std::string& data)
+{
+  if (encoded.size () % 4 != 0)
+    return false;
+
+  data.clear ();
+  data.reserve (3 * (encoded.size () / 4));
+
+  for (size_t pos = 0; pos < encoded.size (); pos += 4)
+    {
+      const bool last = (pos + 4 == encoded.size ());
+
+      unsigned n = 0;
+      unsigned numPadding = 0;
+      for (size_t i = 0; i < 4; ++i)
+        {
+          const char c = encoded[pos + i];
+          n <<= 6;
+
+          if (c == PADDING)
+            {
+              /* Padding is only allowed in the last two positions of the
+                 final group, and must not be followed by other data.  */
+              if (!last || i < 2)
+                return false;
+              ++numPadding;
+              continue;
+            }
+
+          if (numPadding > 0)
+            return false;
+
+          const int val = DecodeCharacter (c);
+          if (val < 0)
+            return false;
+          n |= static_cast<unsigned> (val);
+        }
+
+      data.push_back (static_cast<char> ((n >> 16) & 0xFF));
+      if (numPadding < 2)
+        data.push_back (static_cast<char> ((n >> 8) & 0xFF));
+      if (numPadding < 1)
+        data.push_back (static_cast<char> (n & 0xFF));
+    }
+
+  return true;
+}
+
+} // namespace xaya
@@ -0,0 +1,28 @@
+// Copyright (C) 2019 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef XAYAGAME_BASE64_HPP
+#define XAYAGAME_BASE64_HPP
+
+#include <string>
+
+namespace xaya
+{
+
+/**
+ * Encodes a string of arbitrary bytes as base64 (standard alphabet and
+ * with padding).  This is used to transport binary data, like encoded
+ * game states, within JSON.
+ */
+std::string EncodeBase64 (const std::string& data);
+
+/**
+ * Decodes a base64 string into the raw bytes.  Returns false if the input
+ * is not valid base64 (in the format produced by EncodeBase64).
+ */
+bool DecodeBase64 (const std::string& encoded, std::string& data);
+
+} // namespace xaya
+
+#endif // XAYAGAME_BASE64_HPP
@@ -0,0 +1,75 @@
+// Copyright (C) 2019 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "base64.hpp"
+
+#include <gtest/gtest.h>
+
+#include <string>
+
+namespace xaya
+{
+namespace
+{
+
+/* Test vectors are from RFC 4648.  */
+struct TestVector
+{
+  const char* raw;
+  const char* encoded;
+};
+
+const TestVector VECTORS[] =
+  {
+    {"", ""},
+    {"f", "Zg=="},
+    {"fo", "Zm8="},
+    {"foo", "Zm9v"},
+    {"foob", "Zm9vYg=="},
+    {"fooba", "Zm9vYmE="},
+    {"foobar", "Zm9vYmFy"},
+  };
+
+TEST (Base64Tests, Encode)
+{
+  for (const auto& v : VECTORS)
+    EXPECT_EQ (EncodeBase64 (v.raw), v.encoded);
+}
+
+TEST (Base64Tests, Decode)
+{
+  for (const auto& v : VECTORS)
+    {
+      std::string decoded;
+      ASSERT_TRUE (DecodeBase64 (v.encoded, decoded));
+      EXPECT_EQ (decoded, v.raw);
+    }
+}
+
+TEST (Base64Tests, BinaryRoundTrip)
+{
+  std::string data;
+  for (int i = 0; i < 256; ++i)
+    data.push_back (static_cast<char> (i));
+  data.push_back ('\0');
+
+  const std::string encoded = EncodeBase64 (data);
+  std::string decoded;
+  ASSERT_TRUE (DecodeBase64 (encoded, decoded));
+  EXPECT_EQ (decoded, data);
+}
+
+TEST (Base64Tests, InvalidInput)
+{
+  std::string decoded;
+  EXPECT_FALSE (DecodeBase64 ("Zg=", decoded));
+  EXPECT_FALSE (DecodeBase64 ("Zg=a", decoded));
+  EXPECT_FALSE (DecodeBase64 ("Z===", decoded));
+  EXPECT_FALSE (DecodeBase64 ("Zg==Zg==", decoded));
+  EXPECT_FALSE (DecodeBase64 ("Zm9-", decoded));
+  EXPECT_FALSE (DecodeBase64 ("Zm9v\n", decoded));
+}
+
+} // anonymous namespace
+} // namespace xaya
@@ -0,0 +1,294 @@
+// Copyright (C) 2019 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "checkpoints.hpp"
+
+#include "threadconfig.hpp"
+
+#include <glog/logging.h>
+
+#include <experimental/filesystem>
+
+#include <algorithm>
+#include <cstdlib>
+#include <system_error>
+
+namespace xaya
+{
+namespace internal
+{
+
+namespace fs = std::experimental::filesystem;
+
+namespace
+{
+
+/** File extension used for checkpoints.  */
+const std::string EXTENSION = ".ckpt";
+
+/**
+ * Tries to parse the file name of a checkpoint into its height and
+ * block hash.  Returns false if the name is not in the expected format.
+ */
+bool
+ParseFileName (const std::string& name, unsigned& height, uint256& hash)
+{
+  if (name.size () <= EXTENSION.size ()
+        || name.compare (name.size () - EXTENSION.size (), EXTENSION.size (),
+                         EXTENSION) != 0)
+    return false;
+
+  const size_t sep = name.find ('-');
+  if (sep == 0 || sep == std::string::npos)
+    return false;
+
+  const std::string heightStr = name.substr (0, sep);
+  if (heightStr.find_first_not_of ("0123456789") != std::string::npos)
+    return false;
+  height = std::strtoul (heightStr.c_str (), nullptr, 10);
+
+  const size_t hashStart = sep + 1;
+  const size_t hashLen = name.size () - EXTENSION.size () - hashStart;
+  return hash.FromHex (name.substr (hashStart, hashLen));
+}
+
+} // anonymous namespace
+
+CheckpointManager::CheckpointManager (const std::string& dir,
+                                      const unsigned i, const unsigned k)
+  : directory(dir), interval(i), keep(k)
+{
+  CHECK_GT (interval, 0);
+  CHECK_GT (keep, 0);
+
+  if (!fs::is_directory (directory))
+    {
+      LOG (INFO) << "Creating checkpoint directory: " << directory;
+      CHECK (fs::create_directories (directory));
+    }
+
+  worker = std::thread ([this] () { WorkerLoop (); });
+}
+
+CheckpointManager::~CheckpointManager ()
+{
+  {
+    std::lock_guard<std::mutex> lock(mut);
+    shutdown = true;
+    pending.clear ();
+  }
+  cvJob.notify_all ();
+
+  worker.join ();
+}
+
+bool
+CheckpointManager::WriteFile (
+    const std::function<bool (const std::string&)>& write,
+    const uint256& hash, const unsigned height) const
+{
+  const std::string name
+      = std::to_string (height) + "-" + hash.ToHex () + EXTENSION;
+  const fs::path file = fs::path (directory) / fs::path (name);
+
+  /* The checkpoint is written to a temporary file first and only renamed
+     when complete, so that a crash never leaves a broken checkpoint.  */
+  const fs::path tmpFile = fs::path (file.string () + ".tmp");
+  std::error_code ec;
+  fs::remove (tmpFile, ec);
+  if (ec)
+    {
+      LOG (WARNING)
+          << "Failed to remove " << tmpFile.string () << ": " << ec.message ();
+      return false;
+    }
+
+  LOG (INFO)
+      << "Writing checkpoint for block " << hash.ToHex ()
+      << " at height " << height;
+  if (!write (tmpFile.string ()))
+    {
+      LOG (WARNING) << "Skipping checkpoint at height " << height;
+      fs::remove (tmpFile, ec);
+      return false;
+    }
+
+  fs::rename (tmpFile, file, ec);
+  if (ec)
+    {
+      LOG (WARNING)
+          << "Failed to rename checkpoint " << tmpFile.string ()
+          << ": " << ec.message ();
+      fs::remove (tmpFile, ec);
+      return false;
+    }
+
+  Prune ();
+  return true;
+}
+
+bool
+CheckpointManager::Write (const StorageInterface& storage,
+                          const uint256& hash, const unsigned height) const
+{
+  std::lock_guard<std::mutex> lock(fileMut);
+  return WriteFile ([&storage] (const std::string& file)
+                      {
+                        return storage.WriteCheckpoint (file);
+                      },
+                    hash, height);
+}
+
+void
+CheckpointManager::Schedule (std::unique_ptr<StorageSnapshot> snapshot,
+                             const uint256& hash, const unsigned height)
+{
+  CHECK (snapshot != nullptr);
+
+  auto job = std::make_unique<Job> ();
+  job->snapshot = std::move (snapshot);
+  job->hash = hash;
+  job->height = height;
+
+  {
+    std::lock_guard<std::mutex> lock(mut);
+    pending.push_back (std::move (job));
+  }
+
+  cvJob.notify_all ();
+}
+
+void
+CheckpointManager::WaitForIdle () const
+{
+  std::unique_lock<std::mutex> lock(mut);
+  cvIdle.wait (lock, [this] ()
+    {
+      return pending.empty () && !running;
+    });
+}
+
+void
+CheckpointManager::WorkerLoop ()
+{
+  SetCurrentThreadName ("xaya-checkpoint");
+
+  std::unique_lock<std::mutex> lock(mut);
+  while (true)
+    {
+      cvJob.wait (lock, [this] ()
+        {
+          return shutdown || !pending.empty ();
+        });
+      if (shutdown)
+        break;
+
+      std::unique_ptr<Job> job = std::move (pending.front ());
+      pending.pop_front ();
+      running = true;
+
+      lock.unlock ();
+      {
+        std::lock_guard<std::mutex> fileLock(fileMut);
+        const StorageSnapshot& snapshot = *job->snapshot;
+        WriteFile ([&snapshot] (const std::string& file)
+                     {
+                       return snapshot.WriteCheckpoint (file);
+                     },
+                   job->hash, job->height);
+      }
+      /* Release the snapshot before signalling that we are done, so that
+         it does not outlive the storage when the game shuts down.  */
+      job.reset ();
+      lock.lock ();
+
+      running = false;
+      cvIdle.notify_all ();
+    }
+}
+
+std::vector<CheckpointManager::Checkpoint>
+CheckpointManager::List () const
+{
+  std::vector<Checkpoint> res;
+
+  std::error_code ec;
+  fs::directory_iterator it(directory, ec);
+  for (; !ec && it != fs::directory_iterator (); it.increment (ec))
+    {
+      if (!fs::is_regular_file (it->status ()))
+        continue;
+
+      Checkpoint cur;
+      if (!ParseFileName (it->path ().filename ().string (),
+                          cur.height, cur.hash))
+        continue;
+
+      cur.file = it->path ().string ();
+      res.push_back (std::move (cur));
+    }
+  if (ec)
+    LOG (WARNING)
+        << "Failed to list checkpoints in " << directory
+        << ": " << ec.message ();
+
+  std::sort (res.begin (), res.end (),
+             [] (const Checkpoint& a, const Checkpoint& b)
+               {
+                 if (a.height != b.height)
+                   return a.height > b.height;
+                 return a.file < b.file;
+               });
+
+  return res;
+}
+
+void
+CheckpointManager::Prune () const
+{
+  const auto checkpoints = List ();
+  for (size_t i = keep; i < checkpoints.size (); ++i)
+    {
+      VLOG (1) << "Removing old checkpoint " << checkpoints[i].file;
+      std::error_code ec;
+      fs::remove (checkpoints[i].file, ec);
+      if (ec)
+        LOG (WARNING)
+            << "Failed to remove " << checkpoints[i].file
+            << ": " << ec.message ();
+    }
+}
+
+bool
+CheckpointManager::FindRestorable (const MainChainCheck& check,
+                                   Checkpoint& res) const
+{
+  for (const auto& c : List ())
+    {
+      if (!check (c.hash, c.height))
+        {
+          VLOG (1) << "Checkpoint " << c.file << " is not on the main chain";
+          continue;
+        }
+
+      res = c;
+      return true;
+    }
+
+  LOG (WARNING) << "No usable checkpoint found";
+  return false;
+}
+
+void
+CheckpointManager::Restore (StorageInterface& storage,
+                            const Checkpoint& c) const
+{
+  LOG (INFO)
+      << "Restoring checkpoint for block " << c.hash.ToHex ()
+      << " at height " << c.height;
+  storage.RestoreCheckpoint (c.file);
+}
+
+} // namespace internal
+} // namespace xaya
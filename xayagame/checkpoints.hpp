@@ -0,0 +1,213 @@
+// Copyright (C) 2019 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef XAYAGAME_CHECKPOINTS_HPP
+#define XAYAGAME_CHECKPOINTS_HPP
+
+/* This file is an implementation detail of Game and should not be
+   used directly by external code!  */
+
+#include "storage.hpp"
+#include "uint256.hpp"
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace xaya
+{
+namespace internal
+{
+
+/**
+ * Manager for local checkpoints of the game state.  Every interval blocks,
+ * the current state is written to a file in the checkpoint directory
+ * (through StorageInterface::WriteCheckpoint), and only the newest few
+ * checkpoints are kept.
+ *
+ * If a reorg is deeper than the available undo data, Game can then restore
+ * the newest checkpoint that is still on the main chain and sync forward
+ * from there, rather than resyncing the whole game from its genesis block.
+ *
+ * Checkpoint files are named by the height and block hash, so that they can
+ * be listed without opening them.  If the storage supports snapshots,
+ * checkpoints are written from one on a background thread, so that block
+ * processing is not stalled by the copy.  Since checkpoints are optional,
+ * I/O errors while writing them are logged and the checkpoint is skipped.
+ *
+ * The class is thread-safe.
+ */
+class CheckpointManager
+{
+
+public:
+
+  /**
+   * Data about one checkpoint that exists on disk.
+   */
+  struct Checkpoint
+  {
+
+    /** The block hash of the checkpointed state.  */
+    uint256 hash;
+
+    /** The block height of the checkpointed state.  */
+    unsigned height;
+
+    /** The full path of the checkpoint file.  */
+    std::string file;
+
+  };
+
+  /**
+   * Callback that is used to check if a checkpoint's block is on the
+   * current main chain (and thus may be restored).
+   */
+  using MainChainCheck = std::function<bool (const uint256& hash,
+                                             unsigned height)>;
+
+private:
+
+  /**
+   * A checkpoint to be written from a snapshot by the worker.
+   */
+  struct Job
+  {
+    std::unique_ptr<StorageSnapshot> snapshot;
+    uint256 hash;
+    unsigned height;
+  };
+
+  /** The directory for checkpoint files.  */
+  const std::string directory;
+
+  /** Interval (in blocks) at which checkpoints are written.  */
+  const unsigned interval;
+
+  /** Number of checkpoints to keep.  */
+  const unsigned keep;
+
+  /** Lock for the job data here.  */
+  mutable std::mutex mut;
+
+  /**
+   * Lock held while writing or pruning checkpoint files (on either thread),
+   * so that the directory is only changed by one thread at a time.
+   */
+  mutable std::mutex fileMut;
+
+  /** Signalled when a new job is scheduled or we shut down.  */
+  std::condition_variable cvJob;
+
+  /** Signalled when the worker has finished a job.  */
+  mutable std::condition_variable cvIdle;
+
+  /** Jobs waiting for the worker, oldest first.  */
+  std::deque<std::unique_ptr<Job>> pending;
+
+  /** Whether or not the worker is currently processing a job.  */
+  bool running = false;
+
+  /** Set when the worker should shut down.  */
+  bool shutdown = false;
+
+  /** The worker thread.  */
+  std::thread worker;
+
+  /**
+   * Main function of the worker thread.
+   */
+  void WorkerLoop ();
+
+  /**
+   * Writes a checkpoint file for the given block, using the callback to
+   * write the actual data to a (temporary) file name.  Returns false if
+   * that failed.  Must be called with fileMut held.
+   */
+  bool WriteFile (const std::function<bool (const std::string&)>& write,
+                  const uint256& hash, unsigned height) const;
+
+  /**
+   * Removes the oldest checkpoints beyond the number to keep.
+   */
+  void Prune () const;
+
+public:
+
+  /**
+   * Constructs the manager with the given directory (which is created if
+   * it does not exist yet), interval and number of checkpoints to keep.
+   * This starts the worker thread.
+   */
+  explicit CheckpointManager (const std::string& dir,
+                              unsigned i, unsigned k);
+
+  ~CheckpointManager ();
+
+  CheckpointManager () = delete;
+  CheckpointManager (const CheckpointManager&) = delete;
+  void operator= (const CheckpointManager&) = delete;
+
+  /**
+   * Returns true if a checkpoint should be written for a state at
+   * the given block height.
+   */
+  bool
+  IsDue (const unsigned height) const
+  {
+    return height % interval == 0;
+  }
+
+  /**
+   * Writes a checkpoint of the current state in the given storage, which
+   * must correspond to the given block, synchronously.  The storage must
+   * not have an open transaction.  Old checkpoints are pruned afterwards.
+   * Returns false if the checkpoint could not be written.
+   */
+  bool Write (const StorageInterface& storage,
+              const uint256& hash, unsigned height) const;
+
+  /**
+   * Schedules writing a checkpoint from the given snapshot, which must
+   * correspond to the given block, on the worker thread.
+   */
+  void Schedule (std::unique_ptr<StorageSnapshot> snapshot,
+                 const uint256& hash, unsigned height);
+
+  /**
+   * Blocks until no job is pending or running anymore.  This is mainly
+   * useful for tests.
+   */
+  void WaitForIdle () const;
+
+  /**
+   * Returns all checkpoints currently on disk, newest (highest) first.
+   */
+  std::vector<Checkpoint> List () const;
+
+  /**
+   * Finds the newest checkpoint for which the given callback returns true.
+   * Returns false if there is none.  This does not access the storage, so
+   * that the callback (which may query the daemon) can be run without
+   * holding locks for the game state.
+   */
+  bool FindRestorable (const MainChainCheck& check, Checkpoint& res) const;
+
+  /**
+   * Restores the given checkpoint into the storage.  The storage must not
+   * have an open transaction.
+   */
+  void Restore (StorageInterface& storage, const Checkpoint& c) const;
+
+};
+
+} // namespace internal
+} // namespace xaya
+
+#endif // XAYAGAME_CHECKPOINTS_HPP
@@ -0,0 +1,212 @@
+// Copyright (C) 2019 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "checkpoints.hpp"
+
+#include "testutils.hpp"
+
+#include <gtest/gtest.h>
+
+#include <glog/logging.h>
+
+#include <experimental/filesystem>
+
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace xaya
+{
+namespace internal
+{
+namespace
+{
+
+namespace fs = std::experimental::filesystem;
+
+class CheckpointManagerTests : public testing::Test
+{
+
+protected:
+
+  /** Temporary directory for the checkpoints.  */
+  const std::string directory;
+
+  MemoryStorage storage;
+
+  CheckpointManagerTests ()
+    : directory(std::tmpnam (nullptr))
+  {
+    LOG (INFO) << "Temporary checkpoint directory: " << directory;
+    storage.Initialise ();
+  }
+
+  ~CheckpointManagerTests ()
+  {
+    fs::remove_all (directory);
+  }
+
+  /**
+   * Sets the current state in our storage and writes a checkpoint for it
+   * if one is due.
+   */
+  void
+  SetState (const CheckpointManager& mgr, const unsigned height,
+            const GameStateData& state)
+  {
+    storage.BeginTransaction ();
+    storage.SetCurrentGameState (BlockHash (height), state);
+    storage.CommitTransaction ();
+
+    if (mgr.IsDue (height))
+      mgr.Write (storage, BlockHash (height), height);
+  }
+
+  /**
+   * Returns the heights of all checkpoints, in the order of List().
+   */
+  static std::vector<unsigned>
+  GetHeights (const CheckpointManager& mgr)
+  {
+    std::vector<unsigned> res;
+    for (const auto& c : mgr.List ())
+      {
+        EXPECT_EQ (c.hash, BlockHash (c.height));
+        res.push_back (c.height);
+      }
+    return res;
+  }
+
+};
+
+TEST_F (CheckpointManagerTests, WriteAndPrune)
+{
+  CheckpointManager mgr(directory, 10, 3);
+  EXPECT_TRUE (fs::is_directory (directory));
+  EXPECT_EQ (GetHeights (mgr), std::vector<unsigned> ({}));
+
+  for (unsigned h = 1; h <= 45; ++h)
+    SetState (mgr, h, "state " + std::to_string (h));
+
+  EXPECT_EQ (GetHeights (mgr), std::vector<unsigned> ({40, 30, 20}));
+}
+
+TEST_F (CheckpointManagerTests, IgnoresOtherFiles)
+{
+  CheckpointManager mgr(directory, 10, 3);
+  SetState (mgr, 10, "state");
+
+  const std::vector<std::string> names =
+    {
+      "foo",
+      "10-abc.ckpt",
+      "x-y.ckpt",
+      "20-" + BlockHash (20).ToHex () + ".ckpt.tmp",
+    };
+  for (const auto& name : names)
+    std::ofstream ((fs::path (directory) / fs::path (name)).string ());
+  fs::create_directory (fs::path (directory)
+                          / fs::path ("30-" + BlockHash (30).ToHex ()
+                                        + ".ckpt"));
+
+  EXPECT_EQ (GetHeights (mgr), std::vector<unsigned> ({10}));
+}
+
+TEST_F (CheckpointManagerTests, Restore)
+{
+  CheckpointManager mgr(directory, 10, 5);
+  for (unsigned h = 1; h <= 35; ++h)
+    SetState (mgr, h, "state " + std::to_string (h));
+
+  CheckpointManager::Checkpoint restored;
+  ASSERT_TRUE (mgr.FindRestorable (
+      [] (const uint256& hash, const unsigned height)
+        {
+          return height < 30;
+        }, restored));
+
+  EXPECT_EQ (restored.height, 20);
+  EXPECT_EQ (restored.hash, BlockHash (20));
+  mgr.Restore (storage, restored);
+
+  uint256 hash;
+  ASSERT_TRUE (storage.GetCurrentBlockHash (hash));
+  EXPECT_EQ (hash, BlockHash (20));
+  EXPECT_EQ (storage.GetCurrentGameState (), "state 20");
+}
+
+TEST_F (CheckpointManagerTests, NothingToRestore)
+{
+  CheckpointManager mgr(directory, 10, 5);
+  for (unsigned h = 1; h <= 25; ++h)
+    SetState (mgr, h, "state " + std::to_string (h));
+
+  CheckpointManager::Checkpoint restored;
+  ASSERT_FALSE (mgr.FindRestorable (
+      [] (const uint256& hash, const unsigned height)
+        {
+          return false;
+        }, restored));
+
+  uint256 hash;
+  ASSERT_TRUE (storage.GetCurrentBlockHash (hash));
+  EXPECT_EQ (hash, BlockHash (25));
+}
+
+TEST_F (CheckpointManagerTests, FromSnapshot)
+{
+  CheckpointManager mgr(directory, 10, 3);
+
+  storage.BeginTransaction ();
+  storage.SetCurrentGameState (BlockHash (10), "state 10");
+  storage.CommitTransaction ();
+  mgr.Schedule (storage.OpenSnapshot (), BlockHash (10), 10);
+
+  /* Later changes must not affect the checkpoint.  */
+  storage.BeginTransaction ();
+  storage.SetCurrentGameState (BlockHash (11), "state 11");
+  storage.CommitTransaction ();
+
+  storage.BeginTransaction ();
+  storage.SetCurrentGameState (BlockHash (20), "state 20");
+  storage.CommitTransaction ();
+  mgr.Schedule (storage.OpenSnapshot (), BlockHash (20), 20);
+
+  mgr.WaitForIdle ();
+  EXPECT_EQ (GetHeights (mgr), std::vector<unsigned> ({20, 10}));
+
+  mgr.Restore (storage, mgr.List ().back ());
+  uint256 hash;
+  ASSERT_TRUE (storage.GetCurrentBlockHash (hash));
+  EXPECT_EQ (hash, BlockHash (10));
+  EXPECT_EQ (storage.GetCurrentGameState (), "state 10");
+}
+
+TEST_F (CheckpointManagerTests, WriteFailure)
+{
+  CheckpointManager mgr(directory, 10, 3);
+  SetState (mgr, 10, "state 10");
+
+  /* Block the temporary file name with a non-empty directory, so that
+     the checkpoint cannot be written.  */
+  const fs::path blocker = fs::path (directory)
+      / fs::path ("20-" + BlockHash (20).ToHex () + ".ckpt.tmp");
+  fs::create_directory (blocker);
+  std::ofstream ((blocker / fs::path ("file")).string ());
+
+  storage.BeginTransaction ();
+  storage.SetCurrentGameState (BlockHash (20), "state 20");
+  storage.CommitTransaction ();
+  EXPECT_FALSE (mgr.Write (storage, BlockHash (20), 20));
+
+  mgr.Schedule (storage.OpenSnapshot (), BlockHash (20), 20);
+  mgr.WaitForIdle ();
+
+  EXPECT_EQ (GetHeights (mgr), std::vector<unsigned> ({10}));
+}
+
+} // anonymous namespace
+} // namespace internal
+} // namespace xaya
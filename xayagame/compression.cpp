@@ -0,0 +1,189 @@
+// Copyright (C) 2019 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "compression.hpp"
+
+#include <glog/logging.h>
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <sstream>
+
+namespace xaya
+{
+
+std::string
+ContentEncodingToString (const ContentEncoding enc)
+{
+  switch (enc)
+    {
+    case ContentEncoding::IDENTITY:
+      return "identity";
+    case ContentEncoding::GZIP:
+      return "gzip";
+    case ContentEncoding::DEFLATE:
+      return "deflate";
+    }
+
+  LOG (FATAL) << "Invalid content encoding: " << static_cast<int> (enc);
+}
+
+namespace
+{
+
+/**
+ * Strips leading and trailing whitespace from a string.
+ */
+std::string
+Trim (const std::string& str)
+{
+  const auto isSpace = [] (const char c)
+    {
+      return std::isspace (static_cast<unsigned char> (c));
+    };
+
+  const auto begin = std::find_if_not (str.begin (), str.end (), isSpace);
+  const auto end = std::find_if_not (str.rbegin (), str.rend (), isSpace);
+  if (begin >= end.base ())
+    return "";
+
+  return std::string (begin, end.base ());
+}
+
+/**
+ * Returns the zlib windowBits value that selects the given format.
+ */
+int
+WindowBits (const ContentEncoding enc)
+{
+  switch (enc)
+    {
+    case ContentEncoding::GZIP:
+      return 15 + 16;
+    case ContentEncoding::DEFLATE:
+      return 15;
+    case ContentEncoding::IDENTITY:
+      break;
+    }
+
+  LOG (FATAL) << "Invalid compressing encoding: " << static_cast<int> (enc);
+}
+
+} // anonymous namespace
+
+ContentEncoding
+NegotiateContentEncoding (const std::string& accepted)
+{
+  ContentEncoding best = ContentEncoding::IDENTITY;
+  double bestQ = 0.0;
+
+  std::istringstream in(accepted);
+  std::string entry;
+  while (std::getline (in, entry, ','))
+    {
+      const size_t semicolon = entry.find (';');
+      std::string name = Trim (entry.substr (0, semicolon));
+      std::transform (name.begin (), name.end (), name.begin (),
+                      [] (const unsigned char c) { return std::tolower (c); });
+
+      double q = 1.0;
+      if (semicolon != std::string::npos)
+        {
+          const std::string param = Trim (entry.substr (semicolon + 1));
+          if (param.substr (0, 2) == "q=")
+            q = std::strtod (param.c_str () + 2, nullptr);
+        }
+
+      ContentEncoding enc;
+      if (name == "gzip" || name == "*")
+        enc = ContentEncoding::GZIP;
+      else if (name == "deflate")
+        enc = ContentEncoding::DEFLATE;
+      else
+        continue;
+
+      /* On ties, the first-listed encoding wins.  */
+      if (q > bestQ)
+        {
+          best = enc;
+          bestQ = q;
+        }
+    }
+
+  return best;
+}
+
+std::string
+CompressData (const std::string& data, const ContentEncoding enc)
+{
+  if (enc == ContentEncoding::IDENTITY)
+    return data;
+
+  z_stream stream;
+  stream.zalloc = Z_NULL;
+  stream.zfree = Z_NULL;
+  stream.opaque = Z_NULL;
+  CHECK_EQ (deflateInit2 (&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+                          WindowBits (enc), 8, Z_DEFAULT_STRATEGY),
+            Z_OK);
+
+  std::string res(deflateBound (&stream, data.size ()), '\0');
+  stream.next_in
+      = reinterpret_cast<Bytef*> (const_cast<char*> (data.data ()));
+  stream.avail_in = data.size ();
+  stream.next_out = reinterpret_cast<Bytef*> (&res[0]);
+  stream.avail_out = res.size ();
+
+  /* With an output buffer of deflateBound size, a single call with
+     Z_FINISH is guaranteed to complete.  */
+  CHECK_EQ (deflate (&stream, Z_FINISH), Z_STREAM_END);
+  res.resize (stream.total_out);
+  CHECK_EQ (deflateEnd (&stream), Z_OK);
+
+  return res;
+}
+
+bool
+DecompressData (const std::string& compressed, const ContentEncoding enc,
+                std::string& data)
+{
+  if (enc == ContentEncoding::IDENTITY)
+    {
+      data = compressed;
+      return true;
+    }
+
+  z_stream stream;
+  stream.zalloc = Z_NULL;
+  stream.zfree = Z_NULL;
+  stream.opaque = Z_NULL;
+  stream.next_in
+      = reinterpret_cast<Bytef*> (const_cast<char*> (compressed.data ()));
+  stream.avail_in = compressed.size ();
+  CHECK_EQ (inflateInit2 (&stream, WindowBits (enc)), Z_OK);
+
+  data.clear ();
+  char buffer[16 * 1024];
+  int rc;
+  do
+    {
+      stream.next_out = reinterpret_cast<Bytef*> (buffer);
+      stream.avail_out = sizeof (buffer);
+      rc = inflate (&stream, Z_NO_FLUSH);
+      if (rc != Z_OK && rc != Z_STREAM_END)
+        break;
+      data.append (buffer, sizeof (buffer) - stream.avail_out);
+    }
+  while (rc != Z_STREAM_END);
+
+  inflateEnd (&stream);
+
+  /* Trailing garbage after the compressed stream is an error as well.  */
+  return rc == Z_STREAM_END && stream.avail_in == 0;
+}
+
+} // namespace xaya
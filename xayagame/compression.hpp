@@ -0,0 +1,54 @@
+// Copyright (C) 2019 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef XAYAGAME_COMPRESSION_HPP
+#define XAYAGAME_COMPRESSION_HPP
+
+#include <string>
+
+namespace xaya
+{
+
+/**
+ * Content encodings (in the sense of HTTP) that can be applied to large
+ * RPC payloads.
+ */
+enum class ContentEncoding
+{
+  IDENTITY = 0,
+  /** Gzip format (RFC 1952).  */
+  GZIP = 1,
+  /** Zlib format (RFC 1950), which is what HTTP calls "deflate".  */
+  DEFLATE = 2,
+};
+
+/**
+ * Returns the HTTP name of a content encoding (e.g. "gzip").
+ */
+std::string ContentEncodingToString (ContentEncoding enc);
+
+/**
+ * Picks the preferred content encoding we support from a list in the format
+ * of an HTTP Accept-Encoding header (e.g. "gzip, deflate;q=0.5").  Entries
+ * with "q=0" are ignored.  If there is no acceptable compressing encoding,
+ * IDENTITY is returned.
+ */
+ContentEncoding NegotiateContentEncoding (const std::string& accepted);
+
+/**
+ * Compresses data with the given encoding.  IDENTITY returns the data
+ * unchanged.
+ */
+std::string CompressData (const std::string& data, ContentEncoding enc);
+
+/**
+ * Decompresses data with the given encoding.  Returns false if the data
+ * is invalid.
+ */
+bool DecompressData (const std::string& compressed, ContentEncoding enc,
+                     std::string& data);
+
+} // namespace xaya
+
+#endif // XAYAGAME_COMPRESSION_HPP
@@ -0,0 +1,98 @@
+// Copyright (C) 2019 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "compression.hpp"
+
+#include <gtest/gtest.h>
+
+#include <string>
+
+namespace xaya
+{
+namespace
+{
+
+TEST (ContentEncodingTests, ToString)
+{
+  EXPECT_EQ (ContentEncodingToString (ContentEncoding::IDENTITY), "identity");
+  EXPECT_EQ (ContentEncodingToString (ContentEncoding::GZIP), "gzip");
+  EXPECT_EQ (ContentEncodingToString (ContentEncoding::DEFLATE), "deflate");
+}
+
+TEST (ContentEncodingTests, Negotiate)
+{
+  EXPECT_EQ (NegotiateContentEncoding (""), ContentEncoding::IDENTITY);
+  EXPECT_EQ (NegotiateContentEncoding ("identity, br"),
+             ContentEncoding::IDENTITY);
+
+  EXPECT_EQ (NegotiateContentEncoding ("gzip"), ContentEncoding::GZIP);
+  EXPECT_EQ (NegotiateContentEncoding ("  Deflate "), ContentEncoding::DEFLATE);
+  EXPECT_EQ (NegotiateContentEncoding ("*"), ContentEncoding::GZIP);
+
+  EXPECT_EQ (NegotiateContentEncoding ("deflate, gzip"),
+             ContentEncoding::DEFLATE);
+  EXPECT_EQ (NegotiateContentEncoding ("deflate;q=0.5, gzip"),
+             ContentEncoding::GZIP);
+  EXPECT_EQ (NegotiateContentEncoding ("gzip;q=0, deflate;q=0.1"),
+             ContentEncoding::DEFLATE);
+  EXPECT_EQ (NegotiateContentEncoding ("gzip; q=0"),
+             ContentEncoding::IDENTITY);
+}
+
+class CompressionTests : public testing::TestWithParam<ContentEncoding>
+{};
+
+TEST_P (CompressionTests, Roundtrip)
+{
+  std::string large;
+  for (unsigned i = 0; i < 10000; ++i)
+    large += "{\"player\": " + std::to_string (i % 100) + "}";
+
+  for (const std::string& data : {std::string (""), std::string ("foo"),
+                                  std::string ("a\0b", 3), large})
+    {
+      const std::string compressed = CompressData (data, GetParam ());
+
+      std::string decompressed;
+      ASSERT_TRUE (DecompressData (compressed, GetParam (), decompressed));
+      EXPECT_EQ (decompressed, data);
+    }
+
+  if (GetParam () != ContentEncoding::IDENTITY)
+    {
+      const std::string compressed = CompressData (large, GetParam ());
+      EXPECT_LT (compressed.size (), large.size () / 10);
+    }
+}
+
+TEST_P (CompressionTests, InvalidData)
+{
+  if (GetParam () == ContentEncoding::IDENTITY)
+    return;
+
+  const std::string compressed = CompressData ("foobar", GetParam ());
+
+  std::string data;
+  EXPECT_FALSE (DecompressData ("invalid", GetParam (), data));
+  EXPECT_FALSE (DecompressData (compressed.substr (0, compressed.size () - 2),
+                                GetParam (), data));
+  EXPECT_FALSE (DecompressData (compressed + "x", GetParam (), data));
+}
+
+INSTANTIATE_TEST_CASE_P (AllEncodings, CompressionTests,
+                         testing::Values (ContentEncoding::IDENTITY,
+                                          ContentEncoding::GZIP,
+                                          ContentEncoding::DEFLATE));
+
+TEST (CompressionFormatTests, GzipAndDeflateDiffer)
+{
+  std::string data;
+  EXPECT_FALSE (DecompressData (CompressData ("foo", ContentEncoding::GZIP),
+                                ContentEncoding::DEFLATE, data));
+  EXPECT_FALSE (DecompressData (CompressData ("foo", ContentEncoding::DEFLATE),
+                                ContentEncoding::GZIP, data));
+}
+
+} // anonymous namespace
+} // namespace xaya
@@ -0,0 +1,250 @@
+// Copyright (C) 2019 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "costaccounting.hpp"
+
+#include <glog/logging.h>
+
+#include <algorithm>
+
+namespace xaya
+{
+
+/* ************************************************************************** */
+
+HeavyHitters::HeavyHitters (const size_t c)
+  : capacity(c)
+{
+  CHECK_GT (capacity, 0);
+}
+
+void
+HeavyHitters::Add (const std::string& key, const uint64_t weight,
+                   const std::string& info)
+{
+  auto mit = entries.find (key);
+  if (mit != entries.end ())
+    {
+      mit->second.weight += weight;
+      ++mit->second.count;
+      mit->second.info = info;
+      return;
+    }
+
+  Entry e;
+  e.key = key;
+  e.info = info;
+  e.weight = weight;
+  e.error = 0;
+  e.count = 1;
+
+  if (entries.size () >= capacity)
+    {
+      /* The sketch is small, so that a linear scan for the minimum is
+         cheaper in practice than maintaining an ordered index on each
+         update.  */
+      auto minIt = entries.begin ();
+      for (auto it = entries.begin (); it != entries.end (); ++it)
+        if (it->second.weight < minIt->second.weight)
+          minIt = it;
+
+      e.error = minIt->second.weight;
+      e.weight += e.error;
+      entries.erase (minIt);
+    }
+
+  entries.emplace (key, std::move (e));
+}
+
+std::vector<HeavyHitters::Entry>
+HeavyHitters::GetTop () const
+{
+  std::vector<Entry> res;
+  res.reserve (entries.size ());
+  for (const auto& entry : entries)
+    res.push_back (entry.second);
+
+  std::sort (res.begin (), res.end (),
+             [] (const Entry& a, const Entry& b)
+               {
+                 if (a.weight != b.weight)
+                   return a.weight > b.weight;
+                 return a.key < b.key;
+               });
+
+  return res;
+}
+
+void
+HeavyHitters::Clear ()
+{
+  entries.clear ();
+}
+
+/* ************************************************************************** */
+
+namespace
+{
+
+/**
+ * Comparator for TopItems::Entry that makes the standard heap functions
+ * keep the smallest weight at the front.
+ */
+bool
+LargerWeight (const TopItems::Entry& a, const TopItems::Entry& b)
+{
+  return a.weight > b.weight;
+}
+
+} // anonymous namespace
+
+TopItems::TopItems (const size_t c)
+  : capacity(c)
+{
+  CHECK_GT (capacity, 0);
+}
+
+void
+TopItems::Add (const std::string& key, const uint64_t weight,
+               const std::string& info)
+{
+  if (heap.size () >= capacity)
+    {
+      if (weight <= heap.front ().weight)
+        return;
+
+      std::pop_heap (heap.begin (), heap.end (), &LargerWeight);
+      heap.pop_back ();
+    }
+
+  Entry e;
+  e.key = key;
+  e.info = info;
+  e.weight = weight;
+
+  heap.push_back (std::move (e));
+  std::push_heap (heap.begin (), heap.end (), &LargerWeight);
+}
+
+std::vector<TopItems::Entry>
+TopItems::GetTop () const
+{
+  std::vector<Entry> res = heap;
+  std::sort (res.begin (), res.end (),
+             [] (const Entry& a, const Entry& b)
+               {
+                 if (a.weight != b.weight)
+                   return a.weight > b.weight;
+                 return a.key < b.key;
+               });
+
+  return res;
+}
+
+void
+TopItems::Clear ()
+{
+  heap.clear ();
+}
+
+/* ************************************************************************** */
+
+CostAccounting::CostAccounting (const size_t capacity)
+  : moves(capacity), names(capacity)
+{}
+
+void
+CostAccounting::RecordMove (const std::string& name, const std::string& txid,
+                            const uint64_t micros)
+{
+  std::lock_guard<std::mutex> lock(mut);
+
+  moves.Add (txid, micros, name);
+  names.Add (name, micros);
+
+  ++numMoves;
+  moveMicros += micros;
+}
+
+void
+CostAccounting::RecordBlock (const uint64_t micros)
+{
+  std::lock_guard<std::mutex> lock(mut);
+
+  ++numBlocks;
+  blockMicros += micros;
+}
+
+Json::Value
+CostAccounting::ToJson () const
+{
+  std::lock_guard<std::mutex> lock(mut);
+
+  Json::Value res(Json::objectValue);
+  res["blocks"] = static_cast<Json::UInt64> (numBlocks);
+  res["blockmicros"] = static_cast<Json::UInt64> (blockMicros);
+  res["moves"] = static_cast<Json::UInt64> (numMoves);
+  res["movemicros"] = static_cast<Json::UInt64> (moveMicros);
+
+  Json::Value topMoves(Json::arrayValue);
+  for (const auto& e : moves.GetTop ())
+    {
+      Json::Value cur(Json::objectValue);
+      cur["txid"] = e.key;
+      cur["name"] = e.info;
+      cur["micros"] = static_cast<Json::UInt64> (e.weight);
+      topMoves.append (cur);
+    }
+  res["topmoves"] = topMoves;
+
+  Json::Value topNames(Json::arrayValue);
+  for (const auto& e : names.GetTop ())
+    {
+      Json::Value cur(Json::objectValue);
+      cur["name"] = e.key;
+      cur["micros"] = static_cast<Json::UInt64> (e.weight);
+      cur["error"] = static_cast<Json::UInt64> (e.error);
+      cur["count"] = static_cast<Json::UInt64> (e.count);
+      topNames.append (cur);
+    }
+  res["topnames"] = topNames;
+
+  return res;
+}
+
+void
+CostAccounting::Clear ()
+{
+  std::lock_guard<std::mutex> lock(mut);
+
+  moves.Clear ();
+  names.Clear ();
+  numBlocks = 0;
+  blockMicros = 0;
+  numMoves = 0;
+  moveMicros = 0;
+}
+
+/* ************************************************************************** */
+
+MoveCostScope::MoveCostScope (CostAccounting* acc, const Json::Value& mv)
+  : accounting(acc), move(&mv), start(std::chrono::steady_clock::now ())
+{}
+
+MoveCostScope::~MoveCostScope ()
+{
+  if (accounting == nullptr)
+    return;
+
+  const auto duration = std::chrono::steady_clock::now () - start;
+  const auto micros
+      = std::chrono::duration_cast<std::chrono::microseconds> (duration);
+
+  accounting->RecordMove ((*move)["name"].asString (),
+                          (*move)["txid"].asString (), micros.count ());
+}
+
+/* ************************************************************************** */
+
+} // namespace xaya
@@ -0,0 +1,266 @@
+// Copyright (C) 2019 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef XAYAGAME_COSTACCOUNTING_HPP
+#define XAYAGAME_COSTACCOUNTING_HPP
+
+#include <json/json.h>
+
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace xaya
+{
+
+/**
+ * Bounded sketch of the keys with the largest total weights in a stream,
+ * using the "Space-Saving" algorithm:  At most capacity keys are tracked.
+ * When a new key arrives while the sketch is full, the tracked key with the
+ * smallest weight is replaced, and the new key inherits its weight as an
+ * upper bound of the error.  Every key whose true total weight is larger
+ * than the minimum tracked weight is guaranteed to be in the sketch.
+ *
+ * This class is not thread-safe.
+ */
+class HeavyHitters
+{
+
+public:
+
+  /**
+   * A tracked key and its statistics.
+   */
+  struct Entry
+  {
+
+    /** The key itself.  */
+    std::string key;
+
+    /** Extra information attached to the key (from its latest addition).  */
+    std::string info;
+
+    /**
+     * Total weight attributed to the key.  This may overestimate the
+     * true value by up to error.
+     */
+    uint64_t weight;
+
+    /** Maximum overestimation of the weight.  */
+    uint64_t error;
+
+    /** Number of additions since the key has last entered the sketch.  */
+    uint64_t count;
+
+  };
+
+private:
+
+  /** Maximum number of keys tracked.  */
+  size_t capacity;
+
+  /** The tracked entries by key.  */
+  std::unordered_map<std::string, Entry> entries;
+
+public:
+
+  explicit HeavyHitters (size_t c);
+
+  HeavyHitters () = delete;
+  HeavyHitters (const HeavyHitters&) = delete;
+  void operator= (const HeavyHitters&) = delete;
+
+  /**
+   * Adds weight for the given key.
+   */
+  void Add (const std::string& key, uint64_t weight,
+            const std::string& info = "");
+
+  /**
+   * Returns all tracked entries, ordered by decreasing weight.
+   */
+  std::vector<Entry> GetTop () const;
+
+  /**
+   * Removes all entries.
+   */
+  void Clear ();
+
+};
+
+/**
+ * Exact bounded list of the individual items with the largest weights in
+ * a stream.  In contrast to HeavyHitters, weights are not accumulated per
+ * key, so that every item stays at its true weight.  A min-heap of at most
+ * capacity items is kept, and a new item only replaces the smallest one if
+ * it is larger.
+ *
+ * This class is not thread-safe.
+ */
+class TopItems
+{
+
+public:
+
+  /**
+   * A tracked item.
+   */
+  struct Entry
+  {
+
+    /** The item's key.  */
+    std::string key;
+
+    /** Extra information attached to the item.  */
+    std::string info;
+
+    /** The item's weight.  */
+    uint64_t weight;
+
+  };
+
+private:
+
+  /** Maximum number of items tracked.  */
+  size_t capacity;
+
+  /** The tracked items, as min-heap by weight.  */
+  std::vector<Entry> heap;
+
+public:
+
+  explicit TopItems (size_t c);
+
+  TopItems () = delete;
+  TopItems (const TopItems&) = delete;
+  void operator= (const TopItems&) = delete;
+
+  /**
+   * Adds an item, which is kept if it is among the capacity largest ones.
+   */
+  void Add (const std::string& key, uint64_t weight,
+            const std::string& info = "");
+
+  /**
+   * Returns all tracked items, ordered by decreasing weight.
+   */
+  std::vector<Entry> GetTop () const;
+
+  /**
+   * Removes all items.
+   */
+  void Clear ();
+
+};
+
+/**
+ * Accounting of the processing time that goes into individual moves and
+ * the names sending them.  Games can attribute the time spent in parts
+ * of their block processing to moves with MoveCostScope, using the
+ * instance provided by GameLogic::GetCostAccounting.  The most expensive
+ * individual moves are tracked exactly with TopItems, and the names with
+ * the highest total cost in a HeavyHitters sketch, so that pathological
+ * moves or spamming names can be identified.
+ *
+ * This class is thread-safe.
+ */
+class CostAccounting
+{
+
+private:
+
+  /** Lock for this instance.  */
+  mutable std::mutex mut;
+
+  /** Most expensive individual moves (keyed by txid).  */
+  TopItems moves;
+
+  /** Names with the most expensive moves in total.  */
+  HeavyHitters names;
+
+  /** Number of blocks recorded.  */
+  uint64_t numBlocks = 0;
+
+  /** Total processing time of all recorded blocks.  */
+  uint64_t blockMicros = 0;
+
+  /** Number of moves recorded.  */
+  uint64_t numMoves = 0;
+
+  /** Total processing time attributed to moves.  */
+  uint64_t moveMicros = 0;
+
+public:
+
+  /**
+   * Constructs the accounting, tracking up to the given number of top
+   * moves and names each.
+   */
+  explicit CostAccounting (size_t capacity);
+
+  CostAccounting () = delete;
+  CostAccounting (const CostAccounting&) = delete;
+  void operator= (const CostAccounting&) = delete;
+
+  /**
+   * Records processing time (in microseconds) spent on a move.
+   */
+  void RecordMove (const std::string& name, const std::string& txid,
+                   uint64_t micros);
+
+  /**
+   * Records the total processing time (in microseconds) of a block.
+   * This allows to see how much of it has been attributed to moves.
+   */
+  void RecordBlock (uint64_t micros);
+
+  /**
+   * Returns the accumulated statistics and top offenders as JSON.
+   */
+  Json::Value ToJson () const;
+
+  /**
+   * Resets all data.
+   */
+  void Clear ();
+
+};
+
+/**
+ * RAII helper that measures the time between its construction and
+ * destruction and records it for the given move.  The move is passed as
+ * in the block data (with "name" and "txid" fields).  If the accounting
+ * is null (because it is not enabled), then nothing is done.
+ */
+class MoveCostScope
+{
+
+private:
+
+  /** The accounting to record into, if enabled.  */
+  CostAccounting* const accounting;
+
+  /** The move we are measuring.  */
+  const Json::Value* const move;
+
+  /** Start time of the measurement.  */
+  const std::chrono::steady_clock::time_point start;
+
+public:
+
+  explicit MoveCostScope (CostAccounting* acc, const Json::Value& mv);
+  ~MoveCostScope ();
+
+  MoveCostScope () = delete;
+  MoveCostScope (const MoveCostScope&) = delete;
+  void operator= (const MoveCostScope&) = delete;
+
+};
+
+} // namespace xaya
+
+#endif // XAYAGAME_COSTACCOUNTING_HPP
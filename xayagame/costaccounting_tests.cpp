@@ -0,0 +1,192 @@
+// Copyright (C) 2019 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "costaccounting.hpp"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <string>
+#include <thread>
+
+namespace xaya
+{
+namespace
+{
+
+/* ************************************************************************** */
+
+/**
+ * Returns the keys of the top entries in a HeavyHitters sketch as
+ * concatenated string (for single-character keys).
+ */
+std::string
+TopKeys (const HeavyHitters& hh)
+{
+  std::string res;
+  for (const auto& e : hh.GetTop ())
+    res += e.key;
+  return res;
+}
+
+TEST (HeavyHittersTests, BelowCapacity)
+{
+  HeavyHitters hh(3);
+  hh.Add ("a", 1);
+  hh.Add ("b", 5, "info b");
+  hh.Add ("a", 2);
+
+  const auto top = hh.GetTop ();
+  ASSERT_EQ (top.size (), 2);
+
+  EXPECT_EQ (top[0].key, "b");
+  EXPECT_EQ (top[0].info, "info b");
+  EXPECT_EQ (top[0].weight, 5);
+  EXPECT_EQ (top[0].error, 0);
+  EXPECT_EQ (top[0].count, 1);
+
+  EXPECT_EQ (top[1].key, "a");
+  EXPECT_EQ (top[1].weight, 3);
+  EXPECT_EQ (top[1].error, 0);
+  EXPECT_EQ (top[1].count, 2);
+}
+
+TEST (HeavyHittersTests, Eviction)
+{
+  HeavyHitters hh(2);
+  hh.Add ("a", 10);
+  hh.Add ("b", 3);
+  hh.Add ("c", 1);
+
+  /* c replaced b (the minimum) and inherited its weight as error.  */
+  const auto top = hh.GetTop ();
+  ASSERT_EQ (top.size (), 2);
+  EXPECT_EQ (top[0].key, "a");
+  EXPECT_EQ (top[1].key, "c");
+  EXPECT_EQ (top[1].weight, 4);
+  EXPECT_EQ (top[1].error, 3);
+  EXPECT_EQ (top[1].count, 1);
+}
+
+TEST (HeavyHittersTests, FindsHeavyKey)
+{
+  HeavyHitters hh(3);
+  for (unsigned i = 0; i < 1000; ++i)
+    {
+      hh.Add (std::string (1, 'a' + (i % 20)), 1);
+      if (i % 10 == 0)
+        hh.Add ("X", 20);
+    }
+
+  EXPECT_EQ (TopKeys (hh).substr (0, 1), "X");
+  EXPECT_EQ (hh.GetTop ().size (), 3);
+
+  hh.Clear ();
+  EXPECT_EQ (TopKeys (hh), "");
+}
+
+/* ************************************************************************** */
+
+TEST (TopItemsTests, KeepsLargest)
+{
+  TopItems top(3);
+  top.Add ("a", 5, "info a");
+  top.Add ("b", 1);
+  top.Add ("c", 10);
+  top.Add ("d", 2);
+  top.Add ("e", 7);
+
+  const auto res = top.GetTop ();
+  ASSERT_EQ (res.size (), 3);
+  EXPECT_EQ (res[0].key, "c");
+  EXPECT_EQ (res[0].weight, 10);
+  EXPECT_EQ (res[1].key, "e");
+  EXPECT_EQ (res[2].key, "a");
+  EXPECT_EQ (res[2].info, "info a");
+  EXPECT_EQ (res[2].weight, 5);
+
+  top.Clear ();
+  EXPECT_TRUE (top.GetTop ().empty ());
+}
+
+/* ************************************************************************** */
+
+TEST (CostAccountingTests, CheapMoveDoesNotDisplaceExpensive)
+{
+  CostAccounting acc(2);
+  acc.RecordMove ("domob", "expensive", 1000);
+  acc.RecordMove ("andy", "medium", 100);
+  for (unsigned i = 0; i < 10; ++i)
+    acc.RecordMove ("spam", "cheap" + std::to_string (i), 1);
+
+  const Json::Value moves = acc.ToJson ()["topmoves"];
+  ASSERT_EQ (moves.size (), 2);
+  EXPECT_EQ (moves[0]["txid"], "expensive");
+  EXPECT_EQ (moves[0]["micros"].asUInt64 (), 1000);
+  EXPECT_EQ (moves[1]["txid"], "medium");
+  EXPECT_EQ (moves[1]["micros"].asUInt64 (), 100);
+}
+
+TEST (CostAccountingTests, Json)
+{
+  CostAccounting acc(10);
+  acc.RecordMove ("domob", "tx1", 100);
+  acc.RecordMove ("andy", "tx2", 50);
+  acc.RecordMove ("domob", "tx3", 10);
+  acc.RecordBlock (200);
+
+  const Json::Value val = acc.ToJson ();
+  EXPECT_EQ (val["blocks"].asUInt64 (), 1);
+  EXPECT_EQ (val["blockmicros"].asUInt64 (), 200);
+  EXPECT_EQ (val["moves"].asUInt64 (), 3);
+  EXPECT_EQ (val["movemicros"].asUInt64 (), 160);
+
+  const auto& moves = val["topmoves"];
+  ASSERT_EQ (moves.size (), 3);
+  EXPECT_EQ (moves[0]["txid"], "tx1");
+  EXPECT_EQ (moves[0]["name"], "domob");
+  EXPECT_EQ (moves[0]["micros"].asUInt64 (), 100);
+  EXPECT_EQ (moves[1]["txid"], "tx2");
+  EXPECT_EQ (moves[2]["txid"], "tx3");
+
+  const auto& names = val["topnames"];
+  ASSERT_EQ (names.size (), 2);
+  EXPECT_EQ (names[0]["name"], "domob");
+  EXPECT_EQ (names[0]["micros"].asUInt64 (), 110);
+  EXPECT_EQ (names[0]["count"].asUInt64 (), 2);
+  EXPECT_EQ (names[1]["name"], "andy");
+
+  acc.Clear ();
+  EXPECT_EQ (acc.ToJson ()["moves"].asUInt64 (), 0);
+  EXPECT_EQ (acc.ToJson ()["topnames"].size (), 0);
+}
+
+TEST (CostAccountingTests, MoveCostScope)
+{
+  Json::Value mv(Json::objectValue);
+  mv["name"] = "domob";
+  mv["txid"] = "tx";
+  mv["move"] = 42;
+
+  {
+    MoveCostScope scope(nullptr, mv);
+  }
+
+  CostAccounting acc(10);
+  {
+    MoveCostScope scope(&acc, mv);
+    std::this_thread::sleep_for (std::chrono::milliseconds (2));
+  }
+
+  const Json::Value val = acc.ToJson ();
+  ASSERT_EQ (val["topmoves"].size (), 1);
+  EXPECT_EQ (val["topmoves"][0]["txid"], "tx");
+  EXPECT_EQ (val["topmoves"][0]["name"], "domob");
+  EXPECT_GE (val["topmoves"][0]["micros"].asUInt64 (), 2000);
+}
+
+/* ************************************************************************** */
+
+} // anonymous namespace
+} // namespace xaya
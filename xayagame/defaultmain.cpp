@@ -8,13 +8,18 @@
 #include "gamerpcserver.hpp"
 #include "lmdbstorage.hpp"
 #include "sqlitestorage.hpp"
+#include "threadconfig.hpp"
 
 #include <jsonrpccpp/client/connectors/httpclient.h>
 #include <jsonrpccpp/server/connectors/tcpsocketserver.h>
 #include <jsonrpccpp/server/connectors/httpserver.h>
+#include <jsonrpccpp/server/connectors/unixdomainsocketserver.h>
 
 #include <glog/logging.h>
 
+#include <sys/stat.h>
+#include <sys/types.h>
+
 #include <experimental/filesystem>
 
 #include <cstdlib>
@@ -30,17 +35,14 @@ namespace
 namespace fs = std::experimental::filesystem;
 
 /**
- * Sets up a StorageInterface instance according to the configuration.
+ * Returns the data directory for the given game and chain, creating it
+ * if it does not exist yet.
  */
-std::unique_ptr<StorageInterface>
-CreateStorage (const GameDaemonConfiguration& config,
-               const std::string& gameId, const Chain chain)
+fs::path
+GetGameDirectory (const GameDaemonConfiguration& config,
+                  const std::string& gameId, const Chain chain)
 {
-  if (config.StorageType == "memory")
-    return std::make_unique<MemoryStorage> ();
-
-  CHECK (!config.DataDirectory.empty ())
-      << "DataDirectory must be set if non-memory storage is used";
+  CHECK (!config.DataDirectory.empty ());
   const fs::path gameDir
       = fs::path (config.DataDirectory)
           / fs::path (gameId)
@@ -54,6 +56,23 @@ CreateStorage (const GameDaemonConfiguration& config,
       CHECK (fs::create_directories (gameDir));
     }
 
+  return gameDir;
+}
+
+/**
+ * Sets up a StorageInterface instance according to the configuration.
+ */
+std::unique_ptr<StorageInterface>
+CreateStorage (const GameDaemonConfiguration& config,
+               const std::string& gameId, const Chain chain)
+{
+  if (config.StorageType == "memory")
+    return std::make_unique<MemoryStorage> ();
+
+  CHECK (!config.DataDirectory.empty ())
+      << "DataDirectory must be set if non-memory storage is used";
+  const fs::path gameDir = GetGameDirectory (config, gameId, chain);
+
   if (config.StorageType == "lmdb")
     {
       const fs::path lmdbDir = gameDir / fs::path ("lmdb");
@@ -68,7 +87,10 @@ CreateStorage (const GameDaemonConfiguration& config,
   if (config.StorageType == "sqlite")
     {
       const fs::path dbFile = gameDir / fs::path ("storage.sqlite");
-      return std::make_unique<SQLiteStorage> (dbFile.string ());
+      auto res = std::make_unique<SQLiteStorage> (dbFile.string ());
+      if (config.SQLiteSnapshots)
+        res->EnableSnapshots ();
+      return std::move (res);
     }
 
   LOG (FATAL) << "Invalid storage type selected: " << config.StorageType;
@@ -100,6 +122,28 @@ CreateRpcServerConnector (const GameDaemonConfiguration& config)
           << "Starting JSON-RPC TCP server at port " << config.GameRpcPort;
       return std::make_unique<jsonrpc::TcpSocketServer> ("127.0.0.1",
                                                          config.GameRpcPort);
+
+    case RpcServerType::UNIX:
+      {
+        CHECK (!config.GameRpcSocket.empty ())
+            << "GameRpcSocket must be specified for UNIX server type";
+
+        const fs::path socketPath(config.GameRpcSocket);
+        if (fs::exists (socketPath))
+          {
+            CHECK (fs::is_socket (socketPath))
+                << "GameRpcSocket path exists and is not a socket: "
+                << socketPath;
+            LOG (WARNING) << "Removing stale RPC socket " << socketPath;
+            CHECK (fs::remove (socketPath));
+          }
+
+        LOG (INFO)
+            << "Starting JSON-RPC server at Unix socket "
+            << config.GameRpcSocket;
+        return std::make_unique<jsonrpc::UnixDomainSocketServer> (
+            config.GameRpcSocket);
+      }
     }
 
   LOG (FATAL)
@@ -107,6 +151,61 @@ CreateRpcServerConnector (const GameDaemonConfiguration& config)
       << static_cast<int> (config.GameRpcServer);
 }
 
+/**
+ * Parses the configured state-publishing mode.
+ */
+StatePublishMode
+GetStatePublishMode (const GameDaemonConfiguration& config)
+{
+  if (config.GameStatePublishMode == "notification")
+    return StatePublishMode::NOTIFICATION;
+  if (config.GameStatePublishMode == "full")
+    return StatePublishMode::FULL_STATE;
+  if (config.GameStatePublishMode == "diff")
+    return StatePublishMode::STATE_DIFF;
+
+  LOG (FATAL)
+      << "Invalid state publishing mode: " << config.GameStatePublishMode;
+}
+
+/**
+ * Constructs a ThreadConfig from the CPU list and nice value in the
+ * daemon configuration.
+ */
+ThreadConfig
+GetThreadConfig (const std::string& cpus, const int nice)
+{
+  ThreadConfig res;
+  CHECK (ParseCpuList (cpus, res.cpus)) << "Invalid CPU list: " << cpus;
+  res.nice = nice;
+  return res;
+}
+
+/**
+ * Starts listening on the RPC server.  For a Unix domain socket with
+ * configured permissions, the umask is set accordingly while the socket
+ * is created, so that it never exists with other permissions.
+ */
+void
+StartRpcServer (const GameDaemonConfiguration& config, GameRpcServer& server)
+{
+  if (config.GameRpcServer != RpcServerType::UNIX
+        || config.GameRpcSocketMode < 0)
+    {
+      server.StartListening ();
+      return;
+    }
+
+  const mode_t mode = config.GameRpcSocketMode & 0777;
+  LOG (INFO) << "Creating RPC socket with mode " << std::oct << mode;
+
+  const mode_t oldMask = umask (~mode & 0777);
+  const bool ok = server.StartListening ();
+  umask (oldMask);
+
+  CHECK (ok) << "Failed to listen on RPC socket " << config.GameRpcSocket;
+}
+
 } // anonymous namespace
 
 int
@@ -122,6 +221,8 @@ DefaultMain (const GameDaemonConfiguration& config, const std::string& gameId,
       auto game = std::make_unique<Game> (gameId);
       game->ConnectRpcClient (httpConnector);
       CHECK (game->DetectZmqEndpoint ());
+      for (const auto& endpoint : config.AdditionalZmqEndpoints)
+        game->AddAdditionalZmqEndpoint (endpoint);
 
       std::unique_ptr<StorageInterface> storage
           = CreateStorage (config, gameId, game->GetChain ());
@@ -131,6 +232,66 @@ DefaultMain (const GameDaemonConfiguration& config, const std::string& gameId,
 
       if (config.EnablePruning >= 0)
         game->EnablePruning (config.EnablePruning);
+      game->SetTransactionBatchSizes (config.TransactionBatchSize,
+                                      config.UpToDateBatchSize);
+      game->SetBatchFlushTimeLimit (config.BatchFlushMillis);
+      game->SetCatchingUpNotifyLimits (config.CatchingUpNotifyMillis,
+                                       config.CatchingUpNotifyBlocks);
+      game->SetCompressionThreshold (config.GameRpcCompressionThreshold);
+      if (!config.GameStatePublisher.empty ())
+        game->EnableStatePublisher (config.GameStatePublisher,
+                                    GetStatePublishMode (config));
+      if (config.StateHistoryBlocks > 0)
+        game->EnableStateHistory (config.StateHistoryBlocks,
+                                  config.StateHistoryKeyframeInterval,
+                                  config.StateHistoryCacheSize);
+      if (config.MoveArchiveBlocks > 0)
+        game->EnableMoveArchive (config.MoveArchiveBlocks);
+      if (config.DetachedBlockCacheSize > 0)
+        game->EnableDetachedBlockCache (config.DetachedBlockCacheSize);
+      if (config.CheckpointInterval > 0)
+        {
+          CHECK (!config.DataDirectory.empty ())
+              << "DataDirectory must be set if checkpoints are enabled";
+          CHECK_GT (config.CheckpointsToKeep, 0);
+          const fs::path dir
+              = GetGameDirectory (config, gameId, game->GetChain ())
+                  / fs::path ("checkpoints");
+          game->EnableCheckpoints (dir.string (), config.CheckpointInterval,
+                                   config.CheckpointsToKeep);
+        }
+      if (config.RenderThreads > 0)
+        game->EnableParallelRendering (config.RenderThreads);
+      if (config.DerivedData)
+        game->EnableDerivedData ();
+      if (config.CostAccountingEntries > 0)
+        game->EnableCostAccounting (config.CostAccountingEntries);
+      if (config.MemoryBudgetBytes > 0)
+        game->EnableMemoryBudget (config.MemoryBudgetBytes);
+      if (!config.SharedStateName.empty ())
+        game->EnableSharedStateExport (config.SharedStateName);
+      if (!config.StateFilesDirectory.empty ())
+        game->EnableStateFiles (config.StateFilesDirectory,
+                                config.StateFilesToKeep,
+                                config.StateFilesCompressed,
+                                config.StateFilesCatchingUpMillis);
+      if (config.EnableProfiling)
+        {
+          CHECK (!config.DataDirectory.empty ())
+              << "DataDirectory must be set if profiling is enabled";
+          const fs::path dir
+              = GetGameDirectory (config, gameId, game->GetChain ())
+                  / fs::path ("profiles");
+          game->EnableProfiling (dir.string ());
+        }
+      if (config.LockProfiling)
+        game->EnableLockProfiling ();
+
+      game->SetBlockProcessingThreadConfig (
+          GetThreadConfig (config.BlockProcessingCpus,
+                           config.BlockProcessingNice));
+      game->SetRpcThreadConfig (GetThreadConfig (config.GameRpcCpus,
+                                                 config.GameRpcNice));
 
       auto serverConnector = CreateRpcServerConnector (config);
       std::unique_ptr<GameRpcServer> rpcServer;
@@ -142,7 +303,7 @@ DefaultMain (const GameDaemonConfiguration& config, const std::string& gameId,
           rpcServer = std::make_unique<GameRpcServer> (*game, *serverConnector);
 
       if (rpcServer != nullptr)
-        rpcServer->StartListening ();
+        StartRpcServer (config, *rpcServer);
       game->Run ();
       if (rpcServer != nullptr)
         rpcServer->StopListening ();
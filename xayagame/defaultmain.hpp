@@ -10,7 +10,9 @@
 
 #include <json/json.h>
 
+#include <cstdint>
 #include <string>
+#include <vector>
 
 namespace xaya
 {
@@ -27,6 +29,8 @@ enum class RpcServerType
   HTTP = 1,
   /** Start a JSON-RPC server listening through a plain TCP socket.  */
   TCP = 2,
+  /** Start a JSON-RPC server listening on a local Unix domain socket.  */
+  UNIX = 3,
 };
 
 /**
@@ -45,6 +49,15 @@ struct GameDaemonConfiguration
    */
   std::string XayaRpcUrl;
 
+  /**
+   * ZMQ endpoints of additional Xaya daemons (e.g. "tcp://host:28332"),
+   * whose -zmqpubgameblocks notifications are received in addition to the
+   * main daemon's.  Each notification is applied from whichever daemon
+   * delivers it first.  The daemons must be on the same chain and track
+   * the game as well.
+   */
+  std::vector<std::string> AdditionalZmqEndpoints;
+
   /**
    * The type of JSON-RPC server that should be started for the game
    * (if any).
@@ -57,6 +70,30 @@ struct GameDaemonConfiguration
    */
   int GameRpcPort = 0;
 
+  /**
+   * The filesystem path of the Unix domain socket on which the game daemon's
+   * JSON-RPC server should listen.  This must be set if GameRpcServer
+   * is set to UNIX.  A stale socket at this path (e.g. from a previous run
+   * that crashed) is removed on startup.
+   */
+  std::string GameRpcSocket;
+
+  /**
+   * If non-negative, the permission bits (e.g. 0660) with which the Unix
+   * domain socket for the JSON-RPC server is created.  This controls which
+   * local users are allowed to connect.  If negative, the process umask
+   * applies as usual.
+   */
+  int GameRpcSocketMode = -1;
+
+  /**
+   * Minimum size in bytes of the game state's JSON text for which
+   * getcurrentcompressedstate actually compresses it (with the encoding
+   * negotiated with the client).  This applies to all RPC server types.
+   * If negative, the state is never compressed.
+   */
+  int GameRpcCompressionThreshold = 1024;
+
   /**
    * If non-negative (including zero), pruning of old undo data is enabled.
    * The specified value determines how many of the latest blocks are
@@ -64,12 +101,197 @@ struct GameDaemonConfiguration
    */
   int EnablePruning = -1;
 
+  /**
+   * Number of blocks whose state updates are batched into a single atomic
+   * transaction on the storage while catching up.  Must be at least one.
+   */
+  unsigned TransactionBatchSize = 1000;
+
+  /**
+   * Number of blocks batched into a single transaction while the game is
+   * up-to-date.  The default of one commits every new block right away.
+   */
+  unsigned UpToDateBatchSize = 1;
+
+  /**
+   * If positive, a batch of transactions is committed with the next block
+   * once it has been open for this many milliseconds, even if it is not
+   * full yet.
+   */
+  unsigned BatchFlushMillis = 0;
+
+  /**
+   * While catching up, RPC clients waiting for state changes are woken up
+   * at most once per this many milliseconds (zero for no time limit).
+   */
+  unsigned CatchingUpNotifyMillis = 1000;
+
+  /**
+   * While catching up, RPC clients waiting for state changes are also woken
+   * up after this many blocks (zero for no block limit).  If both limits
+   * are zero, they are woken up for every block.
+   */
+  unsigned CatchingUpNotifyBlocks = 0;
+
+  /**
+   * If set, the ZMQ endpoint (e.g. "tcp://127.0.0.1:28555") at which state
+   * changes of the game are published for frontends.
+   */
+  std::string GameStatePublisher;
+
+  /**
+   * What the published state changes include:  "notification" (default) for
+   * just block hash, height and sync state, "full" for the full game state
+   * or "diff" for a JSON merge patch to the previously published state.
+   */
+  std::string GameStatePublishMode = "notification";
+
+  /**
+   * If positive, the in-memory state history is enabled for this number
+   * of the latest blocks.  This allows to query past game states with
+   * the getstateatblock and getstateatheight RPC methods.  Note that this
+   * is not supported for SQLiteGame.
+   */
+  int StateHistoryBlocks = 0;
+
+  /**
+   * The full game state is kept in the state history for every block
+   * whose height is a multiple of this value (zero disables that).  This
+   * bounds the number of undo steps needed to reconstruct a past state.
+   */
+  unsigned StateHistoryKeyframeInterval = 16;
+
+  /** Number of reconstructed past game states to cache.  */
+  unsigned StateHistoryCacheSize = 16;
+
+  /**
+   * If positive, the moves of this number of latest blocks are kept in
+   * an in-memory archive indexed by name, so that they can be queried with
+   * the getmovesbyname RPC method.
+   */
+  int MoveArchiveBlocks = 0;
+
+  /**
+   * If positive, the results of up to this many detached blocks are kept
+   * in memory, so that they need not be processed again if the same blocks
+   * are re-attached during a reorg.
+   */
+  int DetachedBlockCacheSize = 0;
+
+  /**
+   * If positive, a local checkpoint of the game state is written every
+   * this many blocks into the data directory (which must be set also
+   * for memory storage then).  If a reorg goes deeper than the available
+   * undo data, the newest matching checkpoint is restored instead of
+   * resyncing from the game's genesis.
+   */
+  int CheckpointInterval = 0;
+
+  /** Number of the newest checkpoints to keep on disk.  */
+  int CheckpointsToKeep = 3;
+
+  /**
+   * If positive, the game state is converted to JSON in parallel on this
+   * many extra threads (for games that support partitioning their state).
+   */
+  int RenderThreads = 0;
+
+  /**
+   * Whether to compute derived data of the game state on a background
+   * thread while up-to-date (see GameLogic::ComputeDerivedData).  The
+   * result is returned by the getderiveddata RPC method.
+   */
+  bool DerivedData = false;
+
+  /**
+   * If positive, the processing time of moves (as attributed by the game
+   * logic) is accounted, and this many of the most expensive moves and
+   * names are reported by the getmetrics RPC method.
+   */
+  int CostAccountingEntries = 0;
+
+  /**
+   * If positive, the total memory in bytes that the in-memory caches
+   * (state history, move archive, detached blocks and rendered state
+   * partitions) may use together.  Caches are shrunk as needed to stay
+   * within it.  The usage is reported by the getmetrics RPC method.
+   */
+  uint64_t MemoryBudgetBytes = 0;
+
+  /**
+   * If non-empty, the name of a POSIX shared-memory segment (like "/mv-state")
+   * into which the current game state is exported for other processes
+   * on the same host (see SharedStateReader).
+   */
+  std::string SharedStateName;
+
+  /**
+   * If non-empty, the directory into which the game state is written as
+   * per-block JSON files for serving by a static web server.  A "current.json"
+   * symlink always points to the latest one.
+   */
+  std::string StateFilesDirectory;
+
+  /** Number of blocks for which state files are kept.  */
+  unsigned StateFilesToKeep = 10;
+
+  /** Whether to write gzip-compressed state files as well.  */
+  bool StateFilesCompressed = false;
+
+  /**
+   * Minimum time in milliseconds between state files written while catching
+   * up.  If zero, they are only written when up-to-date.
+   */
+  unsigned StateFilesCatchingUpMillis = 10000;
+
+  /**
+   * Whether to enable the built-in CPU profiler, which can be triggered
+   * through the profile RPC method.  Profiles are written into the
+   * "profiles" subdirectory of the game's data directory.
+   */
+  bool EnableProfiling = false;
+
+  /**
+   * Whether to record wait and hold times of the game's main lock per
+   * calling function, which are reported by the getmetrics RPC method.
+   */
+  bool LockProfiling = false;
+
+  /**
+   * If non-empty, the list of CPUs (like "0-3,6") to which the thread
+   * processing blocks is pinned.
+   */
+  std::string BlockProcessingCpus;
+
+  /**
+   * If non-zero, the nice value to set for the thread processing blocks.
+   * Negative values (higher priority) typically require extra privileges.
+   */
+  int BlockProcessingNice = 0;
+
+  /**
+   * If non-empty, the list of CPUs (like "0-3,6") to which the threads
+   * serving the game's RPC interface are pinned.
+   */
+  std::string GameRpcCpus;
+
+  /** If non-zero, the nice value to set for the RPC server threads.  */
+  int GameRpcNice = 0;
+
   /**
    * The storage type to be used.  Can be "memory" (default), "lmdb"
    * or "sqlite".
    */
   std::string StorageType = "memory";
 
+  /**
+   * Whether to enable snapshots for "sqlite" storage, which lets derived
+   * data and state paging read without holding the game's lock.  This puts
+   * the database into WAL mode (see SQLiteStorage).  The other storage
+   * types support snapshots always.
+   */
+  bool SQLiteSnapshots = false;
+
   /**
    * The base data directory for persistent storage.  Must be set unless memory
    * storage is selected.  The game ID is added as an additional directory part
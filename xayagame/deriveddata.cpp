@@ -0,0 +1,272 @@
+// Copyright (C) 2019 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "deriveddata.hpp"
+
+#include "threadconfig.hpp"
+
+#include <glog/logging.h>
+
+#include <chrono>
+
+namespace xaya
+{
+namespace internal
+{
+
+DerivedDataWorker::DerivedDataWorker (GameLogic& r)
+  : rules(r), cancelled(false)
+{
+  worker = std::thread ([this] ()
+    {
+      WorkerLoop ();
+    });
+}
+
+DerivedDataWorker::~DerivedDataWorker ()
+{
+  {
+    std::lock_guard<std::mutex> lock(mut);
+    shutdown = true;
+    pending.reset ();
+    cancelled = true;
+  }
+  cvJob.notify_all ();
+
+  worker.join ();
+}
+
+void
+DerivedDataWorker::SetPending (std::unique_ptr<Job> job)
+{
+  {
+    std::lock_guard<std::mutex> lock(mut);
+
+    if (pending != nullptr)
+      ++numCancelled;
+    pending = std::move (job);
+
+    if (running)
+      cancelled = true;
+  }
+
+  cvJob.notify_all ();
+}
+
+void
+DerivedDataWorker::Schedule (std::unique_ptr<StorageSnapshot> snapshot)
+{
+  CHECK (snapshot != nullptr);
+
+  /* If the snapshot should not be kept open (e.g. because it defers resizes
+     of an LMDB map), read the state now.  Otherwise the snapshot may wait
+     for a long time while a previous computation is still running.  */
+  if (snapshot->ShouldCloseEarly ())
+    {
+      uint256 hash;
+      if (!snapshot->GetCurrentBlockHash (hash))
+        return;
+
+      GameStateData state = snapshot->GetCurrentGameState ();
+      snapshot.reset ();
+      Schedule (hash, std::move (state));
+      return;
+    }
+
+  auto job = std::make_unique<Job> ();
+  job->snapshot = std::move (snapshot);
+  SetPending (std::move (job));
+}
+
+void
+DerivedDataWorker::Schedule (const uint256& hash, GameStateData&& state)
+{
+  auto job = std::make_unique<Job> ();
+  job->hash = hash;
+  job->state = std::move (state);
+  SetPending (std::move (job));
+}
+
+void
+DerivedDataWorker::Discard ()
+{
+  std::unique_lock<std::mutex> lock(mut);
+
+  if (pending != nullptr)
+    ++numCancelled;
+  pending.reset ();
+
+  if (running)
+    cancelled = true;
+
+  cvIdle.wait (lock, [this] ()
+    {
+      return !readingSnapshot;
+    });
+}
+
+void
+DerivedDataWorker::WaitForIdle () const
+{
+  std::unique_lock<std::mutex> lock(mut);
+  cvIdle.wait (lock, [this] ()
+    {
+      return pending == nullptr && !running;
+    });
+}
+
+void
+DerivedDataWorker::WorkerLoop ()
+{
+  SetCurrentThreadName ("xaya-derived");
+
+  std::unique_lock<std::mutex> lock(mut);
+  while (true)
+    {
+      cvJob.wait (lock, [this] ()
+        {
+          return shutdown || pending != nullptr;
+        });
+      if (shutdown)
+        break;
+
+      std::unique_ptr<Job> job = std::move (pending);
+      running = true;
+      cancelled = false;
+
+      RunJob (lock, *job);
+
+      job.reset ();
+      runningBytes = 0;
+      running = false;
+      cvIdle.notify_all ();
+    }
+}
+
+void
+DerivedDataWorker::RunJob (std::unique_lock<std::mutex>& lock, Job& job)
+{
+  /* Read the state from the snapshot (if we have one), and close the snapshot
+     right away.  This is done without holding the lock, but we keep track of
+     it so that Discard can wait until the snapshot is no longer used.  */
+  if (job.snapshot != nullptr)
+    {
+      readingSnapshot = true;
+      lock.unlock ();
+
+      const bool hasState = job.snapshot->GetCurrentBlockHash (job.hash);
+      if (hasState)
+        job.state = job.snapshot->GetCurrentGameState ();
+      job.snapshot.reset ();
+
+      lock.lock ();
+      readingSnapshot = false;
+      cvIdle.notify_all ();
+
+      if (!hasState)
+        return;
+    }
+  runningBytes = job.state.size ();
+
+  if (cancelled)
+    {
+      ++numCancelled;
+      return;
+    }
+
+  /* If the state has not changed since the last computation (e.g. because
+     the snapshot still shows the same committed block), there is nothing
+     to do.  */
+  if (latest != nullptr && latest->hash == job.hash)
+    {
+      VLOG (1)
+          << "Derived data for block " << job.hash.ToHex ()
+          << " is already up-to-date";
+      return;
+    }
+
+  lock.unlock ();
+
+  VLOG (1) << "Computing derived data for block " << job.hash.ToHex ();
+  const auto start = std::chrono::steady_clock::now ();
+
+  auto result = std::make_shared<Result> ();
+  result->hash = job.hash;
+  const bool done = rules.ComputeDerivedData (job.state, [this] ()
+    {
+      return cancelled.load ();
+    }, result->data);
+  const size_t resultBytes = (done ? EstimateJsonMemory (result->data) : 0);
+
+  const auto duration = std::chrono::steady_clock::now () - start;
+  lock.lock ();
+
+  if (!done)
+    {
+      if (cancelled)
+        {
+          VLOG (1) << "Derived data computation was cancelled";
+          ++numCancelled;
+        }
+      return;
+    }
+
+  ++numComputed;
+  result->version = (latest == nullptr ? 1 : latest->version + 1);
+  latest = std::move (result);
+  latestBytes = resultBytes;
+
+  using std::chrono::milliseconds;
+  VLOG (1)
+      << "Computed derived data version " << latest->version
+      << " for block " << latest->hash.ToHex () << " in "
+      << std::chrono::duration_cast<milliseconds> (duration).count () << " ms";
+}
+
+std::shared_ptr<const DerivedDataWorker::Result>
+DerivedDataWorker::GetLatest () const
+{
+  std::lock_guard<std::mutex> lock(mut);
+  return latest;
+}
+
+Json::Value
+DerivedDataWorker::GetStats () const
+{
+  std::lock_guard<std::mutex> lock(mut);
+
+  Json::Value res(Json::objectValue);
+  res["computed"] = static_cast<Json::UInt64> (numComputed);
+  res["cancelled"] = static_cast<Json::UInt64> (numCancelled);
+  res["running"] = running;
+  if (latest != nullptr)
+    {
+      res["version"] = latest->version;
+      res["blockhash"] = latest->hash.ToHex ();
+    }
+
+  return res;
+}
+
+size_t
+DerivedDataWorker::GetMemoryUsage () const
+{
+  std::lock_guard<std::mutex> lock(mut);
+
+  size_t res = runningBytes + latestBytes;
+  if (pending != nullptr)
+    res += pending->state.size ();
+
+  return res;
+}
+
+void
+DerivedDataWorker::ShrinkMemory (const size_t target)
+{
+  /* The pending state is needed for the next computation, and the latest
+     result is what we serve.  There is nothing we can drop.  */
+}
+
+} // namespace internal
+} // namespace xaya
@@ -0,0 +1,202 @@
+// Copyright (C) 2019 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef XAYAGAME_DERIVEDDATA_HPP
+#define XAYAGAME_DERIVEDDATA_HPP
+
+/* This file is an implementation detail of Game and should not be
+   used directly by external code!  */
+
+#include "gamelogic.hpp"
+#include "memorybudget.hpp"
+#include "storage.hpp"
+#include "uint256.hpp"
+
+#include <json/json.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace xaya
+{
+namespace internal
+{
+
+/**
+ * Background worker that runs GameLogic::ComputeDerivedData for the latest
+ * game state on its own thread, and keeps the latest result so that it can
+ * be served without recomputing it.
+ *
+ * Only the newest scheduled state is of interest:  When a new state is
+ * scheduled while another one is still waiting, the waiting one is dropped.
+ * If a computation is running, it is told to cancel.  Each result that is
+ * published gets a new version number, so that clients can easily detect
+ * when the data has changed.
+ *
+ * The memory used by the copies of the state for pending and running jobs
+ * and by the latest result is reported to the memory budget.  None of it
+ * can be dropped, though, so ShrinkMemory does nothing.
+ *
+ * The class is thread-safe.
+ */
+class DerivedDataWorker : public MemoryConsumer
+{
+
+public:
+
+  /**
+   * A published result of the computation.
+   */
+  struct Result
+  {
+
+    /** The block hash of the state the data was computed for.  */
+    uint256 hash;
+
+    /** The version of this result (counting up from one).  */
+    unsigned version;
+
+    /** The derived data itself.  */
+    Json::Value data;
+
+  };
+
+private:
+
+  /**
+   * A state for which the data should be computed.  It is either given
+   * by a storage snapshot (so that the state is read on the worker thread),
+   * or as explicit copy of the block hash and state.
+   */
+  struct Job
+  {
+    std::unique_ptr<StorageSnapshot> snapshot;
+    uint256 hash;
+    GameStateData state;
+  };
+
+  /** The game logic used to compute the data.  */
+  GameLogic& rules;
+
+  /** Lock for the data here.  */
+  mutable std::mutex mut;
+
+  /** Signalled when a new job is scheduled or we shut down.  */
+  std::condition_variable cvJob;
+
+  /** Signalled when the worker has finished a job or reading a snapshot.  */
+  mutable std::condition_variable cvIdle;
+
+  /** The next job to run, if any.  */
+  std::unique_ptr<Job> pending;
+
+  /** Whether or not the worker is currently processing a job.  */
+  bool running = false;
+
+  /** Whether or not the worker is currently reading from a snapshot.  */
+  bool readingSnapshot = false;
+
+  /** Set to tell the running computation that it is no longer needed.  */
+  std::atomic<bool> cancelled;
+
+  /** Set when the worker should shut down.  */
+  bool shutdown = false;
+
+  /** The latest published result.  */
+  std::shared_ptr<const Result> latest;
+
+  /** Size of the state copy held by the running job.  */
+  size_t runningBytes = 0;
+
+  /** Estimated memory used by the latest result's data.  */
+  size_t latestBytes = 0;
+
+  /** Number of completed computations.  */
+  unsigned long numComputed = 0;
+
+  /** Number of jobs that were superseded before or during computation.  */
+  unsigned long numCancelled = 0;
+
+  /** The worker thread.  */
+  std::thread worker;
+
+  /**
+   * Main function of the worker thread.
+   */
+  void WorkerLoop ();
+
+  /**
+   * Runs the given job.  Must be called with the lock held, which is
+   * released while the computation is going on.
+   */
+  void RunJob (std::unique_lock<std::mutex>& lock, Job& job);
+
+  /**
+   * Replaces the pending job by the given one and cancels the running
+   * computation, if any.
+   */
+  void SetPending (std::unique_ptr<Job> job);
+
+public:
+
+  /**
+   * Constructs the worker and starts its thread.  The game logic instance
+   * must remain valid until this is destructed.
+   */
+  explicit DerivedDataWorker (GameLogic& r);
+
+  ~DerivedDataWorker ();
+
+  DerivedDataWorker () = delete;
+  DerivedDataWorker (const DerivedDataWorker&) = delete;
+  void operator= (const DerivedDataWorker&) = delete;
+
+  /**
+   * Schedules computation for the current state in the given snapshot.
+   * Usually, the state is read from the snapshot on the worker thread.
+   * If the snapshot should be closed early, though, the state is read
+   * (and the snapshot closed) right away.
+   */
+  void Schedule (std::unique_ptr<StorageSnapshot> snapshot);
+
+  /**
+   * Schedules computation for the given block and state.
+   */
+  void Schedule (const uint256& hash, GameStateData&& state);
+
+  /**
+   * Drops the pending job and cancels the running computation.  When this
+   * returns, the worker does not access any storage snapshot anymore, so
+   * that the underlying storage can be cleared.  The last result is kept.
+   */
+  void Discard ();
+
+  /**
+   * Blocks until no job is pending or running anymore.  This is mainly
+   * useful for tests.
+   */
+  void WaitForIdle () const;
+
+  /**
+   * Returns the latest result, or null if none has been computed yet.
+   */
+  std::shared_ptr<const Result> GetLatest () const;
+
+  /**
+   * Returns statistics about the worker as JSON object.
+   */
+  Json::Value GetStats () const;
+
+  size_t GetMemoryUsage () const override;
+  void ShrinkMemory (size_t target) override;
+
+};
+
+} // namespace internal
+} // namespace xaya
+
+#endif // XAYAGAME_DERIVEDDATA_HPP
@@ -0,0 +1,304 @@
+// Copyright (C) 2019 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "deriveddata.hpp"
+
+#include "lmdbstorage.hpp"
+#include "testutils.hpp"
+
+#include <gtest/gtest.h>
+
+#include <glog/logging.h>
+
+#include <experimental/filesystem>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+
+namespace xaya
+{
+namespace internal
+{
+namespace
+{
+
+/**
+ * Game logic for testing derived data.  The derived data is the length
+ * of the game state string.  For the state "block", the computation
+ * blocks until it is cancelled.  For "hold", it blocks until released
+ * (even if cancelled).
+ */
+class DerivedGame : public GameLogic
+{
+
+public:
+
+  /** Set to true when a blocking computation has started.  */
+  std::atomic<bool> blocking;
+
+  /** Set to true to finish a "hold" computation.  */
+  std::atomic<bool> released;
+
+  /** Whether or not derived data is supported.  */
+  bool supported = true;
+
+  DerivedGame ()
+    : blocking(false), released(false)
+  {}
+
+  GameStateData
+  GetInitialState (unsigned& height, std::string& hashHex) override
+  {
+    LOG (FATAL) << "Not implemented";
+  }
+
+  GameStateData
+  ProcessForward (const GameStateData& oldState, const Json::Value& blockData,
+                  UndoData& undoData) override
+  {
+    LOG (FATAL) << "Not implemented";
+  }
+
+  GameStateData
+  ProcessBackwards (const GameStateData& newState, const Json::Value& blockData,
+                    const UndoData& undoData) override
+  {
+    LOG (FATAL) << "Not implemented";
+  }
+
+  bool
+  ComputeDerivedData (const GameStateData& state,
+                      const std::function<bool ()>& cancelled,
+                      Json::Value& result) override
+  {
+    if (!supported)
+      return GameLogic::ComputeDerivedData (state, cancelled, result);
+
+    if (state == "block")
+      {
+        blocking = true;
+        while (!cancelled ())
+          std::this_thread::sleep_for (std::chrono::milliseconds (1));
+        return false;
+      }
+
+    if (state == "hold")
+      {
+        blocking = true;
+        while (!released)
+          std::this_thread::sleep_for (std::chrono::milliseconds (1));
+        return false;
+      }
+
+    result = static_cast<int> (state.size ());
+    return true;
+  }
+
+  /**
+   * Waits until a blocking computation has been started.
+   */
+  void
+  WaitForBlocking ()
+  {
+    while (!blocking)
+      std::this_thread::sleep_for (std::chrono::milliseconds (1));
+  }
+
+};
+
+class DerivedDataWorkerTests : public testing::Test
+{
+
+protected:
+
+  DerivedGame game;
+  DerivedDataWorker worker;
+
+  DerivedDataWorkerTests ()
+    : worker(game)
+  {}
+
+  /**
+   * Expects that the latest result matches the given data.
+   */
+  void
+  ExpectLatest (const uint256& hash, const unsigned version,
+                const int length)
+  {
+    const auto latest = worker.GetLatest ();
+    ASSERT_NE (latest, nullptr);
+    EXPECT_EQ (latest->hash, hash);
+    EXPECT_EQ (latest->version, version);
+    EXPECT_EQ (latest->data, length);
+  }
+
+};
+
+TEST_F (DerivedDataWorkerTests, NoResultYet)
+{
+  EXPECT_EQ (worker.GetLatest (), nullptr);
+  EXPECT_FALSE (worker.GetStats ().isMember ("version"));
+}
+
+TEST_F (DerivedDataWorkerTests, NotSupported)
+{
+  game.supported = false;
+  worker.Schedule (BlockHash (1), "abc");
+  worker.WaitForIdle ();
+  EXPECT_EQ (worker.GetLatest (), nullptr);
+}
+
+TEST_F (DerivedDataWorkerTests, Versions)
+{
+  worker.Schedule (BlockHash (1), "abc");
+  worker.WaitForIdle ();
+  ExpectLatest (BlockHash (1), 1, 3);
+
+  worker.Schedule (BlockHash (2), "abcde");
+  worker.WaitForIdle ();
+  ExpectLatest (BlockHash (2), 2, 5);
+
+  const Json::Value stats = worker.GetStats ();
+  EXPECT_EQ (stats["computed"].asInt (), 2);
+  EXPECT_EQ (stats["version"].asInt (), 2);
+  EXPECT_EQ (stats["blockhash"].asString (), BlockHash (2).ToHex ());
+}
+
+TEST_F (DerivedDataWorkerTests, SameBlockNotRecomputed)
+{
+  worker.Schedule (BlockHash (1), "abc");
+  worker.WaitForIdle ();
+  worker.Schedule (BlockHash (1), "abc");
+  worker.WaitForIdle ();
+
+  ExpectLatest (BlockHash (1), 1, 3);
+  EXPECT_EQ (worker.GetStats ()["computed"].asInt (), 1);
+}
+
+TEST_F (DerivedDataWorkerTests, Snapshot)
+{
+  MemoryStorage storage;
+  storage.Initialise ();
+
+  worker.Schedule (storage.OpenSnapshot ());
+  worker.WaitForIdle ();
+  EXPECT_EQ (worker.GetLatest (), nullptr);
+
+  storage.BeginTransaction ();
+  storage.SetCurrentGameState (BlockHash (10), "foo");
+  storage.CommitTransaction ();
+
+  worker.Schedule (storage.OpenSnapshot ());
+  worker.WaitForIdle ();
+  ExpectLatest (BlockHash (10), 1, 3);
+}
+
+TEST_F (DerivedDataWorkerTests, LMDBResizeWhilePending)
+{
+  const std::string dir = std::tmpnam (nullptr);
+  std::experimental::filesystem::create_directories (dir);
+
+  {
+    LMDBStorage storage(dir);
+    storage.Initialise ();
+
+    storage.BeginTransaction ();
+    storage.SetCurrentGameState (BlockHash (10), "foo");
+    storage.CommitTransaction ();
+
+    /* Schedule a snapshot while a computation is running, so that the job
+       stays pending.  It must not keep the LMDB snapshot open.  */
+    worker.Schedule (BlockHash (1), "hold");
+    game.WaitForBlocking ();
+    worker.Schedule (storage.OpenSnapshot ());
+
+    /* Fill the map until it is full.  The resize must go through right away,
+       so that retrying the failed write works.  */
+    const UndoData undo(1 << 16, 'x');
+    for (unsigned i = 0; ; ++i)
+      {
+        try
+          {
+            storage.BeginTransaction ();
+            storage.AddUndoData (BlockHash (100 + i), i, undo);
+            storage.CommitTransaction ();
+          }
+        catch (const StorageInterface::RetryWithNewTransaction& exc)
+          {
+            storage.RollbackTransaction ();
+
+            storage.BeginTransaction ();
+            storage.AddUndoData (BlockHash (100 + i), i, undo);
+            storage.CommitTransaction ();
+            break;
+          }
+      }
+
+    game.released = true;
+    worker.WaitForIdle ();
+    ExpectLatest (BlockHash (10), 1, 3);
+  }
+
+  std::experimental::filesystem::remove_all (dir);
+}
+
+TEST_F (DerivedDataWorkerTests, Superseded)
+{
+  worker.Schedule (BlockHash (1), "block");
+  game.WaitForBlocking ();
+
+  worker.Schedule (BlockHash (2), "abcd");
+  worker.WaitForIdle ();
+
+  ExpectLatest (BlockHash (2), 1, 4);
+  const Json::Value stats = worker.GetStats ();
+  EXPECT_EQ (stats["computed"].asInt (), 1);
+  EXPECT_EQ (stats["cancelled"].asInt (), 1);
+  EXPECT_FALSE (stats["running"].asBool ());
+}
+
+TEST_F (DerivedDataWorkerTests, Discard)
+{
+  worker.Schedule (BlockHash (1), "abc");
+  worker.WaitForIdle ();
+
+  worker.Schedule (BlockHash (2), "block");
+  game.WaitForBlocking ();
+  worker.Discard ();
+  worker.WaitForIdle ();
+
+  ExpectLatest (BlockHash (1), 1, 3);
+}
+
+TEST_F (DerivedDataWorkerTests, MemoryUsage)
+{
+  EXPECT_EQ (worker.GetMemoryUsage (), 0);
+
+  worker.Schedule (BlockHash (1), "abc");
+  worker.WaitForIdle ();
+  const size_t resultBytes = worker.GetMemoryUsage ();
+  EXPECT_GT (resultBytes, 0);
+
+  /* The state copy of the running job is included.  */
+  worker.Schedule (BlockHash (2), "block");
+  game.WaitForBlocking ();
+  EXPECT_EQ (worker.GetMemoryUsage (), resultBytes + 5);
+
+  worker.Discard ();
+  worker.WaitForIdle ();
+  EXPECT_EQ (worker.GetMemoryUsage (), resultBytes);
+}
+
+TEST_F (DerivedDataWorkerTests, DestructWhileRunning)
+{
+  DerivedDataWorker other(game);
+  other.Schedule (BlockHash (1), "block");
+  game.WaitForBlocking ();
+}
+
+} // anonymous namespace
+} // namespace internal
+} // namespace xaya
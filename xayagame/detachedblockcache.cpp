@@ -0,0 +1,163 @@
+// Copyright (C) 2019 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "detachedblockcache.hpp"
+
+#include <glog/logging.h>
+
+namespace xaya
+{
+namespace internal
+{
+
+DetachedBlockCache::DetachedBlockCache (const unsigned n)
+  : capacity(n)
+{}
+
+size_t
+DetachedBlockCache::EntryBytes (const Entry& e)
+{
+  return sizeof (std::map<Key, Entry>::value_type)
+            + e.newState.size () + e.undo.size ();
+}
+
+void
+DetachedBlockCache::EvictOldest ()
+{
+  CHECK (!order.empty ());
+
+  const auto mit = entries.find (order.front ());
+  CHECK (mit != entries.end ());
+  const size_t bytes = EntryBytes (mit->second);
+  CHECK_GE (memoryUsage, bytes);
+  memoryUsage -= bytes;
+
+  entries.erase (mit);
+  order.pop_front ();
+}
+
+void
+DetachedBlockCache::Trim ()
+{
+  while (entries.size () > capacity)
+    EvictOldest ();
+}
+
+size_t
+DetachedBlockCache::GetMemoryUsage () const
+{
+  std::lock_guard<std::mutex> lock(mut);
+  return memoryUsage;
+}
+
+void
+DetachedBlockCache::ShrinkMemory (const size_t target)
+{
+  std::lock_guard<std::mutex> lock(mut);
+  while (!entries.empty () && memoryUsage > target)
+    EvictOldest ();
+}
+
+void
+DetachedBlockCache::SetCapacity (const unsigned n)
+{
+  std::lock_guard<std::mutex> lock(mut);
+  capacity = n;
+  Trim ();
+}
+
+void
+DetachedBlockCache::Add (const uint256& parent, const uint256& hash,
+                         GameStateData&& newState, UndoData&& undo)
+{
+  const Key key(parent, hash);
+
+  std::lock_guard<std::mutex> lock(mut);
+
+  Entry entry;
+  entry.newState = std::move (newState);
+  entry.undo = std::move (undo);
+
+  memoryUsage += EntryBytes (entry);
+
+  auto mit = entries.find (key);
+  if (mit != entries.end ())
+    {
+      const size_t oldBytes = EntryBytes (mit->second);
+      CHECK_GE (memoryUsage, oldBytes);
+      memoryUsage -= oldBytes;
+      mit->second = std::move (entry);
+    }
+  else
+    {
+      entries.emplace (key, std::move (entry));
+      order.push_back (key);
+    }
+
+  VLOG (1)
+      << "Cached result of detached block " << hash.ToHex ()
+      << ", now " << entries.size () << " entries";
+  Trim ();
+}
+
+bool
+DetachedBlockCache::Take (const uint256& parent, const uint256& hash,
+                          GameStateData& newState, UndoData& undo)
+{
+  const Key key(parent, hash);
+
+  std::lock_guard<std::mutex> lock(mut);
+
+  auto mit = entries.find (key);
+  if (mit == entries.end ())
+    {
+      ++misses;
+      return false;
+    }
+
+  ++hits;
+  const size_t bytes = EntryBytes (mit->second);
+  CHECK_GE (memoryUsage, bytes);
+  memoryUsage -= bytes;
+
+  newState = std::move (mit->second.newState);
+  undo = std::move (mit->second.undo);
+  entries.erase (mit);
+
+  /* The cache is small, so a linear scan of the order list is fine.  */
+  for (auto it = order.begin (); it != order.end (); ++it)
+    if (*it == key)
+      {
+        order.erase (it);
+        break;
+      }
+
+  return true;
+}
+
+void
+DetachedBlockCache::Clear ()
+{
+  std::lock_guard<std::mutex> lock(mut);
+  entries.clear ();
+  order.clear ();
+  memoryUsage = 0;
+}
+
+Json::Value
+DetachedBlockCache::GetStats () const
+{
+  std::lock_guard<std::mutex> lock(mut);
+
+  Json::Value res(Json::objectValue);
+  res["entries"] = static_cast<Json::UInt64> (entries.size ());
+  res["capacity"] = capacity;
+  res["hits"] = static_cast<Json::UInt64> (hits);
+  res["misses"] = static_cast<Json::UInt64> (misses);
+
+  return res;
+}
+
+} // namespace internal
+} // namespace xaya
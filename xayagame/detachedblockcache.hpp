@@ -0,0 +1,172 @@
+// Copyright (C) 2019 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef XAYAGAME_DETACHEDBLOCKCACHE_HPP
+#define XAYAGAME_DETACHEDBLOCKCACHE_HPP
+
+/* This file is an implementation detail of Game and should not be
+   used directly by external code!  */
+
+#include "memorybudget.hpp"
+#include "storage.hpp"
+#include "uint256.hpp"
+
+#include <json/json.h>
+
+#include <cstddef>
+#include <list>
+#include <map>
+#include <mutex>
+#include <utility>
+
+namespace xaya
+{
+namespace internal
+{
+
+/**
+ * Bounded cache of the results of processing blocks that have been detached
+ * again.  During chain races, the same block is often detached and then
+ * re-attached on top of the same parent.  The game state after the block and
+ * its undo data are the same each time, so they can be taken from here
+ * instead of running ProcessForward again.
+ *
+ * Entries are keyed by the parent and the block hash.  The block hash
+ * determines the block's moves, and the parent hash the game state the
+ * block is applied to, so the result is fully determined by the key.
+ * When the cache is full, the oldest entries are evicted first.
+ *
+ * The class is thread-safe, so that statistics can be queried without
+ * holding the lock of Game.
+ */
+class DetachedBlockCache : public MemoryConsumer
+{
+
+private:
+
+  /** Key type of the cache (parent and block hash).  */
+  using Key = std::pair<uint256, uint256>;
+
+  /**
+   * Data stored for each cached block.
+   */
+  struct Entry
+  {
+    GameStateData newState;
+    UndoData undo;
+  };
+
+  /** Lock for all the data here.  */
+  mutable std::mutex mut;
+
+  /** Maximum number of entries.  */
+  unsigned capacity;
+
+  /** The cached entries.  */
+  std::map<Key, Entry> entries;
+
+  /** Order in which entries have been added (front is oldest).  */
+  std::list<Key> order;
+
+  /** Estimated memory used by all entries, kept up-to-date on changes.  */
+  size_t memoryUsage = 0;
+
+  /** Number of successful lookups.  */
+  unsigned long hits = 0;
+
+  /** Number of failed lookups.  */
+  unsigned long misses = 0;
+
+  /**
+   * Evicts the oldest entries until the capacity is satisfied.  Must be
+   * called with the lock held.
+   */
+  void Trim ();
+
+  /**
+   * Evicts the oldest entry.  Must be called with the lock held.
+   */
+  void EvictOldest ();
+
+  /**
+   * Returns the estimated memory used by an entry (including its key).
+   */
+  static size_t EntryBytes (const Entry& e);
+
+public:
+
+  /**
+   * Constructs an empty cache with the given maximum number of entries.
+   */
+  explicit DetachedBlockCache (unsigned n);
+
+  DetachedBlockCache () = delete;
+  DetachedBlockCache (const DetachedBlockCache&) = delete;
+  void operator= (const DetachedBlockCache&) = delete;
+
+  /**
+   * Changes the maximum number of entries.  Entries are evicted immediately
+   * if it is smaller than the current size.
+   */
+  void SetCapacity (unsigned n);
+
+  /**
+   * Returns the maximum number of entries.
+   */
+  unsigned
+  GetCapacity () const
+  {
+    std::lock_guard<std::mutex> lock(mut);
+    return capacity;
+  }
+
+  /**
+   * Returns the current number of entries.
+   */
+  size_t
+  GetSize () const
+  {
+    std::lock_guard<std::mutex> lock(mut);
+    return entries.size ();
+  }
+
+  /**
+   * Adds the result of processing the given block on top of parent.  If
+   * there is already an entry for it, it is replaced.
+   */
+  void Add (const uint256& parent, const uint256& hash,
+            GameStateData&& newState, UndoData&& undo);
+
+  /**
+   * Looks up the result for the given block on top of parent.  If it is
+   * found, the entry is removed from the cache and returned in the output
+   * arguments.  Returns false if there is no entry.
+   */
+  bool Take (const uint256& parent, const uint256& hash,
+             GameStateData& newState, UndoData& undo);
+
+  /**
+   * Removes all entries.
+   */
+  void Clear ();
+
+  size_t GetMemoryUsage () const override;
+
+  /**
+   * Evicts the oldest entries until at most target bytes are used.
+   */
+  void ShrinkMemory (size_t target) override;
+
+  /**
+   * Returns statistics about the cache (entries, capacity, hits and misses)
+   * as JSON object for reporting.
+   */
+  Json::Value GetStats () const;
+
+};
+
+} // namespace internal
+} // namespace xaya
+
+#endif // XAYAGAME_DETACHEDBLOCKCACHE_HPP
@@ -0,0 +1,161 @@
+// Copyright (C) 2019 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "detachedblockcache.hpp"
+
+#include "testutils.hpp"
+
+#include <gtest/gtest.h>
+
+namespace xaya
+{
+namespace internal
+{
+namespace
+{
+
+class DetachedBlockCacheTests : public testing::Test
+{
+
+protected:
+
+  /**
+   * Adds an entry for the block with the given number on top of the block
+   * with the number minus one.  State and undo data are derived from it.
+   */
+  static void
+  AddBlock (DetachedBlockCache& cache, const unsigned num)
+  {
+    cache.Add (BlockHash (num - 1), BlockHash (num),
+               "state " + std::to_string (num),
+               "undo " + std::to_string (num));
+  }
+
+  /**
+   * Looks up the block with the given number and checks its data.  Returns
+   * false if it is not found.
+   */
+  static bool
+  TakeBlock (DetachedBlockCache& cache, const unsigned num)
+  {
+    GameStateData state;
+    UndoData undo;
+    if (!cache.Take (BlockHash (num - 1), BlockHash (num), state, undo))
+      return false;
+
+    EXPECT_EQ (state, "state " + std::to_string (num));
+    EXPECT_EQ (undo, "undo " + std::to_string (num));
+    return true;
+  }
+
+};
+
+TEST_F (DetachedBlockCacheTests, AddAndTake)
+{
+  DetachedBlockCache cache(10);
+  AddBlock (cache, 1);
+  AddBlock (cache, 2);
+  EXPECT_EQ (cache.GetSize (), 2);
+
+  EXPECT_TRUE (TakeBlock (cache, 2));
+  EXPECT_FALSE (TakeBlock (cache, 2));
+  EXPECT_FALSE (TakeBlock (cache, 3));
+  EXPECT_EQ (cache.GetSize (), 1);
+
+  const Json::Value stats = cache.GetStats ();
+  EXPECT_EQ (stats["entries"].asInt (), 1);
+  EXPECT_EQ (stats["capacity"].asInt (), 10);
+  EXPECT_EQ (stats["hits"].asInt (), 1);
+  EXPECT_EQ (stats["misses"].asInt (), 2);
+}
+
+TEST_F (DetachedBlockCacheTests, WrongParent)
+{
+  DetachedBlockCache cache(10);
+  AddBlock (cache, 5);
+
+  GameStateData state;
+  UndoData undo;
+  EXPECT_FALSE (cache.Take (BlockHash (3), BlockHash (5), state, undo));
+  EXPECT_TRUE (TakeBlock (cache, 5));
+}
+
+TEST_F (DetachedBlockCacheTests, Replace)
+{
+  DetachedBlockCache cache(2);
+  AddBlock (cache, 1);
+  AddBlock (cache, 1);
+  AddBlock (cache, 2);
+  EXPECT_EQ (cache.GetSize (), 2);
+  EXPECT_TRUE (TakeBlock (cache, 1));
+  EXPECT_TRUE (TakeBlock (cache, 2));
+}
+
+TEST_F (DetachedBlockCacheTests, Eviction)
+{
+  DetachedBlockCache cache(3);
+  for (unsigned i = 1; i <= 5; ++i)
+    AddBlock (cache, i);
+
+  EXPECT_EQ (cache.GetSize (), 3);
+  EXPECT_FALSE (TakeBlock (cache, 2));
+  EXPECT_TRUE (TakeBlock (cache, 3));
+
+  cache.SetCapacity (1);
+  EXPECT_EQ (cache.GetCapacity (), 1);
+  EXPECT_FALSE (TakeBlock (cache, 4));
+  EXPECT_TRUE (TakeBlock (cache, 5));
+
+  AddBlock (cache, 6);
+  cache.Clear ();
+  EXPECT_EQ (cache.GetSize (), 0);
+}
+
+TEST_F (DetachedBlockCacheTests, ShrinkMemory)
+{
+  DetachedBlockCache cache(10);
+  EXPECT_EQ (cache.GetMemoryUsage (), 0);
+
+  for (unsigned i = 1; i <= 4; ++i)
+    AddBlock (cache, i);
+  const size_t perEntry = cache.GetMemoryUsage () / 4;
+  EXPECT_GT (perEntry, 0);
+
+  cache.ShrinkMemory (2 * perEntry);
+  EXPECT_EQ (cache.GetSize (), 2);
+  EXPECT_FALSE (TakeBlock (cache, 2));
+  EXPECT_TRUE (TakeBlock (cache, 3));
+
+  cache.ShrinkMemory (0);
+  EXPECT_EQ (cache.GetSize (), 0);
+  EXPECT_EQ (cache.GetMemoryUsage (), 0);
+  EXPECT_EQ (cache.GetCapacity (), 10);
+}
+
+TEST_F (DetachedBlockCacheTests, MemoryUsageTracking)
+{
+  DetachedBlockCache cache(2);
+
+  AddBlock (cache, 1);
+  const size_t perEntry = cache.GetMemoryUsage ();
+  EXPECT_GT (perEntry, 0);
+
+  /* Replacing an entry must not count it twice.  */
+  AddBlock (cache, 1);
+  EXPECT_EQ (cache.GetMemoryUsage (), perEntry);
+
+  AddBlock (cache, 2);
+  AddBlock (cache, 3);
+  EXPECT_EQ (cache.GetMemoryUsage (), 2 * perEntry);
+
+  EXPECT_TRUE (TakeBlock (cache, 3));
+  EXPECT_EQ (cache.GetMemoryUsage (), perEntry);
+
+  cache.Clear ();
+  EXPECT_EQ (cache.GetMemoryUsage (), 0);
+}
+
+} // anonymous namespace
+} // namespace internal
+} // namespace xaya
@@ -4,21 +4,57 @@
 
 #include "game.hpp"
 
+#include "allocstats.hpp"
+#include "base64.hpp"
+
 #include <glog/logging.h>
 
+#include <chrono>
+#include <set>
 #include <sstream>
 
 namespace xaya
 {
 
 Game::Game (const std::string& id)
-  : gameId(id)
+  : gameId(id), verbosity(FLAGS_v)
 {
   zmq.AddListener (gameId, this);
 }
 
 jsonrpc::clientVersion_t Game::rpcClientVersion = jsonrpc::JSONRPC_CLIENT_V1;
 
+namespace
+{
+
+/*
+ * Priorities of the caches for the memory budget.  The rendered state and
+ * its fragments are used for every state query, while the other caches only
+ * help with less frequent requests (or reorgs).  The derived data can not
+ * be shrunk, it is only accounted for.
+ */
+constexpr unsigned MEMORY_PRIORITY_RENDERER = 4;
+constexpr unsigned MEMORY_PRIORITY_RENDERED_STATE = 4;
+constexpr unsigned MEMORY_PRIORITY_STATE_HISTORY = 2;
+constexpr unsigned MEMORY_PRIORITY_MOVE_ARCHIVE = 2;
+constexpr unsigned MEMORY_PRIORITY_PUBLISHED_STATE = 1;
+constexpr unsigned MEMORY_PRIORITY_DETACHED_BLOCKS = 1;
+constexpr unsigned MEMORY_PRIORITY_DERIVED_DATA = 1;
+
+/**
+ * Initial capacity of the shared-memory state export.  It grows as needed
+ * for larger states.
+ */
+constexpr uint64_t SHARED_STATE_CAPACITY = 1 << 20;
+
+/**
+ * Number of the most contended call sites of a lock reported in the metrics
+ * if lock profiling is enabled.
+ */
+constexpr unsigned LOCK_STATS_SITES = 10;
+
+} // anonymous namespace
+
 std::string
 Game::StateToString (const State s)
 {
@@ -61,20 +97,75 @@ Game::UpdateStateForAttach (const uint256& parent, const uint256& hash,
   {
     internal::ActiveTransaction tx(transactionManager);
 
+    const auto start = std::chrono::steady_clock::now ();
+
     UndoData undo;
-    const GameStateData newState
-        = rules->ProcessForward (oldState, blockData, undo);
+    GameStateData newState;
+    {
+      AllocPhaseScope phase(AllocPhase::PROCESS);
+      if (detachedBlocks != nullptr
+            && detachedBlocks->Take (parent, hash, newState, undo))
+        {
+          VLOG (1) << "Reusing cached result for block " << hash.ToHex ();
+          newState = rules->ReapplyForward (oldState, blockData,
+                                            newState, undo);
+        }
+      else
+        newState = rules->ProcessForward (oldState, blockData, undo);
+    }
+
+    if (costs != nullptr)
+      {
+        const auto duration = std::chrono::steady_clock::now () - start;
+        using std::chrono::microseconds;
+        costs->RecordBlock (
+            std::chrono::duration_cast<microseconds> (duration).count ());
+      }
+
+    {
+      AllocPhaseScope phase(AllocPhase::STORAGE);
+      storage->AddUndoData (hash, height, undo);
+      storage->SetCurrentGameStateWithHeight (hash, height, newState);
+    }
 
-    storage->AddUndoData (hash, height, undo);
-    storage->SetCurrentGameStateWithHeight (hash, height, newState);
+    {
+      AllocPhaseScope phase(AllocPhase::COMMIT);
+      tx.Commit ();
+    }
 
-    tx.Commit ();
+    if (stateHistory != nullptr)
+      stateHistory->AttachBlock (parent, hash, height, blockData, undo,
+                                 std::move (newState));
+    if (moveArchive != nullptr)
+      moveArchive->AttachBlock (parent, hash, height, blockData);
   }
 
+  if (checkpoints != nullptr && checkpoints->IsDue (height))
+    {
+      /* Write the checkpoint from a snapshot on the background thread if
+         possible, so that we do not stall while the storage is copied.  */
+      transactionManager.Flush ();
+      auto snapshot = storage->OpenSnapshot ();
+      uint256 snapshotHash;
+      if (snapshot != nullptr && snapshot->GetCurrentBlockHash (snapshotHash)
+            && snapshotHash == hash)
+        checkpoints->Schedule (std::move (snapshot), hash, height);
+      else
+        {
+          snapshot.reset ();
+          checkpoints->Write (*storage, hash, height);
+        }
+    }
+
   LOG (INFO)
       << "Current game state is at height " << height
       << " (block " << hash.ToHex () << ")";
-  NotifyStateChange ();
+  EnforceMemoryBudget ();
+  NotifyBlockChange (hash);
+  PublishStateChange ();
+  ExportSharedState ();
+  WriteStateFiles ();
+  ScheduleDerivedData ();
 
   return true;
 }
@@ -97,38 +188,109 @@ Game::UpdateStateForDetach (const uint256& parent, const uint256& hash,
   if (!storage->GetUndoData (hash, undo))
     {
       LOG (ERROR)
-          << "Failed to retrieve undo data for block " << hash.ToHex ()
-          << ".  Need to resync from scratch.";
+          << "Failed to retrieve undo data for block " << hash.ToHex ();
       transactionManager.TryAbortTransaction ();
-      storage->Clear ();
+      undoDataMissing = true;
       return false;
     }
 
-  const GameStateData newState = storage->GetCurrentGameState ();
+  GameStateData newState = storage->GetCurrentGameState ();
 
   {
     internal::ActiveTransaction tx(transactionManager);
 
-    const GameStateData oldState
-        = rules->ProcessBackwards (newState, blockData, undo);
+    GameStateData oldState;
+    {
+      AllocPhaseScope phase(AllocPhase::PROCESS);
+      oldState = rules->ProcessBackwards (newState, blockData, undo);
+    }
 
     const unsigned height = blockData["block"]["height"].asUInt ();
     CHECK_GT (height, 0);
 
-    storage->SetCurrentGameStateWithHeight (parent, height - 1, oldState);
-    storage->ReleaseUndoData (hash);
+    {
+      AllocPhaseScope phase(AllocPhase::STORAGE);
+      storage->SetCurrentGameStateWithHeight (parent, height - 1, oldState);
+      storage->ReleaseUndoData (hash);
+    }
+
+    {
+      AllocPhaseScope phase(AllocPhase::COMMIT);
+      tx.Commit ();
+    }
 
-    tx.Commit ();
+    if (stateHistory != nullptr)
+      stateHistory->DetachBlock (hash, std::move (oldState));
+    if (moveArchive != nullptr)
+      moveArchive->DetachBlock (hash);
+    if (detachedBlocks != nullptr)
+      detachedBlocks->Add (parent, hash, std::move (newState),
+                           std::move (undo));
   }
 
   LOG (INFO)
       << "Detached " << hash.ToHex () << ", restored state for block "
       << parent.ToHex ();
-  NotifyStateChange ();
+  EnforceMemoryBudget ();
+  NotifyBlockChange (parent);
+  PublishStateChange ();
+  ExportSharedState ();
+  WriteStateFiles ();
+  ScheduleDerivedData ();
+
+  return true;
+}
+
+bool
+Game::RestoreCheckpoint ()
+{
+  if (checkpoints == nullptr)
+    return false;
+
+  /* Find the checkpoint to restore before locking mut, since that requires
+     RPC calls to the daemon.  */
+  const auto onMainChain = [this] (const uint256& hash, const unsigned height)
+    {
+      try
+        {
+          std::lock_guard<std::mutex> rpcLock(rpcMut);
+          return rpcClient->getblockhash (height) == hash.ToHex ();
+        }
+      catch (const jsonrpc::JsonRpcException& exc)
+        {
+          /* This happens if the height is above the current tip.  */
+          VLOG (1) << "getblockhash failed: " << exc.what ();
+          return false;
+        }
+    };
+
+  internal::CheckpointManager::Checkpoint restored;
+  if (!checkpoints->FindRestorable (onMainChain, restored))
+    return false;
 
+  internal::InstrumentedLock lock(mut);
+  DiscardDerivedData ();
+  checkpoints->Restore (*storage, restored);
+  storage->SetCachedHeight (restored.hash, restored.height);
+
+  LOG (INFO)
+      << "Restored state from checkpoint at height " << restored.height
+      << ", syncing forward from block " << restored.hash.ToHex ();
   return true;
 }
 
+void
+Game::RecoverMissingUndoData ()
+{
+  if (RestoreCheckpoint ())
+    return;
+
+  internal::InstrumentedLock lock(mut);
+  LOG (ERROR) << "Need to resync from scratch";
+  DiscardDerivedData ();
+  storage->Clear ();
+}
+
 bool
 Game::IsReqtokenRelevant (const Json::Value& data) const
 {
@@ -155,16 +317,20 @@ Game::BlockAttach (const std::string& id, const Json::Value& data,
   CHECK (hash.FromHex (data["block"]["hash"].asString ()));
   VLOG (1) << "Attaching block " << hash.ToHex ();
 
-  std::lock_guard<std::mutex> lock(mut);
+  std::lock_guard<std::mutex> syncLock(syncMut);
+  internal::InstrumentedLock lock(mut);
+
+  ApplyPendingTuning ();
 
   /* If we missed notifications, always reinitialise the state to make sure
      that all is again consistent.  */
   if (seqMismatch)
     {
       LOG (WARNING) << "Missed ZMQ notifications, reinitialising state";
-      ReinitialiseState ();
       if (pruningQueue != nullptr)
         pruningQueue->Reset ();
+      lock.unlock ();
+      ReinitialiseState ();
       return;
     }
 
@@ -224,7 +390,10 @@ Game::BlockAttach (const std::string& id, const Json::Value& data,
     }
 
   if (needReinit)
-    ReinitialiseState ();
+    {
+      lock.unlock ();
+      ReinitialiseState ();
+    }
 }
 
 void
@@ -240,16 +409,20 @@ Game::BlockDetach (const std::string& id, const Json::Value& data,
   CHECK (hash.FromHex (data["block"]["hash"].asString ()));
   VLOG (1) << "Detaching block " << hash.ToHex ();
 
-  std::lock_guard<std::mutex> lock(mut);
+  std::lock_guard<std::mutex> syncLock(syncMut);
+  internal::InstrumentedLock lock(mut);
+
+  ApplyPendingTuning ();
 
   /* If we missed notifications, always reinitialise the state to make sure
      that all is again consistent.  */
   if (seqMismatch)
     {
       LOG (WARNING) << "Missed ZMQ notifications, reinitialising state";
-      ReinitialiseState ();
       if (pruningQueue != nullptr)
         pruningQueue->Reset ();
+      lock.unlock ();
+      ReinitialiseState ();
       return;
     }
 
@@ -308,7 +481,15 @@ Game::BlockDetach (const std::string& id, const Json::Value& data,
     }
 
   if (needReinit)
-    ReinitialiseState ();
+    {
+      lock.unlock ();
+      if (undoDataMissing)
+        {
+          undoDataMissing = false;
+          RecoverMissingUndoData ();
+        }
+      ReinitialiseState ();
+    }
 }
 
 void
@@ -316,10 +497,9 @@ Game::ConnectRpcClient (jsonrpc::IClientConnector& conn)
 {
   auto newClient = std::make_unique<XayaRpcClient> (conn, rpcClientVersion);
 
-  std::lock_guard<std::mutex> lock(mut);
-  rpcClient = std::move (newClient);
-
-  const Json::Value info = rpcClient->getblockchaininfo ();
+  /* Query the new client before locking, so that a slow daemon does not
+     block other users of the game state.  */
+  const Json::Value info = newClient->getblockchaininfo ();
   const std::string newChainStr = info["chain"].asString ();
   Chain newChain;
   if (newChainStr == "main")
@@ -332,6 +512,12 @@ Game::ConnectRpcClient (jsonrpc::IClientConnector& conn)
     LOG (FATAL)
         << "Unexpected chain type returned by Xaya Core: " << newChainStr;
 
+  internal::InstrumentedLock lock(mut);
+  {
+    std::lock_guard<std::mutex> rpcLock(rpcMut);
+    rpcClient = std::move (newClient);
+  }
+
   CHECK (chain == Chain::UNKNOWN || chain == newChain)
       << "Previous RPC connection had chain "
       << ChainToString (chain) << ", now we have "
@@ -346,7 +532,7 @@ Game::ConnectRpcClient (jsonrpc::IClientConnector& conn)
 Chain
 Game::GetChain () const
 {
-  std::lock_guard<std::mutex> lock(mut);
+  internal::InstrumentedLock lock(mut);
   CHECK (chain != Chain::UNKNOWN);
   return chain;
 }
@@ -372,12 +558,13 @@ GetHeightForBlockHash (XayaRpcClient& rpc, const uint256& hash)
 void
 Game::SetStorage (StorageInterface* s)
 {
-  std::lock_guard<std::mutex> lock(mut);
+  internal::InstrumentedLock lock(mut);
   CHECK (!mainLoop.IsRunning ());
   CHECK (pruningQueue == nullptr);
 
   storage = std::make_unique<internal::StorageWithCachedHeight> (*s,
       [this] (const uint256& hash) {
+        std::lock_guard<std::mutex> rpcLock(rpcMut);
         CHECK (rpcClient != nullptr);
         return GetHeightForBlockHash (*rpcClient, hash);
       });
@@ -392,16 +579,21 @@ Game::SetStorage (StorageInterface* s)
     }
 
   transactionManager.SetStorage (*storage);
+  renderedState.reset ();
 }
 
 void
 Game::SetGameLogic (GameLogic* gl)
 {
-  std::lock_guard<std::mutex> lock(mut);
+  internal::InstrumentedLock lock(mut);
   CHECK (!mainLoop.IsRunning ());
+  CHECK (derivedData == nullptr)
+      << "The game logic must be set before enabling derived data";
   rules = gl;
   if (chain != Chain::UNKNOWN)
     rules->SetChain (chain);
+  rules->SetCostAccounting (costs.get ());
+  renderedState.reset ();
 }
 
 void
@@ -409,7 +601,7 @@ Game::EnablePruning (const unsigned nBlocks)
 {
   LOG (INFO) << "Enabling pruning with " << nBlocks << " blocks to keep";
 
-  std::lock_guard<std::mutex> lock(mut);
+  internal::InstrumentedLock lock(mut);
   CHECK (storage != nullptr);
 
   if (pruningQueue == nullptr)
@@ -420,239 +612,1483 @@ Game::EnablePruning (const unsigned nBlocks)
     pruningQueue->SetDesiredSize (nBlocks);
 }
 
-bool
-Game::DetectZmqEndpoint ()
+void
+Game::EnableStateHistory (const unsigned nBlocks,
+                          const unsigned keyframeInterval,
+                          const unsigned cacheSize)
 {
-  Json::Value notifications;
+  LOG (INFO)
+      << "Enabling state history with " << nBlocks << " blocks,"
+      << " keyframes every " << keyframeInterval << " blocks"
+      << " and " << cacheSize << " cached states";
 
-  {
-    std::lock_guard<std::mutex> lock(mut);
-    CHECK (rpcClient != nullptr) << "RPC client is not yet set up";
-    notifications = rpcClient->getzmqnotifications ();
-  }
-  VLOG (1) << "Configured ZMQ notifications:\n" << notifications;
+  internal::InstrumentedLock lock(mut);
 
-  for (const auto& val : notifications)
-    if (val.get ("type", "") == "pubgameblocks")
-      {
-        const std::string endpoint = val.get ("address", "").asString ();
-        CHECK (!endpoint.empty ());
-        LOG (INFO) << "Detected ZMQ endpoint: " << endpoint;
-        SetZmqEndpoint (endpoint);
-        return true;
-      }
+  if (stateHistory == nullptr)
+    stateHistory = std::make_unique<internal::StateHistory> (
+        nBlocks, keyframeInterval, cacheSize);
+  else
+    stateHistory->SetLimits (nBlocks, keyframeInterval, cacheSize);
 
-  LOG (WARNING) << "No -zmqpubgameblocks notifier seems to be set up";
-  return false;
+  RegisterMemoryConsumers ();
 }
 
-Json::Value
-Game::GetCustomStateData (
-    const std::string& jsonField,
-    const std::function<Json::Value (const GameStateData&)>& cb) const
+void
+Game::EnableMoveArchive (const unsigned nBlocks)
 {
-  std::unique_lock<std::mutex> lock(mut);
-
-  Json::Value res(Json::objectValue);
-  res["gameid"] = gameId;
-  res["chain"] = ChainToString (chain);
-  res["state"] = StateToString (state);
+  LOG (INFO) << "Enabling move archive with " << nBlocks << " blocks";
 
-  uint256 hash;
-  unsigned height;
-  if (storage->GetCurrentBlockHashWithHeight (hash, height))
-    {
-      res["blockhash"] = hash.ToHex ();
-      res["height"] = height;
+  internal::InstrumentedLock lock(mut);
 
-      const GameStateData gameState = storage->GetCurrentGameState ();
-      res[jsonField] = cb (gameState);
-    }
+  if (moveArchive == nullptr)
+    moveArchive = std::make_unique<internal::MoveArchive> (nBlocks);
+  else
+    moveArchive->SetLimit (nBlocks);
 
-  return res;
+  RegisterMemoryConsumers ();
 }
 
-Json::Value
-Game::GetCurrentJsonState () const
+void
+Game::EnableDetachedBlockCache (const unsigned n)
 {
-  return GetCustomStateData ("gamestate",
-      [this] (const GameStateData& state)
-        {
-          return rules->GameStateToJson (state);
-        });
+  LOG (INFO) << "Enabling cache for " << n << " detached blocks";
+
+  internal::InstrumentedLock lock(mut);
+  CHECK (!mainLoop.IsRunning ());
+
+  detachedBlocks = std::make_unique<internal::DetachedBlockCache> (n);
+  RegisterMemoryConsumers ();
 }
 
 void
-Game::NotifyStateChange () const
+Game::EnableCheckpoints (const std::string& dir, const unsigned interval,
+                         const unsigned keep)
 {
-  /* Callers are expected to already hold the mut lock here (as that is the
-     typical case when they make changes to the state anyway).  */
-  VLOG (1) << "Notifying waiting threads about state change...";
-  cvStateChanged.notify_all ();
+  LOG (INFO)
+      << "Enabling checkpoints every " << interval << " blocks in " << dir
+      << ", keeping " << keep;
+
+  internal::InstrumentedLock lock(mut);
+  CHECK (!mainLoop.IsRunning ());
+
+  checkpoints = std::make_unique<internal::CheckpointManager> (dir, interval,
+                                                               keep);
 }
 
 void
-Game::WaitForChange (uint256* currentBlock) const
+Game::EnableParallelRendering (const unsigned threads)
 {
-  std::unique_lock<std::mutex> lock(mut);
+  LOG (INFO) << "Enabling parallel rendering with " << threads << " threads";
 
-  if (zmq.IsRunning ())
-    {
-      VLOG (1) << "Waiting for state change on condition variable...";
-      cvStateChanged.wait (lock);
-      VLOG (1) << "Potential state change detected in WaitForChange";
-    }
-  else
-    LOG (WARNING)
-        << "WaitForChange called with no active ZMQ listener,"
-           " returning immediately";
+  internal::InstrumentedLock lock(mut);
+  CHECK (!mainLoop.IsRunning ());
 
-  if (currentBlock != nullptr && !storage->GetCurrentBlockHash (*currentBlock))
-    currentBlock->SetNull ();
+  parallelRenderer = std::make_unique<internal::ParallelRenderer> (threads);
+  RegisterMemoryConsumers ();
 }
 
 void
-Game::TrackGame ()
+Game::EnableDerivedData ()
 {
-  std::lock_guard<std::mutex> lock(mut);
-  CHECK (rpcClient != nullptr) << "RPC client is not yet set up";
-  rpcClient->trackedgames ("add", gameId);
-  LOG (INFO) << "Added " << gameId << " to tracked games";
+  LOG (INFO) << "Enabling background computation of derived data";
+
+  internal::InstrumentedLock lock(mut);
+  CHECK (!mainLoop.IsRunning ());
+  CHECK (rules != nullptr) << "The game logic must be set first";
+
+  derivedData = std::make_unique<internal::DerivedDataWorker> (*rules);
+  RegisterMemoryConsumers ();
 }
 
 void
-Game::UntrackGame ()
+Game::EnableCostAccounting (const unsigned capacity)
 {
-  std::lock_guard<std::mutex> lock(mut);
-  CHECK (rpcClient != nullptr) << "RPC client is not yet set up";
-  rpcClient->trackedgames ("remove", gameId);
-  LOG (INFO) << "Removed " << gameId << " from tracked games";
+  LOG (INFO) << "Enabling cost accounting for " << capacity << " entries";
+
+  internal::InstrumentedLock lock(mut);
+  CHECK (!mainLoop.IsRunning ());
+
+  costs = std::make_unique<CostAccounting> (capacity);
+  if (rules != nullptr)
+    rules->SetCostAccounting (costs.get ());
 }
 
 void
-Game::Start ()
+Game::EnableMemoryBudget (const uint64_t bytes)
 {
-  TrackGame ();
-  zmq.Start ();
+  LOG (INFO) << "Enabling memory budget of " << bytes << " bytes";
 
-  std::lock_guard<std::mutex> lock(mut);
-  ReinitialiseState ();
+  internal::InstrumentedLock lock(mut);
+  CHECK (!mainLoop.IsRunning ());
+
+  memoryBudget = std::make_unique<internal::MemoryBudget> (bytes);
+  RegisterMemoryConsumers ();
 }
 
 void
-Game::Stop ()
+Game::EnableSharedStateExport (const std::string& name)
 {
-  zmq.Stop ();
-  UntrackGame ();
+  LOG (INFO) << "Enabling export of the game state to shared memory " << name;
 
-  /* Make sure to wake up all listeners waiting for a state update (as there
-     won't be one anymore).  */
-  NotifyStateChange ();
+  internal::InstrumentedLock lock(mut);
+  CHECK (!mainLoop.IsRunning ());
+
+  /* Destruct a previous writer first, as it removes its segment (which may
+     have the same name).  */
+  sharedState.reset ();
+  sharedState = std::make_unique<internal::SharedStateWriter> (
+      name, SHARED_STATE_CAPACITY);
 }
 
 void
-Game::Run ()
+Game::ExportSharedState ()
 {
-  CHECK (storage != nullptr && rules != nullptr)
-      << "Storage and GameLogic must be set before starting the main loop";
+  if (sharedState == nullptr || state != State::UP_TO_DATE)
+    return;
 
-  internal::MainLoop::Functor startAction = [this] () { Start (); };
-  internal::MainLoop::Functor stopAction = [this] () { Stop (); };
+  uint256 hash;
+  unsigned height;
+  if (!storage->GetCurrentBlockHashWithHeight (hash, height))
+    return;
 
-  mainLoop.Run (startAction, stopAction);
+  sharedState->Publish (hash, height, storage->GetCurrentGameState ());
+  VLOG (1)
+      << "Exported state for block " << hash.ToHex ()
+      << " to shared memory, version " << sharedState->GetVersion ();
 }
 
 void
-Game::SyncFromCurrentState (const Json::Value& blockchainInfo,
-                            const uint256& currentHash)
+Game::EnableStateFiles (const std::string& dir, const unsigned keep,
+                        const bool compress, const unsigned catchingUpMillis)
 {
-  CHECK (state == State::OUT_OF_SYNC);
-
-  uint256 daemonBestHash;
-  CHECK (daemonBestHash.FromHex (blockchainInfo["bestblockhash"].asString ()));
+  LOG (INFO)
+      << "Enabling state files in " << dir << ", keeping " << keep
+      << (compress ? " (with compression)" : "");
 
-  if (daemonBestHash == currentHash)
-    {
-      LOG (INFO) << "Game state matches current tip, we are up-to-date";
-      state = State::UP_TO_DATE;
-      transactionManager.SetBatchSize (1);
-      return;
-    }
+  internal::InstrumentedLock lock(mut);
+  CHECK (!mainLoop.IsRunning ());
 
-  LOG (INFO)
-      << "Game state does not match current tip, requesting updates from "
-      << currentHash.ToHex ();
-  const Json::Value upd
-      = rpcClient->game_sendupdates (currentHash.ToHex (), gameId);
+  stateFiles = std::make_unique<internal::StateFileWriter> (
+      dir, gameId, keep, compress);
+  stateFilesCatchingUpMillis = catchingUpMillis;
+  lastStateFiles = std::chrono::steady_clock::time_point ();
+}
 
-  LOG (INFO)
-      << "Retrieving " << upd["steps"]["detach"].asInt () << " detach and "
-      << upd["steps"]["attach"].asInt () << " attach steps with reqtoken = "
-      << upd["reqtoken"].asString ()
-      << ", leading to block " << upd["toblock"].asString ();
+void
+Game::EnableProfiling (const std::string& dir)
+{
+  LOG (INFO) << "Enabling CPU profiling into " << dir;
 
-  state = State::CATCHING_UP;
-  transactionManager.SetBatchSize (transactionBatchSize);
+  internal::InstrumentedLock lock(mut);
+  CHECK (!mainLoop.IsRunning ());
 
-  CHECK (targetBlockHash.FromHex (upd["toblock"].asString ()));
-  reqToken = upd["reqtoken"].asString ();
+  profiler = std::make_unique<internal::SamplingProfiler> (dir);
 }
 
 void
-Game::ReinitialiseState ()
+Game::EnableLockProfiling ()
 {
-  state = State::UNKNOWN;
-  LOG (INFO) << "Reinitialising game state";
+  LOG (INFO) << "Enabling lock profiling";
 
-  const Json::Value data = rpcClient->getblockchaininfo ();
+  internal::InstrumentedLock lock(mut);
+  CHECK (!mainLoop.IsRunning ());
 
-  uint256 currentHash;
-  if (storage->GetCurrentBlockHash (currentHash))
+  mut.Enable ();
+}
+
+void
+Game::WriteStateFiles ()
+{
+  if (stateFiles == nullptr)
+    return;
+
+  const auto now = std::chrono::steady_clock::now ();
+  switch (state)
     {
-      LOG (INFO) << "We have a current game state, syncing from there";
-      state = State::OUT_OF_SYNC;
-      SyncFromCurrentState (data, currentHash);
+    case State::UP_TO_DATE:
+      break;
+
+    case State::CATCHING_UP:
+      if (stateFilesCatchingUpMillis == 0
+            || now - lastStateFiles
+                  < std::chrono::milliseconds (stateFilesCatchingUpMillis))
+        return;
+      break;
+
+    default:
       return;
     }
 
-  /* We do not have a current state in the storage.  This means that we have
-     to reset to the initial state.  */
+  uint256 hash;
+  unsigned height;
+  if (!storage->GetCurrentBlockHashWithHeight (hash, height))
+    return;
 
-  unsigned genesisHeight;
-  std::string genesisHashHex;
-  const GameStateData genesisData
-      = rules->GetInitialState (genesisHeight, genesisHashHex);
-  uint256 genesisHash;
-  CHECK (genesisHash.FromHex (genesisHashHex));
+  stateFiles->Schedule (height, RenderCurrentState (hash));
+  lastStateFiles = now;
+}
 
-  /* If the current block height in the daemon is not yet the game's genesis
-     height, simply wait for the genesis hash to be attached.  */
-  if (data["blocks"].asUInt () < genesisHeight)
+void
+Game::RegisterMemoryConsumers ()
+{
+  if (memoryBudget == nullptr)
+    return;
+
+  if (parallelRenderer != nullptr)
+    memoryBudget->Register ("renderer", *parallelRenderer,
+                            MEMORY_PRIORITY_RENDERER);
+  if (stateHistory != nullptr)
+    memoryBudget->Register ("statehistory", *stateHistory,
+                            MEMORY_PRIORITY_STATE_HISTORY);
+  if (moveArchive != nullptr)
+    memoryBudget->Register ("movearchive", *moveArchive,
+                            MEMORY_PRIORITY_MOVE_ARCHIVE);
+  if (detachedBlocks != nullptr)
+    memoryBudget->Register ("detachedblocks", *detachedBlocks,
+                            MEMORY_PRIORITY_DETACHED_BLOCKS);
+  if (derivedData != nullptr)
+    memoryBudget->Register ("deriveddata", *derivedData,
+                            MEMORY_PRIORITY_DERIVED_DATA);
+
+  /* The rendered state is recomputed on demand if we drop it.  */
+  if (renderedStateMemory == nullptr)
+    renderedStateMemory = std::make_unique<internal::CallbackMemoryConsumer> (
+        [this] () -> size_t
+          {
+            if (renderedState == nullptr)
+              return 0;
+            return renderedState->GetMemoryUsage ();
+          },
+        [this] (const size_t target)
+          {
+            if (renderedState != nullptr
+                  && renderedState->GetMemoryUsage () > target)
+              renderedState.reset ();
+          });
+  memoryBudget->Register ("renderedstate", *renderedStateMemory,
+                          MEMORY_PRIORITY_RENDERED_STATE);
+
+  /* Without the last published state, the next notification includes
+     the full state instead of a diff.  */
+  if (publisher != nullptr && publishMode == StatePublishMode::STATE_DIFF)
     {
-      LOG (INFO)
-          << "Block height " << data["blocks"].asInt ()
-          << " is before the genesis height " << genesisHeight;
-      state = State::PREGENESIS;
-      targetBlockHash = genesisHash;
-      return;
+      if (publishedStateMemory == nullptr)
+        publishedStateMemory
+            = std::make_unique<internal::CallbackMemoryConsumer> (
+                [this] ()
+                  {
+                    return lastPublishedBytes;
+                  },
+                [this] (const size_t target)
+                  {
+                    if (lastPublishedBytes > target)
+                      {
+                        lastPublishedHash.SetNull ();
+                        lastPublishedState = Json::Value ();
+                        lastPublishedBytes = 0;
+                      }
+                  });
+      memoryBudget->Register ("publishedstate", *publishedStateMemory,
+                              MEMORY_PRIORITY_PUBLISHED_STATE);
     }
+}
 
-  /* Otherwise, we can store the initial state and start to sync from there.  */
-  const std::string blockHashHex = rpcClient->getblockhash (genesisHeight);
-  uint256 blockHash;
-  CHECK (blockHash.FromHex (blockHashHex));
-  CHECK (blockHash == genesisHash)
-    << "The game's genesis block hash and height do not match";
+void
+Game::EnforceMemoryBudget ()
+{
+  if (memoryBudget != nullptr)
+    memoryBudget->Enforce ();
+}
 
-  transactionManager.TryAbortTransaction ();
-  storage->Clear ();
-  while (true)
-    try
-      {
-        internal::ActiveTransaction tx(transactionManager);
-        storage->SetCurrentGameStateWithHeight (genesisHash, genesisHeight,
-                                                genesisData);
-        tx.Commit ();
+void
+Game::EnableStatePublisher (const std::string& endpoint,
+                            const StatePublishMode mode)
+{
+  internal::InstrumentedLock lock(mut);
+  CHECK (!zmq.IsRunning ());
+
+  publisher = std::make_unique<internal::ZmqPublisher> (endpoint);
+  publishMode = mode;
+  lastPublishedHash.SetNull ();
+  RegisterMemoryConsumers ();
+}
+
+bool
+Game::DetectZmqEndpoint ()
+{
+  Json::Value notifications;
+
+  {
+    std::lock_guard<std::mutex> rpcLock(rpcMut);
+    CHECK (rpcClient != nullptr) << "RPC client is not yet set up";
+    notifications = rpcClient->getzmqnotifications ();
+  }
+  VLOG (1) << "Configured ZMQ notifications:\n" << notifications;
+
+  for (const auto& val : notifications)
+    if (val.get ("type", "") == "pubgameblocks")
+      {
+        const std::string endpoint = val.get ("address", "").asString ();
+        CHECK (!endpoint.empty ());
+        LOG (INFO) << "Detected ZMQ endpoint: " << endpoint;
+        SetZmqEndpoint (endpoint);
+        return true;
+      }
+
+  LOG (WARNING) << "No -zmqpubgameblocks notifier seems to be set up";
+  return false;
+}
+
+Json::Value
+Game::GetCustomStateData (
+    const std::string& jsonField,
+    const std::function<Json::Value (const GameStateData&)>& cb) const
+{
+  internal::InstrumentedLock lock(mut);
+
+  Json::Value res(Json::objectValue);
+  res["gameid"] = gameId;
+  res["chain"] = ChainToString (chain);
+  res["state"] = StateToString (state);
+
+  uint256 hash;
+  unsigned height;
+  if (storage->GetCurrentBlockHashWithHeight (hash, height))
+    {
+      res["blockhash"] = hash.ToHex ();
+      res["height"] = height;
+
+      const GameStateData gameState = storage->GetCurrentGameState ();
+      res[jsonField] = cb (gameState);
+    }
+
+  return res;
+}
+
+std::shared_ptr<const internal::RenderedState>
+Game::RenderCurrentState (const uint256& hash) const
+{
+  if (renderedState == nullptr || renderedState->GetBlockHash () != hash)
+    {
+      VLOG (1) << "Rendering game state for block " << hash.ToHex ();
+      AllocPhaseScope phase(AllocPhase::RENDER);
+      const GameStateData gameState = storage->GetCurrentGameState ();
+
+      renderedState.reset ();
+      if (parallelRenderer != nullptr)
+        renderedState = parallelRenderer->Render (*rules, hash, gameState);
+      if (renderedState == nullptr)
+        renderedState = std::make_shared<const internal::RenderedState> (
+            hash, rules->GameStateToJson (gameState));
+    }
+
+  return renderedState;
+}
+
+Json::Value
+Game::GetRenderedState (
+    std::shared_ptr<const internal::RenderedState>& rendered) const
+{
+  internal::InstrumentedLock lock(mut);
+
+  Json::Value res(Json::objectValue);
+  res["gameid"] = gameId;
+  res["chain"] = ChainToString (chain);
+  res["state"] = StateToString (state);
+
+  uint256 hash;
+  unsigned height;
+  if (storage->GetCurrentBlockHashWithHeight (hash, height))
+    {
+      res["blockhash"] = hash.ToHex ();
+      res["height"] = height;
+      rendered = RenderCurrentState (hash);
+    }
+  else
+    rendered.reset ();
+
+  return res;
+}
+
+Json::Value
+Game::GetCurrentJsonState () const
+{
+  std::shared_ptr<const internal::RenderedState> rendered;
+  Json::Value res = GetRenderedState (rendered);
+
+  if (rendered != nullptr)
+    res["gamestate"] = rendered->GetJson ();
+
+  return res;
+}
+
+Json::Value
+Game::GetCurrentCompressedState (const std::string& accepted) const
+{
+  std::shared_ptr<const internal::RenderedState> rendered;
+  Json::Value res = GetRenderedState (rendered);
+
+  int threshold;
+  {
+    internal::InstrumentedLock lock(mut);
+    threshold = compressionThreshold;
+  }
+
+  if (rendered == nullptr)
+    return res;
+
+  /* The compression (if not yet cached) is done without holding the main
+     lock, so that it does not block block processing.  */
+  ContentEncoding enc = NegotiateContentEncoding (accepted);
+  if (threshold < 0
+        || rendered->GetText ().size () < static_cast<size_t> (threshold))
+    enc = ContentEncoding::IDENTITY;
+
+  res["encoding"] = ContentEncodingToString (enc);
+  if (enc == ContentEncoding::IDENTITY)
+    res["gamestate"] = rendered->GetJson ();
+  else
+    res["compressedgamestate"] = rendered->GetEncoded (enc);
+
+  return res;
+}
+
+void
+Game::SetRpcThreadConfig (const ThreadConfig& cfg)
+{
+  CHECK (!zmq.IsRunning ());
+  rpcThreadConfig = cfg;
+}
+
+void
+Game::ConfigureRpcThread () const
+{
+  ConfigureCurrentThreadOnce ("xaya-rpc", rpcThreadConfig);
+}
+
+void
+Game::SetCompressionThreshold (const int threshold)
+{
+  internal::InstrumentedLock lock(mut);
+  compressionThreshold = threshold;
+}
+
+void
+Game::SetTransactionBatchSizes (const unsigned catchingUp,
+                                const unsigned upToDate)
+{
+  CHECK_GE (catchingUp, 1);
+  CHECK_GE (upToDate, 1);
+
+  internal::InstrumentedLock lock(mut);
+  catchingUpBatchSize = catchingUp;
+  upToDateBatchSize = upToDate;
+  ApplyBatchSize ();
+}
+
+void
+Game::SetBatchFlushTimeLimit (const unsigned millis)
+{
+  internal::InstrumentedLock lock(mut);
+  batchFlushMillis = millis;
+  transactionManager.SetFlushTimeLimit (std::chrono::milliseconds (millis));
+}
+
+void
+Game::SetCatchingUpNotifyLimits (const unsigned millis, const unsigned blocks)
+{
+  internal::InstrumentedLock lock(mut);
+  catchingUpNotifyMillis = millis;
+  catchingUpNotifyBlocks = blocks;
+}
+
+void
+Game::ApplyBatchSize ()
+{
+  if (state == State::CATCHING_UP)
+    transactionManager.SetBatchSize (catchingUpBatchSize);
+  else
+    transactionManager.SetBatchSize (upToDateBatchSize);
+}
+
+void
+Game::ApplyPendingTuning ()
+{
+  if (batchTuningPending)
+    {
+      transactionManager.SetFlushTimeLimit (
+          std::chrono::milliseconds (batchFlushMillis));
+      ApplyBatchSize ();
+      batchTuningPending = false;
+    }
+
+  if (pruningTuningPending)
+    {
+      if (pruningQueue == nullptr)
+        pruningQueue = std::make_unique<internal::PruningQueue> (
+            *storage, transactionManager, pendingPruning);
+      else
+        pruningQueue->SetDesiredSize (pendingPruning);
+      pruningTuningPending = false;
+    }
+}
+
+Json::Value
+Game::GetTuning () const
+{
+  internal::InstrumentedLock lock(mut);
+
+  Json::Value res(Json::objectValue);
+
+  Json::Value batch(Json::objectValue);
+  batch["catchingup"] = catchingUpBatchSize;
+  batch["uptodate"] = upToDateBatchSize;
+  res["batchsize"] = batch;
+
+  res["flushmillis"] = batchFlushMillis;
+
+  Json::Value notify(Json::objectValue);
+  notify["millis"] = catchingUpNotifyMillis;
+  notify["blocks"] = catchingUpNotifyBlocks;
+  res["catchingupnotify"] = notify;
+
+  if (pruningTuningPending)
+    res["pruning"] = pendingPruning;
+  else if (pruningQueue != nullptr)
+    res["pruning"] = pruningQueue->GetDesiredSize ();
+
+  res["compressionthreshold"] = compressionThreshold;
+
+  if (stateHistory != nullptr)
+    {
+      unsigned blocks, keyframes, cache;
+      stateHistory->GetLimits (blocks, keyframes, cache);
+
+      Json::Value hist(Json::objectValue);
+      hist["blocks"] = blocks;
+      hist["keyframes"] = keyframes;
+      hist["cache"] = cache;
+      res["statehistory"] = hist;
+    }
+
+  if (moveArchive != nullptr)
+    res["movearchive"] = moveArchive->GetLimit ();
+  if (detachedBlocks != nullptr)
+    res["detachedblocks"] = detachedBlocks->GetCapacity ();
+  if (memoryBudget != nullptr)
+    res["memorybudget"]
+        = static_cast<Json::UInt64> (memoryBudget->GetBudget ());
+
+  res["verbosity"] = verbosity;
+
+  return res;
+}
+
+namespace
+{
+
+/**
+ * Verifies that the given value is a JSON object with only the allowed
+ * fields in it.  Throws TuningError otherwise.
+ */
+void
+CheckTuningFields (const Json::Value& obj, const std::set<std::string>& allowed,
+                   const std::string& what)
+{
+  if (!obj.isObject ())
+    throw Game::TuningError (what + " must be an object");
+
+  for (const auto& key : obj.getMemberNames ())
+    if (allowed.count (key) == 0)
+      throw Game::TuningError ("unknown field in " + what + ": " + key);
+}
+
+/**
+ * Reads an optional unsigned field from a tuning object.  Returns false
+ * if it is not present, and throws TuningError if it is invalid.
+ */
+bool
+GetTuningUnsigned (const Json::Value& obj, const std::string& key,
+                   unsigned& val)
+{
+  if (!obj.isMember (key))
+    return false;
+
+  if (!obj[key].isUInt ())
+    throw Game::TuningError ("invalid value for " + key);
+
+  val = obj[key].asUInt ();
+  return true;
+}
+
+/**
+ * Reads an optional signed integer field from a tuning object.
+ */
+bool
+GetTuningInt (const Json::Value& obj, const std::string& key, int& val)
+{
+  if (!obj.isMember (key))
+    return false;
+
+  if (!obj[key].isInt ())
+    throw Game::TuningError ("invalid value for " + key);
+
+  val = obj[key].asInt ();
+  return true;
+}
+
+} // anonymous namespace
+
+void
+Game::SetTuning (const Json::Value& params)
+{
+  CheckTuningFields (params,
+                     {"batchsize", "flushmillis", "catchingupnotify", "pruning",
+                      "compressionthreshold", "statehistory", "movearchive",
+                      "detachedblocks", "memorybudget", "verbosity"},
+                     "tuning");
+
+  internal::InstrumentedLock lock(mut);
+
+  /* Parse and validate all values first, so that nothing is changed if
+     any of them is invalid.  */
+
+  unsigned catchingUp = catchingUpBatchSize;
+  unsigned upToDate = upToDateBatchSize;
+  if (params.isMember ("batchsize"))
+    {
+      const Json::Value& batch = params["batchsize"];
+      CheckTuningFields (batch, {"catchingup", "uptodate"}, "batchsize");
+      GetTuningUnsigned (batch, "catchingup", catchingUp);
+      GetTuningUnsigned (batch, "uptodate", upToDate);
+      if (catchingUp == 0 || upToDate == 0)
+        throw TuningError ("batch sizes must be positive");
+    }
+
+  unsigned flushMillis = batchFlushMillis;
+  GetTuningUnsigned (params, "flushmillis", flushMillis);
+
+  unsigned notifyMillis = catchingUpNotifyMillis;
+  unsigned notifyBlocks = catchingUpNotifyBlocks;
+  if (params.isMember ("catchingupnotify"))
+    {
+      const Json::Value& notify = params["catchingupnotify"];
+      CheckTuningFields (notify, {"millis", "blocks"}, "catchingupnotify");
+      GetTuningUnsigned (notify, "millis", notifyMillis);
+      GetTuningUnsigned (notify, "blocks", notifyBlocks);
+    }
+
+  unsigned pruning;
+  const bool setPruning = GetTuningUnsigned (params, "pruning", pruning);
+  if (setPruning && storage == nullptr)
+    throw TuningError ("pruning requires the storage to be set");
+
+  int threshold = compressionThreshold;
+  GetTuningInt (params, "compressionthreshold", threshold);
+
+  unsigned histBlocks = 0, histKeyframes = 0, histCache = 0;
+  if (stateHistory != nullptr)
+    stateHistory->GetLimits (histBlocks, histKeyframes, histCache);
+  if (params.isMember ("statehistory"))
+    {
+      if (stateHistory == nullptr)
+        throw TuningError ("the state history is not enabled");
+
+      const Json::Value& hist = params["statehistory"];
+      CheckTuningFields (hist, {"blocks", "keyframes", "cache"},
+                         "statehistory");
+      GetTuningUnsigned (hist, "blocks", histBlocks);
+      GetTuningUnsigned (hist, "keyframes", histKeyframes);
+      GetTuningUnsigned (hist, "cache", histCache);
+    }
+
+  unsigned archiveBlocks;
+  const bool setArchive
+      = GetTuningUnsigned (params, "movearchive", archiveBlocks);
+  if (setArchive && moveArchive == nullptr)
+    throw TuningError ("the move archive is not enabled");
+
+  unsigned detachedCapacity;
+  const bool setDetached
+      = GetTuningUnsigned (params, "detachedblocks", detachedCapacity);
+  if (setDetached && detachedBlocks == nullptr)
+    throw TuningError ("the detached-block cache is not enabled");
+
+  const bool setBudget = params.isMember ("memorybudget");
+  if (setBudget)
+    {
+      if (memoryBudget == nullptr)
+        throw TuningError ("the memory budget is not enabled");
+      if (!params["memorybudget"].isUInt64 ())
+        throw TuningError ("invalid value for memorybudget");
+    }
+
+  int newVerbosity = verbosity;
+  const bool setVerbosity
+      = GetTuningInt (params, "verbosity", newVerbosity);
+
+  /* Now apply the new values.  */
+
+  LOG (INFO) << "Updating tuning parameters:\n" << params;
+
+  catchingUpBatchSize = catchingUp;
+  upToDateBatchSize = upToDate;
+  batchFlushMillis = flushMillis;
+  batchTuningPending = true;
+
+  catchingUpNotifyMillis = notifyMillis;
+  catchingUpNotifyBlocks = notifyBlocks;
+
+  if (setPruning)
+    {
+      pendingPruning = pruning;
+      pruningTuningPending = true;
+    }
+
+  compressionThreshold = threshold;
+
+  if (stateHistory != nullptr)
+    stateHistory->SetLimits (histBlocks, histKeyframes, histCache);
+  if (setArchive)
+    moveArchive->SetLimit (archiveBlocks);
+  if (setDetached)
+    detachedBlocks->SetCapacity (detachedCapacity);
+
+  if (setBudget)
+    {
+      memoryBudget->SetBudget (params["memorybudget"].asUInt64 ());
+      EnforceMemoryBudget ();
+    }
+
+  /* Assigning FLAGS_v directly would race with VLOG on other threads.
+     SetVLOGLevel updates the levels under glog's own lock instead.  */
+  if (setVerbosity)
+    {
+      verbosity = newVerbosity;
+      google::SetVLOGLevel ("*", verbosity);
+    }
+}
+
+Json::Value
+Game::GetCurrentRawState () const
+{
+  return GetCustomStateData ("rawstate",
+      [] (const GameStateData& state)
+        {
+          return EncodeBase64 (state);
+        });
+}
+
+namespace
+{
+
+/**
+ * Encodes a cursor for paging through the game state at the given block,
+ * continuing after the given key.
+ */
+std::string
+EncodeStateCursor (const uint256& hash, const std::string& lastKey)
+{
+  std::string data(reinterpret_cast<const char*> (hash.GetBlob ()),
+                   uint256::NUM_BYTES);
+  data += lastKey;
+  return EncodeBase64 (data);
+}
+
+/**
+ * Decodes a cursor string into block hash and last key.  Returns false
+ * if the cursor is invalid.  The last key may be empty, since that is a
+ * valid key as well.
+ */
+bool
+DecodeStateCursor (const std::string& cursor, uint256& hash,
+                   std::string& lastKey)
+{
+  std::string data;
+  if (!DecodeBase64 (cursor, data) || data.size () < uint256::NUM_BYTES)
+    return false;
+
+  hash.FromBlob (reinterpret_cast<const unsigned char*> (data.data ()));
+  lastKey = data.substr (uint256::NUM_BYTES);
+  return true;
+}
+
+} // anonymous namespace
+
+Json::Value
+Game::GetStatePage (const std::string& cursor, const unsigned limit) const
+{
+  if (limit == 0 || limit > MAX_STATE_PAGE_SIZE)
+    throw StatePageError ("invalid page size");
+
+  uint256 cursorHash;
+  std::string startAfter;
+  if (!cursor.empty () && !DecodeStateCursor (cursor, cursorHash, startAfter))
+    throw StatePageError ("invalid cursor");
+
+  Json::Value res(Json::objectValue);
+  res["gameid"] = gameId;
+
+  Json::Value entries(Json::objectValue);
+  bool more = false;
+  bool supported;
+  uint256 hash;
+  unsigned height;
+  GameStateData gameState;
+
+  {
+    std::unique_ptr<StorageSnapshot> snapshot;
+    std::shared_lock<std::shared_timed_mutex> readersLock;
+
+    {
+      internal::InstrumentedLock lock(mut);
+
+      res["chain"] = ChainToString (chain);
+      res["state"] = StateToString (state);
+
+      const bool hasState
+          = storage->GetCurrentBlockHashWithHeight (hash, height);
+      if (cursor.empty () && !hasState)
+        return res;
+
+      if (cursor.empty () || (hasState && hash == cursorHash))
+        {
+          /* Read the state through a snapshot after releasing mut if
+             possible.  Snapshots only see committed data, so while catching
+             up (with batched transactions) they may lag behind the current
+             state.  In that case, or without snapshot support, we have to
+             copy the state here.  */
+          snapshot = storage->OpenSnapshot ();
+          uint256 snapshotHash;
+          if (snapshot != nullptr
+                && snapshot->GetCurrentBlockHash (snapshotHash)
+                && snapshotHash == hash)
+            readersLock
+                = std::shared_lock<std::shared_timed_mutex> (
+                    snapshotReadersMut);
+          else
+            {
+              snapshot.reset ();
+              gameState = storage->GetCurrentGameState ();
+            }
+          cursorHash = hash;
+        }
+      else
+        hash.SetNull ();
+    }
+
+    if (snapshot != nullptr)
+      {
+        gameState = snapshot->GetCurrentGameState ();
+        snapshot.reset ();
+      }
+  }
+
+  /* If the cursor refers to an earlier state, try to page through that
+     state from the history.  */
+  if (hash.IsNull ())
+    {
+      if (!GetHistoricalState (cursorHash, gameState, height))
+        throw StatePageError ("the cursor's game state is no longer available");
+      hash = cursorHash;
+    }
+
+  supported = rules->GameStateToJsonPage (
+      gameState, cursor.empty () ? nullptr : &startAfter, limit,
+      entries, more);
+
+  if (!supported)
+    throw StatePageError ("paging is not supported by the game");
+
+  res["blockhash"] = hash.ToHex ();
+  res["height"] = height;
+  res["entries"] = entries;
+
+  /* JSON object members are ordered byte-wise by key, so the last member
+     is the one we have to continue after.  */
+  if (more)
+    {
+      const auto keys = entries.getMemberNames ();
+      CHECK (!keys.empty ());
+      res["cursor"] = EncodeStateCursor (hash, keys.back ());
+    }
+
+  return res;
+}
+
+internal::StateHistory*
+Game::GetStateHistory () const
+{
+  internal::InstrumentedLock lock(mut);
+  return stateHistory.get ();
+}
+
+Json::Value
+Game::HistoricalStateToJson (const uint256& hash, const unsigned height,
+                             const GameStateData& gameState) const
+{
+  Json::Value res(Json::objectValue);
+  res["gameid"] = gameId;
+  res["chain"] = ChainToString (GetChain ());
+  res["blockhash"] = hash.ToHex ();
+  res["height"] = height;
+  res["gamestate"] = rules->GameStateToJson (gameState);
+
+  return res;
+}
+
+bool
+Game::GetHistoricalState (const uint256& hash, GameStateData& gameState,
+                          unsigned& height) const
+{
+  internal::StateHistory* history = GetStateHistory ();
+  if (history == nullptr)
+    return false;
+
+  return history->GetStateAtBlock (hash,
+      [this] (const GameStateData& newState, const Json::Value& blockData,
+              const UndoData& undo)
+        {
+          return rules->ProcessBackwards (newState, blockData, undo);
+        },
+      gameState, height);
+}
+
+Json::Value
+Game::GetStateAtBlock (const uint256& hash) const
+{
+  GameStateData gameState;
+  unsigned height;
+  if (!GetHistoricalState (hash, gameState, height))
+    return Json::Value ();
+
+  return HistoricalStateToJson (hash, height, gameState);
+}
+
+Json::Value
+Game::GetStateAtHeight (const unsigned height) const
+{
+  internal::StateHistory* history = GetStateHistory ();
+  if (history == nullptr)
+    return Json::Value ();
+
+  /* The mapping from height to block hash is only meaningful if the history
+     matches the current chain.  This may not be the case briefly when the
+     state is being reinitialised.  */
+  {
+    internal::InstrumentedLock lock(mut);
+
+    uint256 currentHash, tipHash;
+    if (!storage->GetCurrentBlockHash (currentHash)
+          || !history->GetTip (tipHash) || currentHash != tipHash)
+      return Json::Value ();
+  }
+
+  GameStateData gameState;
+  uint256 hash;
+  const bool found = history->GetStateAtHeight (height,
+      [this] (const GameStateData& newState, const Json::Value& blockData,
+              const UndoData& undo)
+        {
+          return rules->ProcessBackwards (newState, blockData, undo);
+        },
+      gameState, hash);
+
+  if (!found)
+    return Json::Value ();
+
+  return HistoricalStateToJson (hash, height, gameState);
+}
+
+Json::Value
+Game::GetMovesByName (const std::string& name, const unsigned limit) const
+{
+  internal::InstrumentedLock lock(mut);
+
+  if (moveArchive == nullptr)
+    return Json::Value ();
+
+  /* The archive may not match the current state, e.g. right after it
+     has been enabled or while the state is being reinitialised.  */
+  uint256 hash, tipHash;
+  unsigned height;
+  if (!storage->GetCurrentBlockHashWithHeight (hash, height)
+        || !moveArchive->GetTip (tipHash) || hash != tipHash)
+    return Json::Value ();
+
+  Json::Value res(Json::objectValue);
+  res["gameid"] = gameId;
+  res["chain"] = ChainToString (chain);
+  res["state"] = StateToString (state);
+  res["blockhash"] = hash.ToHex ();
+  res["height"] = height;
+  res["moves"] = moveArchive->GetMovesByName (name, limit);
+
+  return res;
+}
+
+Json::Value
+Game::GetMetrics () const
+{
+  Json::Value res(Json::objectValue);
+  res["gameid"] = gameId;
+
+  if (costs != nullptr)
+    res["costs"] = costs->ToJson ();
+  if (AllocStatsEnabled ())
+    res["allocations"] = AllocStatsToJson ();
+
+  if (detachedBlocks != nullptr)
+    res["detachedblocks"] = detachedBlocks->GetStats ();
+  if (derivedData != nullptr)
+    res["deriveddata"] = derivedData->GetStats ();
+  if (memoryBudget != nullptr)
+    res["memory"] = memoryBudget->GetStats ();
+  if (stateFiles != nullptr)
+    res["statefiles"] = stateFiles->GetStats ();
+  if (mut.IsEnabled ())
+    {
+      Json::Value locks(Json::objectValue);
+      locks["game"] = mut.GetStats (LOCK_STATS_SITES);
+      res["locks"] = locks;
+    }
+
+  return res;
+}
+
+Json::Value
+Game::Profile (const unsigned seconds) const
+{
+  if (profiler == nullptr)
+    return Json::Value ();
+
+  Json::Value res;
+  try
+    {
+      res = profiler->Run (seconds);
+    }
+  catch (const internal::SamplingProfiler::Error& exc)
+    {
+      throw ProfileError (exc.what ());
+    }
+  res["gameid"] = gameId;
+
+  return res;
+}
+
+Json::Value
+Game::GetDerivedData () const
+{
+  if (derivedData == nullptr)
+    return Json::Value ();
+
+  const auto latest = derivedData->GetLatest ();
+  if (latest == nullptr)
+    return Json::Value ();
+
+  Json::Value res(Json::objectValue);
+  res["gameid"] = gameId;
+  res["blockhash"] = latest->hash.ToHex ();
+  res["version"] = latest->version;
+  res["data"] = latest->data;
+
+  return res;
+}
+
+void
+Game::ScheduleDerivedData ()
+{
+  if (derivedData == nullptr || state != State::UP_TO_DATE)
+    return;
+
+  uint256 hash;
+  if (!storage->GetCurrentBlockHash (hash))
+    return;
+
+  /* If the storage supports snapshots, the state is read from it on the
+     worker thread.  Otherwise, or if the snapshot lags behind the current
+     state because of a batched transaction, we have to copy it here.  */
+  auto snapshot = storage->OpenSnapshot ();
+  uint256 snapshotHash;
+  if (snapshot != nullptr
+        && snapshot->GetCurrentBlockHash (snapshotHash)
+        && snapshotHash == hash)
+    {
+      derivedData->Schedule (std::move (snapshot));
+      return;
+    }
+  snapshot.reset ();
+
+  derivedData->Schedule (hash, storage->GetCurrentGameState ());
+}
+
+void
+Game::DiscardDerivedData ()
+{
+  if (derivedData != nullptr)
+    derivedData->Discard ();
+  if (checkpoints != nullptr)
+    checkpoints->WaitForIdle ();
+
+  /* Wait for RPC threads that are still reading from snapshots.  New ones
+     can not be opened while we hold mut.  */
+  std::lock_guard<std::shared_timed_mutex> readersLock(snapshotReadersMut);
+}
+
+void
+Game::NotifyStateChange () const
+{
+  /* Callers are expected to already hold the mut lock here (as that is the
+     typical case when they make changes to the state anyway).  */
+  VLOG (1) << "Notifying waiting threads about state change...";
+  cvStateChanged.notify_all ();
+}
+
+void
+Game::NotifyBlockChange (const uint256& newBlock)
+{
+  const auto now = std::chrono::steady_clock::now ();
+
+  bool notify = (state == State::UP_TO_DATE || newBlock == targetBlockHash);
+  notify = notify
+      || (catchingUpNotifyMillis == 0 && catchingUpNotifyBlocks == 0);
+
+  ++blocksSinceNotify;
+  if (catchingUpNotifyBlocks > 0 && blocksSinceNotify >= catchingUpNotifyBlocks)
+    notify = true;
+  if (catchingUpNotifyMillis > 0
+        && now - lastBlockNotify
+              >= std::chrono::milliseconds (catchingUpNotifyMillis))
+    notify = true;
+
+  if (!notify)
+    {
+      VLOG (2)
+          << "Not waking up waiters for block " << newBlock.ToHex ()
+          << " while " << StateToString (state)
+          << ", skipped blocks: " << blocksSinceNotify;
+      return;
+    }
+
+  NotifyStateChange ();
+  lastBlockNotify = now;
+  blocksSinceNotify = 0;
+}
+
+void
+Game::ForceBlockNotify ()
+{
+  NotifyStateChange ();
+  lastBlockNotify = std::chrono::steady_clock::now ();
+  blocksSinceNotify = 0;
+}
+
+void
+Game::PublishStateChange ()
+{
+  if (publisher == nullptr)
+    return;
+
+  Json::Value msg(Json::objectValue);
+  msg["state"] = StateToString (state);
+
+  uint256 hash;
+  unsigned height;
+  const bool hasState = storage->GetCurrentBlockHashWithHeight (hash, height);
+  if (hasState)
+    {
+      msg["blockhash"] = hash.ToHex ();
+      msg["height"] = height;
+    }
+
+  /* The game state itself is only included when we are up-to-date.  While
+     catching up, the notifications stay compact so that we do not convert
+     the game state to JSON for each block.  */
+  if (publishMode == StatePublishMode::NOTIFICATION
+        || !hasState || state != State::UP_TO_DATE)
+    {
+      lastPublishedHash.SetNull ();
+      lastPublishedState = Json::Value ();
+      lastPublishedBytes = 0;
+    }
+  else
+    {
+      Json::Value gameState = RenderCurrentState (hash)->GetJson ();
+
+      /* If the diff can not be expressed as merge patch (because of null
+         members in the new state), the full state is sent instead.  */
+      Json::Value diff;
+      if (publishMode == StatePublishMode::STATE_DIFF
+            && !lastPublishedHash.IsNull ()
+            && internal::JsonMergePatch (lastPublishedState, gameState, diff))
+        {
+          msg["prevblockhash"] = lastPublishedHash.ToHex ();
+          msg["gamestatediff"] = std::move (diff);
+        }
+      else
+        msg["gamestate"] = gameState;
+
+      if (publishMode == StatePublishMode::STATE_DIFF)
+        {
+          lastPublishedHash = hash;
+          lastPublishedState = std::move (gameState);
+          lastPublishedBytes
+              = internal::EstimateJsonMemory (lastPublishedState);
+        }
+    }
+
+  Json::StreamWriterBuilder wbuilder;
+  wbuilder["indentation"] = "";
+
+  publisher->Publish ("game-state json " + gameId,
+                      Json::writeString (wbuilder, msg));
+}
+
+void
+Game::WaitForChange (uint256* currentBlock) const
+{
+  internal::InstrumentedLock lock(mut);
+
+  if (zmq.IsRunning ())
+    {
+      VLOG (1) << "Waiting for state change on condition variable...";
+      cvStateChanged.wait (lock);
+      VLOG (1) << "Potential state change detected in WaitForChange";
+    }
+  else
+    LOG (WARNING)
+        << "WaitForChange called with no active ZMQ listener,"
+           " returning immediately";
+
+  if (currentBlock != nullptr && !storage->GetCurrentBlockHash (*currentBlock))
+    currentBlock->SetNull ();
+}
+
+void
+Game::TrackGame ()
+{
+  std::lock_guard<std::mutex> rpcLock(rpcMut);
+  CHECK (rpcClient != nullptr) << "RPC client is not yet set up";
+  rpcClient->trackedgames ("add", gameId);
+  LOG (INFO) << "Added " << gameId << " to tracked games";
+}
+
+void
+Game::UntrackGame ()
+{
+  std::lock_guard<std::mutex> rpcLock(rpcMut);
+  CHECK (rpcClient != nullptr) << "RPC client is not yet set up";
+  rpcClient->trackedgames ("remove", gameId);
+  LOG (INFO) << "Removed " << gameId << " from tracked games";
+}
+
+void
+Game::Start ()
+{
+  TrackGame ();
+  zmq.Start ();
+
+  std::lock_guard<std::mutex> syncLock(syncMut);
+  ReinitialiseState ();
+}
+
+void
+Game::Stop ()
+{
+  zmq.Stop ();
+  UntrackGame ();
+
+  /* Make sure to wake up all listeners waiting for a state update (as there
+     won't be one anymore).  */
+  NotifyStateChange ();
+}
+
+void
+Game::Run ()
+{
+  CHECK (storage != nullptr && rules != nullptr)
+      << "Storage and GameLogic must be set before starting the main loop";
+
+  internal::MainLoop::Functor startAction = [this] () { Start (); };
+  internal::MainLoop::Functor stopAction = [this] () { Stop (); };
+
+  mainLoop.Run (startAction, stopAction);
+}
+
+void
+Game::SyncFromCurrentState (const DaemonSyncData& daemon,
+                            const uint256& currentHash)
+{
+  CHECK (state == State::OUT_OF_SYNC);
+
+  uint256 daemonBestHash;
+  CHECK (daemonBestHash.FromHex (
+      daemon.blockchainInfo["bestblockhash"].asString ()));
+
+  if (daemonBestHash == currentHash)
+    {
+      LOG (INFO) << "Game state matches current tip, we are up-to-date";
+      state = State::UP_TO_DATE;
+      ApplyBatchSize ();
+
+      /* Make sure waiters see the latest state if some block changes
+         were not yet signalled to them while catching up.  */
+      if (blocksSinceNotify > 0)
+        ForceBlockNotify ();
+      PublishStateChange ();
+      ExportSharedState ();
+      WriteStateFiles ();
+      ScheduleDerivedData ();
+      return;
+    }
+
+  const Json::Value& upd = daemon.updates;
+  CHECK (upd.isObject ()) << "Updates have not been requested";
+
+  LOG (INFO)
+      << "Retrieving " << upd["steps"]["detach"].asInt () << " detach and "
+      << upd["steps"]["attach"].asInt () << " attach steps with reqtoken = "
+      << upd["reqtoken"].asString ()
+      << ", leading to block " << upd["toblock"].asString ();
+
+  state = State::CATCHING_UP;
+  ApplyBatchSize ();
+
+  CHECK (targetBlockHash.FromHex (upd["toblock"].asString ()));
+  reqToken = upd["reqtoken"].asString ();
+}
+
+void
+Game::ReinitialiseState ()
+{
+  LOG (INFO) << "Reinitialising game state";
+
+  /* First, look at the current state in the storage (and for the initial
+     state if there is none) to know what to query from the daemon.  */
+  uint256 currentHash;
+  bool hasState, needHeight;
+  unsigned genesisHeight;
+  uint256 genesisHash;
+  GameStateData genesisData;
+  {
+    internal::InstrumentedLock lock(mut);
+    state = State::UNKNOWN;
+
+    hasState = storage->GetCurrentBlockHash (currentHash);
+    needHeight = hasState && !storage->HasCachedHeight ();
+
+    if (!hasState)
+      {
+        std::string genesisHashHex;
+        genesisData = rules->GetInitialState (genesisHeight, genesisHashHex);
+        CHECK (genesisHash.FromHex (genesisHashHex));
+      }
+  }
+
+  /* Query the daemon without holding mut, so that readers of the game
+     state are not blocked by it.  rpcMut is only held for each call
+     individually, since readers may need it as well (under mut) to look
+     up the current block height if that is not cached.  For the same
+     reason, the height is looked up and cached first.  */
+  DaemonSyncData daemon;
+  bool beforeGenesis = false;
+
+  if (needHeight)
+    {
+      unsigned height;
+      {
+        std::lock_guard<std::mutex> rpcLock(rpcMut);
+        height = GetHeightForBlockHash (*rpcClient, currentHash);
+      }
+
+      internal::InstrumentedLock lock(mut);
+      uint256 hash;
+      if (storage->GetCurrentBlockHash (hash) && hash == currentHash
+            && !storage->HasCachedHeight ())
+        storage->SetCachedHeight (currentHash, height);
+    }
+
+  {
+    std::lock_guard<std::mutex> rpcLock(rpcMut);
+    daemon.blockchainInfo = rpcClient->getblockchaininfo ();
+  }
+
+  uint256 syncFrom = currentHash;
+  if (!hasState)
+    {
+      beforeGenesis
+          = daemon.blockchainInfo["blocks"].asUInt () < genesisHeight;
+      if (!beforeGenesis)
+        {
+          std::string blockHashHex;
+          {
+            std::lock_guard<std::mutex> rpcLock(rpcMut);
+            blockHashHex = rpcClient->getblockhash (genesisHeight);
+          }
+          uint256 blockHash;
+          CHECK (blockHash.FromHex (blockHashHex));
+          CHECK (blockHash == genesisHash)
+            << "The game's genesis block hash and height do not match";
+        }
+      syncFrom = genesisHash;
+    }
+
+  uint256 daemonBestHash;
+  CHECK (daemonBestHash.FromHex (
+      daemon.blockchainInfo["bestblockhash"].asString ()));
+  if (!beforeGenesis && daemonBestHash != syncFrom)
+    {
+      LOG (INFO)
+          << "Game state does not match current tip,"
+             " requesting updates from " << syncFrom.ToHex ();
+      std::lock_guard<std::mutex> rpcLock(rpcMut);
+      daemon.updates
+          = rpcClient->game_sendupdates (syncFrom.ToHex (), gameId);
+    }
+
+  /* Apply the retrieved data.  All changes to the current state are made
+     while holding syncMut (which we hold as well), so the state can not
+     have changed while we were querying the daemon.  */
+  internal::InstrumentedLock lock(mut);
+
+  uint256 hash;
+  CHECK_EQ (storage->GetCurrentBlockHash (hash), hasState);
+  CHECK (!hasState || hash == currentHash);
+
+  if (hasState)
+    {
+      LOG (INFO) << "We have a current game state, syncing from there";
+      state = State::OUT_OF_SYNC;
+      SyncFromCurrentState (daemon, currentHash);
+      return;
+    }
+
+  /* We do not have a current state in the storage.  This means that we
+     have to reset to the initial state.  If the current block height in
+     the daemon is not yet the game's genesis height, simply wait for the
+     genesis hash to be attached.  */
+  if (beforeGenesis)
+    {
+      LOG (INFO)
+          << "Block height " << daemon.blockchainInfo["blocks"].asInt ()
+          << " is before the genesis height " << genesisHeight;
+      state = State::PREGENESIS;
+      targetBlockHash = genesisHash;
+      return;
+    }
+
+  /* Otherwise, we can store the initial state and start to sync from
+     there.  */
+  transactionManager.TryAbortTransaction ();
+  DiscardDerivedData ();
+  storage->Clear ();
+  while (true)
+    try
+      {
+        internal::ActiveTransaction tx(transactionManager);
+        storage->SetCurrentGameStateWithHeight (genesisHash, genesisHeight,
+                                                genesisData);
+        tx.Commit ();
         break;
       }
     catch (const StorageInterface::RetryWithNewTransaction& exc)
@@ -661,12 +2097,13 @@ Game::ReinitialiseState ()
       }
 
   LOG (INFO)
-      << "We are at the genesis height, stored initial game state for block "
-      << genesisHash.ToHex ();
-  NotifyStateChange ();
+      << "We are at the genesis height, stored initial game state"
+         " for block " << genesisHash.ToHex ();
+  ForceBlockNotify ();
+  PublishStateChange ();
 
   state = State::OUT_OF_SYNC;
-  SyncFromCurrentState (data, genesisHash);
+  SyncFromCurrentState (daemon, genesisHash);
 }
 
 } // namespace xaya
@@ -5,13 +5,27 @@
 #ifndef XAYAGAME_GAME_HPP
 #define XAYAGAME_GAME_HPP
 
+#include "checkpoints.hpp"
+#include "deriveddata.hpp"
+#include "detachedblockcache.hpp"
 #include "gamelogic.hpp"
 #include "heightcache.hpp"
+#include "instrumentedmutex.hpp"
 #include "mainloop.hpp"
+#include "memorybudget.hpp"
+#include "movearchive.hpp"
+#include "parallelrender.hpp"
+#include "profiler.hpp"
 #include "pruningqueue.hpp"
+#include "renderedstate.hpp"
+#include "sharedstate.hpp"
+#include "statefiles.hpp"
+#include "statehistory.hpp"
 #include "storage.hpp"
+#include "threadconfig.hpp"
 #include "transactionmanager.hpp"
 #include "uint256.hpp"
+#include "zmqpublisher.hpp"
 #include "zmqsubscriber.hpp"
 
 #include "rpc-stubs/xayarpcclient.h"
@@ -19,15 +33,39 @@
 #include <json/json.h>
 #include <jsonrpccpp/client.h>
 
+#include <chrono>
 #include <condition_variable>
+#include <cstdint>
 #include <functional>
 #include <memory>
 #include <mutex>
+#include <shared_mutex>
+#include <stdexcept>
 #include <string>
 
 namespace xaya
 {
 
+/**
+ * Possible choices for what is included in the state-change notifications
+ * published by Game through ZMQ.
+ */
+enum class StatePublishMode
+{
+  /** Only the block hash, height and sync state are published.  */
+  NOTIFICATION = 0,
+  /** The full game state (as JSON) is included when up-to-date.  */
+  FULL_STATE = 1,
+  /**
+   * A JSON merge patch (RFC 7396) relative to the previously published game
+   * state is included when up-to-date.  The full state is sent instead if
+   * there is no previous state to base the diff on, or if the new state has
+   * null values in objects that a merge patch can not express (since null
+   * means "remove the member" there).
+   */
+  STATE_DIFF = 2,
+};
+
 /**
  * The main class implementing a game on the Xaya platform.  It handles the
  * ZMQ and RPC communication with the Xaya daemon as well as the RPC interface
@@ -89,14 +127,46 @@ private:
    * worker thread in addition to the main thread.
    *
    * It is also used as lock for the waitforchange condition variable.
+   *
+   * If lock profiling is enabled, wait and hold times are recorded for it
+   * per calling function.
+   *
+   * RPC calls to the Xaya daemon should be avoided while holding it where
+   * possible, since a slow daemon would otherwise block all readers of the
+   * game state for the full round trip.
+   */
+  mutable internal::InstrumentedMutex mut;
+
+  /**
+   * Mutex that serialises the processing of ZMQ notifications with
+   * reinitialisation of the game state.  It is held for the full duration
+   * of those operations (including RPC calls to the daemon), while mut
+   * is only acquired when the state is actually accessed.  When both are
+   * needed, syncMut must be locked first.
+   */
+  std::mutex syncMut;
+
+  /**
+   * Mutex for using rpcClient, which is not thread-safe by itself.  It may
+   * be acquired while holding mut (but not the other way round).  Changing
+   * the rpcClient pointer requires both locks, so that code holding just
+   * mut can check whether it is set.
    */
-  mutable std::mutex mut;
+  mutable std::mutex rpcMut;
 
   /**
    * Condition variable that is signalled whenever the game state is changed
    * (due to attached/detached blocks or the initial state becoming known).
    */
-  mutable std::condition_variable cvStateChanged;
+  mutable std::condition_variable_any cvStateChanged;
+
+  /**
+   * Lock held (in shared mode) by RPC threads while they read from storage
+   * snapshots outside of mut.  Before the storage is cleared or restored
+   * (with mut held, so that no new snapshots are opened), it is acquired
+   * exclusively to wait for those readers to finish.
+   */
+  mutable std::shared_timed_mutex snapshotReadersMut;
 
   /** The chain type to which the game is connected.  */
   Chain chain = Chain::UNKNOWN;
@@ -126,6 +196,51 @@ private:
   /** The ZMQ subscriber.  */
   internal::ZmqSubscriber zmq;
 
+  /**
+   * Configuration for threads serving RPC requests.  This is only changed
+   * before the game is started, so that it can be read without locking.
+   */
+  ThreadConfig rpcThreadConfig;
+
+  /** The ZMQ publisher for state changes, if enabled.  */
+  std::unique_ptr<internal::ZmqPublisher> publisher;
+
+  /** What to include in published state-change notifications.  */
+  StatePublishMode publishMode = StatePublishMode::NOTIFICATION;
+
+  /**
+   * For STATE_DIFF mode, the block hash of the last published game state.
+   * This is null if the next message has to include the full state.
+   */
+  uint256 lastPublishedHash;
+
+  /** For STATE_DIFF mode, the last published game state.  */
+  Json::Value lastPublishedState;
+
+  /** Estimated memory used by lastPublishedState.  */
+  size_t lastPublishedBytes = 0;
+
+  /**
+   * The current game state as rendered for RPC responses, shared between
+   * all requests for the same block.  This is replaced whenever a request
+   * finds that the current block has changed.
+   */
+  mutable std::shared_ptr<const internal::RenderedState> renderedState;
+
+  /**
+   * Minimum size (in bytes of JSON text) of the game state for which
+   * GetCurrentCompressedState actually compresses it.  If negative,
+   * compression is disabled.
+   */
+  int compressionThreshold = 1024;
+
+  /**
+   * The VLOG verbosity as last set through SetTuning (or the value of the
+   * --v flag at construction).  We keep our own copy, since FLAGS_v must not
+   * be read or written while other threads may be logging.
+   */
+  int verbosity;
+
   /** The height-caching storage we use.  */
   std::unique_ptr<internal::StorageWithCachedHeight> storage;
 
@@ -136,7 +251,54 @@ private:
    * Desired size for batches of atomic transactions while the game is
    * catching up.  <= 1 means no batching even in these situations.
    */
-  unsigned transactionBatchSize = 1000;
+  unsigned catchingUpBatchSize = 1000;
+
+  /**
+   * Desired size for batches of atomic transactions while the game is
+   * up-to-date.  This is one (no batching) by default, so that each new
+   * block is committed right away.
+   */
+  unsigned upToDateBatchSize = 1;
+
+  /**
+   * Time limit in milliseconds for batches of transactions (zero for none).
+   * See TransactionManager::SetFlushTimeLimit.
+   */
+  unsigned batchFlushMillis = 0;
+
+  /**
+   * Set by SetTuning when the batch sizes or flush time limit have changed.
+   * They are only passed on to the transaction manager by ApplyPendingTuning
+   * on the thread processing blocks, since that may commit the batch.
+   */
+  bool batchTuningPending = false;
+
+  /**
+   * Pruning depth requested through SetTuning, which is applied (and the
+   * pruning queue created if necessary) by ApplyPendingTuning.
+   */
+  bool pruningTuningPending = false;
+  unsigned pendingPruning;
+
+  /**
+   * While not up-to-date, waiters in WaitForChange are woken up for a new
+   * block only if at least this many milliseconds have passed since the last
+   * wakeup (zero to not use a time limit).
+   */
+  unsigned catchingUpNotifyMillis = 1000;
+
+  /**
+   * While not up-to-date, waiters are also woken up if at least this many
+   * blocks have been processed since the last wakeup (zero to not use
+   * a block limit).
+   */
+  unsigned catchingUpNotifyBlocks = 0;
+
+  /** Time of the last wakeup of waiters for a new block.  */
+  std::chrono::steady_clock::time_point lastBlockNotify;
+
+  /** Number of blocks processed without waking up waiters.  */
+  unsigned blocksSinceNotify = 0;
 
   /** The manager for batched atomic transactions.  */
   internal::TransactionManager transactionManager;
@@ -147,6 +309,92 @@ private:
   /** The pruning queue if we are pruning.  */
   std::unique_ptr<internal::PruningQueue> pruningQueue;
 
+  /**
+   * The history of recent blocks for reconstructing past states, if enabled.
+   * Once created, the instance is never destroyed (but just reconfigured)
+   * while the Game is alive.
+   */
+  std::unique_ptr<internal::StateHistory> stateHistory;
+
+  /** The archive of recent moves by name, if enabled.  */
+  std::unique_ptr<internal::MoveArchive> moveArchive;
+
+  /**
+   * Results of recently detached blocks for reuse, if enabled.  This is only
+   * set before the game is started (the capacity can be changed later
+   * through SetTuning), so that the statistics can be read without the lock.
+   */
+  std::unique_ptr<internal::DetachedBlockCache> detachedBlocks;
+
+  /** Local checkpoints of the state for recovery, if enabled.  */
+  std::unique_ptr<internal::CheckpointManager> checkpoints;
+
+  /**
+   * Set by UpdateStateForDetach if the undo data for the detached block is
+   * missing, so that BlockDetach recovers (after releasing mut) before
+   * reinitialising.  This is only accessed while holding syncMut.
+   */
+  bool undoDataMissing = false;
+
+  /**
+   * Renderer for converting the game state to JSON in parallel, if enabled.
+   * It is used (with the lock held) from the const RenderCurrentState.
+   */
+  mutable std::unique_ptr<internal::ParallelRenderer> parallelRenderer;
+
+  /**
+   * Background computation of derived data, if enabled.  This is only set
+   * before the game is started, so that results can be served without
+   * holding the lock (the instance is thread-safe itself).  It is declared
+   * after the storage, so that it stops using snapshots before the storage
+   * is destructed.
+   */
+  std::unique_ptr<internal::DerivedDataWorker> derivedData;
+
+  /**
+   * Accounting of processing costs per move and name, if enabled.  This is
+   * only set before the game is started, so that it can be accessed without
+   * holding the lock (the instance is thread-safe itself).
+   */
+  std::unique_ptr<CostAccounting> costs;
+
+  /**
+   * Memory consumers reporting (and dropping) the rendered state and
+   * the last published state, if the memory budget is enabled.  They are
+   * only used with the lock held.
+   */
+  std::unique_ptr<internal::CallbackMemoryConsumer> renderedStateMemory;
+  std::unique_ptr<internal::CallbackMemoryConsumer> publishedStateMemory;
+
+  /**
+   * The memory budget for the in-memory caches, if enabled.  This is only
+   * set before the game is started, so that its statistics can be read
+   * without the lock.  It is declared after all caches, so that it is
+   * destructed before them.
+   */
+  std::unique_ptr<internal::MemoryBudget> memoryBudget;
+
+  /** Export of the current state to shared memory, if enabled.  */
+  std::unique_ptr<internal::SharedStateWriter> sharedState;
+
+  /**
+   * The CPU profiler, if enabled.  This is only set before the game is
+   * started, so that it can be used without the lock.
+   */
+  std::unique_ptr<internal::SamplingProfiler> profiler;
+
+  /** Writer for per-block state files, if enabled.  */
+  std::unique_ptr<internal::StateFileWriter> stateFiles;
+
+  /**
+   * Minimum time between state files written while catching up.  Zero
+   * means that they are only written when up-to-date.
+   */
+  unsigned stateFilesCatchingUpMillis = 0;
+
+  /** Time at which the last state files were scheduled.  */
+  std::chrono::steady_clock::time_point lastStateFiles;
+
   /**
    * The JSON-RPC version to use for talking to Xaya Core.  The actual daemon
    * needs V1, but for the unit test (where the server is mocked and set up
@@ -191,20 +439,56 @@ private:
    * work for BlockDetach, after the latter handled the state and reqtoken.
    *
    * Returns false if the detached block does not correspond to the current
-   * game state and we need to reinitialise.
+   * game state and we need to reinitialise.  That is also the case if the
+   * undo data for the block is missing, in which case undoDataMissing is
+   * set as well.
    */
   bool UpdateStateForDetach (const uint256& parent, const uint256& child,
                              const Json::Value& blockData);
 
+  /**
+   * Tries to restore the newest checkpoint on the current main chain into
+   * the storage.  Returns false if checkpoints are not enabled or none could
+   * be restored.  The checkpoints are checked against the daemon before mut
+   * is locked for the restore, so callers must hold syncMut but not mut.
+   * There must be no open transaction.
+   */
+  bool RestoreCheckpoint ();
+
+  /**
+   * Handles a detached block for which no undo data is available, by
+   * restoring a checkpoint or clearing the storage (so that we resync from
+   * scratch).  Callers must hold syncMut but not mut.
+   */
+  void RecoverMissingUndoData ();
+
+  /**
+   * Data retrieved from the Xaya daemon by ReinitialiseState (without
+   * holding mut) before it is applied to the game state.
+   */
+  struct DaemonSyncData
+  {
+
+    /** The result of getblockchaininfo.  */
+    Json::Value blockchainInfo;
+
+    /**
+     * The result of game_sendupdates if the state we sync from is not the
+     * daemon's best block, and null otherwise.
+     */
+    Json::Value updates;
+
+  };
+
   /**
    * Starts to sync from the current game state to the current chain tip.
    * This is a helper method called from ReinitialiseState when the state
    * was set to OUT_OF_SYNC.  It checks the current block hash against the
    * best known one from the daemon and then either sets the state to
-   * CATCHING_UP and requests game_sendupdates, or sets the state to
-   * UP_TO_DATE if all is already fine.
+   * CATCHING_UP based on the game_sendupdates result, or sets the state to
+   * UP_TO_DATE if all is already fine.  Callers must hold the mut lock.
    */
-  void SyncFromCurrentState (const Json::Value& blockchainInfo,
+  void SyncFromCurrentState (const DaemonSyncData& daemon,
                              const uint256& currentHash);
 
   /**
@@ -212,25 +496,150 @@ private:
    * sure, like when ZMQ notifications have been missed or during start up.
    * It checks the storage for the current game state and queries the RPC
    * daemon with getblockchaininfo and then determines what needs to be done.
+   *
+   * The daemon is queried without holding mut, and the result is applied
+   * afterwards.  Since all changes to the current state are made while
+   * holding syncMut, the state can not change in the mean time.  rpcMut is
+   * only held for each RPC call, so that readers needing it for a height
+   * lookup are not blocked for the whole sequence of calls.
+   * Callers must hold the syncMut lock, but not mut.
    */
   void ReinitialiseState ();
 
+  /**
+   * Sets the batch size of the transaction manager to the one configured
+   * for the current sync state.  Callers must hold the mut lock.
+   */
+  void ApplyBatchSize ();
+
+  /**
+   * Applies tuning changes that SetTuning could not apply directly because
+   * they may commit or open transactions.  This is called before processing
+   * a block notification.  Callers must hold the mut lock.
+   */
+  void ApplyPendingTuning ();
+
+  /**
+   * Schedules computation of derived data for the current state, if it is
+   * enabled and we are up-to-date.  Callers must hold the mut lock.
+   */
+  void ScheduleDerivedData ();
+
+  /**
+   * Stops the computation of derived data (if enabled), RPC readers and
+   * the checkpoint writer from accessing storage snapshots, which must be
+   * done before clearing or restoring the storage.  Callers must hold the
+   * mut lock.
+   */
+  void DiscardDerivedData ();
+
+  /**
+   * Registers all enabled caches with the memory budget, if it is enabled.
+   * Callers must hold the mut lock.
+   */
+  void RegisterMemoryConsumers ();
+
+  /**
+   * Enforces the memory budget (if enabled) by shrinking caches that use
+   * more than their share.  Callers must hold the mut lock.
+   */
+  void EnforceMemoryBudget ();
+
+  /**
+   * Exports the current state to shared memory, if enabled and we are
+   * up-to-date.  Callers must hold the mut lock.
+   */
+  void ExportSharedState ();
+
+  /**
+   * Schedules writing the state files for the current state, if enabled.
+   * While catching up, this is rate-limited.  Callers must hold the
+   * mut lock.
+   */
+  void WriteStateFiles ();
+
   /**
    * Notifies potentially-waiting threads that the state has changed.  Callers
    * must hold the mut lock.
    */
   void NotifyStateChange () const;
 
+  /**
+   * Notifies waiting threads that the current block has changed to the given
+   * one.  While up-to-date, this always wakes them up.  Otherwise, wakeups
+   * are coalesced according to the catching-up notification limits, except
+   * for the target block of catching up.  Callers must hold the mut lock.
+   */
+  void NotifyBlockChange (const uint256& newBlock);
+
+  /**
+   * Wakes up waiting threads for a block change right away (regardless of
+   * the catching-up limits), and resets the state of those limits so that
+   * coalescing starts afresh.  Callers must hold the mut lock.
+   */
+  void ForceBlockNotify ();
+
+  /**
+   * Publishes the current state (block, height and sync state, and possibly
+   * the game state itself) through the ZMQ publisher, if it is enabled.
+   * Callers must hold the mut lock.
+   */
+  void PublishStateChange ();
+
+  /**
+   * Returns the rendered game state for the current block with the given
+   * hash, either from the cache or by converting it now.  Callers must hold
+   * the mut lock.
+   */
+  std::shared_ptr<const internal::RenderedState> RenderCurrentState (
+      const uint256& hash) const;
+
+  /**
+   * Returns the meta data of the current state (game ID, chain, sync state
+   * and, if there is a current block, its hash and height).  If there is
+   * a current block, the rendered game state is returned in the output
+   * argument, and otherwise it is set to null.
+   */
+  Json::Value GetRenderedState (
+      std::shared_ptr<const internal::RenderedState>& rendered) const;
+
   /**
    * Converts a state enum value to a string for use in log messages and the
    * JSON-RPC interface.
    */
   static std::string StateToString (State s);
 
+  /**
+   * Returns the state history instance if it is enabled, and null otherwise.
+   */
+  internal::StateHistory* GetStateHistory () const;
+
+  /**
+   * Looks up (or reconstructs) the game state at the given block from the
+   * state history, if it is enabled and the block is available.  This is
+   * done without holding the main lock.
+   */
+  bool GetHistoricalState (const uint256& hash, GameStateData& gameState,
+                           unsigned& height) const;
+
+  /**
+   * Builds the JSON result for a historical game state, including
+   * some meta information like the block hash and height.
+   */
+  Json::Value HistoricalStateToJson (const uint256& hash, unsigned height,
+                                     const GameStateData& gameState) const;
+
   friend class GameTestFixture;
 
 public:
 
+  class ProfileError;
+  class StatePageError;
+  class TuningError;
+
+  /** Maximum number of entries that can be requested per state page.  */
+  static constexpr unsigned MAX_STATE_PAGE_SIZE = 10000;
+
   explicit Game (const std::string& id);
 
   Game () = delete;
@@ -271,6 +680,146 @@ public:
    */
   void EnablePruning (unsigned nBlocks);
 
+  /**
+   * Enables (or reconfigures) the in-memory history of recent blocks, which
+   * allows to query past game states with GetStateAtBlock and
+   * GetStateAtHeight.  The last nBlocks blocks are kept.  The full state is
+   * stored for every keyframeInterval-th block (zero to disable keyframes),
+   * and up to cacheSize reconstructed states are cached.
+   *
+   * Past states are reconstructed with ProcessBackwards and converted with
+   * GameStateToJson without holding the main lock, i.e. possibly in
+   * parallel to ProcessForward on another thread.  This must thus only be
+   * used with game logics where this is safe and where the game-state data
+   * itself encodes the state (which is not the case for SQLiteGame).
+   */
+  void EnableStateHistory (unsigned nBlocks, unsigned keyframeInterval,
+                           unsigned cacheSize);
+
+  /**
+   * Enables (or reconfigures) the in-memory archive of moves in the last
+   * nBlocks blocks, which allows to query them by name with GetMovesByName.
+   */
+  void EnableMoveArchive (unsigned nBlocks);
+
+  /**
+   * Enables the cache of results for up to n detached blocks.  When such
+   * a block is attached again on top of the same parent (which is common
+   * during chain races), the cached new state and undo data are passed to
+   * GameLogic::ReapplyForward instead of running ProcessForward again.
+   * This must only be used with game logics that support ReapplyForward
+   * (like SQLiteGame) or that keep all their state in the GameStateData.
+   * Must not be called after Start() or Run().
+   */
+  void EnableDetachedBlockCache (unsigned n);
+
+  /**
+   * Enables local checkpoints of the game state.  Every interval blocks,
+   * a checkpoint is written to the given directory, and the newest keep
+   * checkpoints are retained.  If a block needs to be detached for which
+   * no undo data is available anymore, the newest checkpoint that is
+   * still on the main chain is restored and the game syncs forward from
+   * there instead of from its genesis block.
+   *
+   * If the storage supports snapshots, checkpoints are written from one on
+   * a background thread.  Failures to write them are logged and skipped.
+   *
+   * Must not be called after Start() or Run().
+   */
+  void EnableCheckpoints (const std::string& dir, unsigned interval,
+                          unsigned keep);
+
+  /**
+   * Enables parallel conversion of the game state to JSON with the given
+   * number of extra worker threads.  This only has an effect for game logics
+   * that support GameLogic::PartitionState.  Unchanged partitions are reused
+   * between blocks based on their fingerprints.
+   *
+   * Must not be called after Start() or Run().
+   */
+  void EnableParallelRendering (unsigned threads);
+
+  /**
+   * Enables computation of derived data with GameLogic::ComputeDerivedData
+   * on a background thread.  Whenever the game is up-to-date and the state
+   * changes, the data is computed for the new state (cancelling a running
+   * computation for an older one).  The latest result is returned by
+   * GetDerivedData.  Must be called after the game logic has been set,
+   * and not after Start() or Run().
+   */
+  void EnableDerivedData ();
+
+  /**
+   * Enables accounting of processing costs, which tracks the capacity most
+   * expensive moves and names.  The game logic can attribute time to moves
+   * through GameLogic::GetCostAccounting; the results are returned in
+   * GetMetrics.  Must not be called after Start() or Run() have been called.
+   */
+  void EnableCostAccounting (unsigned capacity);
+
+  /**
+   * Enables a global memory budget of the given number of bytes for the
+   * in-memory caches (state history, move archive, detached blocks and
+   * parallel rendering).  After each block, the budget is split between the
+   * enabled caches by priority and usage, and caches using more than their
+   * share are shrunk.  The usage is reported in GetMetrics.
+   *
+   * Must not be called after Start() or Run().
+   */
+  void EnableMemoryBudget (uint64_t bytes);
+
+  /**
+   * Enables export of the current game state into the POSIX shared-memory
+   * segment with the given name (e.g. "/mv-state").  Whenever the state
+   * changes while the game is up-to-date, the raw GameStateData is written
+   * there together with its block hash, height and a version counter.
+   * Other processes on the same host can read it with SharedStateReader.
+   * The segment is removed again when the Game is destructed.
+   *
+   * This is only useful for games that keep their full state in the
+   * GameStateData.  For SQLiteGame, it is just a handle and the actual
+   * state lives in the database, so readers would not get anything useful.
+   * Note also that the full state is copied into the segment for every
+   * block while holding the game's lock, which adds to the block processing
+   * time for large states.
+   *
+   * Must not be called after Start() or Run().
+   */
+  void EnableSharedStateExport (const std::string& name);
+
+  /**
+   * Enables writing the game state as JSON into per-block files in the given
+   * directory, so that it can be served by a static web server.  After each
+   * block while up-to-date, the state is written to "<blockhash>.json"
+   * (and "<blockhash>.json.gz" if compress is set), and the "current.json"
+   * symlink is atomically updated to point to it.  Only files for the
+   * newest keep blocks are retained.
+   *
+   * While catching up, files are written at most once every
+   * catchingUpMillis milliseconds, or not at all if that is zero.
+   *
+   * Must not be called after Start() or Run().
+   */
+  void EnableStateFiles (const std::string& dir, unsigned keep, bool compress,
+                         unsigned catchingUpMillis);
+
+  /**
+   * Enables the built-in sampling CPU profiler (see Profile), which writes
+   * its results into the given directory.
+   *
+   * Must not be called after Start() or Run().
+   */
+  void EnableProfiling (const std::string& dir);
+
+  /**
+   * Enables recording of wait and hold times for the game's main lock,
+   * which are then reported (in total and for the most contended calling
+   * functions) in GetMetrics.
+   *
+   * Must not be called after Start() or Run().
+   */
+  void EnableLockProfiling ();
+
   /**
    * Sets the ZMQ endpoint that will be used to connect to the ZMQ interface
    * of the Xaya daemon.  Must not be called anymore after Start() or
@@ -282,6 +831,64 @@ public:
     zmq.SetEndpoint (addr);
   }
 
+  /**
+   * Adds the ZMQ endpoint of another Xaya daemon (on the same chain), from
+   * which block notifications are received in addition to the main one.
+   * Each notification is processed as soon as the first copy of it arrives
+   * from any daemon, which hedges against one of them being slow.  Must not
+   * be called anymore after Start() or Run() have been called.
+   */
+  void
+  AddAdditionalZmqEndpoint (const std::string& addr)
+  {
+    zmq.AddAdditionalEndpoint (addr);
+  }
+
+  /**
+   * Sets the CPU affinity and priority for the thread that receives block
+   * notifications and processes the blocks.  Must not be called anymore
+   * after Start() or Run() have been called.
+   */
+  void
+  SetBlockProcessingThreadConfig (const ThreadConfig& cfg)
+  {
+    zmq.SetWorkerThreadConfig (cfg);
+  }
+
+  /**
+   * Sets the CPU affinity and priority for threads serving RPC requests.
+   * Since those threads are typically created by the RPC server library,
+   * the configuration is applied by ConfigureRpcThread when they first
+   * handle a request.  Must not be called anymore after Start() or Run()
+   * have been called.
+   */
+  void SetRpcThreadConfig (const ThreadConfig& cfg);
+
+  /**
+   * Names the calling thread as RPC thread and applies the configuration
+   * set with SetRpcThreadConfig, unless this has been done already for it.
+   * This should be called by RPC servers before handling each request.
+   */
+  void ConfigureRpcThread () const;
+
+  /**
+   * Enables publishing of state changes through a ZMQ PUB socket bound
+   * at the given endpoint.  Whenever the current game state or sync state
+   * changes, a message with topic "game-state json GAMEID" is sent.  Its
+   * payload is a JSON object with the block hash, height and sync state,
+   * and depending on the mode also the game state.  The sequence numbers
+   * follow the same scheme as the Xaya daemon's notifications.
+   *
+   * While catching up, blocks are processed in batched transactions, and
+   * notifications are sent for each block before its batch is committed.
+   * Until then, readers outside of Game (e.g. through a separate database
+   * connection) may not yet see the announced block.
+   *
+   * Must not be called after Start() or Run() have been called.
+   */
+  void EnableStatePublisher (const std::string& endpoint,
+                             StatePublishMode mode);
+
   /**
    * Detects the ZMQ endpoint by calling getzmqnotifications on the Xaya
    * daemon.  Returns false if pubgameblocks is not enabled.
@@ -326,6 +933,177 @@ public:
    */
   Json::Value GetCurrentJsonState () const;
 
+  /**
+   * Returns a JSON object like GetCurrentJsonState, but with the raw
+   * GameStateData (base64-encoded) in the "rawstate" field instead of
+   * the JSON-converted game state.  This skips GameStateToJson entirely,
+   * which can save a lot of work for large states when the client is able
+   * to decode the game's native state format itself.
+   */
+  Json::Value GetCurrentRawState () const;
+
+  /**
+   * Returns a JSON object like GetCurrentJsonState, but with the game state
+   * compressed if it is large.  The encoding is negotiated from a list of
+   * accepted encodings in the format of an HTTP Accept-Encoding header
+   * (e.g. "gzip, deflate").  The used encoding is returned in the
+   * "encoding" field.  If it is "identity", then the game state is in
+   * "gamestate" as usual.  Otherwise, the compressed JSON text of the game
+   * state is in "compressedgamestate" as base64.
+   *
+   * The converted and compressed game state is cached per block, so
+   * that multiple clients requesting it cause only a single compression.
+   */
+  Json::Value GetCurrentCompressedState (const std::string& accepted) const;
+
+  /**
+   * Sets the minimum size (in bytes of JSON text) for which the game state
+   * is compressed by GetCurrentCompressedState.  Smaller states are returned
+   * uncompressed, since the saved bandwidth would not be worth the effort.
+   * A negative value disables compression entirely.
+   */
+  void SetCompressionThreshold (int threshold);
+
+  /**
+   * Sets the sizes for batches of atomic transactions (in blocks) while
+   * catching up and while up-to-date.  Larger batches speed up syncing,
+   * but all blocks of a batch need to be reprocessed if the batch fails.
+   * Both values must be at least one, which disables batching.
+   */
+  void SetTransactionBatchSizes (unsigned catchingUp, unsigned upToDate);
+
+  /**
+   * Sets a time limit (in milliseconds) after which a batch of transactions
+   * is committed with the next processed block even if it is not yet full.
+   * Zero disables the limit.
+   */
+  void SetBatchFlushTimeLimit (unsigned millis);
+
+  /**
+   * Sets how often waiters in WaitForChange are woken up while the game is
+   * not up-to-date (e.g. catching up with thousands of blocks per second).
+   * They are woken up for a new block if at least millis milliseconds
+   * have passed or at least blocks blocks have been processed since the last
+   * wakeup.  Zero disables the respective limit; if both are zero, waiters
+   * are woken up for every block.  They are always woken up when catching
+   * up reaches its target block.
+   */
+  void SetCatchingUpNotifyLimits (unsigned millis, unsigned blocks);
+
+  /**
+   * Returns the current values of parameters that can be tuned at runtime
+   * with SetTuning, as JSON object.
+   */
+  Json::Value GetTuning () const;
+
+  /**
+   * Changes parameters at runtime.  The argument is a JSON object in the
+   * format returned by GetTuning, where only the fields that should be changed
+   * need to be present:
+   *
+   *  - batchsize: object with catchingup and uptodate batch sizes
+   *  - flushmillis: the batch flush time limit
+   *  - catchingupnotify: object with millis and blocks limits for waking up
+   *    waiters while not up-to-date (see SetCatchingUpNotifyLimits)
+   *  - pruning: the number of blocks to keep undo data for (this can enable
+   *    pruning, but not disable it again; GetTuning omits the field if
+   *    pruning is disabled)
+   *  - compressionthreshold: see SetCompressionThreshold
+   *  - statehistory: object with blocks, keyframes and cache (if the
+   *    state history is enabled)
+   *  - movearchive: number of blocks in the move archive (if enabled)
+   *  - detachedblocks: capacity of the detached-block cache (if enabled)
+   *  - memorybudget: the memory budget for caches in bytes (if enabled)
+   *  - verbosity: the glog verbosity level for VLOG (set for all modules
+   *    through google::SetVLOGLevel)
+   *
+   * If any field is invalid, TuningError is thrown and nothing is changed.
+   *
+   * Changes to the batch sizes, flush time limit and pruning are recorded
+   * here, but only take effect on the block-processing thread when the
+   * next block is attached or detached.  Thus a batch that is open at the
+   * moment is never committed from the calling (RPC) thread.
+   */
+  void SetTuning (const Json::Value& params);
+
+  /**
+   * Returns one page of the current game state, as converted by
+   * GameLogic::GameStateToJsonPage.  The result contains the same meta
+   * data as GetCurrentJsonState, and the page's entries in "entries".
+   * If there are more entries, an opaque "cursor" string is returned as
+   * well, which can be passed to the next call to continue.
+   *
+   * The cursor is bound to the block at which paging started.  If the
+   * current state has changed in the mean time, the remaining pages are
+   * served from the state history (if enabled and the block is still
+   * available there), so that clients see a consistent snapshot.  Otherwise,
+   * StatePageError is thrown and the client has to start over.
+   *
+   * StatePageError is also thrown for invalid cursors or page sizes,
+   * and if the game does not support paging.
+   *
+   * Each call reads the full game state and passes it to the game, so the
+   * cost of a page is linear in the size of the state; only the returned
+   * JSON and its conversion are bounded by the page size.  If the storage
+   * supports snapshots, the state is read through one, so that it is not
+   * copied while holding the game's lock.
+   */
+  Json::Value GetStatePage (const std::string& cursor, unsigned limit) const;
+
+  /**
+   * Returns the game state (converted to JSON) at the given block, if
+   * that block is known in the state history.  Returns JSON null if the
+   * state is not available, e.g. because the block is too old or the
+   * state history is not enabled.
+   */
+  Json::Value GetStateAtBlock (const uint256& hash) const;
+
+  /**
+   * Returns the game state (converted to JSON) at the given height of the
+   * current chain, if that height is within the state history.  Returns JSON
+   * null if it is not.
+   */
+  Json::Value GetStateAtHeight (unsigned height) const;
+
+  /**
+   * Returns the latest (up to limit) moves sent by the given name within
+   * the blocks kept in the move archive, newest first.  The result contains
+   * the moves in "moves", together with the current block hash and height
+   * in the same format as GetCurrentJsonState.  Returns JSON null if the
+   * move archive is not enabled or not in sync with the current state.
+   */
+  Json::Value GetMovesByName (const std::string& name, unsigned limit) const;
+
+  /**
+   * Returns the latest result of the derived-data computation, together
+   * with the block hash of the state it belongs to and a version number
+   * that is increased for each new result.  Returns JSON null if derived
+   * data is not enabled or not yet available.  This does not wait for
+   * block processing to finish.
+   */
+  Json::Value GetDerivedData () const;
+
+  /**
+   * Returns internal metrics of the game daemon as JSON object, e.g. the
+   * most expensive moves and names if cost accounting is enabled, and heap
+   * allocations per processing phase if allocation counting is compiled in,
+   * as well as statistics of the detached-block cache and of the
+   * derived-data computation, and lock contention if lock profiling
+   * is enabled.
+   * This does not wait for block processing to finish.
+   */
+  Json::Value GetMetrics () const;
+
+  /**
+   * Samples the stacks of all threads of the process while they use CPU
+   * for the given number of seconds, and writes the result as folded stacks
+   * (for flame graphs) into a new file in the profiling directory.  Blocks
+   * the calling thread (but nothing else) until done, and returns the file
+   * name and statistics about the profile.  Returns JSON null if profiling
+   * is not enabled.  Throws ProfileError if the profile cannot be written.
+   */
+  Json::Value Profile (unsigned seconds) const;
+
   /**
    * Blocks the calling thread until a change to the game state has
    * (potentially) been made.  This can be used to implement long-polling
@@ -368,6 +1146,46 @@ public:
 
 };
 
+/**
+ * Exception thrown by Game::GetStatePage if the request can not be served,
+ * e.g. because the cursor is invalid or refers to a state that is no
+ * longer available.
+ */
+class Game::StatePageError : public std::runtime_error
+{
+
+public:
+
+  using std::runtime_error::runtime_error;
+
+};
+
+/**
+ * Exception thrown by Game::Profile if the profile could not be written
+ * (e.g. because the disk is full).
+ */
+class Game::ProfileError : public std::runtime_error
+{
+
+public:
+
+  using std::runtime_error::runtime_error;
+
+};
+
+/**
+ * Exception thrown by Game::SetTuning if the requested parameters
+ * are invalid.
+ */
+class Game::TuningError : public std::runtime_error
+{
+
+public:
+
+  using std::runtime_error::runtime_error;
+
+};
+
 } // namespace xaya
 
 #endif // XAYAGAME_GAME_HPP
@@ -4,6 +4,8 @@
 
 #include "game.hpp"
 
+#include "base64.hpp"
+#include "compression.hpp"
 #include "gamelogic.hpp"
 #include "uint256.hpp"
 
@@ -17,15 +19,27 @@
 #include <jsonrpccpp/server.h>
 #include <jsonrpccpp/server/connectors/httpserver.h>
 
+#include <zmq.hpp>
+
+#include <unistd.h>
+
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
 
 #include <glog/logging.h>
 
+#include <experimental/filesystem>
+
+#include <atomic>
+#include <chrono>
 #include <cstdio>
+#include <fstream>
+#include <future>
 #include <map>
 #include <sstream>
 #include <string>
+#include <thread>
+#include <vector>
 
 namespace xaya
 {
@@ -35,10 +49,14 @@ namespace
 using testing::_;
 using testing::AnyNumber;
 using testing::InSequence;
+using testing::InvokeWithoutArgs;
 using testing::Return;
 
 constexpr int HTTP_PORT = 32100;
 
+constexpr const char PUBLISHER_ENDPOINT[]
+    = "ipc:///tmp/xayagame_game_tests_publisher";
+
 constexpr const char GAME_ID[] = "test-game";
 
 constexpr const char NO_REQ_TOKEN[] = "";
@@ -256,6 +274,8 @@ public:
 
     for (const auto& m : blockData["moves"])
       {
+        MoveCostScope cost(GetCostAccounting (), m);
+
         const std::string name = m["name"].asString ();
         const std::string value = m["move"].asString ();
         CHECK_NE (value, ".");
@@ -305,6 +325,40 @@ public:
     return res;
   }
 
+  bool
+  GameStateToJsonPage (const GameStateData& state,
+                       const std::string* startAfter, const unsigned limit,
+                       Json::Value& entries, bool& more) override
+  {
+    const Map m = DecodeMap (state);
+
+    entries = Json::Value (Json::objectValue);
+    more = false;
+    auto it = m.begin ();
+    if (startAfter != nullptr)
+      it = m.upper_bound (*startAfter);
+    for (; it != m.end (); ++it)
+      {
+        if (entries.size () == limit)
+          {
+            more = true;
+            break;
+          }
+        entries[it->first] = it->second;
+      }
+
+    return true;
+  }
+
+  bool
+  ComputeDerivedData (const GameStateData& state,
+                      const std::function<bool ()>& cancelled,
+                      Json::Value& result) override
+  {
+    result = static_cast<int> (DecodeMap (state).size ());
+    return true;
+  }
+
   static uint256
   GenesisBlockHash ()
   {
@@ -693,6 +747,195 @@ TEST_F (GetCurrentJsonStateTests, HeightResolvedViaRpc)
   EXPECT_EQ (state["gamestate"]["state"], "");
 }
 
+TEST_F (GetCurrentJsonStateTests, NotBlockedByReinitialisation)
+{
+  Json::Value blockHeaderData(Json::objectValue);
+  blockHeaderData["height"] = 42;
+  EXPECT_CALL (mockXayaServer, getblockheader (GAME_GENESIS_HASH))
+      .WillOnce (Return (blockHeaderData));
+
+  mockXayaServer.SetBestBlock (GAME_GENESIS_HEIGHT,
+                               TestGame::GenesisBlockHash ());
+  ReinitialiseState (g);
+
+  /* Reinitialise a fresh game without cached height, where the daemon
+     blocks in game_sendupdates.  Reading the state in the mean time must
+     not block on the RPC lock.  */
+  Game freshGame(GAME_ID);
+  freshGame.ConnectRpcClient (httpClient);
+  freshGame.SetStorage (&storage);
+  freshGame.SetGameLogic (&rules);
+
+  std::promise<void> inUpdates;
+  std::promise<void> release;
+  std::shared_future<void> released = release.get_future ().share ();
+
+  Json::Value upd(Json::objectValue);
+  upd["toblock"] = BlockHash (20).ToHex ();
+  upd["reqtoken"] = "reqtoken";
+  EXPECT_CALL (mockXayaServer, game_sendupdates (GAME_GENESIS_HASH, GAME_ID))
+      .WillOnce (InvokeWithoutArgs ([&] ()
+        {
+          inUpdates.set_value ();
+          released.wait ();
+          return upd;
+        }));
+
+  mockXayaServer.SetBestBlock (20, BlockHash (20));
+  std::thread reinit ([this, &freshGame] ()
+    {
+      ReinitialiseState (freshGame);
+    });
+  inUpdates.get_future ().wait ();
+
+  auto reader = std::async (std::launch::async, [&freshGame] ()
+    {
+      return freshGame.GetCurrentJsonState ();
+    });
+  const bool done = reader.wait_for (std::chrono::seconds (5))
+                      == std::future_status::ready;
+
+  release.set_value ();
+  reinit.join ();
+
+  ASSERT_TRUE (done);
+  const Json::Value state = reader.get ();
+  EXPECT_EQ (state["state"], "unknown");
+  EXPECT_EQ (state["blockhash"], GAME_GENESIS_HASH);
+  EXPECT_EQ (state["height"].asInt (), 42);
+  EXPECT_EQ (GetState (freshGame), State::CATCHING_UP);
+}
+
+using GetCurrentRawStateTests = InitialStateTests;
+
+TEST_F (GetCurrentRawStateTests, NoStateYet)
+{
+  const Json::Value state = g.GetCurrentRawState ();
+  EXPECT_EQ (state["gameid"], GAME_ID);
+  EXPECT_EQ (state["state"], "unknown");
+  EXPECT_FALSE (state.isMember ("blockhash"));
+  EXPECT_FALSE (state.isMember ("rawstate"));
+}
+
+TEST_F (GetCurrentRawStateTests, WhenUpToDate)
+{
+  mockXayaServer.SetBestBlock (GAME_GENESIS_HEIGHT,
+                               TestGame::GenesisBlockHash ());
+  ReinitialiseState (g);
+  SetStartingBlock (TestGame::GenesisBlockHash ());
+  AttachBlock (g, BlockHash (11), Moves ("a0b1"));
+
+  const Json::Value state = g.GetCurrentRawState ();
+  EXPECT_EQ (state["gameid"], GAME_ID);
+  EXPECT_EQ (state["chain"], "main");
+  EXPECT_EQ (state["state"], "up-to-date");
+  EXPECT_EQ (state["blockhash"], BlockHash (11).ToHex ());
+  EXPECT_EQ (state["height"].asInt (), 2);
+  EXPECT_FALSE (state.isMember ("gamestate"));
+
+  std::string raw;
+  ASSERT_TRUE (DecodeBase64 (state["rawstate"].asString (), raw));
+  EXPECT_EQ (raw, "a0b1");
+}
+
+class GetCurrentCompressedStateTests : public InitialStateTests
+{
+
+protected:
+
+  GetCurrentCompressedStateTests ()
+  {
+    mockXayaServer.SetBestBlock (GAME_GENESIS_HEIGHT,
+                                 TestGame::GenesisBlockHash ());
+    ReinitialiseState (g);
+    SetStartingBlock (TestGame::GenesisBlockHash ());
+    AttachBlock (g, BlockHash (11), Moves ("a0b1"));
+  }
+
+  /**
+   * Decodes the compressed game state from a result and returns it
+   * as parsed JSON.
+   */
+  static Json::Value
+  DecodeCompressedState (const Json::Value& res, const ContentEncoding enc)
+  {
+    EXPECT_FALSE (res.isMember ("gamestate"));
+
+    std::string compressed, text;
+    CHECK (DecodeBase64 (res["compressedgamestate"].asString (), compressed));
+    CHECK (DecompressData (compressed, enc, text));
+
+    Json::Value val;
+    std::istringstream in(text);
+    in >> val;
+    return val;
+  }
+
+};
+
+TEST_F (GetCurrentCompressedStateTests, BelowThreshold)
+{
+  const Json::Value state = g.GetCurrentCompressedState ("gzip");
+  EXPECT_EQ (state["gameid"], GAME_ID);
+  EXPECT_EQ (state["state"], "up-to-date");
+  EXPECT_EQ (state["blockhash"], BlockHash (11).ToHex ());
+  EXPECT_EQ (state["height"].asInt (), 2);
+  EXPECT_EQ (state["encoding"], "identity");
+  EXPECT_EQ (state["gamestate"]["state"], "a0b1");
+  EXPECT_FALSE (state.isMember ("compressedgamestate"));
+}
+
+TEST_F (GetCurrentCompressedStateTests, Compressed)
+{
+  g.SetCompressionThreshold (0);
+
+  Json::Value state = g.GetCurrentCompressedState ("gzip, deflate");
+  EXPECT_EQ (state["blockhash"], BlockHash (11).ToHex ());
+  EXPECT_EQ (state["encoding"], "gzip");
+  EXPECT_EQ (DecodeCompressedState (state, ContentEncoding::GZIP),
+             g.GetCurrentJsonState ()["gamestate"]);
+
+  state = g.GetCurrentCompressedState ("deflate");
+  EXPECT_EQ (state["encoding"], "deflate");
+  EXPECT_EQ (DecodeCompressedState (state, ContentEncoding::DEFLATE),
+             g.GetCurrentJsonState ()["gamestate"]);
+
+  state = g.GetCurrentCompressedState ("br");
+  EXPECT_EQ (state["encoding"], "identity");
+  EXPECT_EQ (state["gamestate"]["state"], "a0b1");
+}
+
+TEST_F (GetCurrentCompressedStateTests, Disabled)
+{
+  g.SetCompressionThreshold (-1);
+
+  const Json::Value state = g.GetCurrentCompressedState ("gzip");
+  EXPECT_EQ (state["encoding"], "identity");
+  EXPECT_EQ (state["gamestate"]["state"], "a0b1");
+}
+
+TEST_F (GetCurrentCompressedStateTests, FollowsNewBlocks)
+{
+  g.SetCompressionThreshold (0);
+
+  Json::Value state = g.GetCurrentCompressedState ("gzip");
+  EXPECT_EQ (DecodeCompressedState (state, ContentEncoding::GZIP)["state"],
+             "a0b1");
+
+  AttachBlock (g, BlockHash (12), Moves ("a2"));
+  state = g.GetCurrentCompressedState ("gzip");
+  EXPECT_EQ (state["blockhash"], BlockHash (12).ToHex ());
+  EXPECT_EQ (DecodeCompressedState (state, ContentEncoding::GZIP)["state"],
+             "a2b1");
+  EXPECT_EQ (g.GetCurrentJsonState ()["gamestate"]["state"], "a2b1");
+
+  DetachBlock (g);
+  state = g.GetCurrentCompressedState ("gzip");
+  EXPECT_EQ (state["blockhash"], BlockHash (11).ToHex ());
+  EXPECT_EQ (DecodeCompressedState (state, ContentEncoding::GZIP)["state"],
+             "a0b1");
+}
+
 /* ************************************************************************** */
 
 class WaitForChangeTests : public InitialStateTests
@@ -703,9 +946,13 @@ private:
   /** The thread that is used to call WaitForChange.  */
   std::unique_ptr<std::thread> waiter;
 
+  /** Set to true when the waiter's WaitForChange call has returned.  */
+  std::atomic<bool> waiterDone;
+
 protected:
 
   WaitForChangeTests ()
+    : waiterDone(false)
   {
     /* Since WaitForChange only really blocks when there is an active
        ZMQ subscriber, we need to set up a fake one.  So we can just use
@@ -736,12 +983,23 @@ protected:
   CallWaitForChange (uint256* bestBlock)
   {
     ASSERT_EQ (waiter, nullptr);
+    waiterDone = false;
     waiter = std::make_unique<std::thread> ([this, bestBlock] ()
       {
         g.WaitForChange (bestBlock);
+        waiterDone = true;
       });
   }
 
+  /**
+   * Returns true if the current waiter has already been woken up.
+   */
+  bool
+  IsWaiterDone () const
+  {
+    return waiterDone;
+  }
+
   /**
    * Verifies that a waiter has been started and received the notification
    * of a new state already (or waits for it to receive it).
@@ -836,6 +1094,120 @@ TEST_F (WaitForChangeTests, ReturnsBestBlock)
   EXPECT_TRUE (bestBlock == TestGame::GenesisBlockHash ());
 }
 
+TEST_F (WaitForChangeTests, CoalescedWhileCatchingUp)
+{
+  mockXayaServer.SetBestBlock (10, TestGame::GenesisBlockHash ());
+  ReinitialiseState (g);
+  EXPECT_EQ (GetState (g), State::UP_TO_DATE);
+
+  g.SetCatchingUpNotifyLimits (0, 2);
+
+  Json::Value upd(Json::objectValue);
+  upd["toblock"] = BlockHash (13).ToHex ();
+  upd["reqtoken"] = "reqtoken";
+  EXPECT_CALL (mockXayaServer, game_sendupdates (GAME_GENESIS_HASH, GAME_ID))
+      .WillOnce (Return (upd));
+
+  mockXayaServer.SetBestBlock (13, BlockHash (13));
+  ReinitialiseState (g);
+  EXPECT_EQ (GetState (g), State::CATCHING_UP);
+
+  uint256 bestBlock;
+  CallWaitForChange (&bestBlock);
+  SleepSome ();
+
+  CallBlockAttach (g, "reqtoken",
+                   TestGame::GenesisBlockHash (), BlockHash (11), 11,
+                   Moves (""), NO_SEQ_MISMATCH);
+  SleepSome ();
+  EXPECT_FALSE (IsWaiterDone ());
+
+  CallBlockAttach (g, "reqtoken", BlockHash (11), BlockHash (12), 12,
+                   Moves (""), NO_SEQ_MISMATCH);
+  JoinWaiter ();
+  EXPECT_EQ (bestBlock, BlockHash (12));
+
+  /* Reaching the target block wakes up waiters right away.  */
+  CallWaitForChange (&bestBlock);
+  SleepSome ();
+  CallBlockAttach (g, "reqtoken", BlockHash (12), BlockHash (13), 13,
+                   Moves (""), NO_SEQ_MISMATCH);
+  JoinWaiter ();
+  EXPECT_EQ (bestBlock, BlockHash (13));
+  EXPECT_EQ (GetState (g), State::UP_TO_DATE);
+}
+
+TEST_F (WaitForChangeTests, GenesisResetsCoalescing)
+{
+  mockXayaServer.SetBestBlock (10, TestGame::GenesisBlockHash ());
+  ReinitialiseState (g);
+  EXPECT_EQ (GetState (g), State::UP_TO_DATE);
+
+  g.SetCatchingUpNotifyLimits (0, 2);
+
+  Json::Value upd(Json::objectValue);
+  upd["toblock"] = BlockHash (13).ToHex ();
+  upd["reqtoken"] = "reqtoken";
+  EXPECT_CALL (mockXayaServer, game_sendupdates (GAME_GENESIS_HASH, GAME_ID))
+      .Times (2)
+      .WillRepeatedly (Return (upd));
+
+  mockXayaServer.SetBestBlock (13, BlockHash (13));
+  ReinitialiseState (g);
+  EXPECT_EQ (GetState (g), State::CATCHING_UP);
+
+  /* Leave one block without a wakeup, and then reset to the genesis state.
+     That wakes up waiters, so that the count of skipped blocks starts
+     again from zero.  */
+  CallBlockAttach (g, "reqtoken",
+                   TestGame::GenesisBlockHash (), BlockHash (11), 11,
+                   Moves (""), NO_SEQ_MISMATCH);
+  storage.Clear ();
+  ReinitialiseState (g);
+  EXPECT_EQ (GetState (g), State::CATCHING_UP);
+
+  uint256 bestBlock;
+  CallWaitForChange (&bestBlock);
+  SleepSome ();
+
+  CallBlockAttach (g, "reqtoken",
+                   TestGame::GenesisBlockHash (), BlockHash (11), 11,
+                   Moves (""), NO_SEQ_MISMATCH);
+  SleepSome ();
+  EXPECT_FALSE (IsWaiterDone ());
+
+  CallBlockAttach (g, "reqtoken", BlockHash (11), BlockHash (12), 12,
+                   Moves (""), NO_SEQ_MISMATCH);
+  JoinWaiter ();
+  EXPECT_EQ (bestBlock, BlockHash (12));
+}
+
+TEST_F (WaitForChangeTests, EveryBlockWithoutLimits)
+{
+  mockXayaServer.SetBestBlock (10, TestGame::GenesisBlockHash ());
+  ReinitialiseState (g);
+
+  g.SetCatchingUpNotifyLimits (0, 0);
+
+  Json::Value upd(Json::objectValue);
+  upd["toblock"] = BlockHash (12).ToHex ();
+  upd["reqtoken"] = "reqtoken";
+  EXPECT_CALL (mockXayaServer, game_sendupdates (GAME_GENESIS_HASH, GAME_ID))
+      .WillOnce (Return (upd));
+
+  mockXayaServer.SetBestBlock (12, BlockHash (12));
+  ReinitialiseState (g);
+  EXPECT_EQ (GetState (g), State::CATCHING_UP);
+
+  CallWaitForChange (nullptr);
+  SleepSome ();
+  CallBlockAttach (g, "reqtoken",
+                   TestGame::GenesisBlockHash (), BlockHash (11), 11,
+                   Moves (""), NO_SEQ_MISMATCH);
+  JoinWaiter ();
+  EXPECT_EQ (GetState (g), State::CATCHING_UP);
+}
+
 /* ************************************************************************** */
 
 class SyncingTests : public InitialStateTests
@@ -1188,60 +1560,1076 @@ TEST_F (PruningTests, MissedZmq)
 
 /* ************************************************************************** */
 
-/**
- * Helper subclass of MemoryStorage that allows us to fail (throw an exception)
- * when setting the current state.
- */
-class FallibleMemoryStorage : public TxMockedMemoryStorage
+class StateAtBlockTests : public SyncingTests
 {
 
-private:
-
-  /** Whether or not SetCurrentGameState should fail.  */
-  bool shouldFail = false;
-
-public:
+protected:
 
-  class Failure : public std::runtime_error
+  StateAtBlockTests ()
   {
-
-  public:
-
-    Failure ()
-      : std::runtime_error("failing memory storage")
-    {}
-
-  };
+    g.EnableStateHistory (2, 0, 10);
+  }
 
   /**
-   * Sets whether or not SetCurrentGameState calls should fail (throw an
-   * exception) when called instead of changing the game state.
+   * Expects that the given JSON result is a historical state for the given
+   * block hash, height and game state.
    */
-  void
-  SetShouldFail (const bool val)
-  {
-    shouldFail = val;
-  }
-
-  void
-  SetCurrentGameState (const uint256& hash, const GameStateData& data) override
+  static void
+  ExpectHistoricalState (const Json::Value& res, const uint256& hash,
+                         const unsigned height, const std::string& state)
   {
-    if (shouldFail)
-      {
-        LOG (INFO) << "Failing call to SetCurrentGameState on purpose";
-        throw Failure ();
-      }
-    MemoryStorage::SetCurrentGameState (hash, data);
+    ASSERT_TRUE (res.isObject ());
+    EXPECT_EQ (res["gameid"], GAME_ID);
+    EXPECT_EQ (res["chain"], "main");
+    EXPECT_EQ (res["blockhash"], hash.ToHex ());
+    EXPECT_EQ (res["height"].asInt (), height);
+    EXPECT_EQ (res["gamestate"]["state"], state);
   }
 
 };
 
-class GameLogicTransactionsTests : public SyncingTests
+TEST_F (StateAtBlockTests, NotEnabled)
 {
+  Game other(GAME_ID);
+  EXPECT_TRUE (other.GetStateAtBlock (BlockHash (11)).isNull ());
+  EXPECT_TRUE (other.GetStateAtHeight (2).isNull ());
+}
 
-protected:
-
-  /** Alternative (fallible) storage used in the tests.  */
+TEST_F (StateAtBlockTests, Window)
+{
+  AttachBlock (g, BlockHash (11), Moves ("a0b1"));
+  AttachBlock (g, BlockHash (12), Moves ("a2c3"));
+  AttachBlock (g, BlockHash (13), Moves ("d4"));
+  ExpectGameState (BlockHash (13), "a2b1c3d4");
+
+  ExpectHistoricalState (g.GetStateAtBlock (BlockHash (13)),
+                         BlockHash (13), 4, "a2b1c3d4");
+  ExpectHistoricalState (g.GetStateAtBlock (BlockHash (12)),
+                         BlockHash (12), 3, "a2b1c3");
+  ExpectHistoricalState (g.GetStateAtHeight (3),
+                         BlockHash (12), 3, "a2b1c3");
+
+  /* Block 11 is outside of the window.  */
+  EXPECT_TRUE (g.GetStateAtBlock (BlockHash (11)).isNull ());
+  EXPECT_TRUE (g.GetStateAtHeight (2).isNull ());
+  EXPECT_TRUE (g.GetStateAtHeight (5).isNull ());
+
+  /* The actual game state is not affected.  */
+  ExpectGameState (BlockHash (13), "a2b1c3d4");
+}
+
+TEST_F (StateAtBlockTests, Detach)
+{
+  AttachBlock (g, BlockHash (11), Moves ("a0b1"));
+  AttachBlock (g, BlockHash (12), Moves ("a2c3"));
+  DetachBlock (g);
+  ExpectGameState (BlockHash (11), "a0b1");
+
+  ExpectHistoricalState (g.GetStateAtHeight (2),
+                         BlockHash (11), 2, "a0b1");
+  EXPECT_TRUE (g.GetStateAtHeight (3).isNull ());
+
+  AttachBlock (g, BlockHash (22), Moves ("x5"));
+  ExpectHistoricalState (g.GetStateAtHeight (3),
+                         BlockHash (22), 3, "a0b1x5");
+}
+
+/* ************************************************************************** */
+
+class MoveArchiveGameTests : public SyncingTests
+{
+
+protected:
+
+  MoveArchiveGameTests ()
+  {
+    g.EnableMoveArchive (2);
+  }
+
+  /**
+   * Looks up the moves by the given name and returns the move values
+   * concatenated, newest first.  Expects that the result matches the
+   * given current block.
+   */
+  std::string
+  GetMoves (const std::string& name, const uint256& currentHash,
+            const unsigned limit = 10)
+  {
+    const Json::Value res = g.GetMovesByName (name, limit);
+    CHECK (res.isObject ());
+    EXPECT_EQ (res["gameid"], GAME_ID);
+    EXPECT_EQ (res["blockhash"], currentHash.ToHex ());
+
+    std::string moves;
+    for (const auto& m : res["moves"])
+      {
+        EXPECT_EQ (m["name"], name);
+        moves += m["move"].asString ();
+      }
+
+    return moves;
+  }
+
+};
+
+TEST_F (MoveArchiveGameTests, NotEnabled)
+{
+  Game other(GAME_ID);
+  EXPECT_TRUE (other.GetMovesByName ("a", 10).isNull ());
+}
+
+TEST_F (MoveArchiveGameTests, NoBlocksYet)
+{
+  EXPECT_TRUE (g.GetMovesByName ("a", 10).isNull ());
+}
+
+TEST_F (MoveArchiveGameTests, AttachAndPrune)
+{
+  AttachBlock (g, BlockHash (11), Moves ("a0b1"));
+  AttachBlock (g, BlockHash (12), Moves ("a2"));
+  EXPECT_EQ (GetMoves ("a", BlockHash (12)), "20");
+  EXPECT_EQ (GetMoves ("a", BlockHash (12), 1), "2");
+  EXPECT_EQ (GetMoves ("b", BlockHash (12)), "1");
+  EXPECT_EQ (GetMoves ("c", BlockHash (12)), "");
+
+  AttachBlock (g, BlockHash (13), Moves ("a3"));
+  EXPECT_EQ (GetMoves ("a", BlockHash (13)), "32");
+  EXPECT_EQ (GetMoves ("b", BlockHash (13)), "");
+
+  const Json::Value res = g.GetMovesByName ("a", 1);
+  ASSERT_EQ (res["moves"].size (), 1);
+  EXPECT_EQ (res["moves"][0]["blockhash"], BlockHash (13).ToHex ());
+  EXPECT_EQ (res["moves"][0]["height"].asInt (), 4);
+}
+
+TEST_F (MoveArchiveGameTests, Detach)
+{
+  AttachBlock (g, BlockHash (11), Moves ("a0"));
+  AttachBlock (g, BlockHash (12), Moves ("a1b2"));
+  DetachBlock (g);
+  EXPECT_EQ (GetMoves ("a", BlockHash (11)), "0");
+  EXPECT_EQ (GetMoves ("b", BlockHash (11)), "");
+
+  AttachBlock (g, BlockHash (22), Moves ("b5"));
+  EXPECT_EQ (GetMoves ("b", BlockHash (22)), "5");
+}
+
+/* ************************************************************************** */
+
+using CostAccountingGameTests = SyncingTests;
+
+TEST_F (CostAccountingGameTests, NotEnabled)
+{
+  AttachBlock (g, BlockHash (11), Moves ("a0"));
+
+  const Json::Value metrics = g.GetMetrics ();
+  EXPECT_EQ (metrics["gameid"], GAME_ID);
+  EXPECT_FALSE (metrics.isMember ("costs"));
+}
+
+TEST_F (CostAccountingGameTests, MovesAndNames)
+{
+  Game other(GAME_ID);
+  other.EnableCostAccounting (10);
+  EXPECT_EQ (other.GetMetrics ()["costs"]["blocks"].asInt (), 0);
+
+  g.EnableCostAccounting (10);
+  AttachBlock (g, BlockHash (11), Moves ("a0b1"));
+  AttachBlock (g, BlockHash (12), Moves ("a2"));
+
+  const Json::Value costs = g.GetMetrics ()["costs"];
+  EXPECT_EQ (costs["blocks"].asInt (), 2);
+  EXPECT_EQ (costs["moves"].asInt (), 3);
+  EXPECT_LE (costs["movemicros"].asUInt64 (),
+             costs["blockmicros"].asUInt64 ());
+
+  std::map<std::string, int> counts;
+  for (const auto& entry : costs["topnames"])
+    counts[entry["name"].asString ()] = entry["count"].asInt ();
+  EXPECT_EQ (counts, (std::map<std::string, int> {{"a", 2}, {"b", 1}}));
+}
+
+/* ************************************************************************** */
+
+class DetachedBlockCacheGameTests : public SyncingTests
+{
+
+protected:
+
+  DetachedBlockCacheGameTests ()
+  {
+    g.EnableDetachedBlockCache (2);
+  }
+
+};
+
+TEST_F (DetachedBlockCacheGameTests, NotEnabled)
+{
+  Game other(GAME_ID);
+  EXPECT_FALSE (other.GetMetrics ().isMember ("detachedblocks"));
+}
+
+TEST_F (DetachedBlockCacheGameTests, Reattach)
+{
+  AttachBlock (g, BlockHash (11), Moves ("a0"));
+  AttachBlock (g, BlockHash (12), Moves ("a1b2"));
+  DetachBlock (g);
+  DetachBlock (g);
+  ExpectGameState (TestGame::GenesisBlockHash (), "");
+
+  /* The moves passed here are different from the original ones.  Since the
+     block hashes are the same, the cached results should be used (i.e. the
+     original moves take effect).  In practice, the moves are of course
+     always the same for a given block hash.  */
+  AttachBlock (g, BlockHash (11), Moves ("a5"));
+  ExpectGameState (BlockHash (11), "a0");
+  AttachBlock (g, BlockHash (12), Moves ("c3"));
+  ExpectGameState (BlockHash (12), "a1b2");
+
+  const Json::Value stats = g.GetMetrics ()["detachedblocks"];
+  EXPECT_EQ (stats["capacity"].asInt (), 2);
+  EXPECT_EQ (stats["entries"].asInt (), 0);
+  EXPECT_EQ (stats["hits"].asInt (), 2);
+  EXPECT_EQ (stats["misses"].asInt (), 2);
+}
+
+TEST_F (DetachedBlockCacheGameTests, DifferentParent)
+{
+  AttachBlock (g, BlockHash (11), Moves ("a0"));
+  AttachBlock (g, BlockHash (12), Moves ("a1b2"));
+  DetachBlock (g);
+  DetachBlock (g);
+
+  AttachBlock (g, BlockHash (21), Moves ("c3"));
+  AttachBlock (g, BlockHash (12), Moves ("d4"));
+  ExpectGameState (BlockHash (12), "c3d4");
+
+  EXPECT_EQ (g.GetMetrics ()["detachedblocks"]["hits"].asInt (), 0);
+}
+
+TEST_F (DetachedBlockCacheGameTests, Tuning)
+{
+  EXPECT_EQ (g.GetTuning ()["detachedblocks"].asInt (), 2);
+  g.SetTuning (ParseJson (R"({"detachedblocks": 5})"));
+  EXPECT_EQ (g.GetTuning ()["detachedblocks"].asInt (), 5);
+}
+
+/* ************************************************************************** */
+
+class DerivedDataGameTests : public SyncingTests
+{
+
+protected:
+
+  DerivedDataGameTests ()
+  {
+    g.EnableDerivedData ();
+  }
+
+  /**
+   * Waits for the derived data to be computed and expects that it matches
+   * the given values.
+   */
+  void
+  ExpectDerivedData (const uint256& hash, const unsigned version,
+                     const int data)
+  {
+    WaitForDerivedData (g);
+
+    const Json::Value res = g.GetDerivedData ();
+    ASSERT_TRUE (res.isObject ());
+    EXPECT_EQ (res["gameid"].asString (), GAME_ID);
+    EXPECT_EQ (res["blockhash"].asString (), hash.ToHex ());
+    EXPECT_EQ (res["version"].asInt (), version);
+    EXPECT_EQ (res["data"].asInt (), data);
+  }
+
+};
+
+TEST_F (DerivedDataGameTests, NotEnabled)
+{
+  Game other(GAME_ID);
+  EXPECT_TRUE (other.GetDerivedData ().isNull ());
+  EXPECT_FALSE (other.GetMetrics ().isMember ("deriveddata"));
+}
+
+TEST_F (DerivedDataGameTests, AttachAndDetach)
+{
+  EXPECT_TRUE (g.GetDerivedData ().isNull ());
+
+  AttachBlock (g, BlockHash (11), Moves ("a0b1"));
+  ExpectDerivedData (BlockHash (11), 1, 2);
+
+  AttachBlock (g, BlockHash (12), Moves ("c2"));
+  ExpectDerivedData (BlockHash (12), 2, 3);
+
+  DetachBlock (g);
+  ExpectDerivedData (BlockHash (11), 3, 2);
+
+  const Json::Value stats = g.GetMetrics ()["deriveddata"];
+  EXPECT_EQ (stats["version"].asInt (), 3);
+  EXPECT_EQ (stats["blockhash"].asString (), BlockHash (11).ToHex ());
+}
+
+/* ************************************************************************** */
+
+class MemoryBudgetGameTests : public SyncingTests
+{
+
+protected:
+
+  MemoryBudgetGameTests ()
+  {
+    g.EnableMoveArchive (10);
+    g.EnableMemoryBudget (1 << 20);
+    g.EnableDetachedBlockCache (10);
+  }
+
+};
+
+TEST_F (MemoryBudgetGameTests, NotEnabled)
+{
+  Game other(GAME_ID);
+  EXPECT_FALSE (other.GetMetrics ().isMember ("memory"));
+  EXPECT_FALSE (other.GetTuning ().isMember ("memorybudget"));
+  EXPECT_THROW (other.SetTuning (ParseJson (R"({"memorybudget": 10})")),
+                Game::TuningError);
+}
+
+TEST_F (MemoryBudgetGameTests, ReportsUsage)
+{
+  AttachBlock (g, BlockHash (11), Moves ("a0b1"));
+  AttachBlock (g, BlockHash (12), Moves ("a2"));
+  DetachBlock (g);
+
+  const Json::Value stats = g.GetMetrics ()["memory"];
+  EXPECT_EQ (stats["budget"].asUInt64 (), 1 << 20);
+  EXPECT_EQ (stats["shrinks"].asInt (), 0);
+
+  const Json::Value& consumers = stats["consumers"];
+  EXPECT_GT (consumers["movearchive"]["usage"].asUInt64 (), 0);
+  EXPECT_GT (consumers["detachedblocks"]["usage"].asUInt64 (), 0);
+  EXPECT_TRUE (consumers.isMember ("renderedstate"));
+  EXPECT_FALSE (consumers.isMember ("statehistory"));
+  EXPECT_FALSE (consumers.isMember ("publishedstate"));
+  EXPECT_FALSE (consumers.isMember ("deriveddata"));
+
+  uint64_t total = 0;
+  for (const auto& c : consumers)
+    total += c["usage"].asUInt64 ();
+  EXPECT_EQ (stats["usage"].asUInt64 (), total);
+}
+
+TEST_F (MemoryBudgetGameTests, RenderedAndDerivedState)
+{
+  g.EnableDerivedData ();
+  AttachBlock (g, BlockHash (11), Moves ("a0b1"));
+  WaitForDerivedData (g);
+  g.GetCurrentJsonState ();
+
+  /* The usage is queried by the next block.  */
+  AttachBlock (g, BlockHash (12), Moves ("c2"));
+  const Json::Value& consumers = g.GetMetrics ()["memory"]["consumers"];
+  EXPECT_GT (consumers["renderedstate"]["usage"].asUInt64 (), 0);
+  EXPECT_GT (consumers["deriveddata"]["usage"].asUInt64 (), 0);
+
+  /* Without budget, the rendered state is dropped.  It is rendered again
+     when requested.  */
+  g.SetTuning (ParseJson (R"({"memorybudget": 0})"));
+  EXPECT_EQ (g.GetCurrentJsonState ()["blockhash"].asString (),
+             BlockHash (12).ToHex ());
+}
+
+TEST_F (MemoryBudgetGameTests, ShrinksCaches)
+{
+  AttachBlock (g, BlockHash (11), Moves ("a0"));
+  AttachBlock (g, BlockHash (12), Moves ("a1"));
+  AttachBlock (g, BlockHash (13), Moves ("a2"));
+  EXPECT_EQ (g.GetMovesByName ("a", 10)["moves"].size (), 3);
+
+  EXPECT_EQ (g.GetTuning ()["memorybudget"].asUInt64 (), 1 << 20);
+  g.SetTuning (ParseJson (R"({"memorybudget": 0})"));
+  EXPECT_EQ (g.GetTuning ()["memorybudget"].asUInt64 (), 0);
+
+  /* The move archive keeps its latest block even without budget.  */
+  EXPECT_EQ (g.GetMovesByName ("a", 10)["moves"].size (), 1);
+  EXPECT_GT (g.GetMetrics ()["memory"]["shrinks"].asInt (), 0);
+
+  AttachBlock (g, BlockHash (14), Moves ("a3"));
+  EXPECT_EQ (g.GetMovesByName ("a", 10)["moves"].size (), 1);
+}
+
+/* ************************************************************************** */
+
+class SharedStateGameTests : public SyncingTests
+{
+
+protected:
+
+  /** Name of the shared-memory segment used.  */
+  const std::string shmName;
+
+  SharedStateGameTests ()
+    : shmName("/xayagame-gametest-" + std::to_string (getpid ()))
+  {
+    g.EnableSharedStateExport (shmName);
+  }
+
+};
+
+TEST_F (SharedStateGameTests, ExportsCurrentState)
+{
+  SharedStateReader reader(shmName);
+  EXPECT_EQ (reader.GetVersion (), 0);
+
+  AttachBlock (g, BlockHash (11), Moves ("a0b1"));
+  AttachBlock (g, BlockHash (12), Moves ("c2"));
+  DetachBlock (g);
+
+  uint256 hash;
+  unsigned height;
+  uint64_t version;
+  GameStateData state;
+  ASSERT_TRUE (reader.Read (hash, height, version, state));
+  EXPECT_EQ (hash, BlockHash (11));
+  EXPECT_EQ (height, 11);
+  EXPECT_EQ (version, 3);
+  EXPECT_EQ (state, "a0b1");
+}
+
+TEST_F (SharedStateGameTests, NotWhileCatchingUp)
+{
+  EXPECT_CALL (mockXayaServer, game_sendupdates (GAME_GENESIS_HASH, GAME_ID))
+      .WillOnce (Return (SendupdatesResponse (BlockHash (12), "reqtoken")));
+
+  mockXayaServer.SetBestBlock (12, BlockHash (12));
+  ReinitialiseState (g);
+  EXPECT_EQ (GetState (g), State::CATCHING_UP);
+
+  SharedStateReader reader(shmName);
+  CallBlockAttach (g, "reqtoken",
+                   TestGame::GenesisBlockHash (), BlockHash (11), 11,
+                   Moves ("a0b1"), NO_SEQ_MISMATCH);
+  EXPECT_EQ (reader.GetVersion (), 0);
+
+  CallBlockAttach (g, "reqtoken", BlockHash (11), BlockHash (12), 12,
+                   Moves ("a2c3"), NO_SEQ_MISMATCH);
+  EXPECT_EQ (GetState (g), State::UP_TO_DATE);
+  EXPECT_EQ (reader.GetVersion (), 1);
+}
+
+/* ************************************************************************** */
+
+class StateFilesGameTests : public SyncingTests
+{
+
+protected:
+
+  /** Temporary directory for the state files.  */
+  const std::string directory;
+
+  StateFilesGameTests ()
+    : directory(std::tmpnam (nullptr))
+  {}
+
+  ~StateFilesGameTests ()
+  {
+    std::experimental::filesystem::remove_all (directory);
+  }
+
+  /**
+   * Reads and parses the file with the given name in our directory.
+   */
+  Json::Value
+  ReadFile (const std::string& name) const
+  {
+    std::ifstream in(directory + "/" + name);
+    Json::Value res;
+    in >> res;
+    return res;
+  }
+
+};
+
+TEST_F (StateFilesGameTests, WrittenWhenUpToDate)
+{
+  g.EnableStateFiles (directory, 2, false, 0);
+
+  AttachBlock (g, BlockHash (11), Moves ("a0b1"));
+  AttachBlock (g, BlockHash (12), Moves ("c2"));
+  DetachBlock (g);
+  WaitForStateFiles (g);
+
+  const Json::Value data = ReadFile ("current.json");
+  EXPECT_EQ (data["gameid"].asString (), GAME_ID);
+  EXPECT_EQ (data["blockhash"].asString (), BlockHash (11).ToHex ());
+  EXPECT_EQ (data["height"].asUInt (), 11);
+  EXPECT_EQ (data["gamestate"]["state"].asString (), "a0b1");
+
+  /* Blocks may be superseded before their files were written.  */
+  const Json::Value stats = g.GetMetrics ()["statefiles"];
+  EXPECT_EQ (stats["written"].asUInt64 () + stats["skipped"].asUInt64 (), 3);
+}
+
+TEST_F (StateFilesGameTests, RateLimitedWhileCatchingUp)
+{
+  g.EnableStateFiles (directory, 5, false, 1000000);
+
+  EXPECT_CALL (mockXayaServer, game_sendupdates (GAME_GENESIS_HASH, GAME_ID))
+      .WillOnce (Return (SendupdatesResponse (BlockHash (13), "reqtoken")));
+
+  mockXayaServer.SetBestBlock (13, BlockHash (13));
+  ReinitialiseState (g);
+  EXPECT_EQ (GetState (g), State::CATCHING_UP);
+
+  /* The first block while catching up is written, but the next one
+     is within the rate limit.  */
+  CallBlockAttach (g, "reqtoken",
+                   TestGame::GenesisBlockHash (), BlockHash (11), 11,
+                   Moves ("a0"), NO_SEQ_MISMATCH);
+  WaitForStateFiles (g);
+  CallBlockAttach (g, "reqtoken", BlockHash (11), BlockHash (12), 12,
+                   Moves ("b1"), NO_SEQ_MISMATCH);
+  CallBlockAttach (g, "reqtoken", BlockHash (12), BlockHash (13), 13,
+                   Moves ("c2"), NO_SEQ_MISMATCH);
+  EXPECT_EQ (GetState (g), State::UP_TO_DATE);
+  WaitForStateFiles (g);
+
+  namespace fs = std::experimental::filesystem;
+  EXPECT_TRUE (fs::exists (directory + "/" + BlockHash (11).ToHex ()
+                            + ".json"));
+  EXPECT_FALSE (fs::exists (directory + "/" + BlockHash (12).ToHex ()
+                             + ".json"));
+  EXPECT_EQ (ReadFile ("current.json")["height"].asUInt (), 13);
+}
+
+/* ************************************************************************** */
+
+using LockProfilingGameTests = SyncingTests;
+
+TEST_F (LockProfilingGameTests, NotEnabled)
+{
+  AttachBlock (g, BlockHash (11), Moves ("a0"));
+  EXPECT_FALSE (g.GetMetrics ().isMember ("locks"));
+}
+
+TEST_F (LockProfilingGameTests, RecordsCallSites)
+{
+  g.EnableLockProfiling ();
+
+  AttachBlock (g, BlockHash (11), Moves ("a0"));
+  AttachBlock (g, BlockHash (12), Moves ("b1"));
+  g.GetCurrentJsonState ();
+
+  const Json::Value stats = g.GetMetrics ()["locks"]["game"];
+  ASSERT_TRUE (stats.isObject ());
+  EXPECT_GE (stats["acquisitions"].asUInt64 (), 3);
+  EXPECT_EQ (stats["hold"]["count"].asUInt64 (),
+             stats["acquisitions"].asUInt64 ());
+
+  bool foundAttach = false;
+  for (const auto& site : stats["topsites"])
+    if (site["site"].asString () == "BlockAttach")
+      {
+        foundAttach = true;
+        EXPECT_EQ (site["acquisitions"].asUInt64 (), 2);
+      }
+  EXPECT_TRUE (foundAttach);
+}
+
+/* ************************************************************************** */
+
+TEST (ProfilingGameTests, NotEnabled)
+{
+  Game g(GAME_ID);
+  EXPECT_TRUE (g.Profile (1).isNull ());
+}
+
+TEST (ProfilingGameTests, WritesProfile)
+{
+  const std::string directory = std::tmpnam (nullptr);
+
+  {
+    Game g(GAME_ID);
+    g.EnableProfiling (directory);
+
+    const Json::Value res = g.Profile (1);
+    ASSERT_TRUE (res.isObject ());
+    EXPECT_EQ (res["gameid"].asString (), GAME_ID);
+    EXPECT_TRUE (std::experimental::filesystem::exists (
+        res["file"].asString ()));
+  }
+
+  std::experimental::filesystem::remove_all (directory);
+}
+
+TEST (ProfilingGameTests, WriteFailure)
+{
+  const std::string directory = std::tmpnam (nullptr);
+
+  Game g(GAME_ID);
+  g.EnableProfiling (directory);
+  std::experimental::filesystem::remove_all (directory);
+
+  EXPECT_THROW (g.Profile (1), Game::ProfileError);
+}
+
+/* ************************************************************************** */
+
+class CheckpointGameTests : public SyncingTests
+{
+
+protected:
+
+  /** Temporary directory for the checkpoints.  */
+  const std::string directory;
+
+  CheckpointGameTests ()
+    : directory(std::tmpnam (nullptr))
+  {
+    g.EnableCheckpoints (directory, 2, 5);
+  }
+
+  ~CheckpointGameTests ()
+  {
+    std::experimental::filesystem::remove_all (directory);
+  }
+
+  /**
+   * Removes the undo data for the given block from the storage, as if it
+   * had been pruned.
+   */
+  void
+  RemoveUndoData (const uint256& hash)
+  {
+    storage.BeginTransaction ();
+    storage.ReleaseUndoData (hash);
+    storage.CommitTransaction ();
+  }
+
+};
+
+TEST_F (CheckpointGameTests, RestoredOnMissingUndo)
+{
+  /* Checkpoints are written for heights 2 and 4.  */
+  AttachBlock (g, BlockHash (11), Moves ("a0"));
+  AttachBlock (g, BlockHash (12), Moves ("b1"));
+  AttachBlock (g, BlockHash (13), Moves ("c2"));
+  ExpectGameState (BlockHash (13), "a0b1c2");
+  WaitForCheckpoints (g);
+
+  RemoveUndoData (BlockHash (13));
+
+  /* Block 13 (with the newest checkpoint) is no longer on the main chain,
+     so the checkpoint for block 11 should be restored.  */
+  EXPECT_CALL (mockXayaServer, getblockhash (4))
+      .WillOnce (Return (BlockHash (23).ToHex ()));
+  EXPECT_CALL (mockXayaServer, getblockhash (2))
+      .WillOnce (Return (BlockHash (11).ToHex ()));
+  mockXayaServer.SetBestBlock (2, BlockHash (11));
+
+  DetachBlock (g);
+  EXPECT_EQ (GetState (g), State::UP_TO_DATE);
+  ExpectGameState (BlockHash (11), "a0");
+}
+
+TEST_F (CheckpointGameTests, WriteFailureSkipped)
+{
+  /* Without the directory, writing checkpoints fails.  That must not stop
+     block processing.  */
+  std::experimental::filesystem::remove_all (directory);
+
+  AttachBlock (g, BlockHash (11), Moves ("a0"));
+  AttachBlock (g, BlockHash (12), Moves ("b1"));
+  WaitForCheckpoints (g);
+
+  EXPECT_EQ (GetState (g), State::UP_TO_DATE);
+  ExpectGameState (BlockHash (12), "a0b1");
+  EXPECT_FALSE (std::experimental::filesystem::exists (directory));
+}
+
+/* ************************************************************************** */
+
+using TuningGameTests = SyncingTests;
+
+TEST_F (TuningGameTests, Defaults)
+{
+  const Json::Value tuning = g.GetTuning ();
+  EXPECT_EQ (tuning["batchsize"]["catchingup"].asInt (), 1000);
+  EXPECT_EQ (tuning["batchsize"]["uptodate"].asInt (), 1);
+  EXPECT_EQ (tuning["flushmillis"].asInt (), 0);
+  EXPECT_EQ (tuning["catchingupnotify"]["millis"].asInt (), 1000);
+  EXPECT_EQ (tuning["catchingupnotify"]["blocks"].asInt (), 0);
+  EXPECT_FALSE (tuning.isMember ("pruning"));
+  EXPECT_EQ (tuning["compressionthreshold"].asInt (), 1024);
+  EXPECT_FALSE (tuning.isMember ("statehistory"));
+  EXPECT_FALSE (tuning.isMember ("movearchive"));
+}
+
+TEST_F (TuningGameTests, Update)
+{
+  g.EnableStateHistory (10, 2, 5);
+  g.EnableMoveArchive (10);
+
+  const int oldVerbosity = g.GetTuning ()["verbosity"].asInt ();
+
+  g.SetTuning (ParseJson (R"({
+    "batchsize": {"catchingup": 50},
+    "flushmillis": 100,
+    "catchingupnotify": {"blocks": 20},
+    "compressionthreshold": -1,
+    "statehistory": {"cache": 3},
+    "movearchive": 4,
+    "verbosity": 2
+  })"));
+
+  const Json::Value tuning = g.GetTuning ();
+  EXPECT_EQ (tuning["batchsize"]["catchingup"].asInt (), 50);
+  EXPECT_EQ (tuning["batchsize"]["uptodate"].asInt (), 1);
+  EXPECT_EQ (tuning["flushmillis"].asInt (), 100);
+  EXPECT_EQ (tuning["catchingupnotify"]["millis"].asInt (), 1000);
+  EXPECT_EQ (tuning["catchingupnotify"]["blocks"].asInt (), 20);
+  EXPECT_EQ (tuning["compressionthreshold"].asInt (), -1);
+  EXPECT_EQ (tuning["statehistory"]["blocks"].asInt (), 10);
+  EXPECT_EQ (tuning["statehistory"]["keyframes"].asInt (), 2);
+  EXPECT_EQ (tuning["statehistory"]["cache"].asInt (), 3);
+  EXPECT_EQ (tuning["movearchive"].asInt (), 4);
+  EXPECT_EQ (tuning["verbosity"].asInt (), 2);
+
+  Json::Value restore(Json::objectValue);
+  restore["verbosity"] = oldVerbosity;
+  g.SetTuning (restore);
+}
+
+TEST_F (TuningGameTests, RoundTrip)
+{
+  const Json::Value before = g.GetTuning ();
+  g.SetTuning (before);
+  EXPECT_EQ (g.GetTuning (), before);
+
+  g.SetTuning (ParseJson (R"({"pruning": 5})"));
+  const Json::Value withPruning = g.GetTuning ();
+  g.SetTuning (withPruning);
+  EXPECT_EQ (g.GetTuning (), withPruning);
+}
+
+TEST_F (TuningGameTests, EnablePruning)
+{
+  AttachBlock (g, BlockHash (11), Moves ("a0"));
+  AttachBlock (g, BlockHash (12), Moves ("a1"));
+
+  g.SetTuning (ParseJson (R"({"pruning": 1})"));
+  EXPECT_EQ (g.GetTuning ()["pruning"].asInt (), 1);
+
+  AttachBlock (g, BlockHash (13), Moves ("a2"));
+  AttachBlock (g, BlockHash (14), Moves ("a3"));
+
+  UndoData undo;
+  EXPECT_FALSE (storage.GetUndoData (BlockHash (13), undo));
+  EXPECT_TRUE (storage.GetUndoData (BlockHash (14), undo));
+
+  g.SetTuning (ParseJson (R"({"pruning": 5})"));
+  EXPECT_EQ (g.GetTuning ()["pruning"].asInt (), 5);
+}
+
+TEST_F (TuningGameTests, Invalid)
+{
+  const Json::Value before = g.GetTuning ();
+
+  for (const std::string str : {
+      "[]",
+      R"({"foo": 1})",
+      R"({"batchsize": 10})",
+      R"({"batchsize": {"uptodate": 0}})",
+      R"({"batchsize": {"catchingup": 10, "bar": 1}})",
+      R"({"flushmillis": -1})",
+      R"({"catchingupnotify": 10})",
+      R"({"catchingupnotify": {"millis": -1}})",
+      R"({"catchingupnotify": {"blocks": 1, "foo": 2}})",
+      R"({"pruning": -1})",
+      R"({"compressionthreshold": "x"})",
+      R"({"statehistory": {"cache": 1}})",
+      R"({"movearchive": 1})",
+      R"({"detachedblocks": 1})",
+      R"({"memorybudget": 1})",
+      R"({"flushmillis": 10, "verbosity": 1.5})",
+    })
+    {
+      EXPECT_THROW (g.SetTuning (ParseJson (str)), Game::TuningError)
+          << "Not rejected: " << str;
+    }
+
+  EXPECT_EQ (g.GetTuning (), before);
+}
+
+/* ************************************************************************** */
+
+class StatePageTests : public SyncingTests
+{
+
+protected:
+
+  StatePageTests ()
+  {
+    AttachBlock (g, BlockHash (11), Moves ("a0b1c2d3e4"));
+  }
+
+  /**
+   * Expects that the given page result has the given entries (encoded
+   * like the game state) and block hash.  Returns the cursor.
+   */
+  static std::string
+  ExpectPage (const Json::Value& res, const uint256& hash,
+              const std::string& entries)
+  {
+    EXPECT_EQ (res["gameid"], GAME_ID);
+    EXPECT_EQ (res["state"], "up-to-date");
+    EXPECT_EQ (res["blockhash"], hash.ToHex ());
+
+    std::ostringstream actual;
+    for (const auto& nm : res["entries"].getMemberNames ())
+      actual << nm << res["entries"][nm].asString ();
+    EXPECT_EQ (actual.str (), entries);
+
+    if (!res.isMember ("cursor"))
+      return "";
+    return res["cursor"].asString ();
+  }
+
+};
+
+TEST_F (StatePageTests, PagesThrough)
+{
+  std::string cursor = ExpectPage (g.GetStatePage ("", 2),
+                                   BlockHash (11), "a0b1");
+  ASSERT_NE (cursor, "");
+  cursor = ExpectPage (g.GetStatePage (cursor, 2), BlockHash (11), "c2d3");
+  ASSERT_NE (cursor, "");
+  cursor = ExpectPage (g.GetStatePage (cursor, 2), BlockHash (11), "e4");
+  EXPECT_EQ (cursor, "");
+
+  EXPECT_EQ (ExpectPage (g.GetStatePage ("", 10), BlockHash (11),
+                         "a0b1c2d3e4"),
+             "");
+}
+
+TEST_F (StatePageTests, InvalidRequests)
+{
+  EXPECT_THROW (g.GetStatePage ("", 0), Game::StatePageError);
+  EXPECT_THROW (g.GetStatePage ("", Game::MAX_STATE_PAGE_SIZE + 1),
+                Game::StatePageError);
+  EXPECT_THROW (g.GetStatePage ("invalid", 2), Game::StatePageError);
+  EXPECT_THROW (g.GetStatePage ("YWJj", 2), Game::StatePageError);
+}
+
+TEST_F (StatePageTests, EmptyLastKey)
+{
+  /* A cursor with just the block hash continues after the empty key,
+     which is a valid key as well.  */
+  const uint256 hash = BlockHash (11);
+  const std::string cursor = EncodeBase64 (std::string (
+      reinterpret_cast<const char*> (hash.GetBlob ()), uint256::NUM_BYTES));
+
+  EXPECT_NE (ExpectPage (g.GetStatePage (cursor, 2), hash, "a0b1"), "");
+}
+
+TEST_F (StatePageTests, StaleCursorWithoutHistory)
+{
+  const std::string cursor
+      = ExpectPage (g.GetStatePage ("", 2), BlockHash (11), "a0b1");
+  AttachBlock (g, BlockHash (12), Moves ("c5"));
+  EXPECT_THROW (g.GetStatePage (cursor, 2), Game::StatePageError);
+}
+
+TEST_F (StatePageTests, StaleCursorFromHistory)
+{
+  g.EnableStateHistory (5, 0, 0);
+  AttachBlock (g, BlockHash (12), Moves ("f5"));
+
+  const std::string cursor
+      = ExpectPage (g.GetStatePage ("", 2), BlockHash (12), "a0b1");
+  AttachBlock (g, BlockHash (13), Moves ("c9"));
+
+  /* The continuation is consistent with the state at block 12, even though
+     the current state has changed in the meantime.  */
+  const std::string next
+      = ExpectPage (g.GetStatePage (cursor, 2), BlockHash (12), "c2d3");
+  ExpectPage (g.GetStatePage (next, 2), BlockHash (12), "e4f5");
+
+  ExpectPage (g.GetStatePage ("", 3), BlockHash (13), "a0b1c9");
+}
+
+/* ************************************************************************** */
+
+class StatePublisherTests : public SyncingTests
+{
+
+protected:
+
+  /** ZMQ context and socket for receiving the published notifications.  */
+  zmq::context_t zmqCtx;
+  zmq::socket_t zmqSocket;
+
+  StatePublisherTests ()
+    : zmqCtx(), zmqSocket(zmqCtx, ZMQ_SUB)
+  {}
+
+  /**
+   * Enables the publisher on the game and connects our subscriber socket.
+   */
+  void
+  Enable (const StatePublishMode mode)
+  {
+    g.EnableStatePublisher (PUBLISHER_ENDPOINT, mode);
+
+    const std::string topic = std::string ("game-state json ") + GAME_ID;
+    zmqSocket.setsockopt (ZMQ_SUBSCRIBE, topic.data (), topic.size ());
+    zmqSocket.connect (PUBLISHER_ENDPOINT);
+    SleepSome ();
+  }
+
+  /**
+   * Receives the next notification, verifies the topic and sequence number
+   * and returns the parsed payload.
+   */
+  Json::Value
+  Receive (const unsigned expectedSeq)
+  {
+    std::vector<std::string> parts;
+    while (true)
+      {
+        zmq::message_t msg;
+        CHECK (zmqSocket.recv (&msg));
+        const char* data = static_cast<const char*> (msg.data ());
+        parts.emplace_back (data, data + msg.size ());
+
+        int more;
+        size_t moreSize = sizeof (more);
+        zmqSocket.getsockopt (ZMQ_RCVMORE, &more, &moreSize);
+        if (!more)
+          break;
+      }
+
+    CHECK_EQ (parts.size (), 3);
+    EXPECT_EQ (parts[0], std::string ("game-state json ") + GAME_ID);
+    EXPECT_EQ (parts[2], std::string ({static_cast<char> (expectedSeq),
+                                       '\0', '\0', '\0'}));
+
+    return ParseJson (parts[1]);
+  }
+
+};
+
+TEST_F (StatePublisherTests, Notification)
+{
+  Enable (StatePublishMode::NOTIFICATION);
+
+  AttachBlock (g, BlockHash (11), Moves ("a0b1"));
+  DetachBlock (g);
+
+  Json::Value msg = Receive (0);
+  EXPECT_EQ (msg["state"], "up-to-date");
+  EXPECT_EQ (msg["blockhash"], BlockHash (11).ToHex ());
+  EXPECT_EQ (msg["height"].asInt (), 2);
+  EXPECT_FALSE (msg.isMember ("gamestate"));
+
+  msg = Receive (1);
+  EXPECT_EQ (msg["blockhash"], GAME_GENESIS_HASH);
+  EXPECT_EQ (msg["height"].asInt (), 1);
+  EXPECT_FALSE (msg.isMember ("gamestate"));
+}
+
+TEST_F (StatePublisherTests, FullState)
+{
+  Enable (StatePublishMode::FULL_STATE);
+
+  AttachBlock (g, BlockHash (11), Moves ("a0b1"));
+  AttachBlock (g, BlockHash (12), Moves ("a2c3"));
+
+  Json::Value msg = Receive (0);
+  EXPECT_EQ (msg["blockhash"], BlockHash (11).ToHex ());
+  EXPECT_EQ (msg["gamestate"]["state"], "a0b1");
+
+  msg = Receive (1);
+  EXPECT_EQ (msg["blockhash"], BlockHash (12).ToHex ());
+  EXPECT_EQ (msg["gamestate"]["state"], "a2b1c3");
+}
+
+TEST_F (StatePublisherTests, StateDiff)
+{
+  Enable (StatePublishMode::STATE_DIFF);
+
+  AttachBlock (g, BlockHash (11), Moves ("a0b1"));
+  AttachBlock (g, BlockHash (12), Moves ("a2c3"));
+
+  Json::Value msg = Receive (0);
+  EXPECT_EQ (msg["blockhash"], BlockHash (11).ToHex ());
+  EXPECT_EQ (msg["gamestate"]["state"], "a0b1");
+  EXPECT_FALSE (msg.isMember ("gamestatediff"));
+
+  msg = Receive (1);
+  EXPECT_EQ (msg["blockhash"], BlockHash (12).ToHex ());
+  EXPECT_EQ (msg["prevblockhash"], BlockHash (11).ToHex ());
+  EXPECT_FALSE (msg.isMember ("gamestate"));
+  EXPECT_EQ (msg["gamestatediff"]["state"], "a2b1c3");
+}
+
+/* ************************************************************************** */
+
+/**
+ * Helper subclass of MemoryStorage that allows us to fail (throw an exception)
+ * when setting the current state.
+ */
+class FallibleMemoryStorage : public TxMockedMemoryStorage
+{
+
+private:
+
+  /** Whether or not SetCurrentGameState should fail.  */
+  bool shouldFail = false;
+
+public:
+
+  class Failure : public std::runtime_error
+  {
+
+  public:
+
+    Failure ()
+      : std::runtime_error("failing memory storage")
+    {}
+
+  };
+
+  /**
+   * Sets whether or not SetCurrentGameState calls should fail (throw an
+   * exception) when called instead of changing the game state.
+   */
+  void
+  SetShouldFail (const bool val)
+  {
+    shouldFail = val;
+  }
+
+  void
+  SetCurrentGameState (const uint256& hash, const GameStateData& data) override
+  {
+    if (shouldFail)
+      {
+        LOG (INFO) << "Failing call to SetCurrentGameState on purpose";
+        throw Failure ();
+      }
+    MemoryStorage::SetCurrentGameState (hash, data);
+  }
+
+};
+
+class GameLogicTransactionsTests : public SyncingTests
+{
+
+protected:
+
+  /** Alternative (fallible) storage used in the tests.  */
   FallibleMemoryStorage fallibleStorage;
 
   GameLogicTransactionsTests ()
@@ -1310,6 +2698,45 @@ TEST_F (GameLogicTransactionsTests, CatchingUpBatched)
   ExpectGameState (fallibleStorage, BlockHash (12), "a2b1c3");
 }
 
+TEST_F (GameLogicTransactionsTests, TuningAppliedOnNextBlock)
+{
+  testing::MockFunction<void ()> tuned;
+  {
+    InSequence dummy;
+
+    EXPECT_CALL (fallibleStorage, RollbackTransactionMock ()).Times (0);
+
+    EXPECT_CALL (mockXayaServer, game_sendupdates (GAME_GENESIS_HASH, GAME_ID))
+        .WillOnce (Return (SendupdatesResponse (BlockHash (13), "reqtoken")));
+
+    EXPECT_CALL (fallibleStorage, BeginTransactionMock ());
+    EXPECT_CALL (tuned, Call ());
+
+    /* The open batch is only committed when the next block is processed,
+       and then each block is committed by itself.  */
+    EXPECT_CALL (fallibleStorage, CommitTransactionMock ());
+    EXPECT_CALL (fallibleStorage, BeginTransactionMock ());
+    EXPECT_CALL (fallibleStorage, CommitTransactionMock ());
+  }
+
+  mockXayaServer.SetBestBlock (13, BlockHash (13));
+  ReinitialiseState (g);
+  EXPECT_EQ (GetState (g), State::CATCHING_UP);
+
+  CallBlockAttach (g, "reqtoken",
+                   TestGame::GenesisBlockHash (), BlockHash (11), 11,
+                   Moves ("a0b1"), NO_SEQ_MISMATCH);
+
+  g.SetTuning (ParseJson (R"({"batchsize": {"catchingup": 1}})"));
+  EXPECT_EQ (g.GetTuning ()["batchsize"]["catchingup"].asInt (), 1);
+  tuned.Call ();
+
+  CallBlockAttach (g, "reqtoken", BlockHash (11), BlockHash (12), 12,
+                   Moves ("a2c3"), NO_SEQ_MISMATCH);
+  EXPECT_EQ (GetState (g), State::CATCHING_UP);
+  ExpectGameState (fallibleStorage, BlockHash (12), "a2b1c3");
+}
+
 TEST_F (GameLogicTransactionsTests, FailureRollsBack)
 {
   {
@@ -42,12 +42,50 @@ GameLogic::SetChain (const Chain c)
   chain = c;
 }
 
+GameStateData
+GameLogic::ReapplyForward (const GameStateData& oldState,
+                           const Json::Value& blockData,
+                           const GameStateData& newState,
+                           const UndoData& undoData)
+{
+  return newState;
+}
+
 Json::Value
 GameLogic::GameStateToJson (const GameStateData& state)
 {
   return state;
 }
 
+bool
+GameLogic::GameStateToJsonPage (const GameStateData& state,
+                                const std::string* startAfter,
+                                const unsigned limit,
+                                Json::Value& entries, bool& more)
+{
+  return false;
+}
+
+std::unique_ptr<PartitionedState>
+GameLogic::PartitionState (const GameStateData& state)
+{
+  return nullptr;
+}
+
+bool
+GameLogic::ComputeDerivedData (const GameStateData& state,
+                               const std::function<bool ()>& cancelled,
+                               Json::Value& result)
+{
+  return false;
+}
+
+std::string
+PartitionedState::GetFingerprint (const Partition& p) const
+{
+  return "";
+}
+
 GameStateData
 CachingGame::ProcessForward (const GameStateData& oldState,
                              const Json::Value& blockData,
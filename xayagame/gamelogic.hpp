@@ -5,11 +5,15 @@
 #ifndef XAYAGAME_GAMELOGIC_HPP
 #define XAYAGAME_GAMELOGIC_HPP
 
+#include "costaccounting.hpp"
 #include "storage.hpp"
 
 #include <json/json.h>
 
+#include <functional>
+#include <memory>
 #include <string>
+#include <vector>
 
 namespace xaya
 {
@@ -32,6 +36,62 @@ enum class Chain
  */
 std::string ChainToString (Chain c);
 
+/**
+ * A game state that has been split into partitions, which can be converted
+ * to JSON independently of each other (and in parallel).  Instances are
+ * returned by GameLogic::PartitionState.
+ *
+ * Each partition contributes the members of a JSON object to the full state.
+ * If its field is empty, those members are top-level fields of the state.
+ * Otherwise, they become members of the object in the top-level field of
+ * that name, which allows splitting e.g. a large map of players into shards.
+ * The members of all partitions must be distinct.
+ */
+class PartitionedState
+{
+
+public:
+
+  /**
+   * Identification of one partition.
+   */
+  struct Partition
+  {
+
+    /** The top-level field this partition contributes to (may be empty).  */
+    std::string field;
+
+    /** An identifier for this partition, unique within the field.  */
+    std::string id;
+
+  };
+
+  virtual ~PartitionedState () = default;
+
+  /**
+   * Returns the list of partitions of this state.
+   */
+  virtual std::vector<Partition> GetPartitions () const = 0;
+
+  /**
+   * Returns a fingerprint of the data in the given partition.  If it is
+   * the same as the fingerprint of the partition with the same field and id
+   * when the state was last rendered, then the previous JSON is reused.
+   * The default implementation returns an empty string, which means that
+   * partitions are never reused.
+   *
+   * This is called concurrently from multiple threads.
+   */
+  virtual std::string GetFingerprint (const Partition& p) const;
+
+  /**
+   * Converts the given partition to a JSON object.  This is called
+   * concurrently from multiple threads.
+   */
+  virtual Json::Value PartitionToJson (const Partition& p) const = 0;
+
+};
+
 /**
  * The interface for actual games.  Implementing classes define the rules
  * of an actual game so that it can be plugged into libxayagame to form
@@ -62,6 +122,9 @@ private:
    */
   Chain chain = Chain::UNKNOWN;
 
+  /** The cost accounting to use, if enabled.  */
+  CostAccounting* costs = nullptr;
+
 protected:
 
   /**
@@ -69,6 +132,17 @@ protected:
    */
   Chain GetChain () const;
 
+  /**
+   * Returns the cost accounting to which the processing time of moves should
+   * be attributed (e.g. with MoveCostScope).  This is null if cost
+   * accounting is not enabled.
+   */
+  CostAccounting*
+  GetCostAccounting () const
+  {
+    return costs;
+  }
+
 public:
 
   GameLogic () = default;
@@ -83,6 +157,16 @@ public:
    */
   void SetChain (Chain c);
 
+  /**
+   * Sets the cost accounting instance (or null to disable it).  This is
+   * typically called by the Game instance.
+   */
+  void
+  SetCostAccounting (CostAccounting* acc)
+  {
+    costs = acc;
+  }
+
   /**
    * Returns the initial state (as well as the associated block height
    * and block hash in big-endian hex) for the game.
@@ -115,6 +199,23 @@ public:
                                           const Json::Value& blockData,
                                           const UndoData& undoData) = 0;
 
+  /**
+   * Attaches a block again whose result is already known, because it has
+   * been processed with ProcessForward on the same oldState before (and was
+   * detached in a reorg since).  newState and undoData are the values
+   * that ProcessForward returned back then.  This must have the same effect
+   * as calling ProcessForward again, and return the new state.
+   *
+   * This is only used if the detached-block cache is enabled in Game.
+   * The default implementation just returns newState, which is correct for
+   * games whose state is fully encoded in the GameStateData.  Games that
+   * keep state elsewhere need to override it.
+   */
+  virtual GameStateData ReapplyForward (const GameStateData& oldState,
+                                        const Json::Value& blockData,
+                                        const GameStateData& newState,
+                                        const UndoData& undoData);
+
   /**
    * Converts an encoded game state to JSON format, which can be returned as
    * game state through the external JSON-RPC interface.  The default
@@ -127,6 +228,68 @@ public:
    */
   virtual Json::Value GameStateToJson (const GameStateData& state);
 
+  /**
+   * Converts a part ("page") of an encoded game state to JSON.  This allows
+   * clients to page through very large game states without having the
+   * full state converted and returned at once.
+   *
+   * Games supporting this should view their state as a collection of
+   * entries with unique string keys (e.g. player names).  They should
+   * return in "entries" a JSON object with up to "limit" of those entries,
+   * namely those with the smallest keys (in byte-wise string order) that
+   * are strictly larger than "*startAfter".  If startAfter is null, the
+   * page starts from the beginning (so that an entry with the empty string
+   * as key is included).  "more" should be set to true if there are
+   * further entries after the returned ones.
+   *
+   * The full encoded state is passed in for every page, so implementations
+   * will generally have to scan all of it.  Paging bounds the size of the
+   * returned JSON and the conversion work, but not the cost of reading
+   * the state.
+   *
+   * The default implementation returns false, which means that paging
+   * is not supported by the game.
+   */
+  virtual bool GameStateToJsonPage (const GameStateData& state,
+                                    const std::string* startAfter,
+                                    unsigned limit,
+                                    Json::Value& entries, bool& more);
+
+  /**
+   * Splits the given state into partitions that can be converted to JSON
+   * in parallel.  This is used instead of GameStateToJson if parallel
+   * rendering is enabled in Game, and must yield the same JSON content.
+   *
+   * The default implementation returns null, which means that the game
+   * does not support partitioning (and GameStateToJson is used).
+   */
+  virtual std::unique_ptr<PartitionedState> PartitionState (
+      const GameStateData& state);
+
+  /**
+   * Computes data derived from the given state that is expensive to compute
+   * but not part of the consensus state itself (e.g. leaderboards or other
+   * aggregates).  If enabled in Game, this is called on a background thread
+   * for the current state whenever the game is up-to-date, and the result
+   * is served by the getderiveddata RPC method.
+   *
+   * This runs concurrently with the other methods, so it must not rely on
+   * or modify mutable data of the instance.  It must also only use the
+   * GameStateData, which means that it does not work for games that keep
+   * their state elsewhere (like SQLiteGame).
+   *
+   * When a newer state becomes available, the computation is no longer
+   * needed and the cancelled callback starts returning true.  Long
+   * computations should check it periodically and return early.
+   *
+   * Returns true and fills in the result if the data was computed, and false
+   * if the computation was cancelled.  The default implementation returns
+   * false, which means that derived data is not supported.
+   */
+  virtual bool ComputeDerivedData (const GameStateData& state,
+                                   const std::function<bool ()>& cancelled,
+                                   Json::Value& result);
+
 };
 
 /**
@@ -4,11 +4,41 @@
 
 #include "gamerpcserver.hpp"
 
+#include <jsonrpccpp/common/errors.h>
+#include <jsonrpccpp/common/exception.h>
+
 #include <glog/logging.h>
 
 namespace xaya
 {
 
+namespace
+{
+
+/**
+ * Maximum duration of a profile requested through RPC, which bounds the
+ * memory used for the samples.
+ */
+constexpr int MAX_PROFILE_SECONDS = 120;
+
+} // anonymous namespace
+
+void
+GameRpcServer::HandleMethodCall (jsonrpc::Procedure& proc,
+                                 const Json::Value& input, Json::Value& output)
+{
+  game.ConfigureRpcThread ();
+  GameRpcServerStub::HandleMethodCall (proc, input, output);
+}
+
+void
+GameRpcServer::HandleNotificationCall (jsonrpc::Procedure& proc,
+                                       const Json::Value& input)
+{
+  game.ConfigureRpcThread ();
+  GameRpcServerStub::HandleNotificationCall (proc, input);
+}
+
 void
 GameRpcServer::stop ()
 {
@@ -23,6 +53,142 @@ GameRpcServer::getcurrentstate ()
   return game.GetCurrentJsonState ();
 }
 
+Json::Value
+GameRpcServer::getcurrentcompressedstate (const std::string& encodings)
+{
+  LOG (INFO) << "RPC method called: getcurrentcompressedstate " << encodings;
+  return game.GetCurrentCompressedState (encodings);
+}
+
+Json::Value
+GameRpcServer::getcurrentrawstate ()
+{
+  LOG (INFO) << "RPC method called: getcurrentrawstate";
+  return game.GetCurrentRawState ();
+}
+
+Json::Value
+GameRpcServer::getstatepage (const std::string& cursor, const int limit)
+{
+  LOG (INFO) << "RPC method called: getstatepage " << cursor << " " << limit;
+
+  if (limit <= 0)
+    throw jsonrpc::JsonRpcException (
+        jsonrpc::Errors::ERROR_RPC_INVALID_PARAMS,
+        "limit must be positive");
+
+  try
+    {
+      return game.GetStatePage (cursor, limit);
+    }
+  catch (const Game::StatePageError& exc)
+    {
+      throw jsonrpc::JsonRpcException (
+          jsonrpc::Errors::ERROR_RPC_INVALID_PARAMS, exc.what ());
+    }
+}
+
+Json::Value
+GameRpcServer::getstateatblock (const std::string& hash)
+{
+  LOG (INFO) << "RPC method called: getstateatblock " << hash;
+
+  uint256 blockHash;
+  if (!blockHash.FromHex (hash))
+    throw jsonrpc::JsonRpcException (
+        jsonrpc::Errors::ERROR_RPC_INVALID_PARAMS,
+        "invalid block hash: " + hash);
+
+  return game.GetStateAtBlock (blockHash);
+}
+
+Json::Value
+GameRpcServer::getstateatheight (const int height)
+{
+  LOG (INFO) << "RPC method called: getstateatheight " << height;
+
+  if (height < 0)
+    throw jsonrpc::JsonRpcException (
+        jsonrpc::Errors::ERROR_RPC_INVALID_PARAMS,
+        "height must not be negative");
+
+  return game.GetStateAtHeight (height);
+}
+
+Json::Value
+GameRpcServer::getmovesbyname (const int limit, const std::string& name)
+{
+  LOG (INFO) << "RPC method called: getmovesbyname " << name << " " << limit;
+
+  if (limit <= 0)
+    throw jsonrpc::JsonRpcException (
+        jsonrpc::Errors::ERROR_RPC_INVALID_PARAMS,
+        "limit must be positive");
+
+  return game.GetMovesByName (name, limit);
+}
+
+Json::Value
+GameRpcServer::getderiveddata ()
+{
+  LOG (INFO) << "RPC method called: getderiveddata";
+  return game.GetDerivedData ();
+}
+
+Json::Value
+GameRpcServer::getmetrics ()
+{
+  LOG (INFO) << "RPC method called: getmetrics";
+  return game.GetMetrics ();
+}
+
+Json::Value
+GameRpcServer::profile (const int seconds)
+{
+  LOG (INFO) << "RPC method called: profile " << seconds;
+
+  if (seconds <= 0 || seconds > MAX_PROFILE_SECONDS)
+    throw jsonrpc::JsonRpcException (
+        jsonrpc::Errors::ERROR_RPC_INVALID_PARAMS,
+        "seconds must be between 1 and "
+            + std::to_string (MAX_PROFILE_SECONDS));
+
+  try
+    {
+      return game.Profile (seconds);
+    }
+  catch (const Game::ProfileError& exc)
+    {
+      throw jsonrpc::JsonRpcException (
+          jsonrpc::Errors::ERROR_RPC_INTERNAL_ERROR, exc.what ());
+    }
+}
+
+Json::Value
+GameRpcServer::gettuning ()
+{
+  LOG (INFO) << "RPC method called: gettuning";
+  return game.GetTuning ();
+}
+
+Json::Value
+GameRpcServer::settuning (const Json::Value& tuning)
+{
+  LOG (INFO) << "RPC method called: settuning\n" << tuning;
+
+  try
+    {
+      game.SetTuning (tuning);
+    }
+  catch (const Game::TuningError& exc)
+    {
+      throw jsonrpc::JsonRpcException (
+          jsonrpc::Errors::ERROR_RPC_INVALID_PARAMS, exc.what ());
+    }
+
+  return game.GetTuning ();
+}
+
 Json::Value
 GameRpcServer::waitforchange ()
 {
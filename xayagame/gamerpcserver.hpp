@@ -12,12 +12,15 @@
 #include <json/json.h>
 #include <jsonrpccpp/server.h>
 
+#include <string>
+
 namespace xaya
 {
 
 /**
  * Implementation of the basic RPC interface that games can expose.  It just
- * supports the generic "stop" and "getcurrentstate" methods, by calling the
+ * supports the generic "stop" and "getcurrentstate" methods (as well as
+ * some variants of the latter), by calling the
  * corresponding functions on a Game instance.
  *
  * This can be used by games that only need this basic, general interface.
@@ -39,10 +42,40 @@ public:
     : GameRpcServerStub(conn), game(g)
   {}
 
+  /* The request handlers are overridden to configure the server's threads
+     (which are created by the RPC library) on their first request.  */
+
+  virtual void HandleMethodCall (jsonrpc::Procedure& proc,
+                                 const Json::Value& input,
+                                 Json::Value& output) override;
+  virtual void HandleNotificationCall (jsonrpc::Procedure& proc,
+                                       const Json::Value& input) override;
+
   virtual void stop () override;
 
   virtual Json::Value getcurrentstate () override;
 
+  virtual Json::Value getcurrentcompressedstate (
+      const std::string& encodings) override;
+
+  virtual Json::Value getcurrentrawstate () override;
+
+  virtual Json::Value getstatepage (const std::string& cursor,
+                                    int limit) override;
+
+  virtual Json::Value getstateatblock (const std::string& hash) override;
+  virtual Json::Value getstateatheight (int height) override;
+
+  virtual Json::Value getmovesbyname (int limit,
+                                      const std::string& name) override;
+
+  virtual Json::Value getderiveddata () override;
+  virtual Json::Value getmetrics () override;
+  virtual Json::Value profile (int seconds) override;
+
+  virtual Json::Value gettuning () override;
+  virtual Json::Value settuning (const Json::Value& tuning) override;
+
   virtual Json::Value waitforchange () override;
 
 };
@@ -27,7 +27,7 @@ StorageWithCachedHeight::SetCurrentGameStateWithHeight (
   hasHeight = true;
   cachedHeight = height;
 
-  VLOG (1) << "Cached height for block " <<  hash.ToHex () << ": " << height;
+  VLOG (1) << "Cached height for block " << hash.ToHex () << ": " << height;
 }
 
 bool
@@ -55,6 +55,46 @@ StorageWithCachedHeight::GetCurrentBlockHashWithHeight (uint256& hash,
   return true;
 }
 
+void
+StorageWithCachedHeight::SetCachedHeight (const uint256& hash,
+                                          const unsigned height)
+{
+  uint256 currentHash;
+  CHECK (storage->GetCurrentBlockHash (currentHash));
+  CHECK (currentHash == hash)
+      << "Current block " << currentHash.ToHex ()
+      << " does not match " << hash.ToHex () << " for cached height";
+
+  hasHeight = true;
+  cachedHeight = height;
+
+  VLOG (1) << "Cached height for block " << hash.ToHex () << ": " << height;
+}
+
+void
+StorageWithCachedHeight::BeginTransaction ()
+{
+  storage->BeginTransaction ();
+
+  txHasHeight = hasHeight && storage->GetCurrentBlockHash (txHash);
+  txCachedHeight = cachedHeight;
+}
+
+void
+StorageWithCachedHeight::RollbackTransaction ()
+{
+  storage->RollbackTransaction ();
+
+  uint256 hash;
+  if (txHasHeight && storage->GetCurrentBlockHash (hash) && hash == txHash)
+    {
+      hasHeight = true;
+      cachedHeight = txCachedHeight;
+    }
+  else
+    hasHeight = false;
+}
+
 void
 StorageWithCachedHeight::SetCurrentGameState (const uint256& hash,
                                               const GameStateData& data)
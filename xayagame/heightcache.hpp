@@ -64,6 +64,16 @@ private:
   /** Whether or not we have a cached height.  */
   mutable bool hasHeight = false;
 
+  /**
+   * The cache state (hasHeight and cachedHeight) at the beginning of the
+   * current transaction, together with the block hash it belongs to.  It is
+   * restored if the transaction is rolled back and the storage is then back
+   * at that block hash.
+   */
+  bool txHasHeight = false;
+  unsigned txCachedHeight;
+  uint256 txHash;
+
   friend class StorageWithDummyHeight;
 
 public:
@@ -99,6 +109,24 @@ public:
    */
   bool GetCurrentBlockHashWithHeight (uint256& hash, unsigned& height) const;
 
+  /**
+   * Returns true if the height of the current state is cached, so that
+   * GetCurrentBlockHashWithHeight does not need to look it up (except for
+   * cross checks).
+   */
+  bool
+  HasCachedHeight () const
+  {
+    return hasHeight;
+  }
+
+  /**
+   * Sets the cached height for the current state, whose block hash must
+   * match the given one.  This allows to look the height up beforehand
+   * (e.g. without holding a lock).
+   */
+  void SetCachedHeight (const uint256& hash, unsigned height);
+
   /* Methods from StorageInterface.  They simply call through to the wrapped
      instance, with a few minor extra things.  */
 
@@ -159,11 +187,7 @@ public:
     storage->PruneUndoData (height);
   }
 
-  void
-  BeginTransaction () override
-  {
-    storage->BeginTransaction ();
-  }
+  void BeginTransaction () override;
 
   void
   CommitTransaction () override
@@ -171,13 +195,31 @@ public:
     storage->CommitTransaction ();
   }
 
+  /**
+   * Rolls back the transaction.  The cached height from the start of the
+   * transaction is restored only if the storage is back at the block hash
+   * it belongs to; otherwise (e.g. if the underlying storage does not
+   * actually roll back all changes), the cache is dropped.
+   */
+  void RollbackTransaction () override;
+
+  std::unique_ptr<StorageSnapshot>
+  OpenSnapshot () const override
+  {
+    return storage->OpenSnapshot ();
+  }
+
+  bool
+  WriteCheckpoint (const std::string& file) const override
+  {
+    return storage->WriteCheckpoint (file);
+  }
+
   void
-  RollbackTransaction () override
+  RestoreCheckpoint (const std::string& file) override
   {
-    /* Clear the cached height to make sure it is not wrong afterwards.  */
     hasHeight = false;
-
-    storage->RollbackTransaction ();
+    storage->RestoreCheckpoint (file);
   }
 
 };
@@ -76,6 +76,8 @@ INSTANTIATE_TYPED_TEST_CASE_P (HeightCache, BasicStorageTests,
                                StorageWithDummyHeight);
 INSTANTIATE_TYPED_TEST_CASE_P (HeightCache, PruningStorageTests,
                                StorageWithDummyHeight);
+INSTANTIATE_TYPED_TEST_CASE_P (HeightCache, SnapshotStorageTests,
+                               StorageWithDummyHeight);
 
 /**
  * Test fixture that sets up a memory storage and a real storage with cached
@@ -183,6 +185,20 @@ TEST_F (HeightCacheTests, TranslationFunction)
   EXPECT_EQ (hashToHeightCount, 1);
 }
 
+TEST_F (HeightCacheTests, SetCachedHeight)
+{
+  StoreOnlyHash (BlockHash (2));
+  EXPECT_FALSE (storage.HasCachedHeight ());
+
+  storage.SetCachedHeight (BlockHash (2), 10);
+  EXPECT_TRUE (storage.HasCachedHeight ());
+  ExpectHashAndHeight (BlockHash (2), 10);
+  EXPECT_EQ (hashToHeightCount, 0);
+
+  EXPECT_DEATH (storage.SetCachedHeight (BlockHash (3), 10),
+                "does not match");
+}
+
 TEST_F (HeightCacheTests, CrossChecks)
 {
   storage.EnableCrossChecks ();
@@ -216,6 +232,36 @@ TEST_F (HeightCacheTests, RollbackTransaction)
   EXPECT_EQ (hashToHeightCount, 1);
 }
 
+TEST_F (HeightCacheTests, RollbackKeepsCommittedHeight)
+{
+  StoreHashAndHeight (BlockHash (2), 10);
+
+  /* The memory storage does not actually roll back changes, so we can only
+     test rolling back an empty transaction here.  */
+  storage.BeginTransaction ();
+  storage.RollbackTransaction ();
+
+  EXPECT_TRUE (storage.HasCachedHeight ());
+  ExpectHashAndHeight (BlockHash (2), 10);
+  EXPECT_EQ (hashToHeightCount, 0);
+}
+
+TEST_F (HeightCacheTests, RollbackDropsHeightOnHashMismatch)
+{
+  StoreHashAndHeight (BlockHash (2), 10);
+
+  /* Since the memory storage does not roll back, the new block stays the
+     current one.  The cached height from before the transaction must not
+     be applied to it.  */
+  storage.BeginTransaction ();
+  storage.SetCurrentGameStateWithHeight (BlockHash (3), 11, GameStateData ());
+  storage.RollbackTransaction ();
+
+  EXPECT_FALSE (storage.HasCachedHeight ());
+  ExpectHashAndHeight (BlockHash (3), 3);
+  EXPECT_EQ (hashToHeightCount, 1);
+}
+
 TEST_F (HeightCacheTests, NoSettingWithoutHeight)
 {
   storage.BeginTransaction ();
@@ -0,0 +1,316 @@
+// Copyright (C) 2019 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "instrumentedmutex.hpp"
+
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace xaya
+{
+namespace internal
+{
+
+DurationHistogram::DurationHistogram ()
+{
+  buckets.fill (0);
+}
+
+unsigned
+DurationHistogram::GetBucket (const uint64_t nanos)
+{
+  const uint64_t micros = nanos / 1000;
+
+  unsigned index = 0;
+  for (uint64_t bound = 1; micros >= bound && index + 1 < NUM_BUCKETS;
+       bound *= 2)
+    ++index;
+
+  return index;
+}
+
+void
+DurationHistogram::Add (const std::chrono::nanoseconds duration)
+{
+  const uint64_t nanos = std::max<int64_t> (duration.count (), 0);
+
+  ++buckets[GetBucket (nanos)];
+  ++count;
+  totalNanos += nanos;
+  maxNanos = std::max (maxNanos, nanos);
+}
+
+void
+DurationHistogram::Merge (const DurationHistogram& other)
+{
+  for (unsigned i = 0; i < NUM_BUCKETS; ++i)
+    buckets[i] += other.buckets[i];
+
+  count += other.count;
+  totalNanos += other.totalNanos;
+  maxNanos = std::max (maxNanos, other.maxNanos);
+}
+
+Json::Value
+DurationHistogram::ToJson () const
+{
+  Json::Value res(Json::objectValue);
+  res["count"] = static_cast<Json::UInt64> (count);
+  res["totalmicros"] = static_cast<Json::UInt64> (totalNanos / 1000);
+  res["maxmicros"] = static_cast<Json::UInt64> (maxNanos / 1000);
+
+  Json::Value hist(Json::arrayValue);
+  for (unsigned i = 0; i < NUM_BUCKETS; ++i)
+    {
+      if (buckets[i] == 0)
+        continue;
+
+      Json::Value cur(Json::objectValue);
+      if (i + 1 < NUM_BUCKETS)
+        cur["belowmicros"] = static_cast<Json::UInt64> (uint64_t (1) << i);
+      cur["count"] = static_cast<Json::UInt64> (buckets[i]);
+      hist.append (cur);
+    }
+  res["histogram"] = hist;
+
+  return res;
+}
+
+/* ************************************************************************** */
+
+ConcurrentDurationHistogram::ConcurrentDurationHistogram ()
+  : count(0), totalNanos(0), maxNanos(0)
+{
+  for (auto& b : buckets)
+    b.store (0, std::memory_order_relaxed);
+}
+
+void
+ConcurrentDurationHistogram::Add (const std::chrono::nanoseconds duration)
+{
+  const uint64_t nanos = std::max<int64_t> (duration.count (), 0);
+
+  buckets[DurationHistogram::GetBucket (nanos)]
+      .fetch_add (1, std::memory_order_relaxed);
+  count.fetch_add (1, std::memory_order_relaxed);
+  totalNanos.fetch_add (nanos, std::memory_order_relaxed);
+
+  uint64_t oldMax = maxNanos.load (std::memory_order_relaxed);
+  while (nanos > oldMax
+           && !maxNanos.compare_exchange_weak (oldMax, nanos,
+                                               std::memory_order_relaxed))
+    ;
+}
+
+DurationHistogram
+ConcurrentDurationHistogram::Get () const
+{
+  DurationHistogram res;
+  for (unsigned i = 0; i < DurationHistogram::NUM_BUCKETS; ++i)
+    res.buckets[i] = buckets[i].load (std::memory_order_relaxed);
+  res.count = count.load (std::memory_order_relaxed);
+  res.totalNanos = totalNanos.load (std::memory_order_relaxed);
+  res.maxNanos = maxNanos.load (std::memory_order_relaxed);
+
+  return res;
+}
+
+/* ************************************************************************** */
+
+namespace
+{
+
+/** Name under which call sites are recorded if the table is full.  */
+const char* const OTHER_SITES = "(other)";
+
+} // anonymous namespace
+
+InstrumentedMutex::InstrumentedMutex ()
+  : enabled(false)
+{}
+
+void
+InstrumentedMutex::Enable ()
+{
+  if (sites == nullptr)
+    {
+      sites.reset (new SiteStats[MAX_SITES]);
+      sites[MAX_SITES - 1].site = OTHER_SITES;
+    }
+
+  enabled.store (true, std::memory_order_release);
+}
+
+InstrumentedMutex::SiteStats&
+InstrumentedMutex::GetSite (const char* site)
+{
+  constexpr unsigned numSlots = MAX_SITES - 1;
+  const unsigned start = std::hash<const char*> () (site) % numSlots;
+
+  for (unsigned i = 0; i < numSlots; ++i)
+    {
+      SiteStats& slot = sites[(start + i) % numSlots];
+
+      const char* cur = slot.site.load (std::memory_order_acquire);
+      if (cur == nullptr
+            && slot.site.compare_exchange_strong (cur, site,
+                                                  std::memory_order_acq_rel))
+        return slot;
+      if (cur == site)
+        return slot;
+    }
+
+  return sites[MAX_SITES - 1];
+}
+
+void
+InstrumentedMutex::lock (const char* site)
+{
+  if (!enabled.load (std::memory_order_acquire))
+    {
+      mut.lock ();
+      return;
+    }
+
+  CHECK (site != nullptr);
+
+  bool contended = false;
+  Clock::time_point start;
+  if (!mut.try_lock ())
+    {
+      contended = true;
+      start = Clock::now ();
+      mut.lock ();
+    }
+
+  /* Only remember the data here; it is recorded in unlock after the mutex
+     has been released.  */
+  holderSite = site;
+  acquireTime = Clock::now ();
+  holderContended = contended;
+  holderWait = contended ? acquireTime - start : Clock::duration::zero ();
+}
+
+void
+InstrumentedMutex::unlock ()
+{
+  /* The lock may have been acquired before the instrumentation was
+     enabled, in which case there is nothing to record.  */
+  if (holderSite == nullptr)
+    {
+      mut.unlock ();
+      return;
+    }
+
+  const char* site = holderSite;
+  const auto held = Clock::now () - acquireTime;
+  const auto waited = holderWait;
+  const bool contended = holderContended;
+  holderSite = nullptr;
+
+  mut.unlock ();
+
+  SiteStats& stats = GetSite (site);
+  stats.acquisitions.fetch_add (1, std::memory_order_relaxed);
+  if (contended)
+    stats.contended.fetch_add (1, std::memory_order_relaxed);
+  stats.wait.Add (waited);
+  stats.hold.Add (held);
+}
+
+namespace
+{
+
+/**
+ * Plain copy of the statistics for a call site.
+ */
+struct SiteSnapshot
+{
+  uint64_t acquisitions = 0;
+  uint64_t contended = 0;
+  DurationHistogram wait;
+  DurationHistogram hold;
+};
+
+} // anonymous namespace
+
+Json::Value
+InstrumentedMutex::GetStats (const unsigned topSites) const
+{
+  /* Copy the counters out of the table first, and then do all the merging
+     and JSON work on the copy.  Different pointers may refer to equal
+     strings (e.g. from different translation units), so merge them
+     by name.  */
+  std::map<std::string, SiteSnapshot> byName;
+  if (enabled.load (std::memory_order_acquire))
+    for (unsigned i = 0; i < MAX_SITES; ++i)
+      {
+        const SiteStats& entry = sites[i];
+        const char* site = entry.site.load (std::memory_order_acquire);
+        if (site == nullptr)
+          continue;
+
+        const uint64_t acquisitions
+            = entry.acquisitions.load (std::memory_order_relaxed);
+        if (acquisitions == 0)
+          continue;
+
+        auto& cur = byName[site];
+        cur.acquisitions += acquisitions;
+        cur.contended += entry.contended.load (std::memory_order_relaxed);
+        cur.wait.Merge (entry.wait.Get ());
+        cur.hold.Merge (entry.hold.Get ());
+      }
+
+  DurationHistogram totalWait, totalHold;
+  uint64_t acquisitions = 0, contended = 0;
+  std::vector<std::pair<std::string, const SiteSnapshot*>> sorted;
+  for (const auto& entry : byName)
+    {
+      acquisitions += entry.second.acquisitions;
+      contended += entry.second.contended;
+      totalWait.Merge (entry.second.wait);
+      totalHold.Merge (entry.second.hold);
+      sorted.emplace_back (entry.first, &entry.second);
+    }
+
+  std::stable_sort (sorted.begin (), sorted.end (),
+                    [] (const std::pair<std::string, const SiteSnapshot*>& a,
+                        const std::pair<std::string, const SiteSnapshot*>& b)
+                      {
+                        return a.second->wait.GetTotalNanos ()
+                                  > b.second->wait.GetTotalNanos ();
+                      });
+
+  Json::Value top(Json::arrayValue);
+  for (size_t i = 0; i < sorted.size () && i < topSites; ++i)
+    {
+      const SiteSnapshot& s = *sorted[i].second;
+
+      Json::Value cur(Json::objectValue);
+      cur["site"] = sorted[i].first;
+      cur["acquisitions"] = static_cast<Json::UInt64> (s.acquisitions);
+      cur["contended"] = static_cast<Json::UInt64> (s.contended);
+      cur["wait"] = s.wait.ToJson ();
+      cur["hold"] = s.hold.ToJson ();
+      top.append (cur);
+    }
+
+  Json::Value res(Json::objectValue);
+  res["acquisitions"] = static_cast<Json::UInt64> (acquisitions);
+  res["contended"] = static_cast<Json::UInt64> (contended);
+  res["wait"] = totalWait.ToJson ();
+  res["hold"] = totalHold.ToJson ();
+  res["topsites"] = top;
+
+  return res;
+}
+
+} // namespace internal
+} // namespace xaya
@@ -0,0 +1,286 @@
+// Copyright (C) 2019 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef XAYAGAME_INSTRUMENTEDMUTEX_HPP
+#define XAYAGAME_INSTRUMENTEDMUTEX_HPP
+
+/* This file is an implementation detail of Game and should not be
+   used directly by external code!  */
+
+#include <json/json.h>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+
+namespace xaya
+{
+namespace internal
+{
+
+/**
+ * Histogram of durations with power-of-two buckets in microseconds.
+ */
+class DurationHistogram
+{
+
+public:
+
+  /**
+   * Number of buckets.  The first one is for durations below 1 us, the
+   * following ones up to 2^(i-1) us, and the last one for everything above.
+   */
+  static constexpr unsigned NUM_BUCKETS = 26;
+
+private:
+
+  std::array<uint64_t, NUM_BUCKETS> buckets;
+
+  uint64_t count = 0;
+  uint64_t totalNanos = 0;
+  uint64_t maxNanos = 0;
+
+  friend class ConcurrentDurationHistogram;
+
+public:
+
+  DurationHistogram ();
+
+  DurationHistogram (const DurationHistogram&) = default;
+  DurationHistogram& operator= (const DurationHistogram&) = default;
+
+  /**
+   * Returns the index of the bucket for a duration in nanoseconds.
+   */
+  static unsigned GetBucket (uint64_t nanos);
+
+  void Add (std::chrono::nanoseconds duration);
+
+  /**
+   * Adds all entries of another histogram to this one.
+   */
+  void Merge (const DurationHistogram& other);
+
+  uint64_t
+  GetTotalNanos () const
+  {
+    return totalNanos;
+  }
+
+  /**
+   * Returns the histogram as JSON, with the number of entries, the total
+   * and maximum durations, and the non-empty buckets (each with the upper
+   * bound of its durations in microseconds and the count).
+   */
+  Json::Value ToJson () const;
+
+};
+
+/**
+ * Version of DurationHistogram that can be updated from multiple threads
+ * without locking, using relaxed atomics.  A copy taken while other threads
+ * add entries may be slightly inconsistent (e.g. the count not matching the
+ * buckets exactly), which is fine for statistics.
+ */
+class ConcurrentDurationHistogram
+{
+
+private:
+
+  std::array<std::atomic<uint64_t>, DurationHistogram::NUM_BUCKETS> buckets;
+
+  std::atomic<uint64_t> count;
+  std::atomic<uint64_t> totalNanos;
+  std::atomic<uint64_t> maxNanos;
+
+public:
+
+  ConcurrentDurationHistogram ();
+
+  ConcurrentDurationHistogram (const ConcurrentDurationHistogram&) = delete;
+  void operator= (const ConcurrentDurationHistogram&) = delete;
+
+  void Add (std::chrono::nanoseconds duration);
+
+  /**
+   * Returns a copy of the current data as plain histogram.
+   */
+  DurationHistogram Get () const;
+
+};
+
+/**
+ * Wrapper around std::mutex which can optionally record how long threads
+ * wait to acquire it and how long they hold it, per call site.  This is
+ * used to find out how much latency is caused by contention on a lock.
+ *
+ * The call site is a string given when locking, which should be a literal
+ * (as it is only stored as pointer).  InstrumentedLock fills it in with
+ * the name of the calling function automatically.
+ *
+ * The statistics are kept per call site in a fixed table of atomic
+ * counters, and they are only updated after the mutex has been released
+ * again, so that the instrumentation does not lengthen the time the lock
+ * is held nor take another lock.  When instrumentation is not enabled,
+ * the overhead is a single atomic load per lock operation.
+ */
+class InstrumentedMutex
+{
+
+private:
+
+  using Clock = std::chrono::steady_clock;
+
+  /**
+   * Maximum number of distinct call sites that are recorded individually.
+   * Further sites are recorded together under a generic name.
+   */
+  static constexpr unsigned MAX_SITES = 128;
+
+  /**
+   * Statistics about one call site.
+   */
+  struct SiteStats
+  {
+
+    /** The call site this is for, or null if the slot is still free.  */
+    std::atomic<const char*> site;
+
+    std::atomic<uint64_t> acquisitions;
+    std::atomic<uint64_t> contended;
+    ConcurrentDurationHistogram wait;
+    ConcurrentDurationHistogram hold;
+
+    SiteStats ()
+      : site(nullptr), acquisitions(0), contended(0)
+    {}
+
+  };
+
+  /** The underlying mutex.  */
+  std::mutex mut;
+
+  /** Whether or not the instrumentation is enabled.  */
+  std::atomic<bool> enabled;
+
+  /**
+   * The call site of the current holder, or null if the lock is not held or
+   * was acquired without instrumentation.  This and the other data about
+   * the current holder are only accessed by the thread holding mut.
+   */
+  const char* holderSite = nullptr;
+
+  /** The time at which the current holder acquired the lock.  */
+  Clock::time_point acquireTime;
+
+  /** How long the current holder waited for the lock.  */
+  Clock::duration holderWait;
+
+  /** Whether the current holder had to wait for the lock.  */
+  bool holderContended = false;
+
+  /**
+   * Table of statistics per call site, allocated when the instrumentation
+   * is enabled.  It is an open-addressing hash table keyed by the site
+   * pointer, whose slots are claimed atomically.  The last slot collects
+   * all sites that do not fit anymore.
+   */
+  std::unique_ptr<SiteStats[]> sites;
+
+  /**
+   * Returns the slot in the table for the given call site, claiming a new
+   * one if the site has not been seen yet.
+   */
+  SiteStats& GetSite (const char* site);
+
+public:
+
+  InstrumentedMutex ();
+
+  InstrumentedMutex (const InstrumentedMutex&) = delete;
+  void operator= (const InstrumentedMutex&) = delete;
+
+  /**
+   * Turns on recording of statistics.  This should be done while no other
+   * thread uses the mutex yet.
+   */
+  void Enable ();
+
+  bool
+  IsEnabled () const
+  {
+    return enabled.load (std::memory_order_relaxed);
+  }
+
+  void lock (const char* site);
+  void unlock ();
+
+  /**
+   * Returns the recorded statistics as JSON, with histograms of wait and
+   * hold times overall and the call sites with the longest total waiting
+   * time (at most topSites of them).  This does not block the mutex.
+   */
+  Json::Value GetStats (unsigned topSites) const;
+
+};
+
+/**
+ * Scoped lock for InstrumentedMutex, which can be used in place of
+ * std::lock_guard or std::unique_lock (including with
+ * std::condition_variable_any).  By default, the call site is the name
+ * of the function constructing the lock.
+ */
+class InstrumentedLock
+{
+
+private:
+
+  InstrumentedMutex& mut;
+  const char* const site;
+
+  /** Whether or not we hold the lock currently.  */
+  bool owns;
+
+public:
+
+  explicit InstrumentedLock (InstrumentedMutex& m,
+                             const char* s = __builtin_FUNCTION ())
+    : mut(m), site(s), owns(false)
+  {
+    lock ();
+  }
+
+  ~InstrumentedLock ()
+  {
+    if (owns)
+      unlock ();
+  }
+
+  InstrumentedLock () = delete;
+  InstrumentedLock (const InstrumentedLock&) = delete;
+  void operator= (const InstrumentedLock&) = delete;
+
+  void
+  lock ()
+  {
+    mut.lock (site);
+    owns = true;
+  }
+
+  void
+  unlock ()
+  {
+    owns = false;
+    mut.unlock ();
+  }
+
+};
+
+} // namespace internal
+} // namespace xaya
+
+#endif // XAYAGAME_INSTRUMENTEDMUTEX_HPP
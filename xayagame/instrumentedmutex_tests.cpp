@@ -0,0 +1,254 @@
+// Copyright (C) 2019 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "instrumentedmutex.hpp"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+namespace xaya
+{
+namespace internal
+{
+namespace
+{
+
+using std::chrono::microseconds;
+using std::chrono::milliseconds;
+
+/* ************************************************************************** */
+
+TEST (DurationHistogramTests, Buckets)
+{
+  DurationHistogram hist;
+  hist.Add (std::chrono::nanoseconds (500));
+  hist.Add (microseconds (1));
+  hist.Add (microseconds (3));
+  hist.Add (microseconds (3));
+  hist.Add (std::chrono::hours (100));
+
+  const Json::Value res = hist.ToJson ();
+  EXPECT_EQ (res["count"].asUInt64 (), 5);
+  EXPECT_EQ (res["maxmicros"].asUInt64 (), 360000000000ull);
+
+  const Json::Value& buckets = res["histogram"];
+  ASSERT_EQ (buckets.size (), 4);
+  EXPECT_EQ (buckets[0]["belowmicros"].asUInt64 (), 1);
+  EXPECT_EQ (buckets[0]["count"].asUInt64 (), 1);
+  EXPECT_EQ (buckets[1]["belowmicros"].asUInt64 (), 2);
+  EXPECT_EQ (buckets[1]["count"].asUInt64 (), 1);
+  EXPECT_EQ (buckets[2]["belowmicros"].asUInt64 (), 4);
+  EXPECT_EQ (buckets[2]["count"].asUInt64 (), 2);
+  EXPECT_FALSE (buckets[3].isMember ("belowmicros"));
+  EXPECT_EQ (buckets[3]["count"].asUInt64 (), 1);
+}
+
+TEST (DurationHistogramTests, Merge)
+{
+  DurationHistogram a, b;
+  a.Add (microseconds (10));
+  b.Add (microseconds (20));
+  b.Add (microseconds (30));
+  a.Merge (b);
+
+  const Json::Value res = a.ToJson ();
+  EXPECT_EQ (res["count"].asUInt64 (), 3);
+  EXPECT_EQ (res["totalmicros"].asUInt64 (), 60);
+  EXPECT_EQ (res["maxmicros"].asUInt64 (), 30);
+}
+
+/* ************************************************************************** */
+
+class InstrumentedMutexTests : public testing::Test
+{
+
+protected:
+
+  InstrumentedMutex mut;
+
+  void
+  LockedHere ()
+  {
+    InstrumentedLock lock(mut);
+  }
+
+};
+
+TEST_F (InstrumentedMutexTests, DisabledRecordsNothing)
+{
+  LockedHere ();
+  EXPECT_FALSE (mut.IsEnabled ());
+  EXPECT_EQ (mut.GetStats (10)["acquisitions"].asUInt64 (), 0);
+}
+
+TEST_F (InstrumentedMutexTests, CallSites)
+{
+  mut.Enable ();
+
+  LockedHere ();
+  LockedHere ();
+  {
+    InstrumentedLock lock(mut, "explicit");
+    std::this_thread::sleep_for (milliseconds (5));
+  }
+
+  const Json::Value stats = mut.GetStats (10);
+  EXPECT_EQ (stats["acquisitions"].asUInt64 (), 3);
+  EXPECT_EQ (stats["contended"].asUInt64 (), 0);
+  EXPECT_EQ (stats["hold"]["count"].asUInt64 (), 3);
+  EXPECT_GE (stats["hold"]["maxmicros"].asUInt64 (), 5000);
+
+  const Json::Value& sites = stats["topsites"];
+  ASSERT_EQ (sites.size (), 2);
+  for (const auto& s : sites)
+    if (s["site"].asString () == "explicit")
+      {
+        EXPECT_EQ (s["acquisitions"].asUInt64 (), 1);
+        EXPECT_GE (s["hold"]["totalmicros"].asUInt64 (), 5000);
+      }
+    else
+      {
+        EXPECT_EQ (s["site"].asString (), "LockedHere");
+        EXPECT_EQ (s["acquisitions"].asUInt64 (), 2);
+      }
+
+  EXPECT_EQ (mut.GetStats (1)["topsites"].size (), 1);
+}
+
+TEST_F (InstrumentedMutexTests, Contention)
+{
+  mut.Enable ();
+
+  std::atomic<bool> locked(false);
+  std::thread holder ([&] ()
+    {
+      InstrumentedLock lock(mut, "holder");
+      locked = true;
+      std::this_thread::sleep_for (milliseconds (20));
+    });
+
+  while (!locked)
+    std::this_thread::yield ();
+  {
+    InstrumentedLock lock(mut, "waiter");
+  }
+  holder.join ();
+
+  const Json::Value stats = mut.GetStats (10);
+  EXPECT_EQ (stats["contended"].asUInt64 (), 1);
+
+  const Json::Value& top = stats["topsites"][0];
+  EXPECT_EQ (top["site"].asString (), "waiter");
+  EXPECT_EQ (top["contended"].asUInt64 (), 1);
+  EXPECT_GE (top["wait"]["maxmicros"].asUInt64 (), 5000);
+}
+
+TEST_F (InstrumentedMutexTests, ConditionVariable)
+{
+  mut.Enable ();
+
+  std::condition_variable_any cv;
+  bool ready = false;
+
+  std::thread waiter ([&] ()
+    {
+      InstrumentedLock lock(mut, "waiter");
+      cv.wait (lock, [&ready] () { return ready; });
+    });
+
+  std::this_thread::sleep_for (milliseconds (5));
+  {
+    InstrumentedLock lock(mut, "notifier");
+    ready = true;
+    cv.notify_all ();
+  }
+  waiter.join ();
+
+  /* Time spent waiting on the condition variable does not count as
+     holding the lock.  */
+  const Json::Value stats = mut.GetStats (10);
+  EXPECT_EQ (stats["hold"]["count"].asUInt64 (),
+             stats["acquisitions"].asUInt64 ());
+  EXPECT_LT (stats["hold"]["maxmicros"].asUInt64 (), 5000);
+}
+
+TEST_F (InstrumentedMutexTests, EnabledWhileHeld)
+{
+  {
+    InstrumentedLock lock(mut, "before");
+    mut.Enable ();
+  }
+
+  LockedHere ();
+  const Json::Value stats = mut.GetStats (10);
+  EXPECT_EQ (stats["acquisitions"].asUInt64 (), 1);
+  EXPECT_EQ (stats["hold"]["count"].asUInt64 (), 1);
+}
+
+TEST_F (InstrumentedMutexTests, ConcurrentUpdates)
+{
+  mut.Enable ();
+
+  constexpr unsigned numThreads = 4;
+  constexpr unsigned perThread = 1000;
+
+  std::vector<std::thread> threads;
+  for (unsigned i = 0; i < numThreads; ++i)
+    threads.emplace_back ([this] ()
+      {
+        for (unsigned j = 0; j < perThread; ++j)
+          LockedHere ();
+      });
+  for (auto& t : threads)
+    t.join ();
+
+  const Json::Value stats = mut.GetStats (10);
+  EXPECT_EQ (stats["acquisitions"].asUInt64 (), numThreads * perThread);
+  EXPECT_EQ (stats["wait"]["count"].asUInt64 (), numThreads * perThread);
+  EXPECT_EQ (stats["hold"]["count"].asUInt64 (), numThreads * perThread);
+  ASSERT_EQ (stats["topsites"].size (), 1);
+  EXPECT_EQ (stats["topsites"][0]["site"].asString (), "LockedHere");
+}
+
+TEST_F (InstrumentedMutexTests, StatsWhileHeld)
+{
+  mut.Enable ();
+  LockedHere ();
+
+  InstrumentedLock lock(mut, "holder");
+  EXPECT_EQ (mut.GetStats (10)["acquisitions"].asUInt64 (), 1);
+}
+
+TEST_F (InstrumentedMutexTests, TooManySites)
+{
+  mut.Enable ();
+
+  constexpr unsigned numSites = 200;
+  static char names[numSites][16];
+  for (unsigned i = 0; i < numSites; ++i)
+    {
+      std::snprintf (names[i], sizeof (names[i]), "site %u", i);
+      InstrumentedLock lock(mut, names[i]);
+    }
+
+  const Json::Value stats = mut.GetStats (numSites);
+  EXPECT_EQ (stats["acquisitions"].asUInt64 (), numSites);
+  EXPECT_LT (stats["topsites"].size (), numSites);
+
+  uint64_t other = 0;
+  for (const auto& s : stats["topsites"])
+    if (s["site"].asString () == "(other)")
+      other = s["acquisitions"].asUInt64 ();
+  EXPECT_EQ (other, numSites - stats["topsites"].size () + 1);
+}
+
+} // anonymous namespace
+} // namespace internal
+} // namespace xaya
@@ -62,10 +62,12 @@ LMDBStorage::~LMDBStorage ()
      but the check for being a nullptr can be done afterwards just fine.  */
   CHECK (startedTxn == nullptr);
 
-  /* When needsResize is set, it should always be reset soon after by the
-     following RollbackTransaction call.  It should never be left true until
-     the object gets destructed, at the very least.  */
-  CHECK (!needsResize);
+  /* needsResize may still be set here, if a resize was deferred because of
+     open snapshots and no transaction has been started since.  That is fine,
+     the map will simply run full again (and get resized then) when the
+     database is opened the next time.  */
+  std::lock_guard<std::mutex> lock(mutSnapshots);
+  CHECK_EQ (numSnapshots, 0) << "LMDBStorage destroyed with open snapshots";
 }
 
 void
@@ -78,12 +80,11 @@ LMDBStorage::CheckOk (const int code) const
      set a flag that tells us to resize the map in the following
      RollbackTransaction call that will be made when the stack unwinds.  There
      we do the actual resizing, so that we are sure there is no currently
-     open transaction.  */
+     open transaction.  If snapshots are open at that point, the resize is
+     deferred further and we may see MDB_MAP_FULL again in the mean time.  */
   if (code == MDB_MAP_FULL)
     {
       LOG (WARNING) << "The LMDB map needs to be resized";
-      CHECK (!needsResize)
-          << "We got another MDB_MAP_FULL error while waiting for the resize";
       needsResize = true;
       throw StorageInterface::RetryWithNewTransaction ("LMDB needs resize");
     }
@@ -95,7 +96,12 @@ void
 LMDBStorage::Initialise ()
 {
   LOG (INFO) << "Opening LMDB database at " << directory;
-  CheckOk (mdb_env_open (env, directory.c_str (), 0, 0644));
+
+  /* With MDB_NOTLS, read-only transactions are not tied to the thread that
+     created them.  This allows a thread to have multiple of them open (e.g.
+     a snapshot and a ReadTransaction), and snapshots to be passed to other
+     threads.  */
+  CheckOk (mdb_env_open (env, directory.c_str (), MDB_NOTLS, 0644));
 
   MDB_envinfo stat;
   CheckOk (mdb_env_info (env, &stat));
@@ -210,6 +216,8 @@ DecodeUnsigned (const unsigned char* bytes)
 
 /**
  * Utility class that manages a read-only transaction using RAII mechanics.
+ * It also implements the actual reading of the data, so that the code
+ * can be shared between the storage itself and snapshots.
  */
 class LMDBStorage::ReadTransaction
 {
@@ -240,12 +248,14 @@ public:
   /**
    * Constructs a read transaction for the given LMDBStorage.  If the instance
    * has a currently open transaction, then that one is used for reading to
-   * ensure that already-modified state is seen.
+   * ensure that already-modified state is seen.  If forceOwnTx is set, then
+   * a fresh read-only transaction is always started instead, which sees
+   * just the committed state.
    */
-  explicit ReadTransaction (const LMDBStorage& s)
+  explicit ReadTransaction (const LMDBStorage& s, const bool forceOwnTx = false)
     : storage(s)
   {
-    if (storage.startedTxn == nullptr)
+    if (forceOwnTx || storage.startedTxn == nullptr)
       {
         ownTx = true;
         VLOG (1) << "Starting a new read-only LMDB transaction";
@@ -273,6 +283,10 @@ public:
       }
   }
 
+  ReadTransaction () = delete;
+  ReadTransaction (const ReadTransaction&) = delete;
+  void operator= (const ReadTransaction&) = delete;
+
   /**
    * Reads data for the given key.  Returns false if the key is not found.
    */
@@ -291,39 +305,64 @@ public:
     LOG (FATAL) << "CheckOk should have failed with code " << code;
   }
 
+  bool
+  GetCurrentBlockHash (uint256& hash) const
+  {
+    MDB_val key;
+    SingleByteValue (KEY_CURRENT_HASH, key);
+
+    MDB_val data;
+    if (!ReadData (key, data))
+      return false;
+
+    CHECK_EQ (data.mv_size, uint256::NUM_BYTES)
+        << "Invalid data for current block hash in LMDB";
+    hash.FromBlob (static_cast<const unsigned char*> (data.mv_data));
+
+    return true;
+  }
+
+  GameStateData
+  GetCurrentGameState () const
+  {
+    MDB_val key;
+    SingleByteValue (KEY_CURRENT_STATE, key);
+
+    MDB_val data;
+    CHECK (ReadData (key, data));
+
+    return ValueToString (data, 0);
+  }
+
+  bool
+  GetUndoData (const uint256& hash, UndoData& undo) const
+  {
+    MDB_val key;
+    const std::string strKey = KeyForUndoData (hash);
+    StringToValue (strKey, key);
+
+    MDB_val data;
+    if (!ReadData (key, data))
+      return false;
+
+    undo = ValueToString (data, UNDO_HEIGHT_BYTES);
+    return true;
+  }
+
 };
 
 bool
 LMDBStorage::GetCurrentBlockHash (uint256& hash) const
 {
   ReadTransaction tx(*this);
-
-  MDB_val key;
-  SingleByteValue (KEY_CURRENT_HASH, key);
-
-  MDB_val data;
-  if (!tx.ReadData (key, data))
-    return false;
-
-  CHECK_EQ (data.mv_size, uint256::NUM_BYTES)
-      << "Invalid data for current block hash in LMDB";
-  hash.FromBlob (static_cast<const unsigned char*> (data.mv_data));
-
-  return true;
+  return tx.GetCurrentBlockHash (hash);
 }
 
 GameStateData
 LMDBStorage::GetCurrentGameState () const
 {
   ReadTransaction tx(*this);
-
-  MDB_val key;
-  SingleByteValue (KEY_CURRENT_STATE, key);
-
-  MDB_val data;
-  CHECK (tx.ReadData (key, data));
-
-  return ValueToString (data, 0);
+  return tx.GetCurrentGameState ();
 }
 
 void
@@ -352,17 +391,7 @@ bool
 LMDBStorage::GetUndoData (const uint256& hash, UndoData& undo) const
 {
   ReadTransaction tx(*this);
-
-  MDB_val key;
-  const std::string strKey = KeyForUndoData (hash);
-  StringToValue (strKey, key);
-
-  MDB_val data;
-  if (!tx.ReadData (key, data))
-    return false;
-
-  undo = ValueToString (data, UNDO_HEIGHT_BYTES);
-  return true;
+  return tx.GetUndoData (hash, undo);
 }
 
 void
@@ -523,8 +552,9 @@ LMDBStorage::PruneUndoData (unsigned height)
 void
 LMDBStorage::BeginTransaction ()
 {
-  CHECK (!needsResize);
   CHECK (startedTxn == nullptr);
+  if (needsResize)
+    TryResize ();
 
   VLOG (1) << "Starting a new LMDB transaction";
   CheckOk (mdb_txn_begin (env, nullptr, 0, &startedTxn));
@@ -537,7 +567,6 @@ LMDBStorage::BeginTransaction ()
 void
 LMDBStorage::CommitTransaction ()
 {
-  CHECK (!needsResize);
   CHECK (startedTxn != nullptr);
   VLOG (1) << "Committing the current LMDB transaction";
 
@@ -577,12 +606,34 @@ LMDBStorage::RollbackTransaction ()
   CHECK (startedTxn == nullptr);
 
   if (needsResize)
-    {
-      needsResize = false;
-      Resize ();
-    }
+    TryResize ();
 
   CHECK (startedTxn == nullptr);
+}
+
+void
+LMDBStorage::TryResize ()
+{
+  CHECK (startedTxn == nullptr);
+  CHECK (needsResize);
+
+  /* mdb_env_set_mapsize must not be called while any transaction is open
+     in this process, including the read transactions of snapshots.  We do not
+     wait for them here, since the caller (e.g. the Game) may hold locks that
+     the snapshot readers need.  Instead, the resize is retried at the start
+     of the next transaction.  */
+  {
+    std::lock_guard<std::mutex> lock(mutSnapshots);
+    if (numSnapshots > 0)
+      {
+        LOG (INFO)
+            << "Deferring LMDB resize, there are " << numSnapshots
+            << " open snapshots";
+        return;
+      }
+  }
+
+  Resize ();
   CHECK (!needsResize);
 }
 
@@ -650,4 +701,92 @@ LMDBStorage::Resize ()
     }
 }
 
+/**
+ * Snapshot of an LMDBStorage, which is just a read-only transaction that
+ * is kept open until the snapshot is destroyed.
+ */
+class LMDBStorage::Snapshot : public StorageSnapshot
+{
+
+private:
+
+  /** The storage this belongs to.  */
+  const LMDBStorage& storage;
+
+  /** The read transaction used.  */
+  std::unique_ptr<ReadTransaction> tx;
+
+public:
+
+  explicit Snapshot (const LMDBStorage& s)
+    : storage(s)
+  {
+    tx.reset (new ReadTransaction (storage, true));
+  }
+
+  ~Snapshot ()
+  {
+    /* The transaction has to be closed before the snapshot is no longer
+       counted, so that a deferred resize can safely proceed.  */
+    tx.reset ();
+
+    std::lock_guard<std::mutex> lock(storage.mutSnapshots);
+    CHECK_GT (storage.numSnapshots, 0);
+    --storage.numSnapshots;
+  }
+
+  bool
+  GetCurrentBlockHash (uint256& hash) const override
+  {
+    return tx->GetCurrentBlockHash (hash);
+  }
+
+  GameStateData
+  GetCurrentGameState () const override
+  {
+    return tx->GetCurrentGameState ();
+  }
+
+  bool
+  GetUndoData (const uint256& hash, UndoData& undo) const override
+  {
+    return tx->GetUndoData (hash, undo);
+  }
+
+  bool
+  ShouldCloseEarly () const override
+  {
+    /* A resize of the map has to wait until all snapshots are closed.  */
+    return true;
+  }
+
+};
+
+std::unique_ptr<StorageSnapshot>
+LMDBStorage::OpenSnapshot () const
+{
+  /* Do not open new snapshots while a resize is pending.  Otherwise a steady
+     stream of readers could keep the resize from ever happening.  */
+  if (needsResize)
+    return nullptr;
+
+  /* Account for the snapshot before starting its transaction, so that the
+     count is never lower than the number of actually open transactions.  */
+  {
+    std::lock_guard<std::mutex> lock(mutSnapshots);
+    ++numSnapshots;
+  }
+
+  try
+    {
+      return std::unique_ptr<StorageSnapshot> (new Snapshot (*this));
+    }
+  catch (...)
+    {
+      std::lock_guard<std::mutex> lock(mutSnapshots);
+      --numSnapshots;
+      throw;
+    }
+}
+
 } // namespace xaya
@@ -10,6 +10,8 @@
 
 #include <lmdb.h>
 
+#include <mutex>
+
 namespace xaya
 {
 
@@ -17,6 +19,14 @@ namespace xaya
  * Implementation of StorageInterface that keeps data in an LMDB database.
  * This is an efficient choice for permanent storage if no other features
  * (like an SQL interface) are needed for the game itself.
+ *
+ * Snapshots are supported through LMDB's read-only transactions, which see
+ * the database as of the last commit and do not block writers.  A resize of
+ * the LMDB map (when it runs full) is only possible while no snapshots are
+ * open, though.  Until they are closed, it is deferred; writes that need the
+ * extra space keep failing with RetryWithNewTransaction, and OpenSnapshot
+ * returns null so that the resize can eventually go through.  Snapshots
+ * therefore request to be closed early (see ShouldCloseEarly).
  */
 class LMDBStorage : public StorageInterface
 {
@@ -25,6 +35,7 @@ private:
 
   class ReadTransaction;
   class Cursor;
+  class Snapshot;
 
   /**
    * Directory for the database.  This is used to open the environment
@@ -49,10 +60,20 @@ private:
    * Special flag that is set to true if we encountered an MDB_MAP_FULL error
    * and need to resize the LMDB map after aborting the current transaction
    * (in the next call to RollbackTransaction that is expected to happen
-   * "soon").
+   * "soon").  If snapshots are open at that time, it stays set and the
+   * resize is attempted again when the next transaction is started.
    */
   mutable bool needsResize = false;
 
+  /**
+   * Lock for the number of open snapshots.  Snapshots may be destroyed on
+   * a different thread than the one using the storage itself.
+   */
+  mutable std::mutex mutSnapshots;
+
+  /** Number of currently open snapshots.  */
+  mutable unsigned numSnapshots = 0;
+
   /**
    * Checks that the error code is zero.  If it is not, LOG(FATAL)'s with the
    * LMDB translation of the error code to a string.  This also takes care of
@@ -60,9 +81,17 @@ private:
    */
   void CheckOk (int code) const;
 
+  /**
+   * Resizes the map if a resize is pending and no snapshots are open.
+   * Otherwise the resize is left pending (without blocking).  This must only
+   * be called if no current transaction is active.
+   */
+  void TryResize ();
+
   /**
    * Increases the database map size.  This must only be called if no current
-   * transaction is active (i.e. startedTxn == nullptr).
+   * transaction is active (i.e. startedTxn == nullptr) and no snapshots
+   * are open.
    */
   void Resize ();
 
@@ -99,6 +128,8 @@ public:
   void CommitTransaction () override;
   void RollbackTransaction () override;
 
+  std::unique_ptr<StorageSnapshot> OpenSnapshot () const override;
+
 };
 
 } // namespace xaya
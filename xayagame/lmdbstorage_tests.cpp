@@ -152,6 +152,12 @@ public:
     storage.RollbackTransaction ();
   }
 
+  std::unique_ptr<StorageSnapshot>
+  OpenSnapshot () const override
+  {
+    return storage.OpenSnapshot ();
+  }
+
 };
 
 INSTANTIATE_TYPED_TEST_CASE_P (LMDB, BasicStorageTests,
@@ -160,6 +166,8 @@ INSTANTIATE_TYPED_TEST_CASE_P (LMDB, PruningStorageTests,
                                TempLMDBStorage);
 INSTANTIATE_TYPED_TEST_CASE_P (LMDB, TransactingStorageTests,
                                TempLMDBStorage);
+INSTANTIATE_TYPED_TEST_CASE_P (LMDB, SnapshotStorageTests,
+                               TempLMDBStorage);
 
 /**
  * Tests for things specific to LMDB.  The fixture manages a temporary directory
@@ -256,5 +264,64 @@ TEST_F (LMDBStorageTests, ResizingMap)
   CHECK_GT (resized, 0);
 }
 
+TEST_F (LMDBStorageTests, ResizeDeferredWhileSnapshotOpen)
+{
+  LMDBStorage storage(GetDir ());
+  storage.Initialise ();
+
+  auto snapshot = storage.OpenSnapshot ();
+  ASSERT_NE (snapshot, nullptr);
+
+  /* Fill the map with large entries until it runs full.  The resize must not
+     block while the snapshot is open.  */
+  const UndoData undo(1 << 16, 'x');
+  unsigned i = 0;
+  bool full = false;
+  while (!full)
+    {
+      std::string hex(64, '0');
+      std::sprintf (&hex[0], "%08x", i);
+      CHECK (hex[8] == 0);
+      hex[8] = '0';
+
+      uint256 hash;
+      CHECK (hash.FromHex (hex));
+
+      try
+        {
+          storage.BeginTransaction ();
+          storage.AddUndoData (hash, i, undo);
+          storage.CommitTransaction ();
+          ++i;
+        }
+      catch (const StorageInterface::RetryWithNewTransaction& exc)
+        {
+          storage.RollbackTransaction ();
+          full = true;
+        }
+    }
+
+  /* While the resize is pending, no new snapshots are handed out and writes
+     still fail.  */
+  EXPECT_EQ (storage.OpenSnapshot (), nullptr);
+  uint256 hash;
+  CHECK (hash.FromHex ("ff" + std::string (62, '0')));
+  storage.BeginTransaction ();
+  EXPECT_THROW (storage.AddUndoData (hash, i, undo),
+                StorageInterface::RetryWithNewTransaction);
+  storage.RollbackTransaction ();
+
+  /* Once the snapshot is closed, the resize happens and writing works.  */
+  snapshot.reset ();
+  storage.BeginTransaction ();
+  storage.AddUndoData (hash, i, undo);
+  storage.CommitTransaction ();
+
+  snapshot = storage.OpenSnapshot ();
+  ASSERT_NE (snapshot, nullptr);
+  UndoData val;
+  EXPECT_TRUE (snapshot->GetUndoData (hash, val));
+}
+
 } // anonymous namespace
 } // namespace xaya
@@ -0,0 +1,208 @@
+// Copyright (C) 2019 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "memorybudget.hpp"
+
+#include <glog/logging.h>
+
+namespace xaya
+{
+namespace internal
+{
+
+namespace
+{
+
+/**
+ * Approximate overhead of a node in the map that holds the members
+ * of a JSON object, in addition to key and value.
+ */
+constexpr size_t JSON_MEMBER_OVERHEAD = 32;
+
+} // anonymous namespace
+
+size_t
+EstimateJsonMemory (const Json::Value& val)
+{
+  size_t res = sizeof (Json::Value);
+
+  switch (val.type ())
+    {
+    case Json::stringValue:
+      res += val.asString ().size ();
+      break;
+
+    case Json::arrayValue:
+      for (const auto& entry : val)
+        res += EstimateJsonMemory (entry) + JSON_MEMBER_OVERHEAD;
+      break;
+
+    case Json::objectValue:
+      for (auto it = val.begin (); it != val.end (); ++it)
+        res += it.name ().size () + EstimateJsonMemory (*it)
+                  + JSON_MEMBER_OVERHEAD;
+      break;
+
+    default:
+      break;
+    }
+
+  return res;
+}
+
+MemoryBudget::MemoryBudget (const uint64_t bytes)
+  : budget(bytes)
+{}
+
+void
+MemoryBudget::Register (const std::string& name, MemoryConsumer& c,
+                        const unsigned priority)
+{
+  CHECK_GT (priority, 0) << "Memory consumer " << name << " has no priority";
+
+  std::lock_guard<std::mutex> lock(mut);
+
+  for (auto& r : consumers)
+    if (r.name == name)
+      {
+        r.consumer = &c;
+        r.priority = priority;
+        r.usage = 0;
+        r.share = 0;
+        return;
+      }
+
+  consumers.push_back (Registration {name, &c, priority, 0, 0});
+}
+
+void
+MemoryBudget::Unregister (const std::string& name)
+{
+  std::lock_guard<std::mutex> lock(mut);
+
+  for (auto it = consumers.begin (); it != consumers.end (); ++it)
+    if (it->name == name)
+      {
+        consumers.erase (it);
+        return;
+      }
+}
+
+void
+MemoryBudget::SetBudget (const uint64_t bytes)
+{
+  std::lock_guard<std::mutex> lock(mut);
+  budget = bytes;
+}
+
+uint64_t
+MemoryBudget::GetBudget () const
+{
+  std::lock_guard<std::mutex> lock(mut);
+  return budget;
+}
+
+void
+MemoryBudget::ComputeShares ()
+{
+  /* Consumers that use less than their fair share keep their usage.  This is
+     repeated until all remaining consumers use more than their fair share of
+     what is left, which is then what they get.  */
+  std::vector<Registration*> open;
+  for (auto& r : consumers)
+    open.push_back (&r);
+
+  uint64_t remaining = budget;
+  while (!open.empty ())
+    {
+      uint64_t totalPriority = 0;
+      for (const auto* r : open)
+        totalPriority += r->priority;
+
+      std::vector<Registration*> stillOpen;
+      uint64_t satisfied = 0;
+      for (auto* r : open)
+        {
+          const double fair = static_cast<double> (remaining) * r->priority
+                                / totalPriority;
+          r->share = static_cast<size_t> (fair);
+          if (r->usage <= fair)
+            {
+              r->share = r->usage;
+              satisfied += r->usage;
+            }
+          else
+            stillOpen.push_back (r);
+        }
+
+      if (stillOpen.size () == open.size ())
+        break;
+
+      remaining -= satisfied;
+      open = std::move (stillOpen);
+    }
+}
+
+void
+MemoryBudget::Enforce ()
+{
+  std::lock_guard<std::mutex> lock(mut);
+
+  uint64_t total = 0;
+  for (auto& r : consumers)
+    {
+      r.usage = r.consumer->GetMemoryUsage ();
+      total += r.usage;
+    }
+
+  ComputeShares ();
+  if (total <= budget)
+    return;
+
+  VLOG (1)
+      << "Memory usage of " << total << " bytes exceeds the budget of "
+      << budget << " bytes";
+
+  for (auto& r : consumers)
+    {
+      if (r.usage <= r.share)
+        continue;
+
+      VLOG (1)
+          << "Shrinking " << r.name << " from " << r.usage
+          << " to " << r.share << " bytes";
+      r.consumer->ShrinkMemory (r.share);
+      r.usage = r.consumer->GetMemoryUsage ();
+      ++numShrinks;
+    }
+}
+
+Json::Value
+MemoryBudget::GetStats () const
+{
+  std::lock_guard<std::mutex> lock(mut);
+
+  Json::Value res(Json::objectValue);
+  res["budget"] = static_cast<Json::UInt64> (budget);
+  res["shrinks"] = static_cast<Json::UInt64> (numShrinks);
+
+  uint64_t total = 0;
+  Json::Value cons(Json::objectValue);
+  for (const auto& r : consumers)
+    {
+      Json::Value entry(Json::objectValue);
+      entry["priority"] = r.priority;
+      entry["usage"] = static_cast<Json::UInt64> (r.usage);
+      entry["share"] = static_cast<Json::UInt64> (r.share);
+      cons[r.name] = entry;
+      total += r.usage;
+    }
+  res["usage"] = static_cast<Json::UInt64> (total);
+  res["consumers"] = cons;
+
+  return res;
+}
+
+} // namespace internal
+} // namespace xaya
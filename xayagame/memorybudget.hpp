@@ -0,0 +1,220 @@
+// Copyright (C) 2019 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef XAYAGAME_MEMORYBUDGET_HPP
+#define XAYAGAME_MEMORYBUDGET_HPP
+
+/* This file is an implementation detail of Game and should not be
+   used directly by external code!  */
+
+#include <json/json.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace xaya
+{
+namespace internal
+{
+
+/**
+ * Interface for in-memory caches whose size is controlled by
+ * a MemoryBudget.
+ */
+class MemoryConsumer
+{
+
+public:
+
+  MemoryConsumer () = default;
+  virtual ~MemoryConsumer () = default;
+
+  /**
+   * Returns the (approximate) number of bytes used currently.  This should
+   * be cheap, as it is called after every block.
+   */
+  virtual size_t GetMemoryUsage () const = 0;
+
+  /**
+   * Requests to free memory so that at most the given number of bytes are
+   * used.  Implementations may keep more than that if they cannot drop
+   * some of their data (e.g. the state at the current tip).
+   */
+  virtual void ShrinkMemory (size_t target) = 0;
+
+};
+
+/**
+ * MemoryConsumer that forwards to the given functions.  This is used for
+ * caches that are plain data members (e.g. of Game) rather than classes
+ * of their own.
+ */
+class CallbackMemoryConsumer : public MemoryConsumer
+{
+
+public:
+
+  /** Function returning the memory usage.  */
+  using UsageFcn = std::function<size_t ()>;
+
+  /** Function to shrink the memory usage to a target.  */
+  using ShrinkFcn = std::function<void (size_t)>;
+
+private:
+
+  /** The function to query the usage.  */
+  const UsageFcn usage;
+
+  /** The function to shrink the cache.  */
+  const ShrinkFcn shrink;
+
+public:
+
+  explicit CallbackMemoryConsumer (const UsageFcn& u, const ShrinkFcn& s)
+    : usage(u), shrink(s)
+  {}
+
+  CallbackMemoryConsumer () = delete;
+  CallbackMemoryConsumer (const CallbackMemoryConsumer&) = delete;
+  void operator= (const CallbackMemoryConsumer&) = delete;
+
+  size_t
+  GetMemoryUsage () const override
+  {
+    return usage ();
+  }
+
+  void
+  ShrinkMemory (const size_t target) override
+  {
+    shrink (target);
+  }
+
+};
+
+/**
+ * Returns a rough estimate of the memory used by a JSON value, including
+ * all nested values, object keys and strings.
+ */
+size_t EstimateJsonMemory (const Json::Value& val);
+
+/**
+ * Global memory limit for the caches kept by Game.  Each cache registers
+ * itself here with a name and priority.  When the total usage exceeds
+ * the budget, it is split between the caches and those using more than
+ * their share are asked to shrink.
+ *
+ * The split is done by priority, taking usage into account:  Each cache is
+ * entitled to a share of the budget proportional to its priority.  Caches
+ * that use less than that keep what they have, and the remainder is split
+ * again between the other caches in the same way.
+ *
+ * The class is thread-safe, but registered consumers are only accessed
+ * from Enforce.  The stats returned by GetStats are those from the last
+ * call to Enforce, so they can be queried without touching the consumers.
+ */
+class MemoryBudget
+{
+
+private:
+
+  /**
+   * Data about a registered consumer.
+   */
+  struct Registration
+  {
+
+    /** The name for reporting.  */
+    std::string name;
+
+    /** The consumer itself.  */
+    MemoryConsumer* consumer;
+
+    /** The priority (positive).  */
+    unsigned priority;
+
+    /** The usage when it was last queried.  */
+    size_t usage;
+
+    /** The share of the budget it got assigned in the last split.  */
+    size_t share;
+
+  };
+
+  /** Lock for the data here.  */
+  mutable std::mutex mut;
+
+  /** The budget in bytes.  */
+  uint64_t budget;
+
+  /** The registered consumers.  */
+  std::vector<Registration> consumers;
+
+  /** Number of times any consumer was asked to shrink.  */
+  unsigned long numShrinks = 0;
+
+  /**
+   * Splits the budget between the consumers according to their current
+   * usage values, and stores the result in their share fields.  Must be
+   * called with the lock held.
+   */
+  void ComputeShares ();
+
+public:
+
+  /**
+   * Constructs a budget with the given number of bytes.
+   */
+  explicit MemoryBudget (uint64_t bytes);
+
+  MemoryBudget () = delete;
+  MemoryBudget (const MemoryBudget&) = delete;
+  void operator= (const MemoryBudget&) = delete;
+
+  /**
+   * Registers a consumer with the given name and priority.  If there is
+   * already one with the same name, it is replaced.  The consumer must stay
+   * valid until it is unregistered or replaced, or this instance
+   * is destructed.
+   */
+  void Register (const std::string& name, MemoryConsumer& c,
+                 unsigned priority);
+
+  /**
+   * Unregisters the consumer with the given name, if there is one.
+   */
+  void Unregister (const std::string& name);
+
+  /**
+   * Changes the budget.  It is enforced with the next call to Enforce.
+   */
+  void SetBudget (uint64_t bytes);
+
+  /**
+   * Returns the budget in bytes.
+   */
+  uint64_t GetBudget () const;
+
+  /**
+   * Queries the usage of all consumers and, if the total exceeds the budget,
+   * asks those above their share to shrink.
+   */
+  void Enforce ();
+
+  /**
+   * Returns the budget, total usage and the usage and share per consumer
+   * (as of the last Enforce) as JSON object for reporting.
+   */
+  Json::Value GetStats () const;
+
+};
+
+} // namespace internal
+} // namespace xaya
+
+#endif // XAYAGAME_MEMORYBUDGET_HPP
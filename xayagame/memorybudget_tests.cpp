@@ -0,0 +1,204 @@
+// Copyright (C) 2019 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "memorybudget.hpp"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+
+namespace xaya
+{
+namespace internal
+{
+namespace
+{
+
+/**
+ * Memory consumer for testing, which simply uses a given number of bytes
+ * and shrinks to whatever it is asked to (but not below a minimum).
+ */
+class TestConsumer : public MemoryConsumer
+{
+
+public:
+
+  size_t usage = 0;
+  size_t minimum = 0;
+
+  /** Number of shrink requests received.  */
+  unsigned shrinks = 0;
+
+  size_t
+  GetMemoryUsage () const override
+  {
+    return usage;
+  }
+
+  void
+  ShrinkMemory (const size_t target) override
+  {
+    ++shrinks;
+    usage = std::max (target, minimum);
+  }
+
+};
+
+/* ************************************************************************** */
+
+TEST (EstimateJsonMemoryTests, GrowsWithContent)
+{
+  Json::Value small(Json::objectValue);
+  small["a"] = 1;
+
+  Json::Value large(Json::objectValue);
+  large["a"] = 1;
+  large["text"] = std::string (1000, 'x');
+
+  Json::Value arr(Json::arrayValue);
+  arr.append (large);
+  arr.append (large);
+
+  EXPECT_GT (EstimateJsonMemory (small), EstimateJsonMemory (Json::Value ()));
+  EXPECT_GT (EstimateJsonMemory (large), EstimateJsonMemory (small) + 1000);
+  EXPECT_GT (EstimateJsonMemory (arr), 2 * EstimateJsonMemory (large));
+}
+
+/* ************************************************************************** */
+
+TEST (CallbackMemoryConsumerTests, Forwards)
+{
+  size_t usage = 100;
+  CallbackMemoryConsumer consumer([&usage] ()
+    {
+      return usage;
+    }, [&usage] (const size_t target)
+    {
+      usage = std::min (usage, target);
+    });
+
+  EXPECT_EQ (consumer.GetMemoryUsage (), 100);
+  consumer.ShrinkMemory (40);
+  EXPECT_EQ (usage, 40);
+  EXPECT_EQ (consumer.GetMemoryUsage (), 40);
+}
+
+/* ************************************************************************** */
+
+class MemoryBudgetTests : public testing::Test
+{
+
+protected:
+
+  MemoryBudget budget;
+  TestConsumer a, b, c;
+
+  MemoryBudgetTests ()
+    : budget(1000)
+  {
+    budget.Register ("a", a, 1);
+    budget.Register ("b", b, 1);
+    budget.Register ("c", c, 2);
+  }
+
+  /**
+   * Expects the given usage and share for a consumer in the stats.
+   */
+  void
+  ExpectConsumer (const std::string& name, const size_t usage,
+                  const size_t share)
+  {
+    const Json::Value stats = budget.GetStats ()["consumers"][name];
+    ASSERT_TRUE (stats.isObject ());
+    EXPECT_EQ (stats["usage"].asUInt64 (), usage);
+    EXPECT_EQ (stats["share"].asUInt64 (), share);
+  }
+
+};
+
+TEST_F (MemoryBudgetTests, WithinBudget)
+{
+  a.usage = 500;
+  b.usage = 100;
+  c.usage = 100;
+  budget.Enforce ();
+
+  EXPECT_EQ (a.shrinks + b.shrinks + c.shrinks, 0);
+  EXPECT_EQ (a.usage, 500);
+
+  const Json::Value stats = budget.GetStats ();
+  EXPECT_EQ (stats["budget"].asUInt64 (), 1000);
+  EXPECT_EQ (stats["usage"].asUInt64 (), 700);
+  EXPECT_EQ (stats["shrinks"].asUInt64 (), 0);
+}
+
+TEST_F (MemoryBudgetTests, SplitByPriority)
+{
+  a.usage = 1000;
+  b.usage = 1000;
+  c.usage = 1000;
+  budget.Enforce ();
+
+  EXPECT_EQ (a.usage, 250);
+  EXPECT_EQ (b.usage, 250);
+  EXPECT_EQ (c.usage, 500);
+  ExpectConsumer ("c", 500, 500);
+  EXPECT_EQ (budget.GetStats ()["shrinks"].asUInt64 (), 3);
+}
+
+TEST_F (MemoryBudgetTests, UnusedShareIsRedistributed)
+{
+  a.usage = 50;
+  b.usage = 2000;
+  c.usage = 2000;
+  budget.Enforce ();
+
+  EXPECT_EQ (a.usage, 50);
+  EXPECT_EQ (a.shrinks, 0);
+  EXPECT_EQ (b.usage, 316);
+  EXPECT_EQ (c.usage, 633);
+}
+
+TEST_F (MemoryBudgetTests, ConsumerCannotShrink)
+{
+  a.usage = 2000;
+  a.minimum = 1500;
+  budget.Enforce ();
+
+  EXPECT_EQ (a.usage, 1500);
+  ExpectConsumer ("a", 1500, 1000);
+}
+
+TEST_F (MemoryBudgetTests, SetBudget)
+{
+  a.usage = 300;
+  budget.Enforce ();
+  EXPECT_EQ (a.shrinks, 0);
+
+  budget.SetBudget (200);
+  EXPECT_EQ (budget.GetBudget (), 200);
+  budget.Enforce ();
+  EXPECT_EQ (a.usage, 200);
+}
+
+TEST_F (MemoryBudgetTests, ReplaceAndUnregister)
+{
+  TestConsumer other;
+  other.usage = 5000;
+  budget.Register ("a", other, 1);
+  budget.Enforce ();
+  EXPECT_EQ (other.usage, 1000);
+  EXPECT_EQ (a.shrinks, 0);
+
+  budget.Unregister ("a");
+  budget.Unregister ("a");
+  other.usage = 5000;
+  budget.Enforce ();
+  EXPECT_EQ (other.usage, 5000);
+  EXPECT_FALSE (budget.GetStats ()["consumers"].isMember ("a"));
+}
+
+} // anonymous namespace
+} // namespace internal
+} // namespace xaya
@@ -0,0 +1,217 @@
+// Copyright (C) 2019 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "movearchive.hpp"
+
+#include <glog/logging.h>
+
+namespace xaya
+{
+namespace internal
+{
+
+MoveArchive::MoveArchive (const unsigned n)
+  : nBlocks(n)
+{}
+
+void
+MoveArchive::PopOldest ()
+{
+  CHECK (!blocks.empty ());
+
+  for (const auto& m : blocks.front ().moves)
+    {
+      const auto mit = byName.find (m->name);
+      CHECK (mit != byName.end ());
+      CHECK (!mit->second.empty () && mit->second.front () == m.get ());
+
+      mit->second.pop_front ();
+      if (mit->second.empty ())
+        byName.erase (mit);
+    }
+
+  CHECK_GE (memoryUsage, blocks.front ().bytes);
+  memoryUsage -= blocks.front ().bytes;
+  blocks.pop_front ();
+}
+
+void
+MoveArchive::TrimWindow ()
+{
+  while (blocks.size () > nBlocks)
+    PopOldest ();
+}
+
+void
+MoveArchive::ClearInternal ()
+{
+  blocks.clear ();
+  byName.clear ();
+  memoryUsage = 0;
+}
+
+void
+MoveArchive::SetLimit (const unsigned n)
+{
+  std::lock_guard<std::mutex> lock(mut);
+  nBlocks = n;
+  TrimWindow ();
+}
+
+unsigned
+MoveArchive::GetLimit () const
+{
+  std::lock_guard<std::mutex> lock(mut);
+  return nBlocks;
+}
+
+void
+MoveArchive::AttachBlock (const uint256& parent, const uint256& hash,
+                          const unsigned height, const Json::Value& blockData)
+{
+  Block blk;
+  blk.hash = hash;
+  blk.height = height;
+  blk.bytes = sizeof (blk);
+
+  const auto& moves = blockData["moves"];
+  blk.moves.reserve (moves.size ());
+  for (const auto& m : moves)
+    {
+      auto mv = std::make_unique<Move> ();
+      mv->name = m["name"].asString ();
+      mv->blockHash = hash;
+      mv->height = height;
+      mv->data = m;
+      blk.bytes += sizeof (Move) + sizeof (const Move*) + mv->name.size ()
+                      + EstimateJsonMemory (mv->data);
+      blk.moves.push_back (std::move (mv));
+    }
+
+  std::lock_guard<std::mutex> lock(mut);
+
+  if (!blocks.empty ())
+    {
+      const auto& tip = blocks.back ();
+      if (tip.hash != parent || tip.height + 1 != height)
+        {
+          VLOG (1)
+              << "Attached block " << hash.ToHex ()
+              << " does not extend the move archive, resetting it";
+          ClearInternal ();
+        }
+    }
+
+  for (const auto& m : blk.moves)
+    byName[m->name].push_back (m.get ());
+  memoryUsage += blk.bytes;
+  blocks.push_back (std::move (blk));
+
+  TrimWindow ();
+}
+
+void
+MoveArchive::DetachBlock (const uint256& hash)
+{
+  std::lock_guard<std::mutex> lock(mut);
+
+  if (blocks.empty () || blocks.back ().hash != hash)
+    {
+      VLOG (1)
+          << "Detached block " << hash.ToHex ()
+          << " is not the tip of the move archive, resetting it";
+      ClearInternal ();
+      return;
+    }
+
+  /* The moves of the tip block are the newest entries in the index
+     for their names.  Remove them in reverse order, so that this also
+     works for names with multiple moves in the block.  */
+  const auto& moves = blocks.back ().moves;
+  for (auto it = moves.rbegin (); it != moves.rend (); ++it)
+    {
+      const auto mit = byName.find ((*it)->name);
+      CHECK (mit != byName.end ());
+      CHECK (!mit->second.empty () && mit->second.back () == it->get ());
+
+      mit->second.pop_back ();
+      if (mit->second.empty ())
+        byName.erase (mit);
+    }
+
+  CHECK_GE (memoryUsage, blocks.back ().bytes);
+  memoryUsage -= blocks.back ().bytes;
+  blocks.pop_back ();
+}
+
+void
+MoveArchive::Clear ()
+{
+  std::lock_guard<std::mutex> lock(mut);
+  ClearInternal ();
+}
+
+bool
+MoveArchive::GetTip (uint256& hash) const
+{
+  std::lock_guard<std::mutex> lock(mut);
+
+  if (blocks.empty ())
+    return false;
+
+  hash = blocks.back ().hash;
+  return true;
+}
+
+Json::Value
+MoveArchive::GetMovesByName (const std::string& name,
+                             const unsigned limit) const
+{
+  Json::Value res(Json::arrayValue);
+
+  std::lock_guard<std::mutex> lock(mut);
+
+  const auto mit = byName.find (name);
+  if (mit == byName.end ())
+    return res;
+
+  const auto& moves = mit->second;
+  for (auto it = moves.rbegin (); it != moves.rend (); ++it)
+    {
+      if (res.size () >= limit)
+        break;
+
+      Json::Value entry = (*it)->data;
+      entry["blockhash"] = (*it)->blockHash.ToHex ();
+      entry["height"] = (*it)->height;
+      res.append (entry);
+    }
+
+  return res;
+}
+
+size_t
+MoveArchive::GetNumBlocks () const
+{
+  std::lock_guard<std::mutex> lock(mut);
+  return blocks.size ();
+}
+
+size_t
+MoveArchive::GetMemoryUsage () const
+{
+  std::lock_guard<std::mutex> lock(mut);
+  return memoryUsage;
+}
+
+void
+MoveArchive::ShrinkMemory (const size_t target)
+{
+  std::lock_guard<std::mutex> lock(mut);
+  while (blocks.size () > 1 && memoryUsage > target)
+    PopOldest ();
+}
+
+} // namespace internal
+} // namespace xaya
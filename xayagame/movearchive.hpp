@@ -0,0 +1,199 @@
+// Copyright (C) 2019 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef XAYAGAME_MOVEARCHIVE_HPP
+#define XAYAGAME_MOVEARCHIVE_HPP
+
+/* This file is an implementation detail of Game and should not be
+   used directly by external code!  */
+
+#include "memorybudget.hpp"
+#include "uint256.hpp"
+
+#include <json/json.h>
+
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace xaya
+{
+namespace internal
+{
+
+/**
+ * In-memory archive of the moves in the last few blocks attached to the
+ * game state, indexed by the name that sent them.  This allows answering
+ * queries like "what did player X do recently" without replaying any
+ * block data.
+ *
+ * The moves are kept in a log ordered by block height (and by order within
+ * each block).  For each name, an index holds pointers to that name's moves
+ * in the same order.  Since blocks are only ever added or removed at the
+ * tip (attach / detach) and pruned at the oldest end, the index for each
+ * name can be updated by simply pushing or popping at its ends.  Lookups
+ * run in time proportional to the size of the result.
+ *
+ * This class is thread-safe.
+ */
+class MoveArchive : public MemoryConsumer
+{
+
+private:
+
+  /**
+   * A single archived move.
+   */
+  struct Move
+  {
+
+    /** The name that sent the move (without the "p/" prefix).  */
+    std::string name;
+
+    /** The block this move was in.  */
+    uint256 blockHash;
+
+    /** The height of the block.  */
+    unsigned height;
+
+    /** The move data as found in the block notification.  */
+    Json::Value data;
+
+  };
+
+  /**
+   * Data kept for each block in the archive.
+   */
+  struct Block
+  {
+
+    /** The block's hash.  */
+    uint256 hash;
+
+    /** The block's height.  */
+    unsigned height;
+
+    /** The moves in the block, in order.  */
+    std::vector<std::unique_ptr<const Move>> moves;
+
+    /** Estimated memory used by this block's data.  */
+    size_t bytes;
+
+  };
+
+  /** Lock for this instance.  */
+  mutable std::mutex mut;
+
+  /** Number of blocks to keep.  */
+  unsigned nBlocks;
+
+  /**
+   * The blocks in the archive (front is oldest).  They form a chain,
+   * i.e. each block's parent is the block before it.
+   */
+  std::deque<Block> blocks;
+
+  /**
+   * Index of the moves for each name, oldest first.  Names without any
+   * moves in the archive are removed.
+   */
+  std::map<std::string, std::deque<const Move*>> byName;
+
+  /** Estimated memory used by all blocks.  */
+  size_t memoryUsage = 0;
+
+  /**
+   * Removes the oldest block from the archive.  Must be called with the
+   * lock held.
+   */
+  void PopOldest ();
+
+  /**
+   * Drops blocks until the archive has at most nBlocks blocks.  Must be
+   * called with the lock held.
+   */
+  void TrimWindow ();
+
+  /**
+   * Clears all data.  Must be called with the lock held.
+   */
+  void ClearInternal ();
+
+public:
+
+  /**
+   * Constructs an empty archive which keeps the moves of the given number
+   * of latest blocks.
+   */
+  explicit MoveArchive (unsigned n);
+
+  MoveArchive () = delete;
+  MoveArchive (const MoveArchive&) = delete;
+  void operator= (const MoveArchive&) = delete;
+
+  /**
+   * Changes the number of blocks to keep.  Old blocks are pruned
+   * immediately if the number has been reduced.
+   */
+  void SetLimit (unsigned n);
+
+  /**
+   * Returns the number of blocks to keep.
+   */
+  unsigned GetLimit () const;
+
+  /**
+   * Adds the moves of a newly attached block.  If the block does not extend
+   * the archived chain, then the archive is reset to just this block.
+   */
+  void AttachBlock (const uint256& parent, const uint256& hash,
+                    unsigned height, const Json::Value& blockData);
+
+  /**
+   * Removes the moves of a detached block.  If the block is not the current
+   * tip, then the archive is cleared.
+   */
+  void DetachBlock (const uint256& hash);
+
+  /**
+   * Removes all data.
+   */
+  void Clear ();
+
+  /**
+   * Returns the hash of the latest archived block, or false if the archive
+   * is empty.
+   */
+  bool GetTip (uint256& hash) const;
+
+  /**
+   * Returns the (up to) limit latest moves by the given name, newest first.
+   * Each move is returned as in the block notification (i.e. with
+   * "txid", "name" and "move" fields), extended by "blockhash"
+   * and "height" of its block.
+   */
+  Json::Value GetMovesByName (const std::string& name, unsigned limit) const;
+
+  /**
+   * Returns the number of blocks currently in the archive.
+   */
+  size_t GetNumBlocks () const;
+
+  size_t GetMemoryUsage () const override;
+
+  /**
+   * Drops the oldest blocks until at most target bytes are used.  The latest
+   * block is always kept, so that the archive still follows the chain.
+   */
+  void ShrinkMemory (size_t target) override;
+
+};
+
+} // namespace internal
+} // namespace xaya
+
+#endif // XAYAGAME_MOVEARCHIVE_HPP
@@ -0,0 +1,231 @@
+// Copyright (C) 2019 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "movearchive.hpp"
+
+#include <gtest/gtest.h>
+
+#include <glog/logging.h>
+
+#include <string>
+#include <vector>
+
+namespace xaya
+{
+namespace internal
+{
+namespace
+{
+
+/**
+ * Test fixture for MoveArchive.  Blocks are attached with moves given
+ * as a string of name/move character pairs (like "a1b2"), and lookups
+ * are checked against the expected sequence of move characters.
+ */
+class MoveArchiveTests : public testing::Test
+{
+
+protected:
+
+  /**
+   * Returns the block hash we use for a block at the given height and
+   * on the given branch.
+   */
+  static uint256
+  BlockHash (const unsigned height, const char branch = 'a')
+  {
+    std::string hex(64, '0');
+    hex[0] = branch;
+    hex[63] = '0' + (height % 10);
+    hex[62] = '0' + (height / 10);
+
+    uint256 res;
+    CHECK (res.FromHex (hex));
+    return res;
+  }
+
+  /**
+   * Attaches a block with the given moves.
+   */
+  static void
+  Attach (MoveArchive& a, const unsigned height, const std::string& moves,
+          const char branch = 'a', const char parentBranch = 'a')
+  {
+    CHECK_EQ (moves.size () % 2, 0);
+
+    Json::Value blockData(Json::objectValue);
+    blockData["moves"] = Json::Value (Json::arrayValue);
+    for (size_t i = 0; i < moves.size (); i += 2)
+      {
+        Json::Value mv(Json::objectValue);
+        mv["txid"] = "tx " + moves.substr (i, 2);
+        mv["name"] = moves.substr (i, 1);
+        mv["move"] = moves.substr (i + 1, 1);
+        blockData["moves"].append (mv);
+      }
+
+    a.AttachBlock (BlockHash (height - 1, parentBranch),
+                   BlockHash (height, branch), height, blockData);
+  }
+
+  /**
+   * Looks up the moves for a name and returns the concatenated move
+   * characters, newest first.
+   */
+  static std::string
+  GetMoves (const MoveArchive& a, const std::string& name,
+            const unsigned limit = 100)
+  {
+    const Json::Value moves = a.GetMovesByName (name, limit);
+    CHECK (moves.isArray ());
+
+    std::string res;
+    for (const auto& m : moves)
+      {
+        CHECK_EQ (m["name"].asString (), name);
+        res += m["move"].asString ();
+      }
+
+    return res;
+  }
+
+};
+
+TEST_F (MoveArchiveTests, Empty)
+{
+  MoveArchive a(10);
+
+  uint256 hash;
+  EXPECT_FALSE (a.GetTip (hash));
+  EXPECT_EQ (a.GetNumBlocks (), 0);
+  EXPECT_EQ (GetMoves (a, "a"), "");
+}
+
+TEST_F (MoveArchiveTests, Lookup)
+{
+  MoveArchive a(10);
+  Attach (a, 1, "a1b1");
+  Attach (a, 2, "");
+  Attach (a, 3, "a2c1a3");
+
+  uint256 hash;
+  ASSERT_TRUE (a.GetTip (hash));
+  EXPECT_EQ (hash, BlockHash (3));
+
+  EXPECT_EQ (GetMoves (a, "a"), "321");
+  EXPECT_EQ (GetMoves (a, "a", 2), "32");
+  EXPECT_EQ (GetMoves (a, "a", 0), "");
+  EXPECT_EQ (GetMoves (a, "b"), "1");
+  EXPECT_EQ (GetMoves (a, "c"), "1");
+  EXPECT_EQ (GetMoves (a, "d"), "");
+}
+
+TEST_F (MoveArchiveTests, EntryFields)
+{
+  MoveArchive a(10);
+  Attach (a, 5, "a1");
+
+  const Json::Value moves = a.GetMovesByName ("a", 10);
+  ASSERT_EQ (moves.size (), 1);
+  EXPECT_EQ (moves[0]["txid"], "tx a1");
+  EXPECT_EQ (moves[0]["name"], "a");
+  EXPECT_EQ (moves[0]["move"], "1");
+  EXPECT_EQ (moves[0]["blockhash"], BlockHash (5).ToHex ());
+  EXPECT_EQ (moves[0]["height"].asInt (), 5);
+}
+
+TEST_F (MoveArchiveTests, Pruning)
+{
+  MoveArchive a(2);
+  Attach (a, 1, "a1b1");
+  Attach (a, 2, "a2");
+  Attach (a, 3, "a3");
+
+  EXPECT_EQ (a.GetNumBlocks (), 2);
+  EXPECT_EQ (GetMoves (a, "a"), "32");
+  EXPECT_EQ (GetMoves (a, "b"), "");
+
+  a.SetLimit (1);
+  EXPECT_EQ (a.GetLimit (), 1);
+  EXPECT_EQ (a.GetNumBlocks (), 1);
+  EXPECT_EQ (GetMoves (a, "a"), "3");
+}
+
+TEST_F (MoveArchiveTests, Detach)
+{
+  MoveArchive a(10);
+  Attach (a, 1, "a1");
+  Attach (a, 2, "a2b1a3");
+
+  a.DetachBlock (BlockHash (2));
+  EXPECT_EQ (GetMoves (a, "a"), "1");
+  EXPECT_EQ (GetMoves (a, "b"), "");
+
+  Attach (a, 2, "b2", 'b', 'a');
+  EXPECT_EQ (GetMoves (a, "a"), "1");
+  EXPECT_EQ (GetMoves (a, "b"), "2");
+
+  uint256 hash;
+  ASSERT_TRUE (a.GetTip (hash));
+  EXPECT_EQ (hash, BlockHash (2, 'b'));
+}
+
+TEST_F (MoveArchiveTests, MemoryUsage)
+{
+  MoveArchive a(10);
+  EXPECT_EQ (a.GetMemoryUsage (), 0);
+
+  Attach (a, 1, "a1b1");
+  const size_t oneBlock = a.GetMemoryUsage ();
+  EXPECT_GT (oneBlock, 0);
+
+  Attach (a, 2, "a2c1a3");
+  EXPECT_GT (a.GetMemoryUsage (), oneBlock);
+  a.DetachBlock (BlockHash (2));
+  EXPECT_EQ (a.GetMemoryUsage (), oneBlock);
+
+  a.Clear ();
+  EXPECT_EQ (a.GetMemoryUsage (), 0);
+}
+
+TEST_F (MoveArchiveTests, ShrinkMemory)
+{
+  MoveArchive a(10);
+  Attach (a, 1, "a1");
+  Attach (a, 2, "a2");
+  Attach (a, 3, "a3");
+
+  a.ShrinkMemory (0);
+  EXPECT_EQ (a.GetNumBlocks (), 1);
+  EXPECT_EQ (GetMoves (a, "a"), "3");
+  EXPECT_EQ (a.GetLimit (), 10);
+
+  Attach (a, 4, "a4");
+  EXPECT_EQ (GetMoves (a, "a"), "43");
+}
+
+TEST_F (MoveArchiveTests, Resets)
+{
+  MoveArchive a(10);
+  Attach (a, 1, "a1");
+  Attach (a, 2, "a2");
+
+  /* A block not extending the tip resets the archive.  */
+  Attach (a, 5, "a5");
+  EXPECT_EQ (a.GetNumBlocks (), 1);
+  EXPECT_EQ (GetMoves (a, "a"), "5");
+
+  /* So does detaching a block that is not the tip.  */
+  a.DetachBlock (BlockHash (4));
+  EXPECT_EQ (a.GetNumBlocks (), 0);
+  EXPECT_EQ (GetMoves (a, "a"), "");
+
+  Attach (a, 1, "a1");
+  a.Clear ();
+  EXPECT_EQ (GetMoves (a, "a"), "");
+}
+
+} // anonymous namespace
+} // namespace internal
+} // namespace xaya
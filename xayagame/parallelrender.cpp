@@ -0,0 +1,226 @@
+// Copyright (C) 2019 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "parallelrender.hpp"
+
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <limits>
+#include <set>
+#include <vector>
+
+namespace xaya
+{
+namespace internal
+{
+
+namespace
+{
+
+/**
+ * Serialises a JSON object and returns the text of its members, without
+ * the enclosing braces.
+ */
+std::string
+MembersText (const Json::Value& obj)
+{
+  CHECK (obj.isObject ()) << "State partition is not a JSON object";
+
+  Json::StreamWriterBuilder wbuilder;
+  wbuilder["indentation"] = "";
+  const std::string text = Json::writeString (wbuilder, obj);
+
+  CHECK_GE (text.size (), 2);
+  CHECK_EQ (text.front (), '{');
+  CHECK_EQ (text.back (), '}');
+  return text.substr (1, text.size () - 2);
+}
+
+/**
+ * Appends a member text to the list of members in an object text
+ * (without braces), adding a separator if needed.
+ */
+void
+AppendMembers (std::string& out, const std::string& members)
+{
+  if (members.empty ())
+    return;
+
+  if (!out.empty ())
+    out += ',';
+  out += members;
+}
+
+} // anonymous namespace
+
+ParallelRenderer::ParallelRenderer (const unsigned threads)
+  : pool(threads, "xaya-render"),
+    keepLimit(std::numeric_limits<size_t>::max ())
+{}
+
+std::shared_ptr<const RenderedState>
+ParallelRenderer::Render (GameLogic& rules, const uint256& hash,
+                          const GameStateData& state)
+{
+  const auto partitioned = rules.PartitionState (state);
+  if (partitioned == nullptr)
+    return nullptr;
+
+  const auto parts = partitioned->GetPartitions ();
+  const size_t n = parts.size ();
+
+  std::vector<std::shared_ptr<const Fragment>> newFragments(n);
+  std::vector<Json::Value> copies(n);
+  std::vector<char> reused(n, false);
+
+  std::vector<WorkerPool::Task> tasks;
+  tasks.reserve (n);
+  for (size_t i = 0; i < n; ++i)
+    tasks.push_back ([&, i] ()
+      {
+        const auto& p = parts[i];
+        std::string fp = partitioned->GetFingerprint (p);
+
+        /* The map of old fragments is only read here, which is fine to do
+           concurrently from the worker threads.  */
+        const auto mit = fragments.find (Key (p.field, p.id));
+        if (!fp.empty () && mit != fragments.end ()
+              && mit->second->fingerprint == fp)
+          {
+            newFragments[i] = mit->second;
+            reused[i] = true;
+          }
+        else
+          {
+            auto frag = std::make_shared<Fragment> ();
+            frag->fingerprint = std::move (fp);
+            frag->json = partitioned->PartitionToJson (p);
+            frag->text = MembersText (frag->json);
+            frag->bytes = sizeof (Fragment) + frag->fingerprint.size ()
+                            + EstimateJsonMemory (frag->json)
+                            + frag->text.size ();
+            newFragments[i] = std::move (frag);
+          }
+
+        /* The fragment itself is kept for reuse, so the full JSON value
+           gets a copy of it.  Make that here in parallel as well.  */
+        copies[i] = newFragments[i]->json;
+      });
+
+  pool.Run (tasks);
+
+  /* Merge the fragments into the full JSON value and text.  Fields are
+     output in the order in which they first appear in the partitions.  */
+  Json::Value json(Json::objectValue);
+  std::string topText;
+  std::vector<std::string> fieldOrder;
+  std::map<std::string, std::string> fieldTexts;
+  std::set<Key> keys;
+  for (size_t i = 0; i < n; ++i)
+    {
+      const auto& p = parts[i];
+
+      Json::Value* target = &json;
+      if (!p.field.empty ())
+        {
+          target = &json[p.field];
+          if (target->isNull ())
+            {
+              *target = Json::Value (Json::objectValue);
+              fieldOrder.push_back (p.field);
+            }
+        }
+      for (auto it = copies[i].begin (); it != copies[i].end (); ++it)
+        (*target)[it.name ()].swap (*it);
+
+      if (p.field.empty ())
+        AppendMembers (topText, newFragments[i]->text);
+      else
+        AppendMembers (fieldTexts[p.field], newFragments[i]->text);
+
+      CHECK (keys.emplace (p.field, p.id).second)
+          << "Duplicate state partition " << p.id << " in field " << p.field;
+
+      if (reused[i])
+        ++numReused;
+      else
+        ++numRendered;
+    }
+
+  for (const auto& field : fieldOrder)
+    AppendMembers (topText, Json::valueToQuotedString (field.c_str ())
+                              + ":{" + fieldTexts[field] + "}");
+
+  VLOG (1)
+      << "Rendered " << n << " state partitions in parallel, total so far: "
+      << numRendered << " converted, " << numReused << " reused";
+
+  KeepFragments (parts, newFragments, reused);
+  return std::make_shared<const RenderedState> (hash, std::move (json),
+                                                "{" + topText + "}");
+}
+
+void
+ParallelRenderer::KeepFragments (
+    const std::vector<PartitionedState::Partition>& parts,
+    std::vector<std::shared_ptr<const Fragment>>& newFragments,
+    const std::vector<char>& reused)
+{
+  const size_t n = parts.size ();
+  CHECK_EQ (newFragments.size (), n);
+  CHECK_EQ (reused.size (), n);
+
+  /* Fragments that were reused are kept first, since they are evidently
+     the ones that do not change often.  Newly converted fragments are only
+     kept as long as they fit into the limit as well.  */
+  std::map<Key, std::shared_ptr<const Fragment>> keptFragments;
+  size_t keptBytes = 0;
+  size_t totalBytes = 0;
+  for (const bool keepReused : {true, false})
+    for (size_t i = 0; i < n; ++i)
+      {
+        if (static_cast<bool> (reused[i]) != keepReused)
+          continue;
+
+        const size_t bytes = newFragments[i]->bytes;
+        totalBytes += bytes;
+        if (bytes > keepLimit - keptBytes)
+          continue;
+
+        keptBytes += bytes;
+        keptFragments.emplace (Key (parts[i].field, parts[i].id),
+                               std::move (newFragments[i]));
+      }
+
+  if (keptBytes < totalBytes)
+    {
+      const size_t growth = totalBytes / 8 + 1;
+      VLOG (1)
+          << "Kept " << keptBytes << " of " << totalBytes
+          << " bytes of rendered fragments, increasing limit by " << growth;
+      keepLimit += std::min (growth,
+                             std::numeric_limits<size_t>::max () - keepLimit);
+    }
+
+  fragments = std::move (keptFragments);
+  fragmentBytes = keptBytes;
+}
+
+void
+ParallelRenderer::ShrinkMemory (const size_t target)
+{
+  keepLimit = target;
+
+  auto it = fragments.begin ();
+  while (it != fragments.end () && fragmentBytes > target)
+    {
+      CHECK_GE (fragmentBytes, it->second->bytes);
+      fragmentBytes -= it->second->bytes;
+      it = fragments.erase (it);
+    }
+}
+
+} // namespace internal
+} // namespace xaya
@@ -0,0 +1,152 @@
+// Copyright (C) 2019 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef XAYAGAME_PARALLELRENDER_HPP
+#define XAYAGAME_PARALLELRENDER_HPP
+
+/* This file is an implementation detail of Game and should not be
+   used directly by external code!  */
+
+#include "gamelogic.hpp"
+#include "memorybudget.hpp"
+#include "renderedstate.hpp"
+#include "storage.hpp"
+#include "uint256.hpp"
+#include "workerpool.hpp"
+
+#include <json/json.h>
+
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace xaya
+{
+namespace internal
+{
+
+/**
+ * Renders game states as JSON in parallel, for games that support splitting
+ * their state into partitions (GameLogic::PartitionState).  Each partition
+ * is converted to JSON and serialised on a worker pool, and the resulting
+ * text fragments are then concatenated into the full JSON text.
+ *
+ * The fragments of the last rendered state are kept together with the
+ * partitions' fingerprints, so that partitions that did not change between
+ * two blocks need not be converted again.
+ *
+ * This class is not thread-safe; Game only uses it while holding its lock.
+ */
+class ParallelRenderer : public MemoryConsumer
+{
+
+private:
+
+  /**
+   * The rendered data for one partition.
+   */
+  struct Fragment
+  {
+
+    /** The partition's fingerprint (empty if it must not be reused).  */
+    std::string fingerprint;
+
+    /** The JSON object for the partition.  */
+    Json::Value json;
+
+    /** The serialised members of the JSON object, without the braces.  */
+    std::string text;
+
+    /** Estimated memory used by the fragment.  */
+    size_t bytes;
+
+  };
+
+  /** Key for fragments (field and partition ID).  */
+  using Key = std::pair<std::string, std::string>;
+
+  /** The worker pool used.  */
+  WorkerPool pool;
+
+  /** The fragments of the last rendered state.  */
+  std::map<Key, std::shared_ptr<const Fragment>> fragments;
+
+  /** Estimated memory used by all fragments.  */
+  size_t fragmentBytes = 0;
+
+  /**
+   * Maximum number of bytes of fragments kept after a render.  This is set
+   * by ShrinkMemory, so that the fragments dropped there are not all kept
+   * again on the next render.  While not all fragments fit, it grows by
+   * an eighth of their total size with each render, so that the renderer
+   * recovers if the budget allows it.
+   */
+  size_t keepLimit;
+
+  /** Number of partitions that were converted.  */
+  unsigned long numRendered = 0;
+
+  /** Number of partitions that were reused.  */
+  unsigned long numReused = 0;
+
+  /**
+   * Replaces the kept fragments by the ones of a new render, subject to
+   * keepLimit.  The fragments are moved out of newFragments.
+   */
+  void KeepFragments (
+      const std::vector<PartitionedState::Partition>& parts,
+      std::vector<std::shared_ptr<const Fragment>>& newFragments,
+      const std::vector<char>& reused);
+
+public:
+
+  /**
+   * Constructs the renderer with the given number of worker threads (in
+   * addition to the calling thread).
+   */
+  explicit ParallelRenderer (unsigned threads);
+
+  ParallelRenderer () = delete;
+  ParallelRenderer (const ParallelRenderer&) = delete;
+  void operator= (const ParallelRenderer&) = delete;
+
+  /**
+   * Renders the given state.  Returns null if the game logic does not
+   * support partitioning of the state.
+   */
+  std::shared_ptr<const RenderedState> Render (GameLogic& rules,
+                                               const uint256& hash,
+                                               const GameStateData& state);
+
+  /**
+   * Returns the total number of partitions converted and reused so far.
+   */
+  void
+  GetCounts (unsigned long& rendered, unsigned long& reused) const
+  {
+    rendered = numRendered;
+    reused = numReused;
+  }
+
+  size_t
+  GetMemoryUsage () const override
+  {
+    return fragmentBytes;
+  }
+
+  /**
+   * Drops kept fragments until at most target bytes are used, and limits
+   * the fragments kept by the next render to that as well.  Dropped fragments
+   * will simply be converted again the next time.
+   */
+  void ShrinkMemory (size_t target) override;
+
+};
+
+} // namespace internal
+} // namespace xaya
+
+#endif // XAYAGAME_PARALLELRENDER_HPP
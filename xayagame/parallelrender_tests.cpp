@@ -0,0 +1,327 @@
+// Copyright (C) 2019 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "parallelrender.hpp"
+
+#include "testutils.hpp"
+
+#include <gtest/gtest.h>
+
+#include <glog/logging.h>
+
+#include <atomic>
+#include <sstream>
+
+namespace xaya
+{
+namespace internal
+{
+namespace
+{
+
+Json::Value
+ParseJson (const std::string& str)
+{
+  Json::Value val;
+  std::istringstream in(str);
+  in >> val;
+  return val;
+}
+
+/**
+ * Game logic for testing the parallel renderer.  The state is a string of
+ * name/value pairs of one character each (e.g. "a1b2").  It is split into
+ * one top-level partition holding the number of entries, and one partition
+ * per name in the field "entries".
+ */
+class PartitionedGame : public GameLogic
+{
+
+private:
+
+  class State : public PartitionedState
+  {
+
+  private:
+
+    const PartitionedGame& game;
+    const GameStateData data;
+
+  public:
+
+    explicit State (const PartitionedGame& g, const GameStateData& d)
+      : game(g), data(d)
+    {
+      CHECK_EQ (data.size () % 2, 0);
+    }
+
+    std::vector<Partition>
+    GetPartitions () const override
+    {
+      std::vector<Partition> res;
+      res.push_back ({"", "count"});
+      for (size_t i = 0; i < data.size (); i += 2)
+        res.push_back ({"entries", data.substr (i, 1)});
+      return res;
+    }
+
+    std::string
+    GetFingerprint (const Partition& p) const override
+    {
+      if (!game.fingerprints)
+        return "";
+
+      if (p.field.empty ())
+        return std::to_string (data.size ());
+
+      const size_t pos = data.find (p.id);
+      CHECK_NE (pos, std::string::npos);
+      return data.substr (pos, 2);
+    }
+
+    Json::Value
+    PartitionToJson (const Partition& p) const override
+    {
+      ++game.converted;
+
+      Json::Value res(Json::objectValue);
+      if (p.field.empty ())
+        {
+          res["count"] = static_cast<int> (data.size () / 2);
+          return res;
+        }
+
+      const size_t pos = data.find (p.id);
+      CHECK_NE (pos, std::string::npos);
+      res[p.id] = data.substr (pos + 1, 1);
+      return res;
+    }
+
+  };
+
+public:
+
+  /** Whether or not to return fingerprints.  */
+  bool fingerprints = true;
+
+  /** Counter for the number of converted partitions.  */
+  mutable std::atomic<unsigned> converted;
+
+  PartitionedGame ()
+    : converted(0)
+  {}
+
+  GameStateData
+  GetInitialState (unsigned& height, std::string& hashHex) override
+  {
+    LOG (FATAL) << "Not implemented";
+  }
+
+  GameStateData
+  ProcessForward (const GameStateData& oldState, const Json::Value& blockData,
+                  UndoData& undoData) override
+  {
+    LOG (FATAL) << "Not implemented";
+  }
+
+  GameStateData
+  ProcessBackwards (const GameStateData& newState, const Json::Value& blockData,
+                    const UndoData& undoData) override
+  {
+    LOG (FATAL) << "Not implemented";
+  }
+
+  std::unique_ptr<PartitionedState>
+  PartitionState (const GameStateData& state) override
+  {
+    return std::make_unique<State> (*this, state);
+  }
+
+};
+
+/**
+ * Game logic that does not support partitioning.
+ */
+class UnpartitionedGame : public GameLogic
+{
+
+public:
+
+  GameStateData
+  GetInitialState (unsigned& height, std::string& hashHex) override
+  {
+    LOG (FATAL) << "Not implemented";
+  }
+
+  GameStateData
+  ProcessForward (const GameStateData& oldState, const Json::Value& blockData,
+                  UndoData& undoData) override
+  {
+    LOG (FATAL) << "Not implemented";
+  }
+
+  GameStateData
+  ProcessBackwards (const GameStateData& newState, const Json::Value& blockData,
+                    const UndoData& undoData) override
+  {
+    LOG (FATAL) << "Not implemented";
+  }
+
+};
+
+class ParallelRendererTests : public testing::Test
+{
+
+protected:
+
+  PartitionedGame game;
+  ParallelRenderer renderer;
+
+  ParallelRendererTests ()
+    : renderer(3)
+  {}
+
+  /**
+   * Renders the given state and verifies that its JSON value matches the
+   * expected one (given as string) and the rendered text parses to it.
+   */
+  void
+  ExpectRendered (const GameStateData& state, const std::string& expected)
+  {
+    const auto rendered = renderer.Render (game, BlockHash (42), state);
+    ASSERT_NE (rendered, nullptr);
+    EXPECT_EQ (rendered->GetBlockHash (), BlockHash (42));
+    EXPECT_EQ (rendered->GetJson (), ParseJson (expected));
+
+    EXPECT_EQ (ParseJson (rendered->GetText ()), ParseJson (expected));
+  }
+
+  /**
+   * Expects the given number of rendered and reused partitions (accumulated
+   * since the start of the test).
+   */
+  void
+  ExpectCounts (const unsigned long expectedRendered,
+                const unsigned long expectedReused)
+  {
+    unsigned long rendered, reused;
+    renderer.GetCounts (rendered, reused);
+    EXPECT_EQ (rendered, expectedRendered);
+    EXPECT_EQ (reused, expectedReused);
+    EXPECT_EQ (game.converted, expectedRendered);
+  }
+
+};
+
+TEST_F (ParallelRendererTests, NotSupported)
+{
+  UnpartitionedGame other;
+  EXPECT_EQ (renderer.Render (other, BlockHash (1), "state"), nullptr);
+}
+
+TEST_F (ParallelRendererTests, EmptyField)
+{
+  ExpectRendered ("", R"({"count": 0})");
+  ExpectCounts (1, 0);
+}
+
+TEST_F (ParallelRendererTests, Rendering)
+{
+  ExpectRendered ("a1b2c3", R"({
+    "count": 3,
+    "entries": {"a": "1", "b": "2", "c": "3"}
+  })");
+  ExpectCounts (4, 0);
+}
+
+TEST_F (ParallelRendererTests, ManyPartitions)
+{
+  std::ostringstream state;
+  Json::Value expected(Json::objectValue);
+  for (char c = 'A'; c <= 'z'; ++c)
+    {
+      state << c << '0';
+      expected[std::string (1, c)] = "0";
+    }
+
+  const auto rendered = renderer.Render (game, BlockHash (1), state.str ());
+  EXPECT_EQ (rendered->GetJson ()["entries"], expected);
+}
+
+TEST_F (ParallelRendererTests, ReusesFragments)
+{
+  ExpectRendered ("a1b2c3", R"({
+    "count": 3,
+    "entries": {"a": "1", "b": "2", "c": "3"}
+  })");
+  ExpectCounts (4, 0);
+
+  ExpectRendered ("a1b5c3", R"({
+    "count": 3,
+    "entries": {"a": "1", "b": "5", "c": "3"}
+  })");
+  ExpectCounts (5, 3);
+
+  ExpectRendered ("a1c3d4", R"({
+    "count": 3,
+    "entries": {"a": "1", "c": "3", "d": "4"}
+  })");
+  ExpectCounts (6, 6);
+
+  ExpectRendered ("a1", R"({
+    "count": 1,
+    "entries": {"a": "1"}
+  })");
+  ExpectCounts (7, 7);
+}
+
+TEST_F (ParallelRendererTests, ShrinkMemory)
+{
+  EXPECT_EQ (renderer.GetMemoryUsage (), 0);
+
+  ExpectRendered ("a1b2c3", R"({
+    "count": 3,
+    "entries": {"a": "1", "b": "2", "c": "3"}
+  })");
+  ExpectCounts (4, 0);
+  const size_t before = renderer.GetMemoryUsage ();
+  EXPECT_GT (before, 0);
+
+  renderer.ShrinkMemory (before - 1);
+  EXPECT_LT (renderer.GetMemoryUsage (), before);
+  renderer.ShrinkMemory (0);
+  EXPECT_EQ (renderer.GetMemoryUsage (), 0);
+
+  /* The next render must not keep all fragments again right away, but
+     the limit grows back over a few renders.  */
+  ExpectRendered ("a1b2c3", R"({
+    "count": 3,
+    "entries": {"a": "1", "b": "2", "c": "3"}
+  })");
+  ExpectCounts (8, 0);
+  EXPECT_LE (renderer.GetMemoryUsage (), before / 8 + 1);
+
+  for (unsigned i = 0; i < 10; ++i)
+    renderer.Render (game, BlockHash (42), "a1b2c3");
+  EXPECT_EQ (renderer.GetMemoryUsage (), before);
+}
+
+TEST_F (ParallelRendererTests, WithoutFingerprints)
+{
+  game.fingerprints = false;
+
+  ExpectRendered ("a1b2", R"({
+    "count": 2,
+    "entries": {"a": "1", "b": "2"}
+  })");
+  ExpectRendered ("a1b2", R"({
+    "count": 2,
+    "entries": {"a": "1", "b": "2"}
+  })");
+  ExpectCounts (6, 0);
+}
+
+} // anonymous namespace
+} // namespace internal
+} // namespace xaya
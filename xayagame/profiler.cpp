@@ -0,0 +1,523 @@
+// Copyright (C) 2019 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "profiler.hpp"
+
+#include <glog/logging.h>
+
+#include <cxxabi.h>
+#include <execinfo.h>
+#include <link.h>
+#include <signal.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+#include <experimental/filesystem>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <system_error>
+#include <thread>
+
+namespace xaya
+{
+namespace internal
+{
+
+namespace fs = std::experimental::filesystem;
+
+namespace
+{
+
+static_assert (ATOMIC_POINTER_LOCK_FREE == 2 && ATOMIC_BOOL_LOCK_FREE == 2,
+               "the profiler's signal handler requires lock-free atomics");
+
+/** Maximum number of stack frames recorded per sample.  */
+constexpr int MAX_FRAMES = 64;
+
+/**
+ * Number of innermost frames of each sample that belong to the signal
+ * handling itself (our handler and the kernel's signal trampoline).
+ */
+constexpr int SKIPPED_FRAMES = 2;
+
+/**
+ * Space for samples is reserved for this many seconds of CPU time per
+ * second of wall-clock time, which is reached if that many threads are
+ * busy at the same time.  Further samples are dropped.
+ */
+constexpr unsigned MAX_BUSY_THREADS = 8;
+
+/**
+ * Maximum number of code ranges (executable segments of the unwinder and
+ * the dynamic loader) in which no samples are taken.
+ */
+constexpr int MAX_UNSAFE_RANGES = 8;
+
+/**
+ * A single recorded stack.
+ */
+struct Sample
+{
+
+  /** Set when the sample has been filled in completely.  */
+  std::atomic<bool> complete;
+
+  /** The thread that was interrupted.  */
+  pid_t tid;
+
+  /** Number of frames in the stack.  */
+  int depth;
+
+  /** The frames, with the innermost first.  */
+  void* frames[MAX_FRAMES];
+
+};
+
+/**
+ * Preallocated storage for the samples of a profile, so that the signal
+ * handler itself does not need to allocate memory for them.
+ */
+struct SampleBuffer
+{
+
+  const size_t capacity;
+  std::unique_ptr<Sample[]> samples;
+
+  /** Index of the next free sample.  */
+  std::atomic<size_t> next;
+
+  /** Number of samples dropped because the buffer was full.  */
+  std::atomic<size_t> dropped;
+
+  /**
+   * Number of samples skipped because the interrupted thread was inside
+   * the unwinder or dynamic loader.
+   */
+  std::atomic<size_t> skipped;
+
+  explicit SampleBuffer (const size_t c)
+    : capacity(c), samples(new Sample[c] ()), next(0), dropped(0), skipped(0)
+  {}
+
+};
+
+/** The buffer of the running profile, if any.  */
+std::atomic<SampleBuffer*> activeBuffer(nullptr);
+
+/** Number of signal handlers currently executing.  */
+std::atomic<unsigned> handlersRunning(0);
+
+/** Lock that ensures only one profile runs at a time.  */
+std::mutex profileMutex;
+
+/** Whether our signal handler has been installed already.  */
+bool handlerInstalled = false;
+
+/**
+ * A range of code addresses, in which the interrupted thread may hold locks
+ * that backtrace needs as well.
+ */
+struct CodeRange
+{
+  uintptr_t begin;
+  uintptr_t end;
+};
+
+/**
+ * The code ranges in which we do not sample.  They are filled in once when
+ * the handler is installed and only read afterwards.
+ */
+CodeRange unsafeRanges[MAX_UNSAFE_RANGES];
+int numUnsafeRanges = 0;
+
+/**
+ * Returns the program counter at which the thread was interrupted, or zero
+ * if it is not known on this platform.
+ */
+uintptr_t
+GetInterruptedPc (const void* ctx)
+{
+  const auto* uc = static_cast<const ucontext_t*> (ctx);
+#if defined(__x86_64__)
+  return uc->uc_mcontext.gregs[REG_RIP];
+#elif defined(__i386__)
+  return uc->uc_mcontext.gregs[REG_EIP];
+#elif defined(__aarch64__)
+  return uc->uc_mcontext.pc;
+#else
+  return 0;
+#endif
+}
+
+/**
+ * Returns true if the interrupted thread was executing code in which it is
+ * not safe to call backtrace.
+ */
+bool
+IsInUnsafeCode (const void* ctx)
+{
+  const uintptr_t pc = GetInterruptedPc (ctx);
+  for (int i = 0; i < numUnsafeRanges; ++i)
+    if (pc >= unsafeRanges[i].begin && pc < unsafeRanges[i].end)
+      return true;
+  return false;
+}
+
+/**
+ * Callback for dl_iterate_phdr, which records the executable segments of
+ * libgcc_s (the unwinder used by backtrace and for exceptions) and of the
+ * dynamic loader as unsafe ranges.
+ */
+int
+RecordUnsafeRanges (dl_phdr_info* info, const size_t size, void* data)
+{
+  if (info->dlpi_name == nullptr)
+    return 0;
+  const std::string name = fs::path (info->dlpi_name).filename ().string ();
+  if (name.compare (0, 9, "libgcc_s.") != 0 && name.compare (0, 3, "ld-") != 0)
+    return 0;
+
+  for (int i = 0; i < info->dlpi_phnum; ++i)
+    {
+      const auto& phdr = info->dlpi_phdr[i];
+      if (phdr.p_type != PT_LOAD || !(phdr.p_flags & PF_X))
+        continue;
+
+      if (numUnsafeRanges == MAX_UNSAFE_RANGES)
+        {
+          LOG (WARNING) << "Too many code ranges to exclude from profiling";
+          return 1;
+        }
+
+      CodeRange& r = unsafeRanges[numUnsafeRanges++];
+      r.begin = info->dlpi_addr + phdr.p_vaddr;
+      r.end = r.begin + phdr.p_memsz;
+      VLOG (1)
+          << "Not sampling inside " << name << " at "
+          << reinterpret_cast<void*> (r.begin) << " to "
+          << reinterpret_cast<void*> (r.end);
+    }
+
+  return 0;
+}
+
+/**
+ * The SIGPROF handler, which records the stack of the interrupted thread.
+ *
+ * backtrace is not formally async-signal-safe:  It needs the unwinder's
+ * internal state and (through dl_iterate_phdr on older glibc versions)
+ * the dynamic loader's lock.  If the interrupted thread holds those itself,
+ * e.g. because it is throwing an exception, calling backtrace here may
+ * deadlock or see inconsistent data.  We avoid the common cases by skipping
+ * the sample if the thread was interrupted inside the unwinder or dynamic
+ * loader.  This is best effort; it does not detect an unwinder that is
+ * linked statically into the executable, nor a thread interrupted in the
+ * libc part of dl_iterate_phdr.
+ */
+void
+HandleProfSignal (const int sig, siginfo_t* info, void* ctx)
+{
+  const int savedErrno = errno;
+  ++handlersRunning;
+
+  SampleBuffer* buf = activeBuffer.load ();
+  if (buf != nullptr && IsInUnsafeCode (ctx))
+    ++buf->skipped;
+  else if (buf != nullptr)
+    {
+      const size_t index = buf->next.fetch_add (1);
+      if (index < buf->capacity)
+        {
+          Sample& s = buf->samples[index];
+          s.tid = syscall (SYS_gettid);
+          s.depth = backtrace (s.frames, MAX_FRAMES);
+          s.complete.store (true);
+        }
+      else
+        ++buf->dropped;
+    }
+
+  --handlersRunning;
+  errno = savedErrno;
+}
+
+/**
+ * Installs our signal handler if not yet done.  It is never removed again,
+ * since SIGPROF signals may still be pending after a profile is stopped,
+ * and the default action for them would terminate the process.  Outside
+ * of a profile, the handler does nothing.
+ */
+void
+InstallHandler ()
+{
+  if (handlerInstalled)
+    return;
+
+  /* The first call to backtrace loads libgcc, which is not safe from
+     within a signal handler.  */
+  void* dummy[1];
+  backtrace (dummy, 1);
+
+  dl_iterate_phdr (&RecordUnsafeRanges, nullptr);
+  if (numUnsafeRanges == 0)
+    LOG (WARNING)
+        << "Could not find the unwinder's code, profiling may deadlock"
+           " while exceptions are thrown";
+
+  struct sigaction sa, oldSa;
+  std::memset (&sa, 0, sizeof (sa));
+  sa.sa_sigaction = &HandleProfSignal;
+  sa.sa_flags = SA_RESTART | SA_SIGINFO;
+  sigemptyset (&sa.sa_mask);
+  CHECK_EQ (sigaction (SIGPROF, &sa, &oldSa), 0)
+      << "Failed to install SIGPROF handler: " << std::strerror (errno);
+
+  if (!(oldSa.sa_flags & SA_SIGINFO)
+        && (oldSa.sa_handler == SIG_DFL || oldSa.sa_handler == SIG_IGN))
+    VLOG (1) << "Installed SIGPROF handler for profiling";
+  else
+    LOG (WARNING) << "Replaced existing SIGPROF handler for profiling";
+
+  handlerInstalled = true;
+}
+
+/**
+ * Sets the profiling timer to the given interval (or disables it for zero).
+ */
+void
+SetTimer (const long intervalMicros)
+{
+  struct itimerval timer;
+  timer.it_interval.tv_sec = intervalMicros / 1000000;
+  timer.it_interval.tv_usec = intervalMicros % 1000000;
+  timer.it_value = timer.it_interval;
+
+  CHECK_EQ (setitimer (ITIMER_PROF, &timer, nullptr), 0)
+      << "Failed to set profiling timer: " << std::strerror (errno);
+}
+
+/**
+ * Returns the name of the thread with the given ID, or a generic name
+ * if it cannot be determined (e.g. because it has exited since).
+ */
+std::string
+GetThreadName (const pid_t tid)
+{
+  std::ifstream in("/proc/self/task/" + std::to_string (tid) + "/comm");
+  std::string name;
+  if (std::getline (in, name) && !name.empty ())
+    return name;
+
+  return "thread-" + std::to_string (tid);
+}
+
+/**
+ * Symbolises code addresses (with caching).
+ */
+class Symboliser
+{
+
+private:
+
+  std::map<void*, std::string> cache;
+
+  /**
+   * Turns the output of backtrace_symbols for an address into a function
+   * name.  That output looks like "module(symbol+0x12) [0xabc]", where
+   * the symbol may be missing.
+   */
+  static std::string
+  ParseSymbol (const std::string& str)
+  {
+    const size_t open = str.find ('(');
+    const size_t plus = str.find ('+', open);
+    const size_t close = str.find (')', open);
+    if (open == std::string::npos || plus == std::string::npos
+          || close == std::string::npos || plus > close)
+      return str;
+
+    const std::string mangled = str.substr (open + 1, plus - open - 1);
+    if (mangled.empty ())
+      {
+        const std::string module = fs::path (str.substr (0, open))
+                                      .filename ().string ();
+        return module + str.substr (plus, close - plus);
+      }
+
+    int status;
+    char* demangled = abi::__cxa_demangle (mangled.c_str (), nullptr, nullptr,
+                                           &status);
+    if (demangled == nullptr)
+      return mangled;
+
+    std::string res(demangled);
+    std::free (demangled);
+    return res;
+  }
+
+public:
+
+  const std::string&
+  Get (void* addr)
+  {
+    auto mit = cache.find (addr);
+    if (mit != cache.end ())
+      return mit->second;
+
+    std::string name;
+    char** symbols = backtrace_symbols (&addr, 1);
+    if (symbols == nullptr)
+      {
+        std::ostringstream out;
+        out << addr;
+        name = out.str ();
+      }
+    else
+      {
+        name = ParseSymbol (symbols[0]);
+        std::free (symbols);
+      }
+
+    /* Semicolons separate frames in the folded format.  */
+    std::replace (name.begin (), name.end (), ';', ':');
+
+    return cache.emplace (addr, std::move (name)).first->second;
+  }
+
+};
+
+} // anonymous namespace
+
+SamplingProfiler::SamplingProfiler (const std::string& dir, const unsigned f)
+  : directory(dir), frequency(f)
+{
+  CHECK_GT (frequency, 0);
+  CHECK_LE (frequency, 1000000);
+
+  if (!fs::is_directory (directory))
+    {
+      LOG (INFO) << "Creating profile directory: " << directory;
+      CHECK (fs::create_directories (directory));
+    }
+}
+
+Json::Value
+SamplingProfiler::Run (const unsigned seconds) const
+{
+  CHECK_GT (seconds, 0);
+
+  std::lock_guard<std::mutex> lock(profileMutex);
+  LOG (INFO)
+      << "Starting CPU profile for " << seconds << " seconds at "
+      << frequency << " Hz";
+
+  auto buf = std::make_unique<SampleBuffer> (
+      static_cast<size_t> (seconds) * frequency * MAX_BUSY_THREADS);
+
+  InstallHandler ();
+  activeBuffer = buf.get ();
+  SetTimer (1000000 / frequency);
+
+  const auto start = std::chrono::steady_clock::now ();
+  std::this_thread::sleep_for (std::chrono::seconds (seconds));
+  const auto duration = std::chrono::steady_clock::now () - start;
+
+  /* Stop sampling, and wait for handlers that have already started to
+     finish before the buffer is read.  */
+  SetTimer (0);
+  activeBuffer = nullptr;
+  while (handlersRunning > 0)
+    std::this_thread::yield ();
+
+  /* Fold the samples by their stacks (from the outermost frame).  */
+  Symboliser symbols;
+  std::map<pid_t, std::string> threadNames;
+  std::map<std::string, unsigned long> folded;
+  const size_t numSamples = std::min (buf->next.load (), buf->capacity);
+  size_t numRecorded = 0;
+  for (size_t i = 0; i < numSamples; ++i)
+    {
+      const Sample& s = buf->samples[i];
+      if (!s.complete)
+        continue;
+      ++numRecorded;
+
+      auto tit = threadNames.find (s.tid);
+      if (tit == threadNames.end ())
+        tit = threadNames.emplace (s.tid, GetThreadName (s.tid)).first;
+
+      std::string stack = tit->second;
+      for (int j = s.depth - 1; j >= SKIPPED_FRAMES; --j)
+        {
+          stack += ';';
+          stack += symbols.Get (s.frames[j]);
+        }
+      ++folded[stack];
+    }
+
+  const fs::path file = fs::path (directory)
+      / ("profile-" + std::to_string (std::time (nullptr)) + ".folded");
+  const fs::path tmpFile = fs::path (file.string () + ".tmp");
+  {
+    std::ofstream out(tmpFile.string ());
+    if (!out)
+      {
+        LOG (WARNING) << "Failed to open " << tmpFile.string ();
+        throw Error ("failed to open " + tmpFile.string () + " for writing");
+      }
+    for (const auto& entry : folded)
+      out << entry.first << ' ' << entry.second << '\n';
+    out.close ();
+    if (!out)
+      {
+        LOG (WARNING) << "Failed to write " << tmpFile.string ();
+        std::error_code ec;
+        fs::remove (tmpFile, ec);
+        throw Error ("failed to write " + tmpFile.string ());
+      }
+  }
+  std::error_code ec;
+  fs::rename (tmpFile, file, ec);
+  if (ec)
+    {
+      LOG (WARNING)
+          << "Failed to rename " << tmpFile.string () << ": " << ec.message ();
+      fs::remove (tmpFile, ec);
+      throw Error ("failed to rename " + tmpFile.string ());
+    }
+
+  LOG (INFO)
+      << "Wrote CPU profile with " << numRecorded << " samples to "
+      << file.string ();
+
+  using std::chrono::milliseconds;
+  Json::Value res(Json::objectValue);
+  res["file"] = file.string ();
+  res["millis"] = static_cast<Json::Int64> (
+      std::chrono::duration_cast<milliseconds> (duration).count ());
+  res["frequency"] = frequency;
+  res["samples"] = static_cast<Json::UInt64> (numRecorded);
+  res["dropped"] = static_cast<Json::UInt64> (buf->dropped.load ());
+  res["skipped"] = static_cast<Json::UInt64> (buf->skipped.load ());
+  res["stacks"] = static_cast<Json::UInt64> (folded.size ());
+
+  return res;
+}
+
+} // namespace internal
+} // namespace xaya
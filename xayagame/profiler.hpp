@@ -0,0 +1,98 @@
+// Copyright (C) 2019 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef XAYAGAME_PROFILER_HPP
+#define XAYAGAME_PROFILER_HPP
+
+/* This file is an implementation detail of Game and should not be
+   used directly by external code!  */
+
+#include <json/json.h>
+
+#include <stdexcept>
+#include <string>
+
+namespace xaya
+{
+namespace internal
+{
+
+/**
+ * Built-in sampling CPU profiler, which allows finding out where time is
+ * spent in a running daemon without external tools like perf.
+ *
+ * While a profile is running, the process-wide ITIMER_PROF timer raises
+ * SIGPROF at a fixed rate of consumed CPU time.  The signal is delivered to
+ * the thread that was running, whose stack is then captured with backtrace.
+ * Since backtrace is not async-signal-safe, samples are skipped when the
+ * thread was interrupted inside the unwinder or dynamic loader (e.g. while
+ * throwing an exception); their number is reported as "skipped".
+ * At the end, the stacks are symbolised and written as "folded stacks" (one
+ * line per distinct stack with frames separated by semicolons, followed by
+ * the number of samples), which can be turned into a flame graph directly.
+ * The root frame of each stack is the name of the thread.
+ *
+ * Symbols of the main executable are only resolved if it is linked with
+ * -rdynamic; otherwise, raw addresses are shown for them.
+ *
+ * Only one profile can run in the process at any time; concurrent calls
+ * to Run wait for each other.
+ */
+class SamplingProfiler
+{
+
+private:
+
+  /** Directory into which the profiles are written.  */
+  const std::string directory;
+
+  /** Sampling frequency in Hz of consumed CPU time.  */
+  const unsigned frequency;
+
+public:
+
+  class Error;
+
+  /** Default sampling frequency.  */
+  static constexpr unsigned DEFAULT_FREQUENCY = 99;
+
+  /**
+   * Constructs the profiler, writing into the given directory (which is
+   * created if it does not exist).
+   */
+  explicit SamplingProfiler (const std::string& dir,
+                             unsigned f = DEFAULT_FREQUENCY);
+
+  SamplingProfiler () = delete;
+  SamplingProfiler (const SamplingProfiler&) = delete;
+  void operator= (const SamplingProfiler&) = delete;
+
+  /**
+   * Profiles the whole process for the given number of seconds (blocking
+   * until done), and writes the result into a new file in the directory.
+   * Returns information about the profile (like the file name and number
+   * of samples) as JSON object.  If the file cannot be written (e.g. because
+   * the disk is full), Error is thrown.
+   */
+  Json::Value Run (unsigned seconds) const;
+
+};
+
+/**
+ * Exception thrown by SamplingProfiler::Run if the profile could not
+ * be written.
+ */
+class SamplingProfiler::Error : public std::runtime_error
+{
+
+public:
+
+  using std::runtime_error::runtime_error;
+
+};
+
+} // namespace internal
+} // namespace xaya
+
+#endif // XAYAGAME_PROFILER_HPP
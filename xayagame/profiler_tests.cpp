@@ -0,0 +1,159 @@
+// Copyright (C) 2019 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "profiler.hpp"
+
+#include "threadconfig.hpp"
+
+#include <gtest/gtest.h>
+
+#include <glog/logging.h>
+
+#include <experimental/filesystem>
+
+#include <atomic>
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+namespace xaya
+{
+namespace internal
+{
+namespace
+{
+
+namespace fs = std::experimental::filesystem;
+
+class SamplingProfilerTests : public testing::Test
+{
+
+protected:
+
+  /** Temporary directory for the profiles.  */
+  const std::string directory;
+
+  SamplingProfilerTests ()
+    : directory(std::tmpnam (nullptr))
+  {
+    LOG (INFO) << "Temporary profile directory: " << directory;
+  }
+
+  ~SamplingProfilerTests ()
+  {
+    fs::remove_all (directory);
+  }
+
+};
+
+TEST_F (SamplingProfilerTests, CreatesDirectory)
+{
+  SamplingProfiler profiler(directory);
+  EXPECT_TRUE (fs::is_directory (directory));
+}
+
+TEST_F (SamplingProfilerTests, SamplesBusyThread)
+{
+  std::atomic<bool> done(false);
+  std::thread busy ([&done] ()
+    {
+      SetCurrentThreadName ("xaya-busy");
+      volatile unsigned long counter = 0;
+      while (!done)
+        ++counter;
+    });
+
+  SamplingProfiler profiler(directory, 500);
+  const Json::Value res = profiler.Run (1);
+
+  done = true;
+  busy.join ();
+
+  ASSERT_TRUE (res.isObject ());
+  EXPECT_EQ (res["frequency"].asUInt (), 500);
+  EXPECT_GE (res["millis"].asInt64 (), 1000);
+  EXPECT_EQ (res["dropped"].asUInt64 (), 0);
+  const uint64_t samples = res["samples"].asUInt64 ();
+  EXPECT_GT (samples, 0);
+
+  const std::string file = res["file"].asString ();
+  EXPECT_EQ (fs::path (file).parent_path (), fs::path (directory));
+  EXPECT_EQ (fs::path (file).extension (), ".folded");
+
+  /* Each line must be a stack and a count, which sum up to the number of
+     samples.  Most of them should come from the busy thread.  */
+  std::ifstream in(file);
+  std::string line;
+  uint64_t total = 0, busySamples = 0, lines = 0;
+  while (std::getline (in, line))
+    {
+      const size_t space = line.rfind (' ');
+      ASSERT_NE (space, std::string::npos) << line;
+      const uint64_t count = std::stoull (line.substr (space + 1));
+      total += count;
+      if (line.compare (0, 10, "xaya-busy;") == 0)
+        busySamples += count;
+      ++lines;
+    }
+
+  EXPECT_EQ (lines, res["stacks"].asUInt64 ());
+  EXPECT_EQ (total, samples);
+  EXPECT_GT (busySamples, samples / 2);
+}
+
+TEST_F (SamplingProfilerTests, ThrowingThread)
+{
+  /* A thread that spends most of its time in the unwinder must not make
+     the profiler deadlock; instead, those samples are skipped.  */
+  std::atomic<bool> done(false);
+  std::thread thrower ([&done] ()
+    {
+      while (!done)
+        try
+          {
+            throw std::runtime_error ("test");
+          }
+        catch (const std::runtime_error& exc)
+          {}
+    });
+
+  SamplingProfiler profiler(directory, 1000);
+  const Json::Value res = profiler.Run (1);
+
+  done = true;
+  thrower.join ();
+
+  ASSERT_TRUE (res.isObject ());
+  EXPECT_GT (res["samples"].asUInt64 () + res["skipped"].asUInt64 (), 0);
+  EXPECT_GT (res["skipped"].asUInt64 (), 0);
+}
+
+TEST_F (SamplingProfilerTests, WriteFailure)
+{
+  SamplingProfiler profiler(directory);
+  fs::remove_all (directory);
+
+  EXPECT_THROW (profiler.Run (1), SamplingProfiler::Error);
+
+  /* The profiler can be used again afterwards.  */
+  fs::create_directories (directory);
+  EXPECT_TRUE (fs::exists (profiler.Run (1)["file"].asString ()));
+}
+
+TEST_F (SamplingProfilerTests, ConsecutiveRuns)
+{
+  SamplingProfiler profiler(directory);
+  const Json::Value first = profiler.Run (1);
+  const Json::Value second = profiler.Run (1);
+
+  EXPECT_NE (first["file"].asString (), second["file"].asString ());
+  EXPECT_TRUE (fs::exists (first["file"].asString ()));
+  EXPECT_TRUE (fs::exists (second["file"].asString ()));
+}
+
+} // anonymous namespace
+} // namespace internal
+} // namespace xaya
@@ -79,6 +79,15 @@ public:
    */
   void SetDesiredSize (unsigned n);
 
+  /**
+   * Returns the number of desired blocks.
+   */
+  unsigned
+  GetDesiredSize () const
+  {
+    return nBlocks;
+  }
+
   /**
    * Resets the queue to empty.  This can be used if the state got out of sync,
    * e.g. with missed ZMQ notifications.  In that case, we should rather start
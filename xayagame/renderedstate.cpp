@@ -0,0 +1,90 @@
+// Copyright (C) 2019 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "renderedstate.hpp"
+
+#include "base64.hpp"
+#include "memorybudget.hpp"
+
+#include <glog/logging.h>
+
+#include <utility>
+
+namespace xaya
+{
+namespace internal
+{
+
+RenderedState::RenderedState (const uint256& h, Json::Value&& j)
+  : hash(h), json(std::move (j))
+{}
+
+RenderedState::RenderedState (const uint256& h, Json::Value&& j,
+                              std::string&& t)
+  : hash(h), json(std::move (j)), hasText(true), text(std::move (t))
+{}
+
+const std::string&
+RenderedState::GetTextInternal () const
+{
+  if (!hasText)
+    {
+      Json::StreamWriterBuilder wbuilder;
+      wbuilder["indentation"] = "";
+      text = Json::writeString (wbuilder, json);
+      hasText = true;
+    }
+
+  return text;
+}
+
+const std::string&
+RenderedState::GetText () const
+{
+  std::lock_guard<std::mutex> lock(mut);
+  return GetTextInternal ();
+}
+
+const std::string&
+RenderedState::GetEncoded (const ContentEncoding enc) const
+{
+  /* The lock is held while compressing, so that concurrent requests for
+     the same encoding wait for the first one instead of duplicating
+     the work.  */
+  std::lock_guard<std::mutex> lock(mut);
+
+  const auto mit = encoded.find (enc);
+  if (mit != encoded.end ())
+    return mit->second;
+
+  const std::string& plain = GetTextInternal ();
+  VLOG (1)
+      << "Compressing game state of " << plain.size ()
+      << " bytes at block " << hash.ToHex ()
+      << " with " << ContentEncodingToString (enc);
+
+  const auto ins
+      = encoded.emplace (enc, EncodeBase64 (CompressData (plain, enc)));
+  CHECK (ins.second);
+
+  return ins.first->second;
+}
+
+size_t
+RenderedState::GetMemoryUsage () const
+{
+  std::lock_guard<std::mutex> lock(mut);
+
+  if (jsonBytes == 0)
+    jsonBytes = EstimateJsonMemory (json);
+
+  size_t res = sizeof (*this) + jsonBytes + text.size ();
+  for (const auto& entry : encoded)
+    res += entry.second.size ();
+
+  return res;
+}
+
+} // namespace internal
+} // namespace xaya
@@ -0,0 +1,120 @@
+// Copyright (C) 2019 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef XAYAGAME_RENDEREDSTATE_HPP
+#define XAYAGAME_RENDEREDSTATE_HPP
+
+/* This file is an implementation detail of Game and should not be
+   used directly by external code!  */
+
+#include "compression.hpp"
+#include "uint256.hpp"
+
+#include <json/json.h>
+
+#include <cstddef>
+#include <map>
+#include <mutex>
+#include <string>
+
+namespace xaya
+{
+namespace internal
+{
+
+/**
+ * The game state at a particular block, converted to JSON once and then
+ * shared between all RPC requests for that block.  Derived forms (the
+ * serialised JSON text and compressed variants of it) are computed lazily
+ * on first use and cached as well, so that each of them is produced at most
+ * once per block no matter how many clients request it.
+ *
+ * Instances are immutable from the outside and thread-safe.
+ */
+class RenderedState
+{
+
+private:
+
+  /** The block hash this state corresponds to.  */
+  const uint256 hash;
+
+  /** The game state as JSON.  */
+  const Json::Value json;
+
+  /** Lock for the lazily computed fields.  */
+  mutable std::mutex mut;
+
+  /** Whether the JSON text has been computed already.  */
+  mutable bool hasText = false;
+
+  /** The compact JSON text of the state.  */
+  mutable std::string text;
+
+  /** Compressed and base64-encoded forms of the text.  */
+  mutable std::map<ContentEncoding, std::string> encoded;
+
+  /**
+   * Estimated memory used by the JSON value.  This is computed on first
+   * use by GetMemoryUsage, and zero before.
+   */
+  mutable size_t jsonBytes = 0;
+
+  /**
+   * Returns the JSON text, computing it if necessary.  Must be called
+   * with the lock held.
+   */
+  const std::string& GetTextInternal () const;
+
+public:
+
+  explicit RenderedState (const uint256& h, Json::Value&& j);
+
+  /**
+   * Constructs the instance with a JSON text that has already been produced
+   * (e.g. by parallel rendering).  It must represent the same JSON value,
+   * but may differ from what the JSON writer would produce (e.g. in
+   * the order of object members).
+   */
+  explicit RenderedState (const uint256& h, Json::Value&& j, std::string&& t);
+
+  RenderedState () = delete;
+  RenderedState (const RenderedState&) = delete;
+  void operator= (const RenderedState&) = delete;
+
+  const uint256&
+  GetBlockHash () const
+  {
+    return hash;
+  }
+
+  const Json::Value&
+  GetJson () const
+  {
+    return json;
+  }
+
+  /**
+   * Returns the serialised JSON (without any whitespace).
+   */
+  const std::string& GetText () const;
+
+  /**
+   * Returns the JSON text compressed with the given encoding and then
+   * encoded as base64 for transport within a JSON-RPC response.
+   */
+  const std::string& GetEncoded (ContentEncoding enc) const;
+
+  /**
+   * Returns the approximate memory used by this instance, including the
+   * JSON value and the text and encoded forms computed so far.
+   */
+  size_t GetMemoryUsage () const;
+
+};
+
+} // namespace internal
+} // namespace xaya
+
+#endif // XAYAGAME_RENDEREDSTATE_HPP
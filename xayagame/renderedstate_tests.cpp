@@ -0,0 +1,97 @@
+// Copyright (C) 2019 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "renderedstate.hpp"
+
+#include "base64.hpp"
+
+#include <gtest/gtest.h>
+
+#include <sstream>
+#include <string>
+
+namespace xaya
+{
+namespace internal
+{
+namespace
+{
+
+class RenderedStateTests : public testing::Test
+{
+
+protected:
+
+  const RenderedState rendered;
+
+  RenderedStateTests ()
+    : rendered(BlockHash (), ParseJson (R"({"foo": [1, 2, "bar"]})"))
+  {}
+
+  static uint256
+  BlockHash ()
+  {
+    uint256 res;
+    res.SetNull ();
+    return res;
+  }
+
+  static Json::Value
+  ParseJson (const std::string& str)
+  {
+    Json::Value val;
+    std::istringstream in(str);
+    in >> val;
+    return val;
+  }
+
+};
+
+TEST_F (RenderedStateTests, Json)
+{
+  EXPECT_EQ (rendered.GetBlockHash (), BlockHash ());
+  EXPECT_EQ (rendered.GetJson (), ParseJson (R"({"foo": [1, 2, "bar"]})"));
+}
+
+TEST_F (RenderedStateTests, Text)
+{
+  EXPECT_EQ (rendered.GetText (), R"({"foo":[1,2,"bar"]})");
+
+  /* The text is computed once and then returned from the cache.  */
+  EXPECT_EQ (&rendered.GetText (), &rendered.GetText ());
+}
+
+TEST_F (RenderedStateTests, Encoded)
+{
+  for (const auto enc : {ContentEncoding::GZIP, ContentEncoding::DEFLATE})
+    {
+      const std::string& encoded = rendered.GetEncoded (enc);
+      EXPECT_EQ (&rendered.GetEncoded (enc), &encoded);
+
+      std::string compressed, text;
+      ASSERT_TRUE (DecodeBase64 (encoded, compressed));
+      ASSERT_TRUE (DecompressData (compressed, enc, text));
+      EXPECT_EQ (text, rendered.GetText ());
+    }
+
+  EXPECT_NE (rendered.GetEncoded (ContentEncoding::GZIP),
+             rendered.GetEncoded (ContentEncoding::DEFLATE));
+}
+
+TEST_F (RenderedStateTests, MemoryUsage)
+{
+  const size_t initial = rendered.GetMemoryUsage ();
+  EXPECT_GT (initial, 0);
+
+  const size_t withText = initial + rendered.GetText ().size ();
+  EXPECT_EQ (rendered.GetMemoryUsage (), withText);
+
+  const size_t encodedSize
+      = rendered.GetEncoded (ContentEncoding::GZIP).size ();
+  EXPECT_EQ (rendered.GetMemoryUsage (), withText + encodedSize);
+}
+
+} // anonymous namespace
+} // namespace internal
+} // namespace xaya
@@ -0,0 +1,410 @@
+// Copyright (C) 2019 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "sharedstate.hpp"
+
+#include <glog/logging.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <thread>
+
+namespace xaya
+{
+
+namespace
+{
+
+static_assert (ATOMIC_INT_LOCK_FREE == 2 && ATOMIC_LLONG_LOCK_FREE == 2,
+               "shared-memory export requires lock-free atomics");
+
+/** Magic number at the start of the segment ("XAYASHM1").  */
+constexpr uint64_t MAGIC = 0x314d485341594158;
+
+/** Value of the active index when no state has been written yet.  */
+constexpr uint32_t NO_DATA = 2;
+
+/**
+ * Maximum number of attempts a reader makes to get a consistent copy of the
+ * latest state.  Writes are short, so this is only exceeded if the writer
+ * stalled (or crashed) in the middle of a write.
+ */
+constexpr unsigned MAX_READ_ATTEMPTS = 10000;
+
+/**
+ * Header at the start of the segment.
+ */
+struct SegmentHeader
+{
+
+  uint64_t magic;
+
+  /** Set by the writer when the segment has been replaced.  */
+  std::atomic<uint32_t> stale;
+
+  /** Index of the buffer with the latest state, or NO_DATA.  */
+  std::atomic<uint32_t> active;
+
+  /** Maximum size of the state data in each buffer.  */
+  uint64_t capacity;
+
+};
+
+/**
+ * Header of each of the two buffers.  The state data follows it directly.
+ */
+struct BufferHeader
+{
+
+  /** Sequence counter, which is odd while the buffer is being written.  */
+  std::atomic<uint64_t> seq;
+
+  unsigned char hash[uint256::NUM_BYTES];
+  uint64_t height;
+  uint64_t version;
+  uint64_t size;
+
+};
+
+/**
+ * Rounds a size up to a multiple of eight bytes, so that the buffer headers
+ * are aligned properly.
+ */
+uint64_t
+RoundUp (const uint64_t n)
+{
+  return (n + 7) & ~static_cast<uint64_t> (7);
+}
+
+/**
+ * Returns the total segment size for the given capacity.
+ */
+size_t
+SegmentSize (const uint64_t capacity)
+{
+  return sizeof (SegmentHeader)
+            + 2 * (sizeof (BufferHeader) + RoundUp (capacity));
+}
+
+SegmentHeader&
+GetHeader (void* mem)
+{
+  return *static_cast<SegmentHeader*> (mem);
+}
+
+BufferHeader&
+GetBuffer (void* mem, const uint32_t index)
+{
+  CHECK_LT (index, 2);
+  const uint64_t capacity = GetHeader (mem).capacity;
+  auto* ptr = static_cast<char*> (mem) + sizeof (SegmentHeader)
+                + index * (sizeof (BufferHeader) + RoundUp (capacity));
+  return *reinterpret_cast<BufferHeader*> (ptr);
+}
+
+char*
+GetData (BufferHeader& buf)
+{
+  return reinterpret_cast<char*> (&buf) + sizeof (BufferHeader);
+}
+
+} // anonymous namespace
+
+/* ************************************************************************** */
+
+SharedStateReader::SharedStateReader (const std::string& n)
+  : name(n)
+{}
+
+SharedStateReader::~SharedStateReader ()
+{
+  Close ();
+}
+
+bool
+SharedStateReader::Open ()
+{
+  CHECK (mem == nullptr);
+
+  const int fd = shm_open (name.c_str (), O_RDONLY, 0);
+  if (fd < 0)
+    {
+      VLOG (1)
+          << "Could not open shared state " << name << ": "
+          << std::strerror (errno);
+      return false;
+    }
+
+  struct stat st;
+  if (fstat (fd, &st) != 0
+        || static_cast<size_t> (st.st_size) < sizeof (SegmentHeader))
+    {
+      close (fd);
+      return false;
+    }
+
+  const size_t size = st.st_size;
+  void* ptr = mmap (nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+  close (fd);
+  if (ptr == MAP_FAILED)
+    {
+      LOG (WARNING)
+          << "Could not map shared state " << name << ": "
+          << std::strerror (errno);
+      return false;
+    }
+
+  const auto& hdr = GetHeader (ptr);
+  if (hdr.magic != MAGIC || SegmentSize (hdr.capacity) > size)
+    {
+      LOG (WARNING) << "Shared state " << name << " is not valid";
+      munmap (ptr, size);
+      return false;
+    }
+
+  mem = ptr;
+  mappedSize = size;
+  return true;
+}
+
+void
+SharedStateReader::Close ()
+{
+  if (mem == nullptr)
+    return;
+
+  munmap (mem, mappedSize);
+  mem = nullptr;
+  mappedSize = 0;
+}
+
+uint64_t
+SharedStateReader::GetVersion ()
+{
+  /* This is done like a full read, except that only the version is
+     copied.  The seqlock makes sure that it belongs to a consistent
+     buffer.  */
+  for (unsigned attempt = 0; attempt < MAX_READ_ATTEMPTS; ++attempt)
+    {
+      if (attempt > 0)
+        std::this_thread::yield ();
+
+      if (mem == nullptr && !Open ())
+        return 0;
+
+      auto& hdr = GetHeader (mem);
+      if (hdr.stale.load (std::memory_order_acquire))
+        {
+          Close ();
+          continue;
+        }
+
+      const uint32_t index = hdr.active.load (std::memory_order_acquire);
+      if (index == NO_DATA)
+        return 0;
+
+      auto& buf = GetBuffer (mem, index);
+      const uint64_t seq = buf.seq.load (std::memory_order_acquire);
+      if (seq % 2 != 0)
+        continue;
+
+      const uint64_t version = buf.version;
+
+      std::atomic_thread_fence (std::memory_order_acquire);
+      if (buf.seq.load (std::memory_order_relaxed) == seq)
+        return version;
+    }
+
+  LOG (WARNING)
+      << "Could not get a consistent version from shared state " << name;
+  return 0;
+}
+
+bool
+SharedStateReader::Read (uint256& hash, unsigned& height, uint64_t& version,
+                         GameStateData& state)
+{
+  for (unsigned attempt = 0; attempt < MAX_READ_ATTEMPTS; ++attempt)
+    {
+      if (attempt > 0)
+        std::this_thread::yield ();
+
+      if (mem == nullptr && !Open ())
+        return false;
+
+      auto& hdr = GetHeader (mem);
+      if (hdr.stale.load (std::memory_order_acquire))
+        {
+          Close ();
+          continue;
+        }
+
+      const uint32_t index = hdr.active.load (std::memory_order_acquire);
+      if (index == NO_DATA)
+        return false;
+
+      auto& buf = GetBuffer (mem, index);
+      const uint64_t seq = buf.seq.load (std::memory_order_acquire);
+      if (seq % 2 != 0)
+        continue;
+
+      /* The size may be garbage if the buffer is being overwritten right
+         now, so make sure we stay within the buffer.  If it is
+         inconsistent, the sequence check below fails anyway.  */
+      const uint64_t size = buf.size;
+      if (size > hdr.capacity)
+        continue;
+
+      hash.FromBlob (buf.hash);
+      height = buf.height;
+      version = buf.version;
+      state.assign (GetData (buf), size);
+
+      std::atomic_thread_fence (std::memory_order_acquire);
+      if (buf.seq.load (std::memory_order_relaxed) == seq)
+        return true;
+    }
+
+  LOG (WARNING)
+      << "Could not read a consistent state from shared state " << name;
+  return false;
+}
+
+/* ************************************************************************** */
+
+namespace internal
+{
+
+SharedStateWriter::SharedStateWriter (const std::string& n,
+                                      const uint64_t capacity)
+  : name(n)
+{
+  /* Remove a potential left-over segment, since readers that still have
+     it mapped would not know that it is no longer updated otherwise.  */
+  shm_unlink (name.c_str ());
+
+  Create (capacity);
+}
+
+SharedStateWriter::~SharedStateWriter ()
+{
+  GetHeader (mem).stale.store (1, std::memory_order_release);
+  munmap (mem, mappedSize);
+  shm_unlink (name.c_str ());
+}
+
+void
+SharedStateWriter::Create (const uint64_t capacity)
+{
+  LOG (INFO)
+      << "Creating shared state " << name << " with capacity "
+      << capacity << " bytes";
+
+  const int fd = shm_open (name.c_str (), O_RDWR | O_CREAT | O_EXCL, 0644);
+  CHECK_GE (fd, 0)
+      << "Failed to create shared state " << name << ": "
+      << std::strerror (errno);
+
+  const size_t size = SegmentSize (capacity);
+  CHECK_EQ (ftruncate (fd, size), 0)
+      << "Failed to resize shared state " << name << ": "
+      << std::strerror (errno);
+
+  void* ptr = mmap (nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close (fd);
+  CHECK (ptr != MAP_FAILED)
+      << "Failed to map shared state " << name << ": "
+      << std::strerror (errno);
+
+  /* The segment is zero-initialised by ftruncate, which is a valid state
+     for the atomics as well.  The magic is written last, so that readers
+     do not accept the segment before the header is complete.  */
+  auto& hdr = GetHeader (ptr);
+  hdr.capacity = capacity;
+  hdr.active.store (NO_DATA, std::memory_order_relaxed);
+  std::atomic_thread_fence (std::memory_order_release);
+  hdr.magic = MAGIC;
+
+  mem = ptr;
+  mappedSize = size;
+}
+
+void
+SharedStateWriter::MarkActiveBufferWriting ()
+{
+  const uint32_t active
+      = GetHeader (mem).active.load (std::memory_order_relaxed);
+  CHECK_NE (active, NO_DATA);
+  GetBuffer (mem, active).seq.fetch_add (1, std::memory_order_release);
+}
+
+uint64_t
+SharedStateWriter::GetCapacity () const
+{
+  return GetHeader (mem).capacity;
+}
+
+void
+SharedStateWriter::Write (const uint256& hash, const unsigned height,
+                          const GameStateData& state)
+{
+  auto& hdr = GetHeader (mem);
+  CHECK_LE (state.size (), hdr.capacity);
+
+  const uint32_t active = hdr.active.load (std::memory_order_relaxed);
+  const uint32_t index = (active == NO_DATA ? 0 : 1 - active);
+  auto& buf = GetBuffer (mem, index);
+
+  buf.seq.fetch_add (1, std::memory_order_relaxed);
+  std::atomic_thread_fence (std::memory_order_release);
+
+  std::memcpy (buf.hash, hash.GetBlob (), uint256::NUM_BYTES);
+  buf.height = height;
+  buf.version = version;
+  buf.size = state.size ();
+  std::memcpy (GetData (buf), state.data (), state.size ());
+
+  buf.seq.fetch_add (1, std::memory_order_release);
+  hdr.active.store (index, std::memory_order_release);
+}
+
+void
+SharedStateWriter::Publish (const uint256& hash, const unsigned height,
+                            const GameStateData& state)
+{
+  ++version;
+
+  if (state.size () <= GetCapacity ())
+    {
+      Write (hash, height, state);
+      return;
+    }
+
+  /* Replace the segment by a larger one.  The new one is filled before
+     the old one is marked stale, so that readers switching over find
+     the state there right away.  */
+  const uint64_t capacity = std::max<uint64_t> (2 * GetCapacity (),
+                                                state.size ());
+  void* oldMem = mem;
+  const size_t oldSize = mappedSize;
+
+  CHECK_EQ (shm_unlink (name.c_str ()), 0)
+      << "Failed to remove shared state " << name << ": "
+      << std::strerror (errno);
+  Create (capacity);
+  Write (hash, height, state);
+
+  GetHeader (oldMem).stale.store (1, std::memory_order_release);
+  munmap (oldMem, oldSize);
+}
+
+} // namespace internal
+} // namespace xaya
@@ -0,0 +1,177 @@
+// Copyright (C) 2019 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef XAYAGAME_SHAREDSTATE_HPP
+#define XAYAGAME_SHAREDSTATE_HPP
+
+#include "storage.hpp"
+#include "uint256.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace xaya
+{
+
+/**
+ * Reader for the current game state exported by Game into a POSIX
+ * shared-memory segment (see Game::EnableSharedStateExport).  This allows
+ * other processes on the same host to read the latest state without
+ * JSON-RPC calls and without contention on the game's lock.
+ *
+ * The segment holds two buffers, one of which contains the latest state
+ * while the other is being written.  Each buffer is protected by a sequence
+ * counter (seqlock), so that reading is lock-free and only needs a copy of
+ * the data.  If the game needs a larger segment, it replaces it and marks
+ * the old one as stale, in which case the reader opens the new one.
+ *
+ * An instance must not be used concurrently from multiple threads.
+ */
+class SharedStateReader
+{
+
+private:
+
+  /** Name of the shared-memory segment.  */
+  const std::string name;
+
+  /** The mapped segment, or null if not open.  */
+  void* mem = nullptr;
+
+  /** Size of the mapping.  */
+  size_t mappedSize = 0;
+
+  /**
+   * Tries to open and map the segment.  Returns false if it does not
+   * exist (yet) or is not valid.
+   */
+  bool Open ();
+
+  /**
+   * Unmaps the segment if it is open.
+   */
+  void Close ();
+
+public:
+
+  /**
+   * Constructs a reader for the segment with the given name (as passed to
+   * Game::EnableSharedStateExport).  The segment need not exist yet.
+   */
+  explicit SharedStateReader (const std::string& n);
+
+  ~SharedStateReader ();
+
+  SharedStateReader () = delete;
+  SharedStateReader (const SharedStateReader&) = delete;
+  void operator= (const SharedStateReader&) = delete;
+
+  /**
+   * Returns the version of the latest exported state, or zero if there
+   * is none (or the segment does not exist).  This is cheap and can be used
+   * to poll for changes before calling Read.  Zero is also returned if no
+   * consistent version could be read after a bounded number of retries
+   * (e.g. because the writer stalled in the middle of an update).
+   */
+  uint64_t GetVersion ();
+
+  /**
+   * Reads the latest exported state.  The version counts up by one for
+   * each export.  Returns false if no state is available, or if no
+   * consistent copy could be made after a bounded number of retries.
+   */
+  bool Read (uint256& hash, unsigned& height, uint64_t& version,
+             GameStateData& state);
+
+};
+
+namespace internal
+{
+
+/**
+ * Writer for the shared-memory state export, used by Game.  It creates
+ * the segment when constructed and removes it again when destructed.
+ */
+class SharedStateWriter
+{
+
+private:
+
+  /** Name of the shared-memory segment.  */
+  const std::string name;
+
+  /** The mapped segment.  */
+  void* mem = nullptr;
+
+  /** Size of the mapping.  */
+  size_t mappedSize = 0;
+
+  /** Version of the last published state.  */
+  uint64_t version = 0;
+
+  friend class SharedStateTests;
+
+  /**
+   * Creates the segment with room for states up to the given size,
+   * and maps it.
+   */
+  void Create (uint64_t capacity);
+
+  /**
+   * Writes the given data into the buffer not currently active and
+   * then marks it as active.
+   */
+  void Write (const uint256& hash, unsigned height,
+              const GameStateData& state);
+
+  /**
+   * Marks the buffer with the latest state as being written (with an odd
+   * sequence number), as if a write had been interrupted.  This is only
+   * used in tests.
+   */
+  void MarkActiveBufferWriting ();
+
+public:
+
+  /**
+   * Creates the segment with the given name and initial capacity.  An
+   * existing segment of the same name (e.g. left over by a crashed process)
+   * is replaced.
+   */
+  explicit SharedStateWriter (const std::string& n, uint64_t capacity);
+
+  ~SharedStateWriter ();
+
+  SharedStateWriter () = delete;
+  SharedStateWriter (const SharedStateWriter&) = delete;
+  void operator= (const SharedStateWriter&) = delete;
+
+  /**
+   * Publishes a new state.  If it does not fit into the segment, a larger
+   * one is created in its place.
+   */
+  void Publish (const uint256& hash, unsigned height,
+                const GameStateData& state);
+
+  /**
+   * Returns the current capacity for the state data in bytes.
+   */
+  uint64_t GetCapacity () const;
+
+  /**
+   * Returns the version of the last published state.
+   */
+  uint64_t
+  GetVersion () const
+  {
+    return version;
+  }
+
+};
+
+} // namespace internal
+} // namespace xaya
+
+#endif // XAYAGAME_SHAREDSTATE_HPP
@@ -0,0 +1,208 @@
+// Copyright (C) 2019 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "sharedstate.hpp"
+
+#include "testutils.hpp"
+
+#include <gtest/gtest.h>
+
+#include <unistd.h>
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+
+namespace xaya
+{
+namespace internal
+{
+
+class SharedStateTests : public testing::Test
+{
+
+protected:
+
+  /** Name of the segment used in the test, unique for this process.  */
+  const std::string name;
+
+  SharedStateTests ()
+    : name("/xayagame-test-" + std::to_string (getpid ()))
+  {}
+
+  /**
+   * Reads the state with the given reader and expects it to match.
+   */
+  static void
+  ExpectState (SharedStateReader& reader, const uint256& hash,
+               const unsigned height, const uint64_t version,
+               const GameStateData& state)
+  {
+    uint256 actualHash;
+    unsigned actualHeight;
+    uint64_t actualVersion;
+    GameStateData actualState;
+    ASSERT_TRUE (reader.Read (actualHash, actualHeight, actualVersion,
+                              actualState));
+
+    EXPECT_EQ (actualHash, hash);
+    EXPECT_EQ (actualHeight, height);
+    EXPECT_EQ (actualVersion, version);
+    EXPECT_EQ (actualState, state);
+    EXPECT_EQ (reader.GetVersion (), version);
+  }
+
+  /**
+   * Expects that the reader does not find any state.
+   */
+  static void
+  ExpectNoState (SharedStateReader& reader)
+  {
+    uint256 hash;
+    unsigned height;
+    uint64_t version;
+    GameStateData state;
+    EXPECT_FALSE (reader.Read (hash, height, version, state));
+    EXPECT_EQ (reader.GetVersion (), 0);
+  }
+
+  /**
+   * Leaves the latest state of the writer as if it were being written
+   * right now (and never finished).
+   */
+  static void
+  InterruptWrite (SharedStateWriter& writer)
+  {
+    writer.MarkActiveBufferWriting ();
+  }
+
+};
+
+namespace
+{
+
+TEST_F (SharedStateTests, NoSegment)
+{
+  SharedStateReader reader(name);
+  ExpectNoState (reader);
+}
+
+TEST_F (SharedStateTests, NoStateYet)
+{
+  internal::SharedStateWriter writer(name, 100);
+  SharedStateReader reader(name);
+  ExpectNoState (reader);
+}
+
+TEST_F (SharedStateTests, PublishAndRead)
+{
+  internal::SharedStateWriter writer(name, 100);
+  SharedStateReader reader(name);
+
+  writer.Publish (BlockHash (10), 10, "first");
+  ExpectState (reader, BlockHash (10), 10, 1, "first");
+
+  writer.Publish (BlockHash (11), 11, "");
+  writer.Publish (BlockHash (12), 12, "third");
+  EXPECT_EQ (writer.GetVersion (), 3);
+  ExpectState (reader, BlockHash (12), 12, 3, "third");
+  ExpectState (reader, BlockHash (12), 12, 3, "third");
+}
+
+TEST_F (SharedStateTests, Growth)
+{
+  internal::SharedStateWriter writer(name, 4);
+  SharedStateReader reader(name);
+
+  writer.Publish (BlockHash (1), 1, "abc");
+  ExpectState (reader, BlockHash (1), 1, 1, "abc");
+
+  const std::string large(1000, 'x');
+  writer.Publish (BlockHash (2), 2, large);
+  EXPECT_GE (writer.GetCapacity (), large.size ());
+  ExpectState (reader, BlockHash (2), 2, 2, large);
+
+  writer.Publish (BlockHash (3), 3, "small");
+  ExpectState (reader, BlockHash (3), 3, 3, "small");
+}
+
+TEST_F (SharedStateTests, WriterRemoved)
+{
+  SharedStateReader reader(name);
+
+  auto writer = std::make_unique<internal::SharedStateWriter> (name, 100);
+  writer->Publish (BlockHash (1), 1, "state");
+  ExpectState (reader, BlockHash (1), 1, 1, "state");
+
+  writer.reset ();
+  ExpectNoState (reader);
+
+  /* A new writer starts over.  */
+  writer = std::make_unique<internal::SharedStateWriter> (name, 100);
+  writer->Publish (BlockHash (5), 5, "new");
+  ExpectState (reader, BlockHash (5), 5, 1, "new");
+}
+
+TEST_F (SharedStateTests, ConcurrentReads)
+{
+  constexpr unsigned NUM_STATES = 2000;
+
+  internal::SharedStateWriter writer(name, 16);
+  writer.Publish (BlockHash (0), 0, "");
+
+  /* Each state is a character derived from the height, repeated a number
+     of times also derived from it.  This way, the reader can verify that
+     what it sees is consistent.  The state size
+     varies, which also triggers growth of the segment.  */
+  std::atomic<bool> done(false);
+  std::thread writerThread ([&] ()
+    {
+      for (unsigned i = 1; i <= NUM_STATES; ++i)
+        writer.Publish (BlockHash (i % 256), i,
+                        std::string (i % 300, 'a' + i % 26));
+      done = true;
+    });
+
+  SharedStateReader reader(name);
+  uint64_t lastVersion = 0;
+  while (!done || lastVersion < NUM_STATES + 1)
+    {
+      uint256 hash;
+      unsigned height;
+      uint64_t version;
+      GameStateData state;
+      ASSERT_TRUE (reader.Read (hash, height, version, state));
+
+      ASSERT_GE (version, lastVersion);
+      ASSERT_EQ (version, height + 1);
+      ASSERT_EQ (hash, BlockHash (height % 256));
+      ASSERT_EQ (state, std::string (height % 300, 'a' + height % 26));
+      lastVersion = version;
+    }
+
+  writerThread.join ();
+}
+
+TEST_F (SharedStateTests, InterruptedWrite)
+{
+  internal::SharedStateWriter writer(name, 100);
+  SharedStateReader reader(name);
+
+  writer.Publish (BlockHash (1), 1, "state");
+  ExpectState (reader, BlockHash (1), 1, 1, "state");
+
+  /* A buffer that stays in the middle of a write must not make the reader
+     spin forever.  */
+  InterruptWrite (writer);
+  ExpectNoState (reader);
+
+  /* The next write goes to the other buffer and can be read again.  */
+  writer.Publish (BlockHash (2), 2, "next");
+  ExpectState (reader, BlockHash (2), 2, 2, "next");
+}
+
+} // anonymous namespace
+} // namespace internal
+} // namespace xaya
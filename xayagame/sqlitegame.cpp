@@ -421,6 +421,26 @@ SQLiteGame::ProcessBackwards (const GameStateData& newState,
   return BLOCKHASH_STATE + blockData["block"]["parent"].asString ();
 }
 
+GameStateData
+SQLiteGame::ReapplyForward (const GameStateData& oldState,
+                            const Json::Value& blockData,
+                            const GameStateData& newState,
+                            const UndoData& undo)
+{
+  database->EnsureCurrentState (oldState);
+
+  /* The undo data is exactly the forward changeset that UpdateState made
+     when the block was processed originally, so it can just be applied.  */
+  void* data = const_cast<void*> (static_cast<const void*> (undo.data ()));
+  CHECK_EQ (sqlite3changeset_apply (database->GetDatabase (),
+                                    undo.size (), data, nullptr,
+                                    &AbortOnConflict, nullptr),
+            SQLITE_OK)
+      << "Failed to reapply changeset";
+
+  return newState;
+}
+
 SQLiteGame::AutoId&
 SQLiteGame::Ids (const std::string& key)
 {
@@ -107,6 +107,8 @@ protected:
    * Updates the current state in the database for the given block of moves.
    * Note that no un-finalised sqlite3_stmt handles or other things open
    * against the database may be left behind when the function returns.
+   * The time spent on individual moves can be attributed with MoveCostScope
+   * and GetCostAccounting.
    */
   virtual void UpdateState (sqlite3* db, const Json::Value& blockData) = 0;
 
@@ -166,6 +168,15 @@ public:
                                   const Json::Value& blockData,
                                   const UndoData& undo) override;
 
+  /**
+   * Reapplies a previously detached block by applying the changeset
+   * recorded as its undo data, without calling UpdateState again.
+   */
+  GameStateData ReapplyForward (const GameStateData& oldState,
+                                const Json::Value& blockData,
+                                const GameStateData& newState,
+                                const UndoData& undo) override;
+
   Json::Value GameStateToJson (const GameStateData& state) override;
 
 };
@@ -491,6 +491,42 @@ TEST_F (MovingTests, ErrorHandling)
   });
 }
 
+TEST_F (MovingTests, ReapplyDetachedBlocks)
+{
+  game.EnableDetachedBlockCache (10);
+
+  const auto moves11 = ChatGame::Moves ({
+    {"domob", "new"},
+    {"a", "x"},
+  });
+  const auto moves12 = ChatGame::Moves ({{"a", "z"}});
+
+  AttachBlock (game, BlockHash (11), moves11);
+  AttachBlock (game, BlockHash (12), moves12);
+  DetachBlock (game);
+  DetachBlock (game);
+  ExpectState ({{"domob", "hello world"}, {"foo", "bar"}});
+
+  /* Re-attaching the blocks should reapply the cached changesets without
+     calling UpdateState, so the failure flag has no effect.  */
+  rules.SetShouldFail (true);
+  AttachBlock (game, BlockHash (11), moves11);
+  AttachBlock (game, BlockHash (12), moves12);
+  rules.SetShouldFail (false);
+  ExpectState ({
+    {"a", "z"},
+    {"domob", "new"},
+    {"foo", "bar"},
+  });
+
+  DetachBlock (game);
+  ExpectState ({
+    {"a", "x"},
+    {"domob", "new"},
+    {"foo", "bar"},
+  });
+}
+
 /* ************************************************************************** */
 
 class PersistenceTests : public GameTestWithBlockchain
@@ -63,6 +63,167 @@ GetStringBlob (sqlite3_stmt* stmt, const int ind)
   return std::string (static_cast<const char*> (blob), blobSize);
 }
 
+/**
+ * Returns true if the given filename refers to a temporary in-memory
+ * database rather than a file.
+ */
+bool
+IsInMemory (const std::string& filename)
+{
+  return filename == ":memory:";
+}
+
+/* The queries for reading data.  They are shared between the main connection
+   and snapshots, and the results are processed by the Read* functions
+   below in both cases.  */
+
+const std::string SQL_GET_BLOCK_HASH = R"(
+  SELECT `value` FROM `xayagame_current` WHERE `key` = 'blockhash'
+)";
+
+const std::string SQL_GET_GAME_STATE = R"(
+  SELECT `value` FROM `xayagame_current` WHERE `key` = 'gamestate'
+)";
+
+const std::string SQL_GET_UNDO_DATA = R"(
+  SELECT `data` FROM `xayagame_undo` WHERE `hash` = ?1
+)";
+
+/**
+ * Steps a given statement and expects no more results.
+ */
+void
+ExpectDone (sqlite3_stmt* stmt)
+{
+  const int rc = sqlite3_step (stmt);
+  if (rc != SQLITE_DONE)
+    LOG (FATAL) << "Expected SQLITE_DONE, got: " << rc;
+}
+
+/**
+ * Executes the (freshly reset) SQL_GET_BLOCK_HASH statement and returns the
+ * result in the same way as GetCurrentBlockHash.
+ */
+bool
+ReadBlockHash (sqlite3_stmt* stmt, uint256& hash)
+{
+  const int rc = sqlite3_step (stmt);
+  if (rc == SQLITE_DONE)
+    return false;
+  if (rc != SQLITE_ROW)
+    LOG (FATAL) << "Failed to fetch current block hash: " << rc;
+
+  const void* blob = sqlite3_column_blob (stmt, 0);
+  const size_t blobSize = sqlite3_column_bytes (stmt, 0);
+  CHECK_EQ (blobSize, uint256::NUM_BYTES)
+      << "Invalid uint256 value stored in database";
+  hash.FromBlob (static_cast<const unsigned char*> (blob));
+
+  ExpectDone (stmt);
+  return true;
+}
+
+/**
+ * Executes the (freshly reset) SQL_GET_GAME_STATE statement and returns
+ * the game state.
+ */
+GameStateData
+ReadGameState (sqlite3_stmt* stmt)
+{
+  const int rc = sqlite3_step (stmt);
+  if (rc != SQLITE_ROW)
+    LOG (FATAL) << "Failed to fetch current game state: " << rc;
+
+  const GameStateData res = GetStringBlob (stmt, 0);
+
+  ExpectDone (stmt);
+  return res;
+}
+
+/**
+ * Executes the (freshly reset) SQL_GET_UNDO_DATA statement for the given
+ * hash and returns the result like GetUndoData.
+ */
+bool
+ReadUndoData (sqlite3_stmt* stmt, const uint256& hash, UndoData& data)
+{
+  BindUint256 (stmt, 1, hash);
+
+  const int rc = sqlite3_step (stmt);
+  if (rc == SQLITE_DONE)
+    return false;
+  if (rc != SQLITE_ROW)
+    LOG (FATAL) << "Failed to fetch undo data: " << rc;
+
+  data = GetStringBlob (stmt, 0);
+
+  ExpectDone (stmt);
+  return true;
+}
+
+/**
+ * Removes the file with the given name if it exists.
+ */
+void
+RemoveIfExists (const std::string& file)
+{
+  if (std::remove (file.c_str ()) == 0)
+    LOG (INFO) << "Removed file: " << file;
+}
+
+/**
+ * Copies the full main database from source to destination using the
+ * online backup API.  Returns false (after logging a warning) if that
+ * failed, e.g. because the destination could not be written.
+ */
+bool
+CopyDatabase (sqlite3* dest, sqlite3* source)
+{
+  sqlite3_backup* backup = sqlite3_backup_init (dest, "main", source, "main");
+  if (backup == nullptr)
+    {
+      LOG (WARNING)
+          << "Failed to start database backup: " << sqlite3_errmsg (dest);
+      return false;
+    }
+
+  const int rc = sqlite3_backup_step (backup, -1);
+  if (sqlite3_backup_finish (backup) != SQLITE_OK || rc != SQLITE_DONE)
+    {
+      LOG (WARNING)
+          << "Database backup failed (" << rc << "): "
+          << sqlite3_errmsg (dest);
+      return false;
+    }
+
+  return true;
+}
+
+/**
+ * Writes a checkpoint of the database on the given connection to a file.
+ */
+bool
+WriteDatabaseCheckpoint (sqlite3* source, const std::string& file)
+{
+  sqlite3* dest = nullptr;
+  const int rc = sqlite3_open (file.c_str (), &dest);
+  if (rc != SQLITE_OK)
+    {
+      LOG (WARNING) << "Failed to open checkpoint database: " << file;
+      sqlite3_close (dest);
+      return false;
+    }
+
+  const bool ok = CopyDatabase (dest, source);
+  if (sqlite3_close (dest) != SQLITE_OK)
+    {
+      LOG (WARNING) << "Failed to close checkpoint database: " << file;
+      return false;
+    }
+
+  return ok;
+}
+
 } // anonymous namespace
 
 SQLiteStorage::SQLiteStorage (const std::string& f)
@@ -98,6 +259,14 @@ SQLiteStorage::OpenDatabase ()
   CHECK (db != nullptr);
   LOG (INFO) << "Opened SQLite database successfully: " << filename;
 
+  if (snapshots && !IsInMemory (filename))
+    {
+      const int rc = sqlite3_exec (db, "PRAGMA `journal_mode` = WAL",
+                                   nullptr, nullptr, nullptr);
+      if (rc != SQLITE_OK)
+        LOG (FATAL) << "Failed to enable WAL mode: " << rc;
+    }
+
   SetupSchema ();
 }
 
@@ -163,9 +332,7 @@ SQLiteStorage::PrepareStatement (const std::string& sql) const
 void
 SQLiteStorage::StepWithNoResult (sqlite3_stmt* stmt)
 {
-  const int rc = sqlite3_step (stmt);
-  if (rc != SQLITE_DONE)
-    LOG (FATAL) << "Expected SQLITE_DONE, got: " << rc;
+  ExpectDone (stmt);
 }
 
 void
@@ -185,6 +352,13 @@ SQLiteStorage::SetupSchema ()
     LOG (FATAL) << "Failed to set up database schema: " << rc;
 }
 
+void
+SQLiteStorage::EnableSnapshots ()
+{
+  CHECK (db == nullptr) << "Snapshots must be enabled before initialisation";
+  snapshots = true;
+}
+
 void
 SQLiteStorage::Initialise ()
 {
@@ -198,7 +372,7 @@ SQLiteStorage::Clear ()
 {
   CloseDatabase ();
 
-  if (filename == ":memory:")
+  if (IsInMemory (filename))
     LOG (INFO)
         << "Database with filename '" << filename << "' is temporary,"
         << " so it does not need to be explicitly removed";
@@ -208,6 +382,12 @@ SQLiteStorage::Clear ()
       const int rc = std::remove (filename.c_str ());
       if (rc != 0)
         LOG (FATAL) << "Failed to remove file: " << rc;
+
+      /* If WAL mode is used, the WAL files are normally removed when the
+         connection is closed, but make sure that no stale ones are left
+         behind for the new database in any case.  */
+      RemoveIfExists (filename + "-wal");
+      RemoveIfExists (filename + "-shm");
     }
 
   OpenDatabase ();
@@ -216,41 +396,13 @@ SQLiteStorage::Clear ()
 bool
 SQLiteStorage::GetCurrentBlockHash (uint256& hash) const
 {
-  auto* stmt = PrepareStatement (R"(
-    SELECT `value` FROM `xayagame_current` WHERE `key` = 'blockhash'
-  )");
-
-  const int rc = sqlite3_step (stmt);
-  if (rc == SQLITE_DONE)
-    return false;
-  if (rc != SQLITE_ROW)
-    LOG (FATAL) << "Failed to fetch current block hash: " << rc;
-
-  const void* blob = sqlite3_column_blob (stmt, 0);
-  const size_t blobSize = sqlite3_column_bytes (stmt, 0);
-  CHECK_EQ (blobSize, uint256::NUM_BYTES)
-      << "Invalid uint256 value stored in database";
-  hash.FromBlob (static_cast<const unsigned char*> (blob));
-
-  StepWithNoResult (stmt);
-  return true;
+  return ReadBlockHash (PrepareStatement (SQL_GET_BLOCK_HASH), hash);
 }
 
 GameStateData
 SQLiteStorage::GetCurrentGameState () const
 {
-  auto* stmt = PrepareStatement (R"(
-    SELECT `value` FROM `xayagame_current` WHERE `key` = 'gamestate'
-  )");
-
-  const int rc = sqlite3_step (stmt);
-  if (rc != SQLITE_ROW)
-    LOG (FATAL) << "Failed to fetch current game state: " << rc;
-
-  const GameStateData res = GetStringBlob (stmt, 0);
-
-  StepWithNoResult (stmt);
-  return res;
+  return ReadGameState (PrepareStatement (SQL_GET_GAME_STATE));
 }
 
 void
@@ -281,21 +433,7 @@ SQLiteStorage::SetCurrentGameState (const uint256& hash,
 bool
 SQLiteStorage::GetUndoData (const uint256& hash, UndoData& data) const
 {
-  auto* stmt = PrepareStatement (R"(
-    SELECT `data` FROM `xayagame_undo` WHERE `hash` = ?1
-  )");
-  BindUint256 (stmt, 1, hash);
-
-  const int rc = sqlite3_step (stmt);
-  if (rc == SQLITE_DONE)
-    return false;
-  if (rc != SQLITE_ROW)
-    LOG (FATAL) << "Failed to fetch undo data: " << rc;
-
-  data = GetStringBlob (stmt, 0);
-
-  StepWithNoResult (stmt);
-  return true;
+  return ReadUndoData (PrepareStatement (SQL_GET_UNDO_DATA), hash, data);
 }
 
 void
@@ -372,4 +510,161 @@ SQLiteStorage::RollbackTransaction ()
   startedTransaction = false;
 }
 
+/**
+ * Snapshot of an SQLiteStorage.  It uses a separate read-only connection
+ * to the database file, on which a read transaction is kept open for the
+ * lifetime of the snapshot.  Since the database is in WAL mode, that
+ * transaction sees the state at its start and does not block the writer.
+ */
+class SQLiteStorage::Snapshot : public StorageSnapshot
+{
+
+private:
+
+  /** The read-only database connection.  */
+  sqlite3* db = nullptr;
+
+  /* Prepared statements for the reads.  */
+  sqlite3_stmt* stmtBlockHash = nullptr;
+  sqlite3_stmt* stmtGameState = nullptr;
+  sqlite3_stmt* stmtUndoData = nullptr;
+
+  /**
+   * Prepares a statement on our connection.
+   */
+  sqlite3_stmt*
+  Prepare (const std::string& sql)
+  {
+    sqlite3_stmt* res = nullptr;
+    const int rc = sqlite3_prepare_v2 (db, sql.c_str (), sql.size () + 1,
+                                       &res, nullptr);
+    if (rc != SQLITE_OK)
+      LOG (FATAL) << "Failed to prepare SQL statement: " << rc;
+
+    return res;
+  }
+
+  /**
+   * Resets a statement for reuse.
+   */
+  static sqlite3_stmt*
+  Reset (sqlite3_stmt* stmt)
+  {
+    sqlite3_reset (stmt);
+    sqlite3_clear_bindings (stmt);
+    return stmt;
+  }
+
+public:
+
+  explicit Snapshot (const std::string& filename)
+  {
+    const int rc = sqlite3_open_v2 (filename.c_str (), &db,
+                                    SQLITE_OPEN_READONLY, nullptr);
+    if (rc != SQLITE_OK)
+      LOG (FATAL) << "Failed to open SQLite snapshot connection: " << rc;
+    CHECK (db != nullptr);
+
+    /* Readers in WAL mode may briefly see SQLITE_BUSY, e.g. while the
+       writer is running a checkpoint.  */
+    sqlite3_busy_timeout (db, 1000);
+
+    stmtBlockHash = Prepare (SQL_GET_BLOCK_HASH);
+    stmtGameState = Prepare (SQL_GET_GAME_STATE);
+    stmtUndoData = Prepare (SQL_GET_UNDO_DATA);
+
+    /* The read transaction (and thus the snapshot) only starts with the
+       first actual read, not with BEGIN.  So do a read right away.  */
+    if (sqlite3_exec (db, "BEGIN", nullptr, nullptr, nullptr) != SQLITE_OK)
+      LOG (FATAL) << "Failed to start snapshot transaction";
+    uint256 dummy;
+    ReadBlockHash (Reset (stmtBlockHash), dummy);
+    sqlite3_reset (stmtBlockHash);
+  }
+
+  ~Snapshot ()
+  {
+    if (sqlite3_exec (db, "ROLLBACK", nullptr, nullptr, nullptr) != SQLITE_OK)
+      LOG (ERROR) << "Failed to end snapshot transaction";
+
+    sqlite3_finalize (stmtBlockHash);
+    sqlite3_finalize (stmtGameState);
+    sqlite3_finalize (stmtUndoData);
+
+    if (sqlite3_close (db) != SQLITE_OK)
+      LOG (ERROR) << "Failed to close SQLite snapshot connection";
+  }
+
+  Snapshot () = delete;
+  Snapshot (const Snapshot&) = delete;
+  void operator= (const Snapshot&) = delete;
+
+  bool
+  GetCurrentBlockHash (uint256& hash) const override
+  {
+    return ReadBlockHash (Reset (stmtBlockHash), hash);
+  }
+
+  GameStateData
+  GetCurrentGameState () const override
+  {
+    return ReadGameState (Reset (stmtGameState));
+  }
+
+  bool
+  GetUndoData (const uint256& hash, UndoData& data) const override
+  {
+    return ReadUndoData (Reset (stmtUndoData), hash, data);
+  }
+
+  /**
+   * Copies the database as seen by our read transaction, which does not
+   * block the writer on the main connection.
+   */
+  bool
+  WriteCheckpoint (const std::string& file) const override
+  {
+    return WriteDatabaseCheckpoint (db, file);
+  }
+
+};
+
+std::unique_ptr<StorageSnapshot>
+SQLiteStorage::OpenSnapshot () const
+{
+  CHECK (db != nullptr);
+
+  if (!snapshots || IsInMemory (filename))
+    return nullptr;
+
+  return std::unique_ptr<StorageSnapshot> (new Snapshot (filename));
+}
+
+bool
+SQLiteStorage::WriteCheckpoint (const std::string& file) const
+{
+  CHECK (db != nullptr);
+  CHECK (!startedTransaction);
+
+  return WriteDatabaseCheckpoint (db, file);
+}
+
+void
+SQLiteStorage::RestoreCheckpoint (const std::string& file)
+{
+  CHECK (db != nullptr);
+  CHECK (!startedTransaction);
+
+  sqlite3* source = nullptr;
+  const int rc = sqlite3_open_v2 (file.c_str (), &source,
+                                  SQLITE_OPEN_READONLY, nullptr);
+  if (rc != SQLITE_OK)
+    LOG (FATAL) << "Failed to open checkpoint database: " << file;
+
+  LOG (INFO) << "Restoring database from checkpoint " << file;
+  CHECK (CopyDatabase (db, source))
+      << "Failed to restore database from checkpoint " << file;
+  CHECK_EQ (sqlite3_close (source), SQLITE_OK);
+}
+
 } // namespace xaya
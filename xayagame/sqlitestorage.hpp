@@ -26,12 +26,21 @@ namespace xaya
  * The storage implementation here uses tables with prefix "xayagame_".
  * Subclasses that wish to store custom other data must not use tables
  * with this prefix.
+ *
+ * Snapshots are only supported if explicitly enabled with EnableSnapshots
+ * for a database backed by a file.  This puts the database into WAL journal
+ * mode, so that snapshots (which are implemented as separate read-only
+ * connections with an open read transaction) can coexist with the writer.
+ * Note that WAL mode keeps extra -wal and -shm files next to the database,
+ * and does not work on network filesystems.
  */
 class SQLiteStorage : public StorageInterface
 {
 
 private:
 
+  class Snapshot;
+
   /**
    * The filename of the database.  This is needed for resetting the storage,
    * which removes the file and reopens the database.
@@ -54,6 +63,9 @@ private:
    */
   bool startedTransaction = false;
 
+  /** Whether or not snapshots (and thus WAL mode) are enabled.  */
+  bool snapshots = false;
+
   /**
    * Opens the database at filename into the handle.  It is an error if the
    * handle is already opened.
@@ -111,6 +123,13 @@ public:
 
   ~SQLiteStorage ();
 
+  /**
+   * Enables support for snapshots, which puts the database into WAL mode.
+   * This must be called before Initialise, and has no effect for temporary
+   * in-memory databases.
+   */
+  void EnableSnapshots ();
+
   void Initialise () override;
 
   /**
@@ -136,6 +155,20 @@ public:
   void CommitTransaction () override;
   void RollbackTransaction () override;
 
+  std::unique_ptr<StorageSnapshot> OpenSnapshot () const override;
+
+  /**
+   * Writes a checkpoint as copy of the full database (using SQLite's online
+   * backup API), so that it includes also the game's own tables.
+   */
+  bool WriteCheckpoint (const std::string& file) const override;
+
+  /**
+   * Restores a checkpoint by copying the database from the file back over
+   * the current one with the backup API.
+   */
+  void RestoreCheckpoint (const std::string& file) override;
+
 };
 
 } // namespace xaya
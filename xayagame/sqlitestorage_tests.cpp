@@ -38,6 +38,142 @@ INSTANTIATE_TYPED_TEST_CASE_P (SQLite, PruningStorageTests,
 INSTANTIATE_TYPED_TEST_CASE_P (SQLite, TransactingStorageTests,
                                InMemorySQLiteStorage);
 
+TEST (InMemorySQLiteStorageTests, NoSnapshots)
+{
+  InMemorySQLiteStorage storage;
+  storage.Initialise ();
+  EXPECT_EQ (storage.OpenSnapshot (), nullptr);
+}
+
+/**
+ * Removes a database file as well as its WAL files.
+ */
+void
+RemoveDatabaseFiles (const std::string& filename)
+{
+  std::remove (filename.c_str ());
+  std::remove ((filename + "-wal").c_str ());
+  std::remove ((filename + "-shm").c_str ());
+}
+
+/**
+ * Holder for the name of a temporary file, which is removed on destruction.
+ * This is used as first base class of TempFileSQLiteStorage, so that the
+ * file is only removed after the database has been closed.
+ */
+class TemporaryFileName
+{
+
+protected:
+
+  const std::string tempFile;
+
+  TemporaryFileName ()
+    : tempFile(std::tmpnam (nullptr))
+  {
+    LOG (INFO) << "Using temporary database file: " << tempFile;
+  }
+
+  ~TemporaryFileName ()
+  {
+    RemoveDatabaseFiles (tempFile);
+  }
+
+};
+
+/**
+ * SQLiteStorage that is default constructible with a temporary file on disk
+ * and has snapshots enabled (which is not possible with the in-memory
+ * database).
+ */
+class TempFileSQLiteStorage : private TemporaryFileName, public SQLiteStorage
+{
+
+public:
+
+  TempFileSQLiteStorage ()
+    : SQLiteStorage (tempFile)
+  {
+    EnableSnapshots ();
+  }
+
+  /**
+   * Returns the name of the database file.
+   */
+  const std::string&
+  GetFilename () const
+  {
+    return tempFile;
+  }
+
+};
+
+/**
+ * SQLiteStorage with a temporary file on disk but without snapshots.
+ */
+class NoSnapshotsSQLiteStorage : private TemporaryFileName,
+                                 public SQLiteStorage
+{
+
+public:
+
+  NoSnapshotsSQLiteStorage ()
+    : SQLiteStorage (tempFile)
+  {}
+
+  const std::string&
+  GetFilename () const
+  {
+    return tempFile;
+  }
+
+};
+
+/**
+ * Returns the journal mode of the given database file.
+ */
+std::string
+GetJournalMode (const std::string& filename)
+{
+  sqlite3* db;
+  CHECK_EQ (sqlite3_open (filename.c_str (), &db), SQLITE_OK);
+
+  sqlite3_stmt* stmt;
+  CHECK_EQ (sqlite3_prepare_v2 (db, "PRAGMA `journal_mode`", -1, &stmt,
+                                nullptr),
+            SQLITE_OK);
+  CHECK_EQ (sqlite3_step (stmt), SQLITE_ROW);
+  const std::string res
+      = reinterpret_cast<const char*> (sqlite3_column_text (stmt, 0));
+  sqlite3_finalize (stmt);
+  CHECK_EQ (sqlite3_close (db), SQLITE_OK);
+
+  return res;
+}
+
+TEST (SQLiteSnapshotsTests, DisabledByDefault)
+{
+  NoSnapshotsSQLiteStorage storage;
+  storage.Initialise ();
+  EXPECT_EQ (storage.OpenSnapshot (), nullptr);
+  EXPECT_EQ (GetJournalMode (storage.GetFilename ()), "delete");
+}
+
+TEST (SQLiteSnapshotsTests, EnabledUsesWal)
+{
+  TempFileSQLiteStorage storage;
+  storage.Initialise ();
+  EXPECT_NE (storage.OpenSnapshot (), nullptr);
+  EXPECT_EQ (GetJournalMode (storage.GetFilename ()), "wal");
+}
+
+INSTANTIATE_TYPED_TEST_CASE_P (SQLiteFile, BasicStorageTests,
+                               TempFileSQLiteStorage);
+INSTANTIATE_TYPED_TEST_CASE_P (SQLiteFile, TransactingStorageTests,
+                               TempFileSQLiteStorage);
+INSTANTIATE_TYPED_TEST_CASE_P (SQLiteFile, SnapshotStorageTests,
+                               TempFileSQLiteStorage);
+
 /**
  * Tests for SQLiteStorage with a temporary on-disk database file (instead of
  * just an in-memory database).  They verify explicitly that data is persisted
@@ -71,7 +207,7 @@ protected:
   ~PersistentSQLiteStorageTests ()
   {
     LOG (INFO) << "Cleaning up temporary file: " << filename;
-    std::remove (filename.c_str ());
+    RemoveDatabaseFiles (filename);
   }
 
 };
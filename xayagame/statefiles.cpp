@@ -0,0 +1,413 @@
+// Copyright (C) 2019 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "statefiles.hpp"
+
+#include "compression.hpp"
+#include "threadconfig.hpp"
+#include "uint256.hpp"
+
+#include <glog/logging.h>
+
+#include <experimental/filesystem>
+
+#include <algorithm>
+#include <fstream>
+#include <map>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+namespace xaya
+{
+namespace internal
+{
+
+namespace fs = std::experimental::filesystem;
+
+namespace
+{
+
+/** Extension of the plain JSON files.  */
+const std::string EXTENSION = ".json";
+
+/** Extension of the compressed files.  */
+const std::string COMPRESSED_EXTENSION = ".json.gz";
+
+/** Base name of the symlinks to the latest files.  */
+const std::string CURRENT = "current";
+
+/** Suffix of temporary files while they are written.  */
+const std::string TMP_SUFFIX = ".tmp";
+
+/**
+ * Checks if the file name is one of the state files and extracts
+ * the block hash from it if it is.
+ */
+bool
+ParseFileName (const std::string& name, std::string& hashHex)
+{
+  std::string base;
+  for (const auto& ext : {COMPRESSED_EXTENSION, EXTENSION})
+    if (name.size () > ext.size ()
+          && name.compare (name.size () - ext.size (), ext.size (), ext) == 0)
+      {
+        base = name.substr (0, name.size () - ext.size ());
+        break;
+      }
+
+  uint256 hash;
+  if (base.size () != 2 * uint256::NUM_BYTES || !hash.FromHex (base))
+    return false;
+
+  hashHex = hash.ToHex ();
+  return hashHex == base;
+}
+
+} // anonymous namespace
+
+StateFileWriter::StateFileWriter (const std::string& dir, const std::string& id,
+                                  const unsigned k, const bool c)
+  : directory(dir), gameId(id), keep(k), compress(c)
+{
+  CHECK_GT (keep, 0);
+
+  if (!fs::is_directory (directory))
+    {
+      LOG (INFO) << "Creating state-file directory: " << directory;
+      CHECK (fs::create_directories (directory));
+    }
+
+  /* Collect files from a previous run, so that they get cleaned up
+     eventually as well.  They are ordered by their modification time.
+     Temporary files (and symlinks) left over by an interrupted write are
+     removed right away.  */
+  std::map<std::string, fs::file_time_type> existing;
+  std::vector<fs::path> stale;
+  for (const auto& entry : fs::directory_iterator (directory))
+    {
+      const std::string name = entry.path ().filename ().string ();
+      if (name.size () > TMP_SUFFIX.size ()
+            && name.compare (name.size () - TMP_SUFFIX.size (),
+                             TMP_SUFFIX.size (), TMP_SUFFIX) == 0
+            && !fs::is_directory (entry.symlink_status ()))
+        {
+          stale.push_back (entry.path ());
+          continue;
+        }
+
+      if (!fs::is_regular_file (entry.status ()))
+        continue;
+
+      std::string hashHex;
+      if (!ParseFileName (name, hashHex))
+        continue;
+
+      const auto time = fs::last_write_time (entry.path ());
+      auto mit = existing.find (hashHex);
+      if (mit == existing.end ())
+        existing.emplace (hashHex, time);
+      else
+        mit->second = std::max (mit->second, time);
+    }
+
+  for (const auto& path : stale)
+    {
+      LOG (INFO) << "Removing stale temporary file " << path.string ();
+      std::error_code ec;
+      if (!fs::remove (path, ec) && ec)
+        LOG (WARNING)
+            << "Failed to remove " << path.string () << ": " << ec.message ();
+    }
+
+  /* Without compression, a symlink left from an earlier run would
+     eventually dangle.  Otherwise we need to know where the symlinks point
+     to, so that those files are not removed.  */
+  if (!compress)
+    {
+      std::error_code ec;
+      fs::remove (fs::path (directory) / (CURRENT + COMPRESSED_EXTENSION), ec);
+    }
+  for (const auto& ext : {EXTENSION, COMPRESSED_EXTENSION})
+    {
+      std::error_code ec;
+      const fs::path target
+          = fs::read_symlink (fs::path (directory) / (CURRENT + ext), ec);
+      std::string hashHex;
+      if (!ec && ParseFileName (target.filename ().string (), hashHex))
+        linked[CURRENT + ext] = hashHex;
+    }
+
+  std::vector<std::pair<fs::file_time_type, std::string>> sorted;
+  for (const auto& e : existing)
+    sorted.emplace_back (e.second, e.first);
+  std::sort (sorted.begin (), sorted.end ());
+  for (const auto& e : sorted)
+    written.push_back (e.second);
+
+  if (!written.empty ())
+    LOG (INFO)
+        << "Found state files for " << written.size ()
+        << " blocks in " << directory;
+  CollectGarbage ();
+
+  worker = std::thread ([this] ()
+    {
+      WorkerLoop ();
+    });
+}
+
+StateFileWriter::~StateFileWriter ()
+{
+  {
+    std::lock_guard<std::mutex> lock(mut);
+    shutdown = true;
+    pending.reset ();
+  }
+  cvJob.notify_all ();
+
+  worker.join ();
+}
+
+void
+StateFileWriter::Schedule (const unsigned height,
+                           std::shared_ptr<const RenderedState> rendered)
+{
+  CHECK (rendered != nullptr);
+
+  auto job = std::make_unique<Job> ();
+  job->height = height;
+  job->rendered = std::move (rendered);
+
+  {
+    std::lock_guard<std::mutex> lock(mut);
+    if (pending != nullptr)
+      ++numSkipped;
+    pending = std::move (job);
+  }
+
+  cvJob.notify_all ();
+}
+
+void
+StateFileWriter::WaitForIdle () const
+{
+  std::unique_lock<std::mutex> lock(mut);
+  cvIdle.wait (lock, [this] ()
+    {
+      return pending == nullptr && !running;
+    });
+}
+
+void
+StateFileWriter::WorkerLoop ()
+{
+  SetCurrentThreadName ("xaya-statefiles");
+
+  std::unique_lock<std::mutex> lock(mut);
+  while (true)
+    {
+      cvJob.wait (lock, [this] ()
+        {
+          return shutdown || pending != nullptr;
+        });
+      if (shutdown)
+        break;
+
+      std::unique_ptr<Job> job = std::move (pending);
+      running = true;
+
+      lock.unlock ();
+      const bool ok = WriteFiles (*job);
+      lock.lock ();
+
+      if (ok)
+        {
+          ++numWritten;
+          latestHash = job->rendered->GetBlockHash ().ToHex ();
+        }
+      else
+        ++numFailed;
+      running = false;
+      cvIdle.notify_all ();
+    }
+}
+
+bool
+StateFileWriter::WriteFiles (const Job& job)
+{
+  const std::string hashHex = job.rendered->GetBlockHash ().ToHex ();
+  VLOG (1)
+      << "Writing state files for block " << hashHex
+      << " at height " << job.height;
+
+  /* The metadata is serialised as JSON object on its own, and the already
+     rendered state text is then spliced into it.  This avoids copying and
+     re-serialising the potentially large state.  */
+  Json::Value meta(Json::objectValue);
+  meta["gameid"] = gameId;
+  meta["blockhash"] = hashHex;
+  meta["height"] = job.height;
+
+  Json::StreamWriterBuilder wbuilder;
+  wbuilder["indentation"] = "";
+  std::string text = Json::writeString (wbuilder, meta);
+  CHECK (!text.empty () && text.back () == '}');
+  text.pop_back ();
+  text += ",\"gamestate\":";
+  text += job.rendered->GetText ();
+  text += "}";
+
+  /* If writing any of the files fails (e.g. because the disk is full), we
+     skip this block and leave the symlinks pointing to the previous one.
+     The files are still recorded, so that partial results get removed
+     by the garbage collection later on.  The garbage collection keeps
+     the files the symlinks point to, even if those are older.  */
+  bool ok = WriteAtomically (hashHex + EXTENSION, text);
+  if (ok && compress)
+    ok = WriteAtomically (hashHex + COMPRESSED_EXTENSION,
+                          CompressData (text, ContentEncoding::GZIP));
+
+  for (const auto& ext : {EXTENSION, COMPRESSED_EXTENSION})
+    {
+      if (!ok || (ext == COMPRESSED_EXTENSION && !compress))
+        break;
+      ok = UpdateSymlink (CURRENT + ext, hashHex + ext);
+      if (ok)
+        linked[CURRENT + ext] = hashHex;
+    }
+
+  /* A block may be written again after a reorg back to it, in which case
+     it is moved to the end of the list.  */
+  const auto it = std::find (written.begin (), written.end (), hashHex);
+  if (it != written.end ())
+    written.erase (it);
+  written.push_back (hashHex);
+
+  CollectGarbage ();
+
+  if (!ok)
+    LOG (WARNING) << "Failed to write state files for block " << hashHex;
+  return ok;
+}
+
+bool
+StateFileWriter::WriteAtomically (const std::string& name,
+                                  const std::string& data) const
+{
+  const fs::path file = fs::path (directory) / name;
+  const fs::path tmpFile = fs::path (file.string () + TMP_SUFFIX);
+
+  {
+    std::ofstream out(tmpFile.string (), std::ios::binary | std::ios::trunc);
+    if (!out)
+      {
+        LOG (WARNING) << "Failed to open " << tmpFile.string ();
+        return false;
+      }
+    out.write (data.data (), data.size ());
+    out.close ();
+    if (!out)
+      {
+        LOG (WARNING) << "Failed to write " << tmpFile.string ();
+        std::error_code ec;
+        fs::remove (tmpFile, ec);
+        return false;
+      }
+  }
+
+  std::error_code ec;
+  fs::rename (tmpFile, file, ec);
+  if (ec)
+    {
+      LOG (WARNING)
+          << "Failed to rename " << tmpFile.string () << ": " << ec.message ();
+      fs::remove (tmpFile, ec);
+      return false;
+    }
+
+  return true;
+}
+
+bool
+StateFileWriter::UpdateSymlink (const std::string& name,
+                                const std::string& target) const
+{
+  /* The target is relative, so that the directory can be moved or
+     mounted elsewhere (e.g. into a web server's container).  */
+  const fs::path link = fs::path (directory) / name;
+  const fs::path tmpLink = fs::path (link.string () + TMP_SUFFIX);
+
+  std::error_code ec;
+  fs::remove (tmpLink, ec);
+  fs::create_symlink (target, tmpLink, ec);
+  if (!ec)
+    fs::rename (tmpLink, link, ec);
+
+  if (ec)
+    {
+      LOG (WARNING)
+          << "Failed to update symlink " << link.string ()
+          << ": " << ec.message ();
+      fs::remove (tmpLink, ec);
+      return false;
+    }
+
+  return true;
+}
+
+bool
+StateFileWriter::IsLinked (const std::string& hashHex) const
+{
+  for (const auto& entry : linked)
+    if (entry.second == hashHex)
+      return true;
+  return false;
+}
+
+void
+StateFileWriter::CollectGarbage ()
+{
+  while (written.size () > keep)
+    {
+      auto it = written.begin ();
+      while (it != written.end () && IsLinked (*it))
+        ++it;
+      if (it == written.end ())
+        break;
+
+      const std::string hashHex = std::move (*it);
+      written.erase (it);
+
+      VLOG (1) << "Removing state files for block " << hashHex;
+      const fs::path base = fs::path (directory) / hashHex;
+      for (const auto& ext : {EXTENSION, COMPRESSED_EXTENSION})
+        {
+          std::error_code ec;
+          if (!fs::remove (base.string () + ext, ec) && ec)
+            LOG (WARNING)
+                << "Failed to remove state file " << base.string () << ext
+                << ": " << ec.message ();
+        }
+    }
+}
+
+Json::Value
+StateFileWriter::GetStats () const
+{
+  std::lock_guard<std::mutex> lock(mut);
+
+  Json::Value res(Json::objectValue);
+  res["written"] = static_cast<Json::UInt64> (numWritten);
+  res["skipped"] = static_cast<Json::UInt64> (numSkipped);
+  res["failed"] = static_cast<Json::UInt64> (numFailed);
+  res["running"] = running;
+  if (!latestHash.empty ())
+    res["blockhash"] = latestHash;
+
+  return res;
+}
+
+} // namespace internal
+} // namespace xaya
@@ -0,0 +1,197 @@
+// Copyright (C) 2019 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef XAYAGAME_STATEFILES_HPP
+#define XAYAGAME_STATEFILES_HPP
+
+/* This file is an implementation detail of Game and should not be
+   used directly by external code!  */
+
+#include "renderedstate.hpp"
+
+#include <json/json.h>
+
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace xaya
+{
+namespace internal
+{
+
+/**
+ * Writer for per-block state files, which allows serving the game state
+ * with a plain static HTTP server (or CDN) instead of through JSON-RPC.
+ *
+ * For each block passed to Schedule, the rendered state (together with the
+ * game ID, block hash and height) is written to a file named by the block
+ * hash, e.g. "<hash>.json", and optionally also a gzip-compressed variant
+ * "<hash>.json.gz".  Files are written to a temporary name first and renamed
+ * when complete, and afterwards the "current.json" (and "current.json.gz")
+ * symlinks are atomically swapped to point to them.  Readers thus never see
+ * partially written files.  Only the files for the newest few blocks are
+ * kept, older ones are deleted.  Errors while writing (e.g. a full disk)
+ * are logged and counted, and the affected block is skipped.  The files
+ * the symlinks point to are never deleted, even if they are older than
+ * that (because writing the newer blocks failed).
+ *
+ * Writing is done on a background thread.  If a new block is scheduled
+ * while the previous one is still waiting, the waiting one is dropped.
+ *
+ * The class is thread-safe.
+ */
+class StateFileWriter
+{
+
+private:
+
+  /**
+   * A block for which files should be written.
+   */
+  struct Job
+  {
+    unsigned height;
+    std::shared_ptr<const RenderedState> rendered;
+  };
+
+  /** The directory in which files are written.  */
+  const std::string directory;
+
+  /** The game ID, which is included in the files.  */
+  const std::string gameId;
+
+  /** Number of blocks for which files are kept.  */
+  const unsigned keep;
+
+  /** Whether or not compressed files are written as well.  */
+  const bool compress;
+
+  /** Lock for the data here.  */
+  mutable std::mutex mut;
+
+  /** Signalled when a new job is scheduled or we shut down.  */
+  std::condition_variable cvJob;
+
+  /** Signalled when the worker has finished a job.  */
+  mutable std::condition_variable cvIdle;
+
+  /** The next job to run, if any.  */
+  std::unique_ptr<Job> pending;
+
+  /** Whether or not the worker is currently processing a job.  */
+  bool running = false;
+
+  /** Set when the worker should shut down.  */
+  bool shutdown = false;
+
+  /**
+   * Block hashes (as hex) for which files exist, from oldest to newest.
+   * This is only accessed by the worker thread (and the constructor).
+   */
+  std::deque<std::string> written;
+
+  /**
+   * For each of the "current" symlinks (by file name), the block hash
+   * (as hex) it points to.  The files of these blocks are kept by the
+   * garbage collection.  This is only accessed by the worker thread
+   * (and the constructor).
+   */
+  std::map<std::string, std::string> linked;
+
+  /** The hash of the latest block written, as hex.  */
+  std::string latestHash;
+
+  /** Number of blocks for which files were written.  */
+  unsigned long numWritten = 0;
+
+  /** Number of scheduled blocks that were superseded before writing.  */
+  unsigned long numSkipped = 0;
+
+  /** Number of blocks for which writing the files failed.  */
+  unsigned long numFailed = 0;
+
+  /** The worker thread.  */
+  std::thread worker;
+
+  /**
+   * Main function of the worker thread.
+   */
+  void WorkerLoop ();
+
+  /**
+   * Writes all files for the given job and updates the symlinks.  Returns
+   * false (after logging the error) if that failed.
+   */
+  bool WriteFiles (const Job& job);
+
+  /**
+   * Writes a file atomically (through a temporary file that is renamed).
+   * Returns false if that failed.
+   */
+  bool WriteAtomically (const std::string& name,
+                        const std::string& data) const;
+
+  /**
+   * Points the symlink with the given name atomically to a new target.
+   * Returns false if that failed.
+   */
+  bool UpdateSymlink (const std::string& name,
+                      const std::string& target) const;
+
+  /**
+   * Returns true if one of the symlinks points to the given block.
+   */
+  bool IsLinked (const std::string& hashHex) const;
+
+  /**
+   * Removes the files of old blocks exceeding the number to keep, except
+   * for those the symlinks point to.
+   */
+  void CollectGarbage ();
+
+public:
+
+  /**
+   * Constructs the writer and starts its thread.  The directory is created
+   * if it does not exist yet.  State files left over in it (e.g. from
+   * a previous run) are taken into account for garbage collection.
+   */
+  explicit StateFileWriter (const std::string& dir, const std::string& id,
+                            unsigned k, bool c);
+
+  ~StateFileWriter ();
+
+  StateFileWriter () = delete;
+  StateFileWriter (const StateFileWriter&) = delete;
+  void operator= (const StateFileWriter&) = delete;
+
+  /**
+   * Schedules writing the files for the given rendered state at
+   * the given height.
+   */
+  void Schedule (unsigned height,
+                 std::shared_ptr<const RenderedState> rendered);
+
+  /**
+   * Blocks until no job is pending or running anymore.  This is mainly
+   * useful for tests.
+   */
+  void WaitForIdle () const;
+
+  /**
+   * Returns statistics about the writer as JSON object.
+   */
+  Json::Value GetStats () const;
+
+};
+
+} // namespace internal
+} // namespace xaya
+
+#endif // XAYAGAME_STATEFILES_HPP
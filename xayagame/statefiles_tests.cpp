@@ -0,0 +1,276 @@
+// Copyright (C) 2019 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "statefiles.hpp"
+
+#include "compression.hpp"
+#include "testutils.hpp"
+
+#include <gtest/gtest.h>
+
+#include <glog/logging.h>
+
+#include <experimental/filesystem>
+
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <string>
+
+namespace xaya
+{
+namespace internal
+{
+namespace
+{
+
+namespace fs = std::experimental::filesystem;
+
+Json::Value
+ParseJson (const std::string& str)
+{
+  Json::Value val;
+  std::istringstream in(str);
+  in >> val;
+  return val;
+}
+
+class StateFileWriterTests : public testing::Test
+{
+
+protected:
+
+  /** Temporary directory for the state files.  */
+  const std::string directory;
+
+  StateFileWriterTests ()
+    : directory(std::tmpnam (nullptr))
+  {
+    LOG (INFO) << "Temporary state-file directory: " << directory;
+  }
+
+  ~StateFileWriterTests ()
+  {
+    fs::remove_all (directory);
+  }
+
+  /**
+   * Schedules the state for the given height (with the block hash
+   * derived from it) and waits for the files to be written.
+   */
+  static void
+  WriteState (StateFileWriter& writer, const unsigned height,
+              const std::string& value)
+  {
+    Json::Value state(Json::objectValue);
+    state["value"] = value;
+    writer.Schedule (height, std::make_shared<const RenderedState> (
+                                 BlockHash (height), std::move (state)));
+    writer.WaitForIdle ();
+  }
+
+  /**
+   * Returns the path of a file in the directory.
+   */
+  fs::path
+  GetPath (const std::string& name) const
+  {
+    return fs::path (directory) / name;
+  }
+
+  /**
+   * Reads the given file's raw content.
+   */
+  std::string
+  ReadFile (const std::string& name) const
+  {
+    std::ifstream in(GetPath (name).string (), std::ios::binary);
+    CHECK (in) << "Failed to open " << name;
+    std::ostringstream out;
+    out << in.rdbuf ();
+    return out.str ();
+  }
+
+  /**
+   * Reads and parses the given file as JSON.
+   */
+  Json::Value
+  ReadJsonFile (const std::string& name) const
+  {
+    return ParseJson (ReadFile (name));
+  }
+
+  /**
+   * Returns the file name of the state file for the given height.
+   */
+  static std::string
+  FileName (const unsigned height, const std::string& ext = ".json")
+  {
+    return BlockHash (height).ToHex () + ext;
+  }
+
+};
+
+TEST_F (StateFileWriterTests, WritesStateAndSymlink)
+{
+  StateFileWriter writer(directory, "game", 3, false);
+  WriteState (writer, 10, "foo");
+
+  const Json::Value data = ReadJsonFile (FileName (10));
+  EXPECT_EQ (data, ParseJson (R"({
+    "gameid": "game",
+    "blockhash": ")" + BlockHash (10).ToHex () + R"(",
+    "height": 10,
+    "gamestate": {"value": "foo"}
+  })"));
+
+  EXPECT_TRUE (fs::is_symlink (fs::symlink_status (GetPath ("current.json"))));
+  EXPECT_EQ (fs::read_symlink (GetPath ("current.json")), FileName (10));
+  EXPECT_EQ (ReadJsonFile ("current.json"), data);
+
+  EXPECT_FALSE (fs::exists (GetPath (FileName (10, ".json.gz"))));
+  EXPECT_FALSE (fs::exists (GetPath ("current.json.gz")));
+
+  const Json::Value stats = writer.GetStats ();
+  EXPECT_EQ (stats["written"].asUInt64 (), 1);
+  EXPECT_EQ (stats["blockhash"].asString (), BlockHash (10).ToHex ());
+}
+
+TEST_F (StateFileWriterTests, Compressed)
+{
+  StateFileWriter writer(directory, "game", 3, true);
+  WriteState (writer, 10, "foo");
+
+  std::string uncompressed;
+  ASSERT_TRUE (DecompressData (ReadFile ("current.json.gz"),
+                               ContentEncoding::GZIP, uncompressed));
+  EXPECT_EQ (uncompressed, ReadFile (FileName (10)));
+  EXPECT_EQ (fs::read_symlink (GetPath ("current.json.gz")),
+             FileName (10, ".json.gz"));
+}
+
+TEST_F (StateFileWriterTests, GarbageCollection)
+{
+  StateFileWriter writer(directory, "game", 2, true);
+  for (unsigned h = 1; h <= 4; ++h)
+    WriteState (writer, h, "foo");
+
+  for (const unsigned h : {1, 2})
+    {
+      EXPECT_FALSE (fs::exists (GetPath (FileName (h))));
+      EXPECT_FALSE (fs::exists (GetPath (FileName (h, ".json.gz"))));
+    }
+  for (const unsigned h : {3, 4})
+    {
+      EXPECT_TRUE (fs::exists (GetPath (FileName (h))));
+      EXPECT_TRUE (fs::exists (GetPath (FileName (h, ".json.gz"))));
+    }
+
+  /* Writing block 3 again (e.g. after a reorg) makes it the newest, so that
+     the next block removes 4 instead.  */
+  WriteState (writer, 3, "bar");
+  WriteState (writer, 5, "foo");
+  EXPECT_TRUE (fs::exists (GetPath (FileName (3))));
+  EXPECT_FALSE (fs::exists (GetPath (FileName (4))));
+  EXPECT_TRUE (fs::exists (GetPath (FileName (5))));
+  EXPECT_EQ (ReadJsonFile (FileName (3))["gamestate"]["value"], "bar");
+}
+
+TEST_F (StateFileWriterTests, ExistingFilesCollected)
+{
+  {
+    StateFileWriter writer(directory, "game", 5, true);
+    for (unsigned h = 1; h <= 3; ++h)
+      WriteState (writer, h, "foo");
+  }
+
+  /* Unrelated files must be left alone.  */
+  std::ofstream (GetPath ("other.json").string ()) << "{}";
+
+  {
+    StateFileWriter writer(directory, "game", 2, false);
+    EXPECT_FALSE (fs::exists (GetPath (FileName (1))));
+    EXPECT_FALSE (fs::exists (GetPath ("current.json.gz")));
+    EXPECT_TRUE (fs::exists (GetPath ("other.json")));
+
+    WriteState (writer, 4, "foo");
+    EXPECT_FALSE (fs::exists (GetPath (FileName (2))));
+    EXPECT_TRUE (fs::exists (GetPath (FileName (3))));
+    EXPECT_TRUE (fs::exists (GetPath (FileName (4))));
+    EXPECT_EQ (fs::read_symlink (GetPath ("current.json")), FileName (4));
+  }
+}
+
+TEST_F (StateFileWriterTests, WriteFailureSkipsBlock)
+{
+  StateFileWriter writer(directory, "game", 3, false);
+  WriteState (writer, 1, "foo");
+
+  /* A directory in place of the temporary file makes the write fail.  */
+  fs::create_directory (GetPath (FileName (2) + ".tmp"));
+  WriteState (writer, 2, "bar");
+
+  EXPECT_FALSE (fs::exists (GetPath (FileName (2))));
+  EXPECT_EQ (fs::read_symlink (GetPath ("current.json")), FileName (1));
+
+  Json::Value stats = writer.GetStats ();
+  EXPECT_EQ (stats["written"].asUInt64 (), 1);
+  EXPECT_EQ (stats["failed"].asUInt64 (), 1);
+  EXPECT_EQ (stats["blockhash"].asString (), BlockHash (1).ToHex ());
+
+  /* The writer keeps working for the next block.  */
+  WriteState (writer, 3, "baz");
+  EXPECT_EQ (fs::read_symlink (GetPath ("current.json")), FileName (3));
+  stats = writer.GetStats ();
+  EXPECT_EQ (stats["written"].asUInt64 (), 2);
+  EXPECT_EQ (stats["failed"].asUInt64 (), 1);
+}
+
+TEST_F (StateFileWriterTests, LinkedFileKept)
+{
+  StateFileWriter writer(directory, "game", 1, true);
+  WriteState (writer, 1, "foo");
+
+  /* Block 2 fails to write, so that the symlinks keep pointing to block 1.
+     Its files must not be removed, even though only one block is kept.  */
+  fs::create_directory (GetPath (FileName (2, ".json.gz") + ".tmp"));
+  WriteState (writer, 2, "bar");
+
+  EXPECT_EQ (writer.GetStats ()["failed"].asUInt64 (), 1);
+  EXPECT_EQ (fs::read_symlink (GetPath ("current.json")), FileName (1));
+  EXPECT_EQ (ReadJsonFile ("current.json")["gamestate"]["value"], "foo");
+  EXPECT_TRUE (fs::exists (GetPath ("current.json.gz")));
+  EXPECT_FALSE (fs::exists (GetPath (FileName (2))));
+
+  /* The same holds when restarting with the files present.  */
+  {
+    StateFileWriter other(directory, "game", 1, true);
+    EXPECT_TRUE (fs::exists (GetPath (FileName (1))));
+    EXPECT_TRUE (fs::exists (GetPath (FileName (1, ".json.gz"))));
+  }
+
+  /* Once a newer block is linked, the old files are removed.  */
+  WriteState (writer, 3, "baz");
+  EXPECT_EQ (fs::read_symlink (GetPath ("current.json")), FileName (3));
+  EXPECT_FALSE (fs::exists (GetPath (FileName (1))));
+  EXPECT_FALSE (fs::exists (GetPath (FileName (1, ".json.gz"))));
+  EXPECT_TRUE (fs::exists (GetPath (FileName (3, ".json.gz"))));
+}
+
+TEST_F (StateFileWriterTests, StaleTemporaryFilesRemoved)
+{
+  fs::create_directories (directory);
+  std::ofstream (GetPath (FileName (1) + ".tmp").string ()) << "partial";
+  fs::create_symlink (FileName (1), GetPath ("current.json.tmp"));
+
+  StateFileWriter writer(directory, "game", 3, false);
+  EXPECT_FALSE (fs::exists (GetPath (FileName (1) + ".tmp")));
+  EXPECT_FALSE (fs::is_symlink (fs::symlink_status (
+                    GetPath ("current.json.tmp"))));
+}
+
+} // anonymous namespace
+} // namespace internal
+} // namespace xaya
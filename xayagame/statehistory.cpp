@@ -0,0 +1,363 @@
+// Copyright (C) 2019 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "statehistory.hpp"
+
+#include <glog/logging.h>
+
+#include <vector>
+
+namespace xaya
+{
+namespace internal
+{
+
+StateHistory::StateHistory (const unsigned n, const unsigned keyframe,
+                            const unsigned cache)
+  : nBlocks(n), keyframeInterval(keyframe), cacheSize(cache)
+{}
+
+bool
+StateHistory::IsKeyframe (const unsigned height) const
+{
+  return keyframeInterval > 0 && height % keyframeInterval == 0;
+}
+
+void
+StateHistory::AddStateRef (const StatePtr& state)
+{
+  if (state == nullptr)
+    return;
+
+  if (stateRefs[state.get ()]++ == 0)
+    memoryUsage += state->size ();
+}
+
+void
+StateHistory::ReleaseStateRef (const StatePtr& state)
+{
+  if (state == nullptr)
+    return;
+
+  const auto mit = stateRefs.find (state.get ());
+  CHECK (mit != stateRefs.end ());
+  CHECK_GT (mit->second, 0);
+  if (--mit->second == 0)
+    {
+      CHECK_GE (memoryUsage, state->size ());
+      memoryUsage -= state->size ();
+      stateRefs.erase (mit);
+    }
+}
+
+void
+StateHistory::SetEntryState (Entry& entry, StatePtr state)
+{
+  AddStateRef (state);
+  ReleaseStateRef (entry.state);
+  entry.state = std::move (state);
+}
+
+void
+StateHistory::PushEntry (std::shared_ptr<Entry> entry)
+{
+  memoryUsage += entry->bytes;
+  AddStateRef (entry->state);
+  entries.push_back (std::move (entry));
+}
+
+void
+StateHistory::PopEntry (const bool front)
+{
+  CHECK (!entries.empty ());
+  auto& entry = front ? entries.front () : entries.back ();
+
+  CHECK_GE (memoryUsage, entry->bytes);
+  memoryUsage -= entry->bytes;
+  SetEntryState (*entry, nullptr);
+
+  if (front)
+    entries.pop_front ();
+  else
+    entries.pop_back ();
+}
+
+void
+StateHistory::ClearEntries ()
+{
+  while (!entries.empty ())
+    PopEntry (false);
+}
+
+void
+StateHistory::EvictCached ()
+{
+  CHECK (!lru.empty ());
+  CHECK_GE (memoryUsage, sizeof (CachedState));
+  memoryUsage -= sizeof (CachedState);
+  ReleaseStateRef (lru.back ().state);
+
+  lruIndex.erase (lru.back ().hash);
+  lru.pop_back ();
+}
+
+void
+StateHistory::TrimWindow ()
+{
+  while (entries.size () > nBlocks)
+    PopEntry (true);
+}
+
+StateHistory::StatePtr
+StateHistory::LookupCache (const uint256& hash)
+{
+  const auto mit = lruIndex.find (hash);
+  if (mit == lruIndex.end ())
+    return nullptr;
+
+  lru.splice (lru.begin (), lru, mit->second);
+  return mit->second->state;
+}
+
+void
+StateHistory::InsertCache (const uint256& hash, const unsigned height,
+                           StatePtr state)
+{
+  if (cacheSize == 0 || lruIndex.count (hash) > 0)
+    return;
+
+  memoryUsage += sizeof (CachedState);
+  AddStateRef (state);
+  lru.push_front (CachedState {hash, height, std::move (state)});
+  lruIndex.emplace (hash, lru.begin ());
+
+  while (lru.size () > cacheSize)
+    EvictCached ();
+}
+
+void
+StateHistory::SetLimits (const unsigned n, const unsigned keyframe,
+                         const unsigned cache)
+{
+  std::lock_guard<std::mutex> lock(mut);
+
+  nBlocks = n;
+  cacheSize = cache;
+  TrimWindow ();
+  while (lru.size () > cacheSize)
+    EvictCached ();
+
+  /* Keyframes for blocks already in the window stay as they are.  If the
+     interval has been changed, some older states will be missing or
+     superfluous until those blocks drop out of the window.  */
+  keyframeInterval = keyframe;
+}
+
+void
+StateHistory::GetLimits (unsigned& n, unsigned& keyframe,
+                         unsigned& cache) const
+{
+  std::lock_guard<std::mutex> lock(mut);
+
+  n = nBlocks;
+  keyframe = keyframeInterval;
+  cache = cacheSize;
+}
+
+void
+StateHistory::AttachBlock (const uint256& parent, const uint256& hash,
+                           const unsigned height, const Json::Value& blockData,
+                           const UndoData& undo, GameStateData&& newState)
+{
+  auto entry = std::make_shared<Entry> ();
+  entry->hash = hash;
+  entry->height = height;
+  entry->blockData = blockData;
+  entry->undo = undo;
+  entry->bytes = sizeof (Entry) + EstimateJsonMemory (blockData) + undo.size ();
+  entry->state = std::make_shared<const GameStateData> (std::move (newState));
+
+  std::lock_guard<std::mutex> lock(mut);
+
+  if (!entries.empty ())
+    {
+      auto& tip = *entries.back ();
+      if (tip.hash != parent || tip.height + 1 != height)
+        {
+          VLOG (1)
+              << "Attached block " << hash.ToHex ()
+              << " does not extend the state history, resetting it";
+          ClearEntries ();
+        }
+      else if (!IsKeyframe (tip.height))
+        SetEntryState (tip, nullptr);
+    }
+
+  PushEntry (std::move (entry));
+  TrimWindow ();
+}
+
+void
+StateHistory::DetachBlock (const uint256& hash, GameStateData&& parentState)
+{
+  std::lock_guard<std::mutex> lock(mut);
+
+  if (entries.empty () || entries.back ()->hash != hash)
+    {
+      VLOG (1)
+          << "Detached block " << hash.ToHex ()
+          << " is not the tip of the state history, resetting it";
+      ClearEntries ();
+      return;
+    }
+
+  PopEntry (false);
+  if (entries.empty () || entries.back ()->state != nullptr)
+    return;
+
+  /* If the parent's state is in the cache of reconstructed states, share
+     that instead of keeping a second copy.  */
+  auto& parent = *entries.back ();
+  StatePtr state = LookupCache (parent.hash);
+  if (state == nullptr)
+    state = std::make_shared<const GameStateData> (std::move (parentState));
+  SetEntryState (parent, std::move (state));
+}
+
+void
+StateHistory::Clear ()
+{
+  std::lock_guard<std::mutex> lock(mut);
+  ClearEntries ();
+}
+
+size_t
+StateHistory::GetMemoryUsage () const
+{
+  std::lock_guard<std::mutex> lock(mut);
+  return memoryUsage;
+}
+
+void
+StateHistory::ShrinkMemory (const size_t target)
+{
+  std::lock_guard<std::mutex> lock(mut);
+
+  while (!lru.empty () && memoryUsage > target)
+    EvictCached ();
+
+  while (entries.size () > 1 && memoryUsage > target)
+    PopEntry (true);
+}
+
+bool
+StateHistory::GetTip (uint256& hash) const
+{
+  std::lock_guard<std::mutex> lock(mut);
+
+  if (entries.empty ())
+    return false;
+
+  hash = entries.back ()->hash;
+  return true;
+}
+
+StateHistory::StatePtr
+StateHistory::Reconstruct (std::unique_lock<std::mutex>& lock,
+                           const size_t index, const UndoFunction& undoFcn)
+{
+  CHECK_LT (index, entries.size ());
+
+  /* Find the closest newer block (or the block itself) for which we know
+     the full state, and collect the blocks that need to be undone
+     starting from it.  The tip always has a state, so this terminates.  */
+  StatePtr start;
+  std::vector<std::shared_ptr<const Entry>> toUndo;
+  for (size_t j = index; ; ++j)
+    {
+      const auto& entry = entries[j];
+
+      start = LookupCache (entry->hash);
+      if (start == nullptr)
+        start = entry->state;
+      if (start != nullptr)
+        break;
+
+      CHECK_LT (j + 1, entries.size ()) << "State history tip has no state";
+      toUndo.push_back (entries[j + 1]);
+    }
+
+  if (toUndo.empty ())
+    return start;
+
+  const uint256 targetHash = entries[index]->hash;
+  const unsigned targetHeight = entries[index]->height;
+
+  /* The actual replay is done without holding the lock.  The entries are
+     kept alive through the shared pointers, and their data used here is
+     immutable.  We need to undo the blocks from newest to oldest.  */
+  lock.unlock ();
+  VLOG (1)
+      << "Reconstructing state at height " << targetHeight
+      << " by undoing " << toUndo.size () << " blocks";
+  GameStateData state = *start;
+  for (auto it = toUndo.rbegin (); it != toUndo.rend (); ++it)
+    state = undoFcn (state, (*it)->blockData, (*it)->undo);
+  auto result = std::make_shared<const GameStateData> (std::move (state));
+  lock.lock ();
+
+  InsertCache (targetHash, targetHeight, result);
+  return result;
+}
+
+bool
+StateHistory::GetStateAtBlock (const uint256& hash,
+                               const UndoFunction& undoFcn,
+                               GameStateData& state, unsigned& height)
+{
+  std::unique_lock<std::mutex> lock(mut);
+
+  const auto mit = lruIndex.find (hash);
+  if (mit != lruIndex.end ())
+    {
+      height = mit->second->height;
+      state = *LookupCache (hash);
+      return true;
+    }
+
+  for (size_t i = 0; i < entries.size (); ++i)
+    if (entries[i]->hash == hash)
+      {
+        height = entries[i]->height;
+        state = *Reconstruct (lock, i, undoFcn);
+        return true;
+      }
+
+  return false;
+}
+
+bool
+StateHistory::GetStateAtHeight (const unsigned height,
+                                const UndoFunction& undoFcn,
+                                GameStateData& state, uint256& hash)
+{
+  std::unique_lock<std::mutex> lock(mut);
+
+  if (entries.empty ())
+    return false;
+
+  const unsigned first = entries.front ()->height;
+  if (height < first || height > entries.back ()->height)
+    return false;
+
+  const size_t index = height - first;
+  CHECK_EQ (entries[index]->height, height);
+  hash = entries[index]->hash;
+  state = *Reconstruct (lock, index, undoFcn);
+
+  return true;
+}
+
+} // namespace internal
+} // namespace xaya
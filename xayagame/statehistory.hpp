@@ -0,0 +1,296 @@
+// Copyright (C) 2019 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef XAYAGAME_STATEHISTORY_HPP
+#define XAYAGAME_STATEHISTORY_HPP
+
+/* This file is an implementation detail of Game and should not be
+   used directly by external code!  */
+
+#include "memorybudget.hpp"
+#include "storage.hpp"
+#include "uint256.hpp"
+
+#include <json/json.h>
+
+#include <deque>
+#include <functional>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <utility>
+
+namespace xaya
+{
+namespace internal
+{
+
+/**
+ * In-memory history of the last few blocks attached to the game state,
+ * which allows reconstructing the game state at any of those blocks.
+ *
+ * For each block, we keep the block data and undo data, so that the state
+ * can be rolled back with ProcessBackwards starting from a newer state.
+ * The full state is kept for the current tip and for "keyframes" every
+ * few blocks, so that a lookup never needs to replay more than the keyframe
+ * interval of undo steps.  In addition, reconstructed states are kept in
+ * an LRU cache.
+ *
+ * This class is thread-safe.  The actual reconstruction (calling the undo
+ * function) is done without holding the internal lock, so that concurrent
+ * updates (e.g. attached blocks) are not blocked by long lookups.
+ */
+class StateHistory : public MemoryConsumer
+{
+
+public:
+
+  /**
+   * Function that is used to undo a block, i.e. compute the state before
+   * a block from the state after it.  This is GameLogic::ProcessBackwards.
+   */
+  using UndoFunction
+      = std::function<GameStateData (const GameStateData& newState,
+                                     const Json::Value& blockData,
+                                     const UndoData& undoData)>;
+
+private:
+
+  /** Shared pointer to an immutable game state.  */
+  using StatePtr = std::shared_ptr<const GameStateData>;
+
+  /**
+   * Data stored for each block in the history window.
+   */
+  struct Entry
+  {
+
+    /** The block's hash.  */
+    uint256 hash;
+
+    /** The block's height.  */
+    unsigned height;
+
+    /** The block data, as passed to ProcessForward/ProcessBackwards.  */
+    Json::Value blockData;
+
+    /** The undo data returned by ProcessForward.  */
+    UndoData undo;
+
+    /** Estimated memory used by the entry, not including the state.  */
+    size_t bytes;
+
+    /**
+     * The full game state after this block, if this is a keyframe
+     * or the current tip.  Null otherwise.  This is only accessed while
+     * holding the lock; the other fields are immutable once the entry
+     * has been added.
+     */
+    StatePtr state;
+
+  };
+
+  /**
+   * A state from the reconstruction cache, together with the height of
+   * the block it corresponds to.
+   */
+  struct CachedState
+  {
+    uint256 hash;
+    unsigned height;
+    StatePtr state;
+  };
+
+  /** Lock for this instance.  */
+  mutable std::mutex mut;
+
+  /** Number of blocks to keep in the window.  */
+  unsigned nBlocks;
+
+  /** Every keyframeInterval-th block height has its full state kept.  */
+  unsigned keyframeInterval;
+
+  /** Maximum number of reconstructed states to cache.  */
+  unsigned cacheSize;
+
+  /**
+   * The blocks in the window (front is oldest).  They form a chain,
+   * i.e. each block's parent is the block before it.
+   */
+  std::deque<std::shared_ptr<Entry>> entries;
+
+  /** LRU list of cached states (front is most recently used).  */
+  std::list<CachedState> lru;
+
+  /** Index into the LRU list by block hash.  */
+  std::map<uint256, std::list<CachedState>::iterator> lruIndex;
+
+  /**
+   * Number of references to each state from the window and the LRU cache.
+   * A state shared between them is only counted once for the memory usage.
+   */
+  std::map<const GameStateData*, unsigned> stateRefs;
+
+  /**
+   * Estimated memory used by the window and the cache.  This is kept
+   * up-to-date on every change, so that it need not be recomputed.
+   */
+  size_t memoryUsage = 0;
+
+  /**
+   * Returns true if the given height is a keyframe.
+   */
+  bool IsKeyframe (unsigned height) const;
+
+  /**
+   * Accounts for a new reference to the given state (if not null).  Must be
+   * called with the lock held.
+   */
+  void AddStateRef (const StatePtr& state);
+
+  /**
+   * Accounts for a reference to the given state (if not null) being
+   * dropped.  Must be called with the lock held.
+   */
+  void ReleaseStateRef (const StatePtr& state);
+
+  /**
+   * Sets the full state of an entry in the window, updating the memory
+   * accounting.  Must be called with the lock held.
+   */
+  void SetEntryState (Entry& entry, StatePtr state);
+
+  /**
+   * Adds a new entry at the end of the window.  Must be called with the
+   * lock held.
+   */
+  void PushEntry (std::shared_ptr<Entry> entry);
+
+  /**
+   * Drops the oldest or newest entry from the window.  Must be called
+   * with the lock held.
+   */
+  void PopEntry (bool front);
+
+  /**
+   * Drops all entries in the window.  Must be called with the lock held.
+   */
+  void ClearEntries ();
+
+  /**
+   * Evicts the least-recently used state from the cache.  Must be called
+   * with the lock held.
+   */
+  void EvictCached ();
+
+  /**
+   * Drops the oldest entries until the window has at most nBlocks entries.
+   * Must be called with the lock held.
+   */
+  void TrimWindow ();
+
+  /**
+   * Looks up a state in the LRU cache and marks it as recently used.
+   * Returns null if not found.  Must be called with the lock held.
+   */
+  StatePtr LookupCache (const uint256& hash);
+
+  /**
+   * Inserts a state into the LRU cache, evicting old entries as necessary.
+   * Must be called with the lock held.
+   */
+  void InsertCache (const uint256& hash, unsigned height, StatePtr state);
+
+  /**
+   * Reconstructs the state for the entry with the given index into the
+   * window.  The lock must be held by the passed-in lock object, and will
+   * be released during the actual replay.
+   */
+  StatePtr Reconstruct (std::unique_lock<std::mutex>& lock, size_t index,
+                        const UndoFunction& undoFcn);
+
+public:
+
+  /**
+   * Constructs an empty history with the given window size, keyframe interval
+   * and cache size.
+   */
+  explicit StateHistory (unsigned n, unsigned keyframe, unsigned cache);
+
+  StateHistory () = delete;
+  StateHistory (const StateHistory&) = delete;
+  void operator= (const StateHistory&) = delete;
+
+  /**
+   * Updates the limits.  The window and cache are trimmed if the new limits
+   * are smaller than the current sizes.
+   */
+  void SetLimits (unsigned n, unsigned keyframe, unsigned cache);
+
+  /**
+   * Returns the current limits.
+   */
+  void GetLimits (unsigned& n, unsigned& keyframe, unsigned& cache) const;
+
+  /**
+   * Records a newly attached block.  If the block does not extend the
+   * current window (i.e. its parent is not the last block), then the window
+   * is reset to just this block.
+   */
+  void AttachBlock (const uint256& parent, const uint256& hash,
+                    unsigned height, const Json::Value& blockData,
+                    const UndoData& undo, GameStateData&& newState);
+
+  /**
+   * Removes a detached block from the window.  The state of the new tip
+   * (the parent block) must be passed in, so that we can start replays
+   * from it.  If the hash does not match the current tip, the window
+   * is cleared.
+   */
+  void DetachBlock (const uint256& hash, GameStateData&& parentState);
+
+  /**
+   * Clears the window.  The cache of reconstructed states is kept, since
+   * the state for a particular block hash never changes.
+   */
+  void Clear ();
+
+  /**
+   * Returns the hash of the current tip in the window, or false
+   * if the window is empty.
+   */
+  bool GetTip (uint256& hash) const;
+
+  /**
+   * Looks up or reconstructs the state at the given block.  Returns false
+   * if the block is not within the window and also not cached.
+   */
+  bool GetStateAtBlock (const uint256& hash, const UndoFunction& undoFcn,
+                        GameStateData& state, unsigned& height);
+
+  /**
+   * Looks up or reconstructs the state at the given height of the chain
+   * that is currently in the window.  Returns false if the height is not
+   * within the window.
+   */
+  bool GetStateAtHeight (unsigned height, const UndoFunction& undoFcn,
+                         GameStateData& state, uint256& hash);
+
+  size_t GetMemoryUsage () const override;
+
+  /**
+   * Frees memory by evicting cached states first and then dropping the
+   * oldest blocks from the window (but never the tip).  The configured
+   * window size is not changed, so the window grows again with new blocks
+   * if memory permits.
+   */
+  void ShrinkMemory (size_t target) override;
+
+};
+
+} // namespace internal
+} // namespace xaya
+
+#endif // XAYAGAME_STATEHISTORY_HPP
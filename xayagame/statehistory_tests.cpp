@@ -0,0 +1,358 @@
+// Copyright (C) 2019 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "statehistory.hpp"
+
+#include <gtest/gtest.h>
+
+#include <glog/logging.h>
+
+#include <string>
+
+namespace xaya
+{
+namespace internal
+{
+namespace
+{
+
+/**
+ * Test fixture for StateHistory.  The "game" we use has a state that is
+ * simply the concatenation of single characters, one per block.  The block
+ * data for each block has the character in it, and undoing a block removes
+ * the last character.
+ */
+class StateHistoryTests : public testing::Test
+{
+
+protected:
+
+  /** Number of times the undo function has been called.  */
+  unsigned undoCalls = 0;
+
+  /** The undo function passed to the history.  */
+  const StateHistory::UndoFunction undoFcn;
+
+  /** The current state at the tip.  */
+  std::string currentState;
+
+  StateHistoryTests ()
+    : undoFcn([this] (const GameStateData& newState,
+                      const Json::Value& blockData, const UndoData& undo)
+        {
+          ++undoCalls;
+          CHECK (!newState.empty ());
+          CHECK_EQ (newState.substr (newState.size () - 1),
+                    blockData["c"].asString ());
+          CHECK_EQ (undo, "undo " + blockData["c"].asString ());
+          return newState.substr (0, newState.size () - 1);
+        })
+  {}
+
+  /**
+   * Returns the block hash we use for a block at the given height.
+   * The hash depends on the branch as well, so that we can simulate
+   * reorgs.
+   */
+  static uint256
+  BlockHash (const unsigned height, const char branch = 'a')
+  {
+    std::string hex(64, '0');
+    hex[0] = branch;
+    hex[63] = '0' + (height % 10);
+    hex[62] = '0' + (height / 10);
+
+    uint256 res;
+    CHECK (res.FromHex (hex));
+    return res;
+  }
+
+  /**
+   * Attaches a block with the given character and height.
+   */
+  void
+  Attach (StateHistory& h, const unsigned height, const char c,
+          const char branch = 'a', const char parentBranch = 'a')
+  {
+    Json::Value blockData(Json::objectValue);
+    blockData["c"] = std::string (1, c);
+    currentState.push_back (c);
+
+    std::string stateCopy = currentState;
+    h.AttachBlock (BlockHash (height - 1, parentBranch),
+                   BlockHash (height, branch), height, blockData,
+                   "undo " + std::string (1, c), std::move (stateCopy));
+  }
+
+  /**
+   * Detaches the block at the given height.
+   */
+  void
+  Detach (StateHistory& h, const unsigned height, const char branch = 'a')
+  {
+    currentState.pop_back ();
+    std::string stateCopy = currentState;
+    h.DetachBlock (BlockHash (height, branch), std::move (stateCopy));
+  }
+
+  /**
+   * Expects that the state at the given height is the given string.
+   */
+  void
+  ExpectStateAtHeight (StateHistory& h, const unsigned height,
+                       const std::string& expected, const char branch = 'a')
+  {
+    GameStateData state;
+    uint256 hash;
+    ASSERT_TRUE (h.GetStateAtHeight (height, undoFcn, state, hash));
+    EXPECT_EQ (state, expected);
+    EXPECT_EQ (hash, BlockHash (height, branch));
+  }
+
+};
+
+TEST_F (StateHistoryTests, Empty)
+{
+  StateHistory h(10, 0, 0);
+
+  uint256 hash;
+  EXPECT_FALSE (h.GetTip (hash));
+
+  GameStateData state;
+  unsigned height;
+  EXPECT_FALSE (h.GetStateAtBlock (BlockHash (1), undoFcn, state, height));
+  EXPECT_FALSE (h.GetStateAtHeight (1, undoFcn, state, hash));
+}
+
+TEST_F (StateHistoryTests, Reconstruction)
+{
+  StateHistory h(10, 0, 0);
+  for (unsigned i = 1; i <= 5; ++i)
+    Attach (h, i, 'a' + i - 1);
+
+  uint256 hash;
+  ASSERT_TRUE (h.GetTip (hash));
+  EXPECT_EQ (hash, BlockHash (5));
+
+  ExpectStateAtHeight (h, 5, "abcde");
+  EXPECT_EQ (undoCalls, 0);
+  ExpectStateAtHeight (h, 3, "abc");
+  EXPECT_EQ (undoCalls, 2);
+  ExpectStateAtHeight (h, 1, "a");
+  EXPECT_EQ (undoCalls, 6);
+
+  GameStateData state;
+  unsigned height;
+  ASSERT_TRUE (h.GetStateAtBlock (BlockHash (2), undoFcn, state, height));
+  EXPECT_EQ (state, "ab");
+  EXPECT_EQ (height, 2);
+
+  EXPECT_FALSE (h.GetStateAtHeight (0, undoFcn, state, hash));
+  EXPECT_FALSE (h.GetStateAtHeight (6, undoFcn, state, hash));
+}
+
+TEST_F (StateHistoryTests, WindowSize)
+{
+  StateHistory h(3, 0, 0);
+  for (unsigned i = 1; i <= 5; ++i)
+    Attach (h, i, 'a' + i - 1);
+
+  GameStateData state;
+  uint256 hash;
+  EXPECT_FALSE (h.GetStateAtHeight (2, undoFcn, state, hash));
+  ExpectStateAtHeight (h, 3, "abc");
+
+  h.SetLimits (1, 0, 0);
+  unsigned n, keyframe, cache;
+  h.GetLimits (n, keyframe, cache);
+  EXPECT_EQ (n, 1);
+  EXPECT_EQ (keyframe, 0);
+  EXPECT_EQ (cache, 0);
+  EXPECT_FALSE (h.GetStateAtHeight (4, undoFcn, state, hash));
+  ExpectStateAtHeight (h, 5, "abcde");
+}
+
+TEST_F (StateHistoryTests, Keyframes)
+{
+  StateHistory h(100, 10, 0);
+  for (unsigned i = 1; i <= 25; ++i)
+    Attach (h, i, 'a' + i - 1);
+
+  /* Height 10 and 20 are keyframes, so looking up 15 needs five undos
+     starting from height 20.  */
+  ExpectStateAtHeight (h, 15, currentState.substr (0, 15));
+  EXPECT_EQ (undoCalls, 5);
+
+  undoCalls = 0;
+  ExpectStateAtHeight (h, 20, currentState.substr (0, 20));
+  EXPECT_EQ (undoCalls, 0);
+
+  undoCalls = 0;
+  ExpectStateAtHeight (h, 1, currentState.substr (0, 1));
+  EXPECT_EQ (undoCalls, 9);
+}
+
+TEST_F (StateHistoryTests, Cache)
+{
+  StateHistory h(100, 0, 2);
+  for (unsigned i = 1; i <= 10; ++i)
+    Attach (h, i, 'a' + i - 1);
+
+  ExpectStateAtHeight (h, 5, "abcde");
+  EXPECT_EQ (undoCalls, 5);
+
+  undoCalls = 0;
+  ExpectStateAtHeight (h, 5, "abcde");
+  EXPECT_EQ (undoCalls, 0);
+
+  /* Cached states are used as starting points as well.  */
+  ExpectStateAtHeight (h, 3, "abc");
+  EXPECT_EQ (undoCalls, 2);
+
+  /* Height 1 evicts height 5 from the cache.  */
+  undoCalls = 0;
+  ExpectStateAtHeight (h, 1, "a");
+  EXPECT_EQ (undoCalls, 2);
+  ExpectStateAtHeight (h, 5, "abcde");
+  EXPECT_EQ (undoCalls, 7);
+}
+
+TEST_F (StateHistoryTests, ShrinkMemory)
+{
+  StateHistory h(100, 0, 10);
+  EXPECT_EQ (h.GetMemoryUsage (), 0);
+
+  for (unsigned i = 1; i <= 10; ++i)
+    Attach (h, i, 'a' + i - 1);
+  ExpectStateAtHeight (h, 5, "abcde");
+  const size_t before = h.GetMemoryUsage ();
+  EXPECT_GT (before, 0);
+
+  /* Shrinking a bit drops the cached state first.  */
+  h.ShrinkMemory (before - 1);
+  EXPECT_LT (h.GetMemoryUsage (), before);
+  GameStateData state;
+  unsigned height;
+  ASSERT_TRUE (h.GetStateAtBlock (BlockHash (5), undoFcn, state, height));
+
+  /* Shrinking to nothing keeps only the tip.  */
+  h.ShrinkMemory (0);
+  uint256 hash;
+  EXPECT_FALSE (h.GetStateAtHeight (9, undoFcn, state, hash));
+  ExpectStateAtHeight (h, 10, currentState);
+
+  /* The window grows again with new blocks.  */
+  Attach (h, 11, 'k');
+  ExpectStateAtHeight (h, 10, currentState.substr (0, 10));
+
+  unsigned n, keyframe, cache;
+  h.GetLimits (n, keyframe, cache);
+  EXPECT_EQ (n, 100);
+}
+
+TEST_F (StateHistoryTests, CachedStatesSurviveClear)
+{
+  StateHistory h(100, 0, 10);
+  for (unsigned i = 1; i <= 5; ++i)
+    Attach (h, i, 'a' + i - 1);
+  ExpectStateAtHeight (h, 2, "ab");
+
+  h.Clear ();
+
+  GameStateData state;
+  uint256 hash;
+  EXPECT_FALSE (h.GetStateAtHeight (2, undoFcn, state, hash));
+  EXPECT_FALSE (h.GetTip (hash));
+
+  unsigned height;
+  ASSERT_TRUE (h.GetStateAtBlock (BlockHash (2), undoFcn, state, height));
+  EXPECT_EQ (state, "ab");
+  EXPECT_EQ (height, 2);
+}
+
+TEST_F (StateHistoryTests, Reorg)
+{
+  StateHistory h(100, 0, 0);
+  for (unsigned i = 1; i <= 5; ++i)
+    Attach (h, i, 'a' + i - 1);
+
+  Detach (h, 5);
+  Detach (h, 4);
+  Attach (h, 4, 'x', 'b', 'a');
+  Attach (h, 5, 'y', 'b', 'b');
+
+  uint256 hash;
+  ASSERT_TRUE (h.GetTip (hash));
+  EXPECT_EQ (hash, BlockHash (5, 'b'));
+
+  ExpectStateAtHeight (h, 5, "abcxy", 'b');
+  ExpectStateAtHeight (h, 4, "abcx", 'b');
+  ExpectStateAtHeight (h, 3, "abc");
+
+  GameStateData state;
+  unsigned height;
+  EXPECT_FALSE (h.GetStateAtBlock (BlockHash (4), undoFcn, state, height));
+}
+
+TEST_F (StateHistoryTests, DetachKeepsParentState)
+{
+  StateHistory h(100, 0, 0);
+  for (unsigned i = 1; i <= 3; ++i)
+    Attach (h, i, 'a' + i - 1);
+
+  Detach (h, 3);
+  undoCalls = 0;
+  ExpectStateAtHeight (h, 2, "ab");
+  EXPECT_EQ (undoCalls, 0);
+}
+
+TEST_F (StateHistoryTests, SharedStateCountedOnce)
+{
+  /* Use a large state, so that its size dominates the memory usage.  */
+  constexpr size_t stateSize = 100000;
+  currentState = std::string (stateSize, 'x');
+  const std::string prefix = currentState;
+
+  StateHistory h(100, 0, 10);
+  for (unsigned i = 1; i <= 5; ++i)
+    Attach (h, i, 'a' + i - 1);
+  ExpectStateAtHeight (h, 4, prefix + "abcd");
+  EXPECT_LT (h.GetMemoryUsage (), 3 * stateSize);
+
+  /* The parent's state after the detach is the cached one, which is then
+     shared between the window and the cache.  */
+  Detach (h, 5);
+  EXPECT_LT (h.GetMemoryUsage (), 2 * stateSize);
+  undoCalls = 0;
+  ExpectStateAtHeight (h, 4, prefix + "abcd");
+  EXPECT_EQ (undoCalls, 0);
+
+  h.Clear ();
+  EXPECT_GT (h.GetMemoryUsage (), stateSize);
+  h.ShrinkMemory (0);
+  EXPECT_EQ (h.GetMemoryUsage (), 0);
+}
+
+TEST_F (StateHistoryTests, NonExtendingAttachResets)
+{
+  StateHistory h(100, 0, 0);
+  for (unsigned i = 1; i <= 3; ++i)
+    Attach (h, i, 'a' + i - 1);
+
+  currentState = "xyz";
+  Attach (h, 10, 'w');
+
+  GameStateData state;
+  uint256 hash;
+  EXPECT_FALSE (h.GetStateAtHeight (3, undoFcn, state, hash));
+  ExpectStateAtHeight (h, 10, "xyzw");
+
+  /* A detach that does not match the tip resets everything.  */
+  Detach (h, 9);
+  EXPECT_FALSE (h.GetTip (hash));
+}
+
+} // anonymous namespace
+} // namespace internal
+} // namespace xaya
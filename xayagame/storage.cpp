@@ -6,6 +6,10 @@
 
 #include <glog/logging.h>
 
+#include <fstream>
+#include <limits>
+#include <sstream>
+
 namespace xaya
 {
 
@@ -33,13 +37,201 @@ StorageInterface::RollbackTransaction ()
   /* Nothing is done in the default implementation.  */
 }
 
+std::unique_ptr<StorageSnapshot>
+StorageInterface::OpenSnapshot () const
+{
+  /* Snapshots are not supported by default.  */
+  return nullptr;
+}
+
+namespace
+{
+
+/**
+ * Writes a checkpoint file in the default format, with the block hash on
+ * the first line and the raw game state afterwards.
+ */
+bool
+WriteDefaultCheckpoint (const std::string& file, const uint256& hash,
+                        const GameStateData& state)
+{
+  std::ofstream out(file, std::ios::binary | std::ios::trunc);
+  out << hash.ToHex () << '\n' << state;
+  out.close ();
+  if (!out)
+    {
+      LOG (WARNING) << "Failed to write checkpoint file " << file;
+      return false;
+    }
+
+  return true;
+}
+
+} // anonymous namespace
+
+bool
+StorageSnapshot::WriteCheckpoint (const std::string& file) const
+{
+  uint256 hash;
+  CHECK (GetCurrentBlockHash (hash));
+  return WriteDefaultCheckpoint (file, hash, GetCurrentGameState ());
+}
+
+bool
+StorageSnapshot::ShouldCloseEarly () const
+{
+  return false;
+}
+
+bool
+StorageInterface::WriteCheckpoint (const std::string& file) const
+{
+  uint256 hash;
+  CHECK (GetCurrentBlockHash (hash));
+  return WriteDefaultCheckpoint (file, hash, GetCurrentGameState ());
+}
+
+void
+StorageInterface::RestoreCheckpoint (const std::string& file)
+{
+  std::ifstream in(file, std::ios::binary);
+  CHECK (in) << "Failed to open checkpoint file " << file;
+
+  std::string hashHex;
+  std::getline (in, hashHex);
+  uint256 hash;
+  CHECK (hash.FromHex (hashHex)) << "Invalid checkpoint file " << file;
+
+  std::ostringstream state;
+  state << in.rdbuf ();
+  CHECK (!in.bad ()) << "Failed to read checkpoint file " << file;
+
+  /* Clear is not allowed inside a transaction, so we remove the undo data
+     through pruning instead.  That way, the whole update is done in a single
+     transaction and a failure leaves the previous state intact.  */
+  BeginTransaction ();
+  try
+    {
+      PruneUndoData (std::numeric_limits<unsigned>::max ());
+      SetCurrentGameState (hash, state.str ());
+      CommitTransaction ();
+    }
+  catch (...)
+    {
+      RollbackTransaction ();
+      throw;
+    }
+}
+
+/**
+ * Snapshot of a MemoryStorage.  It simply holds on to the shared game state
+ * and undo buckets, which the storage does not modify anymore once they are
+ * shared with us.
+ */
+class MemoryStorage::Snapshot : public StorageSnapshot
+{
+
+private:
+
+  const bool hasState;
+  const uint256 currentBlock;
+  const std::shared_ptr<const GameStateData> currentState;
+  const std::shared_ptr<const UndoBuckets> undoData;
+
+public:
+
+  explicit Snapshot (const MemoryStorage& s)
+    : hasState(s.hasState), currentBlock(s.currentBlock),
+      currentState(s.currentState), undoData(s.undoData)
+  {}
+
+  bool
+  GetCurrentBlockHash (uint256& hash) const override
+  {
+    if (!hasState)
+      return false;
+
+    hash = currentBlock;
+    return true;
+  }
+
+  GameStateData
+  GetCurrentGameState () const override
+  {
+    CHECK (hasState);
+    return *currentState;
+  }
+
+  bool
+  GetUndoData (const uint256& hash, UndoData& data) const override
+  {
+    const UndoMap& bucket = GetUndoBucket (*undoData, hash);
+    const auto mit = bucket.find (hash);
+    if (mit == bucket.end ())
+      return false;
+
+    data = mit->second.data;
+    return true;
+  }
+
+};
+
+MemoryStorage::MemoryStorage ()
+  : currentState(std::make_shared<GameStateData> ()),
+    undoData(EmptyUndoBuckets ())
+{}
+
+std::shared_ptr<MemoryStorage::UndoBuckets>
+MemoryStorage::EmptyUndoBuckets ()
+{
+  auto res = std::make_shared<UndoBuckets> ();
+  for (auto& b : *res)
+    b = std::make_shared<UndoMap> ();
+  return res;
+}
+
+const MemoryStorage::UndoMap&
+MemoryStorage::GetUndoBucket (const UndoBuckets& buckets, const uint256& hash)
+{
+  return *buckets[hash.GetBlob ()[0] % UNDO_BUCKETS];
+}
+
+MemoryStorage::UndoMap&
+MemoryStorage::MutableUndoBucket (const unsigned index)
+{
+  CHECK_LT (index, UNDO_BUCKETS);
+
+  /* The use counts are only changed while holding the storage's lock
+     (snapshots are created by OpenSnapshot, and copies of them are never
+     made), except for snapshots being destroyed on other threads.  That can
+     only make the counts smaller, in which case we copy unnecessarily but
+     safely.
+
+     After copying the table, all buckets are shared between the copy and
+     the snapshots' table, so the check below copies the bucket as well.  */
+  if (undoData.use_count () > 1)
+    undoData = std::make_shared<UndoBuckets> (*undoData);
+
+  auto& bucket = (*undoData)[index];
+  if (bucket.use_count () > 1)
+    bucket = std::make_shared<UndoMap> (*bucket);
+
+  return *bucket;
+}
+
+MemoryStorage::UndoMap&
+MemoryStorage::MutableUndoBucket (const uint256& hash)
+{
+  return MutableUndoBucket (hash.GetBlob ()[0] % UNDO_BUCKETS);
+}
+
 void
 MemoryStorage::Clear ()
 {
   CHECK (!startedTxn);
 
   hasState = false;
-  undoData.clear ();
+  undoData = EmptyUndoBuckets ();
 }
 
 bool
@@ -56,7 +248,7 @@ GameStateData
 MemoryStorage::GetCurrentGameState () const
 {
   CHECK (hasState);
-  return currentState;
+  return *currentState;
 }
 
 void
@@ -67,14 +259,15 @@ MemoryStorage::SetCurrentGameState (const uint256& hash,
 
   hasState = true;
   currentBlock = hash;
-  currentState = data;
+  currentState = std::make_shared<GameStateData> (data);
 }
 
 bool
 MemoryStorage::GetUndoData (const uint256& hash, UndoData& data) const
 {
-  const auto mit = undoData.find (hash);
-  if (mit == undoData.end ())
+  const UndoMap& bucket = GetUndoBucket (*undoData, hash);
+  const auto mit = bucket.find (hash);
+  if (mit == bucket.end ())
     return false;
 
   data = mit->second.data;
@@ -88,14 +281,15 @@ MemoryStorage::AddUndoData (const uint256& hash,
   CHECK (startedTxn);
 
   HeightAndUndoData heightAndData = {height, data};
-  undoData.emplace (hash, std::move (heightAndData));
+  MutableUndoBucket (hash).emplace (hash, std::move (heightAndData));
 }
 
 void
 MemoryStorage::ReleaseUndoData (const uint256& hash)
 {
   CHECK (startedTxn);
-  undoData.erase (hash);
+  if (GetUndoBucket (*undoData, hash).count (hash) > 0)
+    MutableUndoBucket (hash).erase (hash);
 }
 
 void
@@ -103,11 +297,27 @@ MemoryStorage::PruneUndoData (const unsigned height)
 {
   CHECK (startedTxn);
 
-  for (auto it = undoData.cbegin (); it != undoData.cend (); )
-    if (it->second.height <= height)
-      it = undoData.erase (it);
-    else
-      ++it;
+  /* Only buckets that actually contain entries to prune are modified (and
+     thus copied if shared with a snapshot).  */
+  for (unsigned i = 0; i < UNDO_BUCKETS; ++i)
+    {
+      bool needsPruning = false;
+      for (const auto& entry : *(*undoData)[i])
+        if (entry.second.height <= height)
+          {
+            needsPruning = true;
+            break;
+          }
+      if (!needsPruning)
+        continue;
+
+      UndoMap& undo = MutableUndoBucket (i);
+      for (auto it = undo.cbegin (); it != undo.cend (); )
+        if (it->second.height <= height)
+          it = undo.erase (it);
+        else
+          ++it;
+    }
 }
 
 void
@@ -133,4 +343,12 @@ MemoryStorage::RollbackTransaction ()
   LOG (WARNING) << "Memory storage is not capable of rolling back transactions";
 }
 
+std::unique_ptr<StorageSnapshot>
+MemoryStorage::OpenSnapshot () const
+{
+  /* Since the memory storage cannot roll back, changes made in a pending
+     transaction are as good as committed.  */
+  return std::unique_ptr<StorageSnapshot> (new Snapshot (*this));
+}
+
 } // namespace xaya
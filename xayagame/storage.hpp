@@ -7,7 +7,9 @@
 
 #include "uint256.hpp"
 
+#include <array>
 #include <map>
+#include <memory>
 #include <stdexcept>
 #include <string>
 
@@ -24,6 +26,65 @@ using GameStateData = std::string;
 /** The game-specific undo data for a block.  */
 using UndoData = std::string;
 
+/**
+ * Read-only view of a storage at a fixed point in time, as returned by
+ * StorageInterface::OpenSnapshot.  The view is not affected by changes
+ * that are made to the storage after it was opened, and it may be used
+ * from a different thread than the one updating the storage (without
+ * additional synchronisation).  A single snapshot instance itself must not
+ * be used by multiple threads at the same time, though.
+ *
+ * Snapshots must be destroyed before the storage they belong to is cleared
+ * or destroyed itself.
+ */
+class StorageSnapshot
+{
+
+public:
+
+  virtual ~StorageSnapshot () = default;
+
+  /**
+   * Retrieves the block hash to which the game state in the snapshot belongs.
+   * Returns false if there is no state.
+   */
+  virtual bool GetCurrentBlockHash (uint256& hash) const = 0;
+
+  /**
+   * Retrieves the game state in the snapshot.  Must not be called if there
+   * is none (i.e. if GetCurrentBlockHash returns false).
+   */
+  virtual GameStateData GetCurrentGameState () const = 0;
+
+  /**
+   * Retrieves undo data for the given block hash.  Returns false if none is
+   * stored with that key.
+   */
+  virtual bool GetUndoData (const uint256& hash, UndoData& data) const = 0;
+
+  /**
+   * Writes a checkpoint of the snapshot's state to the given file, in the
+   * same format as StorageInterface::WriteCheckpoint.  This allows writing
+   * checkpoints on a background thread.  Returns false (after logging a
+   * warning) if the file could not be written.
+   *
+   * The default implementation writes the block hash and game state, like
+   * the one of StorageInterface.
+   */
+  virtual bool WriteCheckpoint (const std::string& file) const;
+
+  /**
+   * Returns true if keeping the snapshot open holds back the storage (like
+   * LMDB snapshots, which defer resizes of the map).  Users should then
+   * read what they need right away and close the snapshot, instead of
+   * keeping it e.g. in a queue of pending work.
+   *
+   * The default implementation returns false.
+   */
+  virtual bool ShouldCloseEarly () const;
+
+};
+
 /**
  * Interface for the storage layer used by the game.  This is used to
  * hold undo data for every block in the currently active chain as well
@@ -147,6 +208,53 @@ public:
    */
   virtual void RollbackTransaction ();
 
+  /**
+   * Opens a snapshot of the last committed state, which can be read from
+   * other threads while this storage continues to be updated.  This method
+   * itself must be synchronised with the other calls (like all methods
+   * of StorageInterface).
+   *
+   * Note that the Game batches blocks into a single transaction while
+   * catching up (and possibly also when up-to-date if configured), so that
+   * the committed state may lag behind what GetCurrentBlockHash returns
+   * by up to the batch size.  Callers that need the current state have to
+   * compare the snapshot's GetCurrentBlockHash against it.  Storages that
+   * cannot roll back (like MemoryStorage) may instead include the changes
+   * of a pending transaction in the snapshot.
+   *
+   * Support for snapshots is optional.  The default implementation returns
+   * null, which means that they are not supported.
+   */
+  virtual std::unique_ptr<StorageSnapshot> OpenSnapshot () const;
+
+  /**
+   * Writes a checkpoint of the current state to the given file, from which
+   * it can later be restored with RestoreCheckpoint.  Undo data need not
+   * be included.  This is only called when there is a current state and
+   * no transaction is open.
+   *
+   * The default implementation writes the current block hash and game state
+   * to the file.  Storages that keep more than that (like SQLiteStorage,
+   * which shares its database with the game) need to override it.
+   *
+   * I/O errors (e.g. a full disk) must not be fatal, since checkpoints are
+   * optional.  Instead, false is returned after logging a warning.
+   */
+  virtual bool WriteCheckpoint (const std::string& file) const;
+
+  /**
+   * Replaces all data in the storage by the state of a checkpoint file
+   * written before by WriteCheckpoint.  Like Clear, this is called without
+   * an open transaction and should be atomic by itself.
+   *
+   * The default implementation prunes all undo data and sets the current
+   * state from the file in a single transaction.  This is only atomic if
+   * the storage supports rolling back transactions, and storages that do
+   * not implement PruneUndoData keep their old undo entries.  Storages
+   * with more data than that need to override it.
+   */
+  virtual void RestoreCheckpoint (const std::string& file);
+
 };
 
 /**
@@ -182,19 +290,27 @@ public:
  *
  * Besides needing to sync from scratch on every restart, this is actually
  * a fully functional implementation.
+ *
+ * Snapshots are supported through copy-on-write:  They share the game state
+ * and undo data with the storage, and the storage copies the parts of the
+ * undo data it modifies if they are still referenced by a snapshot.  For this,
+ * the undo data is split into buckets (by block hash), so that a change only
+ * copies the bucket table and a single bucket rather than all entries.
  */
 class MemoryStorage : public StorageInterface
 {
 
 private:
 
+  class Snapshot;
+
   /** Whether or not we have a current block hash / state.  */
   bool hasState = false;
 
   /** The current block hash, if we have one.  */
   uint256 currentBlock;
-  /** The current game state.  */
-  GameStateData currentState;
+  /** The current game state (never null).  */
+  std::shared_ptr<const GameStateData> currentState;
 
   /**
    * Convenience struct to hold a block height together with undo data.
@@ -205,11 +321,20 @@ private:
     UndoData data;
   };
 
-  /** Type of the map holding undo data.  */
+  /** Number of buckets the undo data is split into.  */
+  static constexpr unsigned UNDO_BUCKETS = 256;
+
+  /** Type of the map holding the undo data of one bucket.  */
   using UndoMap = std::map<uint256, HeightAndUndoData>;
 
-  /** Undo data associated to block hashes we know about.  */
-  UndoMap undoData;
+  /** Type of the table of undo buckets (none of them is ever null).  */
+  using UndoBuckets = std::array<std::shared_ptr<UndoMap>, UNDO_BUCKETS>;
+
+  /**
+   * Undo data associated to block hashes we know about.  The table and
+   * the individual buckets are shared with open snapshots (and never null).
+   */
+  std::shared_ptr<UndoBuckets> undoData;
 
   /**
    * Whether or not a transaction has currently been started.  The storage
@@ -220,9 +345,32 @@ private:
    */
   bool startedTxn = false;
 
+  /**
+   * Constructs a fresh table of empty undo buckets.
+   */
+  static std::shared_ptr<UndoBuckets> EmptyUndoBuckets ();
+
+  /**
+   * Returns the bucket in the given table that holds the given block hash.
+   */
+  static const UndoMap& GetUndoBucket (const UndoBuckets& buckets,
+                                       const uint256& hash);
+
+  /**
+   * Returns the undo bucket with the given index for modification.  If it
+   * (or the bucket table) is shared with any snapshots, then it is
+   * copied first.
+   */
+  UndoMap& MutableUndoBucket (unsigned index);
+
+  /**
+   * Returns the undo bucket holding the given block hash for modification.
+   */
+  UndoMap& MutableUndoBucket (const uint256& hash);
+
 public:
 
-  MemoryStorage () = default;
+  MemoryStorage ();
   MemoryStorage (const MemoryStorage&) = delete;
 
   void operator= (const MemoryStorage&) = delete;
@@ -244,6 +392,8 @@ public:
   void CommitTransaction () override;
   void RollbackTransaction () override;
 
+  std::unique_ptr<StorageSnapshot> OpenSnapshot () const override;
+
 };
 
 } // namespace xaya
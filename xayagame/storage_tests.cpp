@@ -11,6 +11,7 @@ namespace
 
 INSTANTIATE_TYPED_TEST_CASE_P (Memory, BasicStorageTests, MemoryStorage);
 INSTANTIATE_TYPED_TEST_CASE_P (Memory, PruningStorageTests, MemoryStorage);
+INSTANTIATE_TYPED_TEST_CASE_P (Memory, SnapshotStorageTests, MemoryStorage);
 
 } // anonymous namespace
 } // namespace xaya
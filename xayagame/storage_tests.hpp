@@ -12,7 +12,11 @@
 
 #include <glog/logging.h>
 
+#include <cstdio>
+#include <memory>
 #include <string>
+#include <thread>
+#include <vector>
 
 namespace xaya
 {
@@ -157,9 +161,39 @@ TYPED_TEST_P (BasicStorageTests, ReadInTransaction)
   this->storage.RollbackTransaction ();
 }
 
+TYPED_TEST_P (BasicStorageTests, Checkpoint)
+{
+  const std::string file = std::tmpnam (nullptr);
+
+  this->storage.BeginTransaction ();
+  this->storage.SetCurrentGameState (this->hash1, this->state1);
+  this->storage.AddUndoData (this->hash1, 18, this->undo1);
+  this->storage.CommitTransaction ();
+  ASSERT_TRUE (this->storage.WriteCheckpoint (file));
+
+  this->storage.BeginTransaction ();
+  this->storage.SetCurrentGameState (this->hash2, this->state2);
+  this->storage.AddUndoData (this->hash2, 19, this->undo2);
+  this->storage.CommitTransaction ();
+
+  this->storage.RestoreCheckpoint (file);
+  uint256 hash;
+  ASSERT_TRUE (this->storage.GetCurrentBlockHash (hash));
+  EXPECT_EQ (hash, this->hash1);
+  EXPECT_EQ (this->storage.GetCurrentGameState (), this->state1);
+
+  /* The storage must still be usable normally after restoring.  */
+  this->storage.BeginTransaction ();
+  this->storage.SetCurrentGameState (this->hash2, this->state2);
+  this->storage.CommitTransaction ();
+  EXPECT_EQ (this->storage.GetCurrentGameState (), this->state2);
+
+  std::remove (file.c_str ());
+}
+
 REGISTER_TYPED_TEST_CASE_P (BasicStorageTests,
                             Empty, CurrentState, StoringUndoData,
-                            Clear, ReadInTransaction);
+                            Clear, ReadInTransaction, Checkpoint);
 
 /**
  * Tests specific for the pruning/removing of undo data in a storage.  Since
@@ -249,8 +283,31 @@ TYPED_TEST_P (PruningStorageTests, MultibyteHeight)
   EXPECT_TRUE (this->storage.GetUndoData (this->hash2, undo));
 }
 
+TYPED_TEST_P (PruningStorageTests, RestoreCheckpoint)
+{
+  const std::string file = std::tmpnam (nullptr);
+
+  this->storage.BeginTransaction ();
+  this->storage.SetCurrentGameState (this->hash1, this->state1);
+  this->storage.CommitTransaction ();
+  ASSERT_TRUE (this->storage.WriteCheckpoint (file));
+
+  this->storage.BeginTransaction ();
+  this->storage.SetCurrentGameState (this->hash2, this->state2);
+  this->storage.AddUndoData (this->hash2, 19, this->undo2);
+  this->storage.CommitTransaction ();
+
+  /* Undo data added after the checkpoint must be gone after restoring.  */
+  this->storage.RestoreCheckpoint (file);
+  UndoData undo;
+  EXPECT_FALSE (this->storage.GetUndoData (this->hash2, undo));
+
+  std::remove (file.c_str ());
+}
+
 REGISTER_TYPED_TEST_CASE_P (PruningStorageTests,
-                            ReleaseUndoData, PruneUndoData, MultibyteHeight);
+                            ReleaseUndoData, PruneUndoData, MultibyteHeight,
+                            RestoreCheckpoint);
 
 /**
  * Tests the transaction mechanism in a storage implementation.  This can
@@ -294,6 +351,180 @@ TYPED_TEST_P (TransactingStorageTests, Rollback)
 
 REGISTER_TYPED_TEST_CASE_P (TransactingStorageTests, Commit, Rollback);
 
+/**
+ * Tests for storage snapshots.  This can be applied to implementations
+ * that support OpenSnapshot.
+ */
+template <typename T>
+  using SnapshotStorageTests = BasicStorageTests<T>;
+
+TYPED_TEST_CASE_P (SnapshotStorageTests);
+
+TYPED_TEST_P (SnapshotStorageTests, Empty)
+{
+  const auto snapshot = this->storage.OpenSnapshot ();
+  ASSERT_NE (snapshot, nullptr);
+
+  uint256 hash;
+  EXPECT_FALSE (snapshot->GetCurrentBlockHash (hash));
+  UndoData undo;
+  EXPECT_FALSE (snapshot->GetUndoData (this->hash1, undo));
+}
+
+TYPED_TEST_P (SnapshotStorageTests, FixedState)
+{
+  this->storage.BeginTransaction ();
+  this->storage.SetCurrentGameState (this->hash1, this->state1);
+  this->storage.AddUndoData (this->hash1, 1, this->undo1);
+  this->storage.CommitTransaction ();
+
+  const auto snapshot = this->storage.OpenSnapshot ();
+  ASSERT_NE (snapshot, nullptr);
+
+  this->storage.BeginTransaction ();
+  this->storage.SetCurrentGameState (this->hash2, this->state2);
+  this->storage.AddUndoData (this->hash2, 2, this->undo2);
+  this->storage.ReleaseUndoData (this->hash1);
+  this->storage.CommitTransaction ();
+
+  uint256 hash;
+  UndoData undo;
+
+  ASSERT_TRUE (snapshot->GetCurrentBlockHash (hash));
+  EXPECT_EQ (hash, this->hash1);
+  EXPECT_EQ (snapshot->GetCurrentGameState (), this->state1);
+  ASSERT_TRUE (snapshot->GetUndoData (this->hash1, undo));
+  EXPECT_EQ (undo, this->undo1);
+  EXPECT_FALSE (snapshot->GetUndoData (this->hash2, undo));
+
+  const auto newSnapshot = this->storage.OpenSnapshot ();
+  ASSERT_TRUE (newSnapshot->GetCurrentBlockHash (hash));
+  EXPECT_EQ (hash, this->hash2);
+  EXPECT_EQ (newSnapshot->GetCurrentGameState (), this->state2);
+  EXPECT_FALSE (newSnapshot->GetUndoData (this->hash1, undo));
+  ASSERT_TRUE (newSnapshot->GetUndoData (this->hash2, undo));
+  EXPECT_EQ (undo, this->undo2);
+
+  ASSERT_TRUE (this->storage.GetCurrentBlockHash (hash));
+  EXPECT_EQ (hash, this->hash2);
+}
+
+TYPED_TEST_P (SnapshotStorageTests, OtherThread)
+{
+  this->storage.BeginTransaction ();
+  this->storage.SetCurrentGameState (this->hash1, this->state1);
+  this->storage.CommitTransaction ();
+
+  std::unique_ptr<StorageSnapshot> snapshot = this->storage.OpenSnapshot ();
+  ASSERT_NE (snapshot, nullptr);
+
+  /* Keep writing new states on this thread while the snapshot is read
+     (and finally destroyed) on another one.  */
+  std::thread reader([this, &snapshot] ()
+    {
+      for (unsigned i = 0; i < 100; ++i)
+        {
+          uint256 hash;
+          CHECK (snapshot->GetCurrentBlockHash (hash));
+          CHECK (hash == this->hash1);
+          CHECK_EQ (snapshot->GetCurrentGameState (), this->state1);
+        }
+      snapshot.reset ();
+    });
+
+  for (unsigned i = 0; i < 100; ++i)
+    {
+      this->storage.BeginTransaction ();
+      this->storage.SetCurrentGameState (i % 2 == 0 ? this->hash2 : this->hash1,
+                                         this->state2);
+      this->storage.AddUndoData (this->hash2, i, this->undo2);
+      this->storage.CommitTransaction ();
+    }
+
+  reader.join ();
+  EXPECT_EQ (snapshot, nullptr);
+  EXPECT_EQ (this->storage.GetCurrentGameState (), this->state2);
+}
+
+TYPED_TEST_P (SnapshotStorageTests, ManyUndoEntries)
+{
+  /* Use enough entries with different hashes so that they are spread out
+     over the whole range of hashes, and change some of them while the
+     snapshot is open.  */
+  constexpr unsigned numEntries = 512;
+  std::vector<uint256> hashes;
+  for (unsigned i = 0; i < numEntries; ++i)
+    {
+      char hex[9];
+      std::sprintf (hex, "%08x", i * 0x00800000);
+      uint256 hash;
+      CHECK (hash.FromHex (std::string (hex) + std::string (56, '0')));
+      hashes.push_back (hash);
+    }
+
+  this->storage.BeginTransaction ();
+  for (unsigned i = 0; i < numEntries; i += 2)
+    this->storage.AddUndoData (hashes[i], i, this->undo1);
+  this->storage.CommitTransaction ();
+
+  const auto snapshot = this->storage.OpenSnapshot ();
+  ASSERT_NE (snapshot, nullptr);
+
+  this->storage.BeginTransaction ();
+  for (unsigned i = 1; i < numEntries; i += 2)
+    this->storage.AddUndoData (hashes[i], i, this->undo2);
+  this->storage.PruneUndoData (numEntries / 2);
+  this->storage.CommitTransaction ();
+
+  for (unsigned i = 0; i < numEntries; ++i)
+    {
+      UndoData undo;
+      if (i % 2 == 0)
+        {
+          ASSERT_TRUE (snapshot->GetUndoData (hashes[i], undo));
+          EXPECT_EQ (undo, this->undo1);
+        }
+      else
+        EXPECT_FALSE (snapshot->GetUndoData (hashes[i], undo));
+
+      EXPECT_EQ (this->storage.GetUndoData (hashes[i], undo),
+                 i > numEntries / 2);
+    }
+}
+
+TYPED_TEST_P (SnapshotStorageTests, Checkpoint)
+{
+  const std::string file = std::tmpnam (nullptr);
+
+  this->storage.BeginTransaction ();
+  this->storage.SetCurrentGameState (this->hash1, this->state1);
+  this->storage.CommitTransaction ();
+
+  auto snapshot = this->storage.OpenSnapshot ();
+  ASSERT_NE (snapshot, nullptr);
+
+  this->storage.BeginTransaction ();
+  this->storage.SetCurrentGameState (this->hash2, this->state2);
+  this->storage.CommitTransaction ();
+
+  /* The checkpoint is written from the snapshot while the storage has
+     moved on already.  */
+  ASSERT_TRUE (snapshot->WriteCheckpoint (file));
+  snapshot.reset ();
+
+  this->storage.RestoreCheckpoint (file);
+  uint256 hash;
+  ASSERT_TRUE (this->storage.GetCurrentBlockHash (hash));
+  EXPECT_EQ (hash, this->hash1);
+  EXPECT_EQ (this->storage.GetCurrentGameState (), this->state1);
+
+  std::remove (file.c_str ());
+}
+
+REGISTER_TYPED_TEST_CASE_P (SnapshotStorageTests,
+                            Empty, FixedState, OtherThread, ManyUndoEntries,
+                            Checkpoint);
+
 } // namespace xaya
 
 #endif // XAYAGAME_STORAGE_TESTS_HPP
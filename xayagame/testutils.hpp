@@ -132,17 +132,47 @@ protected:
   static void
   ReinitialiseState (Game& g)
   {
-    std::lock_guard<std::mutex> lock(g.mut);
+    std::lock_guard<std::mutex> lock(g.syncMut);
     g.ReinitialiseState ();
   }
 
   static void
   ForceState (Game& g, const State s)
   {
-    std::lock_guard<std::mutex> lock(g.mut);
+    internal::InstrumentedLock lock(g.mut);
     g.state = s;
   }
 
+  /**
+   * Waits until the derived-data computation of the game (which must be
+   * enabled) has processed all scheduled states.
+   */
+  static void
+  WaitForDerivedData (const Game& g)
+  {
+    g.derivedData->WaitForIdle ();
+  }
+
+  /**
+   * Waits until the state-file writer of the game (which must be enabled)
+   * has written all scheduled states.
+   */
+  static void
+  WaitForStateFiles (const Game& g)
+  {
+    g.stateFiles->WaitForIdle ();
+  }
+
+  /**
+   * Waits until the checkpoint writer of the game (which must be enabled)
+   * has written all scheduled checkpoints.
+   */
+  static void
+  WaitForCheckpoints (const Game& g)
+  {
+    g.checkpoints->WaitForIdle ();
+  }
+
   /**
    * Calls BlockAttach on the given game instance.  The function takes care
    * of setting up the blockData JSON object correctly based on the building
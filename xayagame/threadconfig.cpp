@@ -0,0 +1,182 @@
+// Copyright (C) 2019 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "threadconfig.hpp"
+
+#include <glog/logging.h>
+
+#include <pthread.h>
+#ifdef __linux__
+# include <sched.h>
+# include <sys/resource.h>
+# include <sys/syscall.h>
+# include <unistd.h>
+#endif // __linux__
+
+#include <cerrno>
+#include <cstring>
+#include <set>
+#include <sstream>
+
+namespace xaya
+{
+
+namespace
+{
+
+/** Maximum length of a thread name (without the null terminator).  */
+constexpr size_t MAX_THREAD_NAME = 15;
+
+/**
+ * Upper bound (exclusive) for CPU numbers, which is the size of the CPU
+ * sets used for setting the affinity.  This also bounds the ranges that
+ * ParseCpuList has to expand.
+ */
+#ifdef __linux__
+constexpr unsigned MAX_CPUS = CPU_SETSIZE;
+#else // __linux__
+constexpr unsigned MAX_CPUS = 1024;
+#endif // __linux__
+
+/**
+ * Parses a non-negative decimal number.  Returns false if the string
+ * is empty or contains anything other than digits.
+ */
+bool
+ParseUnsigned (const std::string& str, unsigned& val)
+{
+  if (str.empty () || str.size () > 9)
+    return false;
+
+  val = 0;
+  for (const char c : str)
+    {
+      if (c < '0' || c > '9')
+        return false;
+      val = 10 * val + (c - '0');
+    }
+
+  return true;
+}
+
+} // anonymous namespace
+
+bool
+ParseCpuList (const std::string& str, std::vector<unsigned>& cpus)
+{
+  std::set<unsigned> res;
+
+  if (!str.empty ())
+    {
+      std::istringstream in(str);
+      std::string part;
+      while (std::getline (in, part, ','))
+        {
+          unsigned from, to;
+          const size_t dash = part.find ('-');
+          if (dash == std::string::npos)
+            {
+              if (!ParseUnsigned (part, from))
+                return false;
+              to = from;
+            }
+          else if (!ParseUnsigned (part.substr (0, dash), from)
+                    || !ParseUnsigned (part.substr (dash + 1), to)
+                    || from > to)
+            return false;
+
+          if (to >= MAX_CPUS)
+            return false;
+
+          for (unsigned i = from; i <= to; ++i)
+            res.insert (i);
+        }
+
+      /* getline does not return an empty last part for a trailing comma,
+         so check for that explicitly.  */
+      if (str.back () == ',')
+        return false;
+    }
+
+  cpus.assign (res.begin (), res.end ());
+  return true;
+}
+
+void
+SetCurrentThreadName (const std::string& name)
+{
+#ifdef __linux__
+  const std::string truncated = name.substr (0, MAX_THREAD_NAME);
+  const int rc = pthread_setname_np (pthread_self (), truncated.c_str ());
+  if (rc != 0)
+    LOG (WARNING)
+        << "Failed to set thread name " << truncated << ": "
+        << std::strerror (rc);
+#else // __linux__
+  VLOG (1) << "Thread names are not supported on this platform";
+#endif // __linux__
+}
+
+bool
+ApplyThreadConfig (const ThreadConfig& cfg)
+{
+  bool ok = true;
+
+#ifdef __linux__
+  if (!cfg.cpus.empty ())
+    {
+      cpu_set_t set;
+      CPU_ZERO (&set);
+      for (const unsigned c : cfg.cpus)
+        if (c < CPU_SETSIZE)
+          CPU_SET (c, &set);
+        else
+          LOG (WARNING) << "Ignoring invalid CPU " << c;
+
+      const int rc = pthread_setaffinity_np (pthread_self (),
+                                             sizeof (set), &set);
+      if (rc != 0)
+        {
+          LOG (WARNING) << "Failed to set CPU affinity: " << std::strerror (rc);
+          ok = false;
+        }
+    }
+
+  if (cfg.nice != 0)
+    {
+      /* On Linux, the nice value is a per-thread attribute that can be set
+         through setpriority with the thread ID.  */
+      const pid_t tid = syscall (SYS_gettid);
+      if (setpriority (PRIO_PROCESS, tid, cfg.nice) != 0)
+        {
+          LOG (WARNING)
+              << "Failed to set thread priority to " << cfg.nice << ": "
+              << std::strerror (errno);
+          ok = false;
+        }
+    }
+#else // __linux__
+  if (!cfg.cpus.empty () || cfg.nice != 0)
+    {
+      LOG (WARNING) << "Thread configuration is not supported on this platform";
+      ok = false;
+    }
+#endif // __linux__
+
+  return ok;
+}
+
+void
+ConfigureCurrentThreadOnce (const std::string& name, const ThreadConfig& cfg)
+{
+  thread_local bool configured = false;
+  if (configured)
+    return;
+  configured = true;
+
+  SetCurrentThreadName (name);
+  ApplyThreadConfig (cfg);
+}
+
+} // namespace xaya
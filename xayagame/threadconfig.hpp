@@ -0,0 +1,70 @@
+// Copyright (C) 2019 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef XAYAGAME_THREADCONFIG_HPP
+#define XAYAGAME_THREADCONFIG_HPP
+
+#include <string>
+#include <vector>
+
+namespace xaya
+{
+
+/**
+ * Settings applied to a thread (or a group of threads like the RPC server
+ * pool) when it starts running.  The default-constructed value leaves
+ * everything as it is.
+ */
+struct ThreadConfig
+{
+
+  /**
+   * The CPUs the thread should be pinned to.  If empty, the affinity
+   * is not changed.
+   */
+  std::vector<unsigned> cpus;
+
+  /**
+   * Nice value (scheduling priority) to set for the thread.  Zero means
+   * that the priority is not changed.  Note that lowering the value below
+   * the current one typically requires extra privileges.
+   */
+  int nice = 0;
+
+};
+
+/**
+ * Parses a list of CPUs in the format used e.g. by taskset, like "0-3,6".
+ * Returns false if the string is invalid, including if it contains CPU
+ * numbers that are too large for the system's CPU sets.  An empty string
+ * is valid and yields an empty list.
+ */
+bool ParseCpuList (const std::string& str, std::vector<unsigned>& cpus);
+
+/**
+ * Sets the name of the calling thread, as shown e.g. by top or in
+ * debuggers.  The name is truncated to the 15 characters allowed
+ * by the system.
+ */
+void SetCurrentThreadName (const std::string& name);
+
+/**
+ * Applies the given configuration to the calling thread.  Failures
+ * (e.g. invalid CPUs or missing permissions) are logged as warnings, and
+ * false is returned in that case.
+ */
+bool ApplyThreadConfig (const ThreadConfig& cfg);
+
+/**
+ * Names the calling thread and applies the configuration, unless this
+ * has already been done before for it.  This is useful for threads of pools
+ * that we do not create ourselves, and which can thus only be configured
+ * when they first run our code.
+ */
+void ConfigureCurrentThreadOnce (const std::string& name,
+                                 const ThreadConfig& cfg);
+
+} // namespace xaya
+
+#endif // XAYAGAME_THREADCONFIG_HPP
@@ -0,0 +1,136 @@
+// Copyright (C) 2019 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "threadconfig.hpp"
+
+#include <gtest/gtest.h>
+
+#include <glog/logging.h>
+
+#include <pthread.h>
+#ifdef __linux__
+# include <sched.h>
+# include <sys/resource.h>
+# include <sys/syscall.h>
+# include <unistd.h>
+#endif // __linux__
+
+#include <algorithm>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace xaya
+{
+namespace
+{
+
+TEST (ParseCpuListTests, Valid)
+{
+  std::vector<unsigned> cpus = {42};
+  ASSERT_TRUE (ParseCpuList ("", cpus));
+  EXPECT_TRUE (cpus.empty ());
+
+  ASSERT_TRUE (ParseCpuList ("3", cpus));
+  EXPECT_EQ (cpus, std::vector<unsigned> ({3}));
+
+  ASSERT_TRUE (ParseCpuList ("0-3,6", cpus));
+  EXPECT_EQ (cpus, std::vector<unsigned> ({0, 1, 2, 3, 6}));
+
+  ASSERT_TRUE (ParseCpuList ("5,1-2,2,10-10", cpus));
+  EXPECT_EQ (cpus, std::vector<unsigned> ({1, 2, 5, 10}));
+}
+
+TEST (ParseCpuListTests, Invalid)
+{
+  std::vector<unsigned> cpus;
+  for (const std::string str : {",", "1,", ",1", "1,,2", "a", "-1", "1-",
+                                "3-1", "1-2-3", " 1", "1 ", "0x1",
+                                "999999999", "0-999999999", "4294967295",
+                                "0-4294967295"})
+    EXPECT_FALSE (ParseCpuList (str, cpus)) << str;
+}
+
+#ifdef __linux__
+
+/**
+ * Returns the name of the calling thread.
+ */
+std::string
+GetCurrentThreadName ()
+{
+  char buf[16];
+  CHECK_EQ (pthread_getname_np (pthread_self (), buf, sizeof (buf)), 0);
+  return buf;
+}
+
+TEST (ThreadConfigTests, Name)
+{
+  std::thread ([] ()
+    {
+      SetCurrentThreadName ("xaya-test");
+      EXPECT_EQ (GetCurrentThreadName (), "xaya-test");
+
+      SetCurrentThreadName ("a very long thread name");
+      EXPECT_EQ (GetCurrentThreadName (), "a very long thr");
+    }).join ();
+}
+
+TEST (ThreadConfigTests, Affinity)
+{
+  cpu_set_t allowed;
+  ASSERT_EQ (sched_getaffinity (0, sizeof (allowed), &allowed), 0);
+  unsigned cpu = 0;
+  while (!CPU_ISSET (cpu, &allowed))
+    ++cpu;
+
+  std::thread ([cpu] ()
+    {
+      ThreadConfig cfg;
+      cfg.cpus = {cpu};
+      ASSERT_TRUE (ApplyThreadConfig (cfg));
+
+      cpu_set_t set;
+      ASSERT_EQ (pthread_getaffinity_np (pthread_self (), sizeof (set), &set),
+                 0);
+      EXPECT_EQ (CPU_COUNT (&set), 1);
+      EXPECT_TRUE (CPU_ISSET (cpu, &set));
+    }).join ();
+}
+
+TEST (ThreadConfigTests, Priority)
+{
+  const pid_t mainTid = syscall (SYS_gettid);
+  const int before = getpriority (PRIO_PROCESS, mainTid);
+
+  std::thread ([before] ()
+    {
+      /* Increasing the nice value is always allowed.  */
+      ThreadConfig cfg;
+      cfg.nice = std::min (before + 1, 19);
+      ASSERT_TRUE (ApplyThreadConfig (cfg));
+
+      const pid_t tid = syscall (SYS_gettid);
+      EXPECT_EQ (getpriority (PRIO_PROCESS, tid), cfg.nice);
+    }).join ();
+
+  /* Only the thread itself is affected.  */
+  EXPECT_EQ (getpriority (PRIO_PROCESS, mainTid), before);
+}
+
+TEST (ThreadConfigTests, OnlyOnce)
+{
+  std::thread ([] ()
+    {
+      ConfigureCurrentThreadOnce ("first", ThreadConfig ());
+      EXPECT_EQ (GetCurrentThreadName (), "first");
+      ConfigureCurrentThreadOnce ("second", ThreadConfig ());
+      EXPECT_EQ (GetCurrentThreadName (), "first");
+    }).join ();
+}
+
+#endif // __linux__
+
+} // anonymous namespace
+} // namespace xaya
@@ -74,6 +74,15 @@ TransactionManager::SetBatchSize (const unsigned sz)
     }
 }
 
+void
+TransactionManager::SetFlushTimeLimit (const std::chrono::milliseconds limit)
+{
+  flushTimeLimit = limit;
+  LOG (INFO)
+      << "Set flush time limit for TransactionManager to "
+      << flushTimeLimit.count () << " ms";
+}
+
 void
 TransactionManager::BeginTransaction ()
 {
@@ -89,6 +98,7 @@ TransactionManager::BeginTransaction ()
     {
       LOG (INFO) << "No pending commits, starting new underlying transaction";
       storage->BeginTransaction ();
+      batchStart = std::chrono::steady_clock::now ();
     }
 }
 
@@ -108,6 +118,12 @@ TransactionManager::CommitTransaction ()
 
   if (batchedCommits >= batchSize)
     Flush ();
+  else if (flushTimeLimit.count () > 0
+            && std::chrono::steady_clock::now () - batchStart >= flushTimeLimit)
+    {
+      LOG (INFO) << "Batch has reached the flush time limit";
+      Flush ();
+    }
 }
 
 void
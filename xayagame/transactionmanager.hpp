@@ -10,6 +10,8 @@
 
 #include "storage.hpp"
 
+#include <chrono>
+
 namespace xaya
 {
 namespace internal
@@ -41,6 +43,15 @@ private:
    */
   unsigned batchedCommits = 0;
 
+  /**
+   * Maximum time a batch may stay open before it is committed.  Zero means
+   * that there is no time limit.
+   */
+  std::chrono::milliseconds flushTimeLimit{0};
+
+  /** The time when the currently open underlying transaction was started.  */
+  std::chrono::steady_clock::time_point batchStart;
+
   /**
    * Whether or not a transaction has currently been started *on the manager*.
    * This is independent of batching.
@@ -53,12 +64,6 @@ private:
    */
   bool commitFailed = false;
 
-  /**
-   * Flushes the current batch of transactions to the underlying storage.
-   * This must not be called if a transaction is in progress.
-   */
-  void Flush ();
-
 public:
 
   TransactionManager () = default;
@@ -83,6 +88,15 @@ public:
    */
   void SetBatchSize (unsigned sz);
 
+  /**
+   * Sets a time limit for batches.  If a transaction is committed on the
+   * manager when the batch has been open for at least that long, then the
+   * batch is committed even if it is not yet full.  (There is no timer,
+   * so an idle batch stays open until the next commit.)  Zero disables
+   * the time limit.
+   */
+  void SetFlushTimeLimit (std::chrono::milliseconds limit);
+
   /**
    * Starts a new transaction on the manager.  Depending on batching
    * behaviour, this may or may not start a transaction on the underlying
@@ -112,6 +126,13 @@ public:
    */
   void TryAbortTransaction ();
 
+  /**
+   * Flushes the current batch of transactions to the underlying storage.
+   * This must not be called if a transaction is in progress.  Afterwards,
+   * the storage has no open transaction.
+   */
+  void Flush ();
+
 };
 
 /**
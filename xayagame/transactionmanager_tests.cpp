@@ -13,7 +13,9 @@
 
 #include <glog/logging.h>
 
+#include <chrono>
 #include <stdexcept>
+#include <thread>
 
 namespace xaya
 {
@@ -103,6 +105,33 @@ TEST_F (TransactionManagerTests, BasicBatching)
   tm.CommitTransaction ();
 }
 
+TEST_F (TransactionManagerTests, FlushTimeLimit)
+{
+  {
+    InSequence dummy;
+    EXPECT_CALL (storage, BeginTransactionMock ());
+    EXPECT_CALL (storage, CommitTransactionMock ());
+    EXPECT_CALL (storage, BeginTransactionMock ());
+    EXPECT_CALL (storage, RollbackTransactionMock ());
+  }
+
+  tm.SetBatchSize (100);
+  tm.SetFlushTimeLimit (std::chrono::milliseconds (10));
+
+  tm.BeginTransaction ();
+  tm.CommitTransaction ();
+
+  std::this_thread::sleep_for (std::chrono::milliseconds (20));
+
+  tm.BeginTransaction ();
+  tm.CommitTransaction ();
+
+  /* The new batch is fresh and stays open until we abort it.  */
+  tm.BeginTransaction ();
+  tm.CommitTransaction ();
+  tm.TryAbortTransaction ();
+}
+
 TEST_F (TransactionManagerTests, Rollback)
 {
   {
@@ -0,0 +1,116 @@
+// Copyright (C) 2019 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "workerpool.hpp"
+
+#include "threadconfig.hpp"
+
+#include <glog/logging.h>
+
+namespace xaya
+{
+
+WorkerPool::WorkerPool (const unsigned n, const std::string& name)
+{
+  LOG (INFO) << "Starting worker pool " << name << " with " << n << " threads";
+  for (unsigned i = 0; i < n; ++i)
+    threads.emplace_back ([this, name] ()
+      {
+        WorkerLoop (name);
+      });
+}
+
+WorkerPool::~WorkerPool ()
+{
+  {
+    std::lock_guard<std::mutex> lock(mut);
+    CHECK (tasks == nullptr);
+    shutdown = true;
+  }
+  cvWork.notify_all ();
+
+  for (auto& t : threads)
+    t.join ();
+}
+
+void
+WorkerPool::ProcessTasks (std::unique_lock<std::mutex>& lock)
+{
+  while (tasks != nullptr && next < tasks->size ())
+    {
+      const Task& task = (*tasks)[next++];
+
+      lock.unlock ();
+      std::exception_ptr exc;
+      try
+        {
+          task ();
+        }
+      catch (...)
+        {
+          exc = std::current_exception ();
+        }
+      lock.lock ();
+
+      if (exc != nullptr && error == nullptr)
+        error = exc;
+
+      CHECK_GT (remaining, 0);
+      --remaining;
+      if (remaining == 0)
+        cvDone.notify_all ();
+    }
+}
+
+void
+WorkerPool::WorkerLoop (const std::string& name)
+{
+  SetCurrentThreadName (name);
+
+  std::unique_lock<std::mutex> lock(mut);
+  while (true)
+    {
+      cvWork.wait (lock, [this] ()
+        {
+          return shutdown || (tasks != nullptr && next < tasks->size ());
+        });
+      if (shutdown)
+        break;
+
+      ProcessTasks (lock);
+    }
+}
+
+void
+WorkerPool::Run (const std::vector<Task>& batch)
+{
+  if (batch.empty ())
+    return;
+
+  std::lock_guard<std::mutex> runLock(mutRun);
+  std::unique_lock<std::mutex> lock(mut);
+
+  CHECK (tasks == nullptr);
+  tasks = &batch;
+  next = 0;
+  remaining = batch.size ();
+  error = nullptr;
+  cvWork.notify_all ();
+
+  ProcessTasks (lock);
+  cvDone.wait (lock, [this] ()
+    {
+      return remaining == 0;
+    });
+
+  tasks = nullptr;
+  std::exception_ptr exc = error;
+  error = nullptr;
+  lock.unlock ();
+
+  if (exc != nullptr)
+    std::rethrow_exception (exc);
+}
+
+} // namespace xaya
@@ -0,0 +1,111 @@
+// Copyright (C) 2019 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef XAYAGAME_WORKERPOOL_HPP
+#define XAYAGAME_WORKERPOOL_HPP
+
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace xaya
+{
+
+/**
+ * A fixed pool of worker threads, which can be used to run a batch of
+ * independent tasks in parallel and wait for all of them to finish.
+ * The calling thread takes part in processing the tasks as well, so that
+ * a pool with zero threads simply runs everything sequentially.
+ */
+class WorkerPool
+{
+
+public:
+
+  /** Type of the tasks that can be run.  */
+  using Task = std::function<void ()>;
+
+private:
+
+  /** The worker threads.  */
+  std::vector<std::thread> threads;
+
+  /** Lock for the current batch of tasks.  */
+  std::mutex mut;
+
+  /** Signalled when there is new work or we shut down.  */
+  std::condition_variable cvWork;
+
+  /** Signalled when all tasks of the current batch are done.  */
+  std::condition_variable cvDone;
+
+  /** The tasks of the current batch (null if there is none).  */
+  const std::vector<Task>* tasks = nullptr;
+
+  /** Index of the next task to start.  */
+  size_t next = 0;
+
+  /** Number of tasks of the current batch that are not yet finished.  */
+  size_t remaining = 0;
+
+  /** The first exception thrown by a task of the current batch.  */
+  std::exception_ptr error;
+
+  /** Set to true when the pool is being destructed.  */
+  bool shutdown = false;
+
+  /** Lock that makes sure only one batch is run at a time.  */
+  std::mutex mutRun;
+
+  /**
+   * Runs tasks of the current batch until none are left to start.  Must be
+   * called with the lock held, which is released while running a task.
+   */
+  void ProcessTasks (std::unique_lock<std::mutex>& lock);
+
+  /**
+   * Main function of the worker threads.
+   */
+  void WorkerLoop (const std::string& name);
+
+public:
+
+  /**
+   * Starts a pool with the given number of threads.  They are named after
+   * the given name (e.g. as shown in top).
+   */
+  explicit WorkerPool (unsigned n, const std::string& name);
+
+  ~WorkerPool ();
+
+  WorkerPool () = delete;
+  WorkerPool (const WorkerPool&) = delete;
+  void operator= (const WorkerPool&) = delete;
+
+  /**
+   * Returns the number of worker threads (not counting the caller).
+   */
+  size_t
+  GetSize () const
+  {
+    return threads.size ();
+  }
+
+  /**
+   * Runs all the given tasks and returns when they are done.  If a task
+   * throws, the other tasks are still run and the first exception is
+   * rethrown afterwards.
+   */
+  void Run (const std::vector<Task>& batch);
+
+};
+
+} // namespace xaya
+
+#endif // XAYAGAME_WORKERPOOL_HPP
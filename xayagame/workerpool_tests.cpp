@@ -0,0 +1,99 @@
+// Copyright (C) 2019 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "workerpool.hpp"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <stdexcept>
+#include <vector>
+
+namespace xaya
+{
+namespace
+{
+
+/**
+ * Constructs a batch of n tasks that each increment the corresponding
+ * entry in the given vector.
+ */
+std::vector<WorkerPool::Task>
+CountingTasks (const size_t n, std::vector<int>& counts)
+{
+  counts.assign (n, 0);
+
+  std::vector<WorkerPool::Task> res;
+  for (size_t i = 0; i < n; ++i)
+    res.push_back ([&counts, i] ()
+      {
+        ++counts[i];
+      });
+
+  return res;
+}
+
+TEST (WorkerPoolTests, RunsAllTasks)
+{
+  WorkerPool pool(4, "test");
+  EXPECT_EQ (pool.GetSize (), 4);
+
+  std::vector<int> counts;
+  pool.Run (CountingTasks (1000, counts));
+  EXPECT_EQ (counts, std::vector<int> (1000, 1));
+}
+
+TEST (WorkerPoolTests, WithoutThreads)
+{
+  WorkerPool pool(0, "test");
+  EXPECT_EQ (pool.GetSize (), 0);
+
+  std::vector<int> counts;
+  pool.Run (CountingTasks (10, counts));
+  EXPECT_EQ (counts, std::vector<int> (10, 1));
+}
+
+TEST (WorkerPoolTests, EmptyBatch)
+{
+  WorkerPool pool(2, "test");
+  pool.Run ({});
+}
+
+TEST (WorkerPoolTests, RepeatedBatches)
+{
+  WorkerPool pool(3, "test");
+
+  for (size_t n = 1; n <= 50; ++n)
+    {
+      std::vector<int> counts;
+      pool.Run (CountingTasks (n, counts));
+      EXPECT_EQ (counts, std::vector<int> (n, 1));
+    }
+}
+
+TEST (WorkerPoolTests, Exception)
+{
+  WorkerPool pool(2, "test");
+
+  std::atomic<unsigned> done(0);
+  std::vector<WorkerPool::Task> tasks;
+  for (unsigned i = 0; i < 20; ++i)
+    tasks.push_back ([&done, i] ()
+      {
+        ++done;
+        if (i % 5 == 0)
+          throw std::runtime_error ("failed");
+      });
+
+  EXPECT_THROW (pool.Run (tasks), std::runtime_error);
+  EXPECT_EQ (done, 20);
+
+  /* The pool should be usable again afterwards.  */
+  std::vector<int> counts;
+  pool.Run (CountingTasks (10, counts));
+  EXPECT_EQ (counts, std::vector<int> (10, 1));
+}
+
+} // anonymous namespace
+} // namespace xaya
@@ -0,0 +1,116 @@
+// Copyright (C) 2019 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "zmqpublisher.hpp"
+
+#include <glog/logging.h>
+
+namespace xaya
+{
+namespace internal
+{
+
+ZmqPublisher::ZmqPublisher (const std::string& address)
+  : addr(address), ctx(), socket(ctx, ZMQ_PUB)
+{
+  /* Do not block on shutdown if subscribers have not received everything
+     yet.  The notifications are best-effort anyway.  */
+  const int linger = 0;
+  socket.setsockopt (ZMQ_LINGER, &linger, sizeof (linger));
+
+  LOG (INFO) << "Binding ZMQ publisher to address: " << addr;
+  socket.bind (addr.c_str ());
+}
+
+void
+ZmqPublisher::SendPart (const std::string& data, const bool more)
+{
+  zmq::message_t msg(data.begin (), data.end ());
+  CHECK (socket.send (msg, more ? ZMQ_SNDMORE : 0))
+      << "Failed to send ZMQ message";
+}
+
+void
+ZmqPublisher::Publish (const std::string& topic, const std::string& payload)
+{
+  uint32_t& seq = nextSeq[topic];
+  VLOG (1) << "Publishing " << topic << " with sequence number " << seq;
+  VLOG (2) << "Payload:\n" << payload;
+
+  std::string seqBytes(4, '\0');
+  for (int i = 0; i < 4; ++i)
+    seqBytes[i] = static_cast<char> ((seq >> (8 * i)) & 0xFF);
+
+  SendPart (topic, true);
+  SendPart (payload, true);
+  SendPart (seqBytes, false);
+
+  ++seq;
+}
+
+namespace
+{
+
+/**
+ * Checks if the value has null members in (possibly nested) objects.  Arrays
+ * are not looked into, since they are replaced as a whole by merge patches.
+ */
+bool
+HasNullMembers (const Json::Value& val)
+{
+  if (!val.isObject ())
+    return false;
+
+  for (const auto& member : val)
+    if (member.isNull () || HasNullMembers (member))
+      return true;
+
+  return false;
+}
+
+} // anonymous namespace
+
+bool
+JsonMergePatch (const Json::Value& oldValue, const Json::Value& newValue,
+                Json::Value& patch)
+{
+  /* A non-object patch replaces the old value as a whole.  An object patch
+     is applied recursively to an empty object, so that it can not contain
+     null members.  */
+  if (!oldValue.isObject () || !newValue.isObject ())
+    {
+      if (HasNullMembers (newValue))
+        return false;
+      patch = newValue;
+      return true;
+    }
+
+  patch = Json::Value (Json::objectValue);
+
+  for (const auto& key : oldValue.getMemberNames ())
+    if (!newValue.isMember (key))
+      patch[key] = Json::Value ();
+
+  for (const auto& key : newValue.getMemberNames ())
+    {
+      /* For a missing key, this is null (and thus not an object).  */
+      const Json::Value& oldMember = oldValue[key];
+      const Json::Value& newMember = newValue[key];
+      if (oldValue.isMember (key) && oldMember == newMember)
+        continue;
+
+      if (newMember.isNull ())
+        return false;
+
+      Json::Value memberPatch;
+      if (!JsonMergePatch (oldMember, newMember, memberPatch))
+        return false;
+      patch[key] = std::move (memberPatch);
+    }
+
+  return true;
+}
+
+} // namespace internal
+} // namespace xaya
@@ -0,0 +1,96 @@
+// Copyright (C) 2019 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef XAYAGAME_ZMQPUBLISHER_HPP
+#define XAYAGAME_ZMQPUBLISHER_HPP
+
+/* This file is an implementation detail of Game and should not be
+   used directly by external code!  */
+
+#include <zmq.hpp>
+
+#include <json/json.h>
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+
+namespace xaya
+{
+namespace internal
+{
+
+/**
+ * A ZMQ PUB socket that sends notifications in the same format as the
+ * Xaya daemon does:  Three-part messages consisting of the topic, the
+ * payload and a four-byte little-endian sequence number that is incremented
+ * for each message per topic.  This allows consumers like ZmqSubscriber
+ * to detect missed messages.
+ *
+ * This class is not thread-safe.  Game only uses it while holding its lock.
+ */
+class ZmqPublisher
+{
+
+private:
+
+  /** The ZMQ endpoint we are bound to.  */
+  const std::string addr;
+  /** The ZMQ context used by this instance.  */
+  zmq::context_t ctx;
+  /** The PUB socket.  */
+  zmq::socket_t socket;
+
+  /** The next sequence number for each topic.  */
+  std::unordered_map<std::string, uint32_t> nextSeq;
+
+  /**
+   * Sends a single part of the message, with the "more" flag set or not.
+   */
+  void SendPart (const std::string& data, bool more);
+
+public:
+
+  /**
+   * Constructs the publisher and binds it to the given endpoint.
+   */
+  explicit ZmqPublisher (const std::string& address);
+
+  ZmqPublisher () = delete;
+  ZmqPublisher (const ZmqPublisher&) = delete;
+  void operator= (const ZmqPublisher&) = delete;
+
+  /**
+   * Returns the endpoint the publisher is bound to.
+   */
+  const std::string&
+  GetEndpoint () const
+  {
+    return addr;
+  }
+
+  /**
+   * Publishes a message with the given topic and payload.
+   */
+  void Publish (const std::string& topic, const std::string& payload);
+
+};
+
+/**
+ * Computes a JSON merge patch (RFC 7396) that transforms the old into the
+ * new value.  Unchanged object members are left out, members removed from
+ * objects are set to null, and everything else is replaced by the new value.
+ * This is used to publish game-state diffs.
+ *
+ * Null values inside objects of the new value can not always be represented,
+ * since they mean "removed" in a merge patch.  If the patch would have to
+ * contain such a value, false is returned.
+ */
+bool JsonMergePatch (const Json::Value& oldValue, const Json::Value& newValue,
+                     Json::Value& patch);
+
+} // namespace internal
+} // namespace xaya
+
+#endif // XAYAGAME_ZMQPUBLISHER_HPP
@@ -0,0 +1,220 @@
+// Copyright (C) 2019 The Xaya developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "zmqpublisher.hpp"
+
+#include <zmq.hpp>
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace xaya
+{
+namespace internal
+{
+namespace
+{
+
+constexpr const char IPC_ENDPOINT[] = "ipc:///tmp/xayagame_zmqpublisher_tests";
+
+const Json::Value
+ParseJson (const std::string& str)
+{
+  Json::Value val;
+  std::istringstream in(str);
+  in >> val;
+  return val;
+}
+
+/* ************************************************************************** */
+
+class ZmqPublisherTests : public testing::Test
+{
+
+protected:
+
+  ZmqPublisher publisher;
+
+  /* ZMQ context and socket used for receiving the published messages.  */
+  zmq::context_t zmqCtx;
+  zmq::socket_t zmqSocket;
+
+  ZmqPublisherTests ()
+    : publisher(IPC_ENDPOINT), zmqCtx(), zmqSocket(zmqCtx, ZMQ_SUB)
+  {
+    zmqSocket.setsockopt (ZMQ_SUBSCRIBE, "", 0);
+    zmqSocket.connect (IPC_ENDPOINT);
+
+    /* Sleep for "some time" to avoid the "slow joiner syndrome".  */
+    std::this_thread::sleep_for (std::chrono::milliseconds (10));
+  }
+
+  /**
+   * Receives a multipart message and returns the parts as strings.
+   */
+  std::vector<std::string>
+  ReceiveMultipart ()
+  {
+    std::vector<std::string> parts;
+    while (true)
+      {
+        zmq::message_t msg;
+        EXPECT_TRUE (zmqSocket.recv (&msg));
+        const char* data = static_cast<const char*> (msg.data ());
+        parts.emplace_back (data, data + msg.size ());
+
+        int more;
+        size_t moreSize = sizeof (more);
+        zmqSocket.getsockopt (ZMQ_RCVMORE, &more, &moreSize);
+        if (!more)
+          return parts;
+      }
+  }
+
+};
+
+TEST_F (ZmqPublisherTests, Endpoint)
+{
+  EXPECT_EQ (publisher.GetEndpoint (), IPC_ENDPOINT);
+}
+
+TEST_F (ZmqPublisherTests, MessageFormat)
+{
+  publisher.Publish ("topic", "payload");
+
+  const auto parts = ReceiveMultipart ();
+  ASSERT_EQ (parts.size (), 3);
+  EXPECT_EQ (parts[0], "topic");
+  EXPECT_EQ (parts[1], "payload");
+  EXPECT_EQ (parts[2], std::string (4, '\0'));
+}
+
+TEST_F (ZmqPublisherTests, SequenceNumbersPerTopic)
+{
+  for (unsigned i = 0; i < 258; ++i)
+    publisher.Publish ("a", "");
+  publisher.Publish ("b", "");
+
+  for (unsigned i = 0; i < 257; ++i)
+    ReceiveMultipart ();
+
+  auto parts = ReceiveMultipart ();
+  ASSERT_EQ (parts.size (), 3);
+  EXPECT_EQ (parts[0], "a");
+  EXPECT_EQ (parts[2], std::string ("\x01\x01\x00\x00", 4));
+
+  parts = ReceiveMultipart ();
+  ASSERT_EQ (parts.size (), 3);
+  EXPECT_EQ (parts[0], "b");
+  EXPECT_EQ (parts[2], std::string (4, '\0'));
+}
+
+/* ************************************************************************** */
+
+class JsonMergePatchTests : public testing::Test
+{
+
+protected:
+
+  /**
+   * Computes the merge patch between the given values, expecting that
+   * it is possible.
+   */
+  static Json::Value
+  Patch (const Json::Value& oldValue, const Json::Value& newValue)
+  {
+    Json::Value res;
+    EXPECT_TRUE (JsonMergePatch (oldValue, newValue, res));
+    return res;
+  }
+
+  /**
+   * Expects that no merge patch between the values is possible.
+   */
+  static void
+  ExpectImpossible (const std::string& oldValue, const std::string& newValue)
+  {
+    Json::Value res;
+    EXPECT_FALSE (JsonMergePatch (ParseJson (oldValue), ParseJson (newValue),
+                                  res))
+        << oldValue << " -> " << newValue;
+  }
+
+};
+
+TEST_F (JsonMergePatchTests, NonObjects)
+{
+  EXPECT_EQ (Patch (ParseJson ("1"), ParseJson ("[1, 2]")),
+             ParseJson ("[1, 2]"));
+  EXPECT_EQ (Patch (ParseJson ("{\"a\": 1}"), ParseJson ("\"x\"")),
+             ParseJson ("\"x\""));
+  EXPECT_EQ (Patch (ParseJson ("[1]"), ParseJson ("{\"a\": 1}")),
+             ParseJson ("{\"a\": 1}"));
+  EXPECT_EQ (Patch (ParseJson ("{\"a\": 1}"), ParseJson ("null")),
+             ParseJson ("null"));
+}
+
+TEST_F (JsonMergePatchTests, Objects)
+{
+  const Json::Value oldValue = ParseJson (R"({
+    "same": {"x": 1},
+    "removed": 5,
+    "changed": [1, 2],
+    "nested":
+      {
+        "same": true,
+        "changed": "foo",
+        "removed": null
+      }
+  })");
+  const Json::Value newValue = ParseJson (R"({
+    "same": {"x": 1},
+    "changed": [2],
+    "added": {"y": 2},
+    "nested":
+      {
+        "same": true,
+        "changed": "bar"
+      }
+  })");
+
+  EXPECT_EQ (Patch (oldValue, newValue), ParseJson (R"({
+    "removed": null,
+    "changed": [2],
+    "added": {"y": 2},
+    "nested":
+      {
+        "changed": "bar",
+        "removed": null
+      }
+  })"));
+
+  EXPECT_EQ (Patch (newValue, newValue), Json::Value (Json::objectValue));
+}
+
+TEST_F (JsonMergePatchTests, NullMembers)
+{
+  /* Unchanged nulls and nulls inside arrays are fine.  */
+  EXPECT_EQ (Patch (ParseJson (R"({"a": null, "b": 1})"),
+                    ParseJson (R"({"a": null, "b": 2})")),
+             ParseJson (R"({"b": 2})"));
+  EXPECT_EQ (Patch (ParseJson (R"({"a": 1})"),
+                    ParseJson (R"({"a": [null, {"x": null}]})")),
+             ParseJson (R"({"a": [null, {"x": null}]})"));
+
+  ExpectImpossible (R"({"a": 1})", R"({"a": null})");
+  ExpectImpossible (R"({})", R"({"a": null})");
+  ExpectImpossible (R"({})", R"({"a": {"b": {"c": null}}})");
+  ExpectImpossible (R"({"a": 1})", R"({"a": {"b": null}})");
+  ExpectImpossible ("[]", R"({"a": null})");
+}
+
+} // anonymous namespace
+} // namespace internal
+} // namespace xaya
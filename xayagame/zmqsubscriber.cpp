@@ -4,6 +4,8 @@
 
 #include "zmqsubscriber.hpp"
 
+#include "allocstats.hpp"
+
 #include <glog/logging.h>
 
 #include <sstream>
@@ -13,11 +15,50 @@ namespace xaya
 namespace internal
 {
 
+NotificationDeduplicator::NotificationDeduplicator (const size_t numSources,
+                                                    const size_t w)
+  : window(w), received(numSources)
+{}
+
+bool
+NotificationDeduplicator::ShouldApply (const size_t source,
+                                       const std::string& key)
+{
+  CHECK_LT (source, received.size ());
+  const unsigned cnt = ++received[source][key];
+
+  const auto mit = applied.find (key);
+  if (mit == applied.end ())
+    {
+      applied.emplace (key, cnt);
+      order.push_back (key);
+
+      while (order.size () > window)
+        {
+          const std::string& oldest = order.front ();
+          applied.erase (oldest);
+          for (auto& r : received)
+            r.erase (oldest);
+          order.pop_front ();
+        }
+
+      return true;
+    }
+
+  if (cnt <= mit->second)
+    return false;
+
+  mit->second = cnt;
+  return true;
+}
+
+constexpr size_t ZmqSubscriber::DEDUP_WINDOW;
+
 ZmqSubscriber::~ZmqSubscriber ()
 {
   if (IsRunning ())
     Stop ();
-  CHECK (socket == nullptr);
+  CHECK (sockets.empty ());
 }
 
 void
@@ -27,6 +68,20 @@ ZmqSubscriber::SetEndpoint (const std::string& address)
   addr = address;
 }
 
+void
+ZmqSubscriber::AddAdditionalEndpoint (const std::string& address)
+{
+  CHECK (!IsRunning ());
+  additionalAddrs.push_back (address);
+}
+
+void
+ZmqSubscriber::SetWorkerThreadConfig (const ThreadConfig& cfg)
+{
+  CHECK (!IsRunning ());
+  workerConfig = cfg;
+}
+
 void
 ZmqSubscriber::AddListener (const std::string& gameId, ZmqListener* listener)
 {
@@ -34,10 +89,66 @@ ZmqSubscriber::AddListener (const std::string& gameId, ZmqListener* listener)
   listeners.emplace (gameId, listener);
 }
 
+bool
+ZmqSubscriber::WaitForMessage (size_t& source)
+{
+  /* With just a single socket, we simply block in recv (with a timeout)
+     as before.  */
+  if (sockets.size () == 1)
+    {
+      source = 0;
+      return true;
+    }
+
+  std::vector<zmq::pollitem_t> items;
+  for (const auto& s : sockets)
+    items.push_back ({static_cast<void*> (*s), 0, ZMQ_POLLIN, 0});
+
+  while (true)
+    {
+      {
+        std::lock_guard<std::mutex> lock(mut);
+        if (shouldStop)
+          return false;
+      }
+
+      int ready;
+      try
+        {
+          ready = zmq::poll (items, 100);
+        }
+      catch (const zmq::error_t& exc)
+        {
+          if (exc.num () == ETERM)
+            return false;
+          throw;
+        }
+
+      if (ready == 0)
+        continue;
+
+      /* Serve ready sockets in round-robin order, so that a flood of
+         notifications from one source does not starve the others.  */
+      for (size_t i = 1; i <= items.size (); ++i)
+        {
+          const size_t idx = (lastSource + i) % items.size ();
+          if (items[idx].revents & ZMQ_POLLIN)
+            {
+              source = lastSource = idx;
+              return true;
+            }
+        }
+    }
+}
+
 bool
 ZmqSubscriber::ReceiveMultiparts (std::string& topic, std::string& payload,
-                                  uint32_t& seq)
+                                  uint32_t& seq, size_t& source)
 {
+  if (!WaitForMessage (source))
+    return false;
+  zmq::socket_t& socket = *sockets[source];
+
   for (unsigned parts = 1; ; ++parts)
     {
       zmq::message_t msg;
@@ -46,7 +157,7 @@ ZmqSubscriber::ReceiveMultiparts (std::string& topic, std::string& payload,
           bool gotMessage = false;
           while (!gotMessage)
             {
-              gotMessage = socket->recv (&msg);
+              gotMessage = socket.recv (&msg);
 
               /* Check if a shutdown is requested.  */
               std::lock_guard<std::mutex> lock(mut);
@@ -101,7 +212,7 @@ ZmqSubscriber::ReceiveMultiparts (std::string& topic, std::string& payload,
 
       int more;
       size_t moreSize = sizeof (more);
-      socket->getsockopt (ZMQ_RCVMORE, &more, &moreSize);
+      socket.getsockopt (ZMQ_RCVMORE, &more, &moreSize);
       if (!more)
         {
           CHECK_EQ (parts, 3) << "Expected exactly three message parts in ZMQ";
@@ -137,6 +248,9 @@ ZmqSubscriber::Listen (ZmqSubscriber* self)
   if (self->noListeningForTesting)
     return;
 
+  SetCurrentThreadName ("xaya-zmq");
+  ApplyThreadConfig (self->workerConfig);
+
   Json::CharReaderBuilder rbuilder;
   rbuilder["allowComments"] = false;
   rbuilder["strictRoot"] = true;
@@ -146,9 +260,12 @@ ZmqSubscriber::Listen (ZmqSubscriber* self)
   std::string topic;
   std::string payload;
   uint32_t seq;
-  while (self->ReceiveMultiparts (topic, payload, seq))
+  size_t source;
+  while (self->ReceiveMultiparts (topic, payload, seq, source))
     {
-      VLOG (1) << "Received " << topic << " with sequence number " << seq;
+      VLOG (1)
+          << "Received " << topic << " with sequence number " << seq
+          << " from source " << source;
       VLOG (2) << "Payload:\n" << payload;
 
       std::string gameId;
@@ -160,11 +277,12 @@ ZmqSubscriber::Listen (ZmqSubscriber* self)
       else
         LOG (FATAL) << "Unexpected topic of ZMQ notification: " << topic;
 
-      auto mit = self->lastSeq.find (topic);
+      auto& sourceSeq = self->lastSeq[source];
+      auto mit = sourceSeq.find (topic);
       bool seqMismatch;
-      if (mit == self->lastSeq.end ())
+      if (mit == sourceSeq.end ())
         {
-          self->lastSeq.emplace (topic, seq);
+          sourceSeq.emplace (topic, seq);
           seqMismatch = true;
         }
       else
@@ -178,10 +296,30 @@ ZmqSubscriber::Listen (ZmqSubscriber* self)
         continue;
 
       Json::Value data;
-      std::string parseErrs;
-      std::istringstream in(payload);
-      CHECK (Json::parseFromStream (rbuilder, in, &data, &parseErrs))
-          << "Error parsing notification JSON: " << parseErrs;
+      {
+        AllocPhaseScope phase(AllocPhase::PARSE);
+        std::string parseErrs;
+        std::istringstream in(payload);
+        CHECK (Json::parseFromStream (rbuilder, in, &data, &parseErrs))
+            << "Error parsing notification JSON: " << parseErrs;
+      }
+
+      /* With multiple sources, the same notification arrives once from each
+         of them.  Apply the first copy and drop the others.  A sequence
+         mismatch is only relevant for the copy that is applied; if some
+         source missed a notification that was applied from another one,
+         nothing is lost.  */
+      if (self->dedup != nullptr)
+        {
+          std::ostringstream key;
+          key << topic << '\n' << data["block"]["hash"].asString ()
+              << '\n' << data.get ("reqtoken", "").asString ();
+          if (!self->dedup->ShouldApply (source, key.str ()))
+            {
+              VLOG (1) << "Dropping duplicate notification from " << source;
+              continue;
+            }
+        }
 
       for (auto i = range.first; i != range.second; ++i)
         if (isAttach)
@@ -196,21 +334,38 @@ ZmqSubscriber::Start ()
 {
   CHECK (IsEndpointSet ());
   LOG (INFO) << "Starting ZMQ subscriber at address: " << addr;
+  for (const auto& a : additionalAddrs)
+    LOG (INFO) << "Additional ZMQ endpoint: " << a;
 
   CHECK (!IsRunning ());
-  socket = std::make_unique<zmq::socket_t> (ctx, ZMQ_SUB);
-  for (const auto& entry : listeners)
-    for (const std::string cmd : {"game-block-attach", "game-block-detach"})
-      {
-        const std::string topic = cmd + " json " + entry.first;
-        socket->setsockopt (ZMQ_SUBSCRIBE, topic.data (), topic.size ());
-      }
-  const int timeout = 100;
-  socket->setsockopt (ZMQ_RCVTIMEO, &timeout, sizeof (timeout));
-  socket->connect (addr.c_str ());
+  std::vector<std::string> allAddrs = {addr};
+  allAddrs.insert (allAddrs.end (),
+                   additionalAddrs.begin (), additionalAddrs.end ());
+  CHECK (sockets.empty ());
+  for (const auto& a : allAddrs)
+    {
+      auto socket = std::make_unique<zmq::socket_t> (ctx, ZMQ_SUB);
+      for (const auto& entry : listeners)
+        for (const std::string cmd : {"game-block-attach", "game-block-detach"})
+          {
+            const std::string topic = cmd + " json " + entry.first;
+            socket->setsockopt (ZMQ_SUBSCRIBE, topic.data (), topic.size ());
+          }
+      const int timeout = 100;
+      socket->setsockopt (ZMQ_RCVTIMEO, &timeout, sizeof (timeout));
+      socket->connect (a.c_str ());
+      sockets.push_back (std::move (socket));
+    }
 
-  /* Reset last-seen sequence numbers for a fresh start.  */
-  lastSeq.clear ();
+  /* Reset last-seen sequence numbers and de-duplication state for a
+     fresh start.  */
+  lastSeq.assign (sockets.size (), {});
+  lastSource = 0;
+  if (sockets.size () > 1)
+    dedup = std::make_unique<NotificationDeduplicator> (sockets.size (),
+                                                        DEDUP_WINDOW);
+  else
+    dedup.reset ();
 
   shouldStop = false;
   worker = std::make_unique<std::thread> (&ZmqSubscriber::Listen, this);
@@ -229,7 +384,7 @@ ZmqSubscriber::Stop ()
 
   worker->join ();
   worker.reset ();
-  socket.reset ();
+  sockets.clear ();
 }
 
 } // namespace internal
@@ -8,15 +8,19 @@
 /* This file is an implementation detail of Game and should not be
    used directly by external code!  */
 
+#include "threadconfig.hpp"
+
 #include <zmq.hpp>
 
 #include <json/json.h>
 
+#include <deque>
 #include <memory>
 #include <mutex>
 #include <string>
 #include <thread>
 #include <unordered_map>
+#include <vector>
 
 namespace xaya
 {
@@ -53,31 +57,109 @@ public:
 
 };
 
+/**
+ * Helper class for de-duplicating notifications that are received from
+ * multiple sources (Xaya daemons), which all deliver the same stream of
+ * notifications, possibly at different times.
+ *
+ * Each notification is identified by a key (e.g. topic, block hash and
+ * reqtoken).  The same key may legitimately be delivered more than once
+ * by each source (e.g. when a block is attached, detached and attached
+ * again during reorgs).  Thus we count how often each source has delivered
+ * a given key, and the n-th occurrence of a key is applied when the first
+ * source delivers it.  Later copies from other sources are dropped.
+ *
+ * Only the most recent keys are remembered.  If a source lags behind the
+ * others by more than that window, its copies are applied again (which the
+ * listener then has to detect, as it would for an out-of-order
+ * notification anyway).
+ */
+class NotificationDeduplicator
+{
+
+private:
+
+  /** Number of distinct keys that are remembered.  */
+  const size_t window;
+
+  /** For each source, how often it delivered each key.  */
+  std::vector<std::unordered_map<std::string, unsigned>> received;
+
+  /** For each key, how many occurrences have been applied.  */
+  std::unordered_map<std::string, unsigned> applied;
+
+  /** The remembered keys, in the order they were first seen.  */
+  std::deque<std::string> order;
+
+public:
+
+  explicit NotificationDeduplicator (size_t numSources, size_t w);
+
+  NotificationDeduplicator () = delete;
+  NotificationDeduplicator (const NotificationDeduplicator&) = delete;
+  void operator= (const NotificationDeduplicator&) = delete;
+
+  /**
+   * Records that the given source delivered a notification with the given
+   * key, and returns true if it is the first copy (and should thus be
+   * applied).
+   */
+  bool ShouldApply (size_t source, const std::string& key);
+
+};
+
 /**
  * The Game subsystem that implements the ZMQ subscriber to the Xaya daemon's
  * game-block-* notifications (for a particular game ID).
+ *
+ * In addition to the main endpoint, notifications can be received from
+ * additional endpoints (of other Xaya daemons) at the same time.  This
+ * "hedges" against a single daemon being slow or unavailable:  Each
+ * notification is forwarded to the listeners as soon as the first copy of
+ * it arrives from any of the sources, and the other copies are dropped.
  */
 class ZmqSubscriber
 {
 
 private:
 
-  /** The ZMQ endpoint to connect to.  */
+  /**
+   * Number of distinct notifications remembered for de-duplication when
+   * multiple endpoints are used.
+   */
+  static constexpr size_t DEDUP_WINDOW = 1024;
+
+  /** The main ZMQ endpoint to connect to.  */
   std::string addr;
+  /** Additional ZMQ endpoints to receive the same notifications from.  */
+  std::vector<std::string> additionalAddrs;
   /** The ZMQ context that is used by the this instance.  */
   zmq::context_t ctx;
-  /** The ZMQ socket used to subscribe to the Xaya daemon, if connected.  */
-  std::unique_ptr<zmq::socket_t> socket;
+  /**
+   * The ZMQ sockets used to subscribe to the Xaya daemons, if connected.
+   * The first one is for the main endpoint, followed by the additional ones
+   * in order.
+   */
+  std::vector<std::unique_ptr<zmq::socket_t>> sockets;
 
   /** Game IDs and associated listeners.  */
   std::unordered_multimap<std::string, ZmqListener*> listeners;
 
-  /** Last sequence numbers for each topic.  */
-  std::unordered_map<std::string, uint32_t> lastSeq;
+  /** For each source, the last sequence numbers for each topic.  */
+  std::vector<std::unordered_map<std::string, uint32_t>> lastSeq;
+
+  /** De-duplication of notifications if we have multiple sources.  */
+  std::unique_ptr<NotificationDeduplicator> dedup;
+
+  /** Index of the source that was read from last (for fairness).  */
+  size_t lastSource = 0;
 
   /** The running ZMQ listener thread, if any.  */
   std::unique_ptr<std::thread> worker;
 
+  /** Configuration applied to the listener thread when it starts.  */
+  ThreadConfig workerConfig;
+
   /** Signals the listener to stop.  */
   bool shouldStop;
   /** Mutex guarding shouldStop.  */
@@ -91,12 +173,20 @@ private:
 
   /**
    * Receives a three-part message sent by the Xaya daemon (consisting
-   * of topic and payload as strings as well as the serial number).  Returns
-   * false if the socket was closed or the subscriber stopped, and errors out
-   * on any other errors.
+   * of topic and payload as strings as well as the serial number) from
+   * any of the sockets.  The index of the socket it was received on is
+   * returned in source.  Returns false if the socket was closed or the
+   * subscriber stopped, and errors out on any other errors.
    */
   bool ReceiveMultiparts (std::string& topic, std::string& payload,
-                          uint32_t& seq);
+                          uint32_t& seq, size_t& source);
+
+  /**
+   * Waits until one of the sockets has a message ready and returns its
+   * index.  Returns false if the subscriber is stopped or the context
+   * terminated before.
+   */
+  bool WaitForMessage (size_t& source);
 
   /**
    * Listens on the ZMQ socket for messages until the socket is closed.
@@ -121,6 +211,21 @@ public:
    */
   void SetEndpoint (const std::string& address);
 
+  /**
+   * Adds an additional endpoint (of another Xaya daemon) from which the
+   * same notifications are received as well.  Must not be called anymore
+   * after Start() has been called.
+   */
+  void AddAdditionalEndpoint (const std::string& address);
+
+  /**
+   * Sets the configuration (CPU affinity and priority) for the listener
+   * thread.  Since that thread processes all blocks, this controls where
+   * the game's hot path runs.  Must not be called anymore after Start()
+   * has been called.
+   */
+  void SetWorkerThreadConfig (const ThreadConfig& cfg);
+
   /**
    * Returns whether the endpoint is set.
    */
@@ -109,7 +109,8 @@ protected:
   ReceiveMultiparts (ZmqSubscriber& zmq, std::string& topic,
                      std::string& payload, uint32_t& seq)
   {
-    return zmq.ReceiveMultiparts (topic, payload, seq);
+    size_t source;
+    return zmq.ReceiveMultiparts (topic, payload, seq, source);
   }
 
   /**
@@ -127,7 +128,7 @@ protected:
     }
 
     threadToWaitFor.join ();
-    zmq.socket.reset ();
+    zmq.sockets.clear ();
   }
 
 };
@@ -434,6 +435,176 @@ TEST_F (ZmqSubscriberTests, MultipleListeners)
   SleepSome ();
 }
 
+/* ************************************************************************** */
+
+constexpr const char OTHER_IPC_ENDPOINT[]
+    = "ipc:///tmp/xayagame_zmqsubscriber_tests_other";
+
+/**
+ * Tests with two sources of notifications, where the second one is
+ * simulated by another publisher socket.
+ */
+class MultipleEndpointsTests : public ZmqSubscriberTests
+{
+
+protected:
+
+  zmq::socket_t otherSocket;
+
+  /** Payload used for block A.  */
+  Json::Value blockA;
+  /** Payload used for block B.  */
+  Json::Value blockB;
+
+  MultipleEndpointsTests ()
+    : otherSocket(zmqCtx, ZMQ_PUB)
+  {
+    otherSocket.bind (OTHER_IPC_ENDPOINT);
+
+    zmq.Stop ();
+    zmq.AddAdditionalEndpoint (OTHER_IPC_ENDPOINT);
+    zmq.Start ();
+    SleepSome ();
+
+    blockA["block"]["hash"] = "block a";
+    blockB["block"]["hash"] = "block b";
+  }
+
+  /**
+   * Sends a message through the second publisher.
+   */
+  void
+  SendOther (const std::string& cmd, const Json::Value& payload,
+             const uint32_t seq)
+  {
+    std::ostringstream payloadStr;
+    payloadStr << payload;
+
+    const std::string topic = "game-block-" + cmd + " json " + GAME_ID;
+    const std::string payloadData = payloadStr.str ();
+    const std::string seqData(reinterpret_cast<const char*> (&seq),
+                              sizeof (seq));
+
+    const std::vector<std::string> parts = {topic, payloadData, seqData};
+    for (size_t i = 0; i < parts.size (); ++i)
+      {
+        zmq::message_t msg(parts[i].begin (), parts[i].end ());
+        const bool hasMore = (i + 1 < parts.size ());
+        ASSERT_TRUE (otherSocket.send (msg, hasMore ? ZMQ_SNDMORE : 0));
+      }
+  }
+
+};
+
+TEST_F (MultipleEndpointsTests, FirstCopyApplied)
+{
+  {
+    InSequence dummy;
+    EXPECT_CALL (mockListener, BlockAttach (GAME_ID, blockA, true));
+    EXPECT_CALL (mockListener, BlockAttach (GAME_ID, blockB, false));
+  }
+
+  SendAttach (GAME_ID, blockA, 1);
+  SleepSome ();
+  SendOther ("attach", blockA, 10);
+  SleepSome ();
+
+  /* Block B arrives first from the other source.  */
+  SendOther ("attach", blockB, 11);
+  SleepSome ();
+  SendAttach (GAME_ID, blockB, 2);
+}
+
+TEST_F (MultipleEndpointsTests, SequencePerSource)
+{
+  {
+    InSequence dummy;
+    EXPECT_CALL (mockListener, BlockAttach (GAME_ID, blockA, true));
+    EXPECT_CALL (mockListener, BlockDetach (GAME_ID, blockA, true));
+    EXPECT_CALL (mockListener, BlockAttach (GAME_ID, blockB, false));
+  }
+
+  SendAttach (GAME_ID, blockA, 1);
+  SleepSome ();
+  SendOther ("attach", blockA, 10);
+  SleepSome ();
+
+  /* The other source delivers the detach first, which is its first
+     detach notification (and thus a mismatch).  */
+  SendOther ("detach", blockA, 20);
+  SleepSome ();
+  SendDetach (GAME_ID, blockA, 1);
+  SleepSome ();
+
+  /* The main source continues its sequence without gaps.  */
+  SendAttach (GAME_ID, blockB, 2);
+  SleepSome ();
+  SendOther ("attach", blockB, 11);
+}
+
+TEST_F (MultipleEndpointsTests, RepeatedNotifications)
+{
+  {
+    InSequence dummy;
+    EXPECT_CALL (mockListener, BlockAttach (GAME_ID, blockA, _));
+    EXPECT_CALL (mockListener, BlockDetach (GAME_ID, blockA, _));
+    EXPECT_CALL (mockListener, BlockAttach (GAME_ID, blockA, _));
+  }
+
+  /* A block that is attached, detached and attached again must be seen
+     twice even though the keys are the same.  The other source lags
+     behind and delivers its copies afterwards.  */
+  SendAttach (GAME_ID, blockA, 1);
+  SendDetach (GAME_ID, blockA, 1);
+  SendAttach (GAME_ID, blockA, 2);
+  SleepSome ();
+  SendOther ("attach", blockA, 1);
+  SendOther ("detach", blockA, 1);
+  SendOther ("attach", blockA, 2);
+}
+
+/* ************************************************************************** */
+
+TEST (NotificationDeduplicatorTests, SingleOccurrences)
+{
+  NotificationDeduplicator dedup(3, 100);
+
+  EXPECT_TRUE (dedup.ShouldApply (0, "a"));
+  EXPECT_FALSE (dedup.ShouldApply (1, "a"));
+  EXPECT_TRUE (dedup.ShouldApply (2, "b"));
+  EXPECT_FALSE (dedup.ShouldApply (2, "a"));
+  EXPECT_FALSE (dedup.ShouldApply (0, "b"));
+  EXPECT_FALSE (dedup.ShouldApply (1, "b"));
+}
+
+TEST (NotificationDeduplicatorTests, RepeatedKeys)
+{
+  NotificationDeduplicator dedup(2, 100);
+
+  EXPECT_TRUE (dedup.ShouldApply (0, "a"));
+  EXPECT_TRUE (dedup.ShouldApply (0, "a"));
+  EXPECT_FALSE (dedup.ShouldApply (1, "a"));
+  EXPECT_FALSE (dedup.ShouldApply (1, "a"));
+  EXPECT_TRUE (dedup.ShouldApply (1, "a"));
+  EXPECT_FALSE (dedup.ShouldApply (0, "a"));
+}
+
+TEST (NotificationDeduplicatorTests, Window)
+{
+  NotificationDeduplicator dedup(2, 2);
+
+  EXPECT_TRUE (dedup.ShouldApply (0, "a"));
+  EXPECT_TRUE (dedup.ShouldApply (0, "b"));
+  EXPECT_FALSE (dedup.ShouldApply (1, "a"));
+
+  /* This evicts "a", so that a late copy is seen as new.  */
+  EXPECT_TRUE (dedup.ShouldApply (0, "c"));
+  EXPECT_FALSE (dedup.ShouldApply (1, "b"));
+  EXPECT_TRUE (dedup.ShouldApply (1, "a"));
+}
+
+/* ************************************************************************** */
+
 TEST_F (ZmqSubscriberTests, InvalidJson)
 {
   const std::string topic = std::string ("game-block-attach json ") + GAME_ID;
@@ -6,16 +6,69 @@
 Code for running a game daemon as component in an integration test.
 """
 
+import json
 import jsonrpclib
 import logging
 import os
 import os.path
 import re
 import shutil
+import socket
 import subprocess
 import time
 
 
+class UnixSocketRpc ():
+  """
+  Minimal JSON-RPC 2.0 client that talks to a game daemon listening on a
+  Unix domain socket.  Requests and responses are framed by newlines, as
+  done by libjsonrpccpp's Unix domain socket connectors.  It supports the
+  same calling convention as jsonrpclib.Server (including "_notify").
+  """
+
+  def __init__ (self, path, notify=False):
+    self.path = path
+    self.notify = notify
+    self.nextId = 1
+
+  def __getattr__ (self, name):
+    if name.startswith ("__"):
+      raise AttributeError (name)
+    if name == "_notify":
+      return UnixSocketRpc (self.path, notify=True)
+
+    def call (*args):
+      return self.request (name, list (args))
+    return call
+
+  def request (self, method, params):
+    req = {"jsonrpc": "2.0", "method": method, "params": params}
+    if not self.notify:
+      req["id"] = self.nextId
+      self.nextId += 1
+
+    sock = socket.socket (socket.AF_UNIX, socket.SOCK_STREAM)
+    try:
+      sock.connect (self.path)
+      sock.sendall ((json.dumps (req) + "\n").encode ("utf-8"))
+      if self.notify:
+        return None
+
+      data = b""
+      while not data.endswith (b"\n"):
+        chunk = sock.recv (4096)
+        if not chunk:
+          break
+        data += chunk
+    finally:
+      sock.close ()
+
+    resp = json.loads (data.decode ("utf-8"))
+    if "error" in resp:
+      raise RuntimeError ("JSON-RPC error: %s" % resp["error"])
+    return resp["result"]
+
+
 class Node ():
   """
   An instance of a game daemon that is connected to a regtest Xaya Core node
@@ -27,6 +80,10 @@ class Node ():
   * Have the --xaya_rpc_url, --game_rpc_port and --datadir flags that moverd
     has, and
   * provide at least the "stop" and "getcurrentstate" RPC methods.
+
+  If rpcSocket is set to a path before starting the daemon, it is passed
+  as --game_rpc_socket and the RPC connections use that Unix domain socket
+  instead of HTTP.
   """
 
   def __init__ (self, basedir, port, binary):
@@ -41,6 +98,7 @@ class Node ():
     os.mkdir (self.datadir)
 
     self.proc = None
+    self.rpcSocket = None
 
   def start (self, xayarpc, extraArgs=[]):
     if self.proc is not None:
@@ -52,6 +110,8 @@ class Node ():
     args.append ("--xaya_rpc_url=%s" % xayarpc)
     args.append ("--game_rpc_port=%d" % self.port)
     args.append ("--datadir=%s" % self.datadir)
+    if self.rpcSocket is not None:
+      args.append ("--game_rpc_socket=%s" % self.rpcSocket)
     args.extend (extraArgs)
     envVars = dict (os.environ)
     envVars["GLOG_log_dir"] = self.datadir
@@ -86,6 +146,9 @@ class Node ():
     be used if multiple threads need to send RPCs in parallel.
     """
 
+    if self.rpcSocket is not None:
+      return UnixSocketRpc (self.rpcSocket)
+
     return jsonrpclib.Server ("http://localhost:%d" % self.port)
 
 